@@ -100,8 +100,8 @@ std::ostream& print(std::ostream& out) {
 }
 
 template <typename... Args>
-struct Compare {
-    Compare(std::vector<Benchmark<Args...>> const& benchs, int count = 100, int repeat = 100000):
+struct Comparison {
+    Comparison(std::vector<Benchmark<Args...>> const& benchs, int count = 100, int repeat = 100000):
         benchmarks(benchs), count(count), repeat(repeat) {}
 
     void run(std::ostream& out) {
@@ -0,0 +1,85 @@
+#include "bench.h"
+
+#include "lexer/buffer.h"
+#include "parser/parser.h"
+#include "sema/sema.h"
+#include "vm/tree.h"
+#include "vm/vm.h"
+
+#include <iostream>
+
+using namespace lython;
+
+// Compare both Value layouts by running it from a build configured
+// with and without WITH_NANBOX
+String code = R"(
+def loop(n: i32) -> f64:
+    total: f64 = 0.0
+    i: i32 = 0
+    while i < n:
+        total = total + 1.5
+        i = i + 1
+    return total
+
+result = loop(1000)
+)";
+
+struct Script {
+    Script(String const& source):
+        reader(source), lex(reader), parser(lex) {
+        mod = parser.parse_module();
+        sema.exec(mod, 0);
+
+        StringBuffer call_reader("loop(1000)");
+        Lexer        call_lex(call_reader);
+        Parser       call_parser(call_lex);
+
+        call = call_parser.parse_module();
+        sema.exec(call->body[0], 0);
+    }
+
+    ~Script() {
+        delete call;
+        delete mod;
+    }
+
+    StringBuffer     reader;
+    Lexer            lex;
+    Parser           parser;
+    SemanticAnalyser sema;
+    Module*          mod  = nullptr;
+    Module*          call = nullptr;
+};
+
+int main() {
+    Script  script(code);
+    Program program = compile(script.mod);
+
+    // the per node traces would dominate the measure
+    outlog().disable(LogLevel::Trace);
+    outlog().disable(LogLevel::Debug);
+
+    // clang-format off
+    Array<Benchmark<>> benchs = {
+        Benchmark<>("TreeEvaluator", [&]() {
+            TreeEvaluator eval;
+            eval.module(script.mod, 0);
+            fakeuse(eval.eval(script.call->body[0]).tag());
+        }, 10, 100),
+        Benchmark<>("VM", [&]() {
+            fakeuse(eval(program).tag());
+        }, 10, 100),
+    };
+    // clang-format on
+
+    std::cout << fmt::format("Value: {} bytes (KIWI_NANBOX={})\n", sizeof(Value), KIWI_NANBOX);
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+    return 0;
+}
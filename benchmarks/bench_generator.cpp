@@ -0,0 +1,63 @@
+#include "bench.h"
+
+#include "lexer/buffer.h"
+#include "parser/parser.h"
+#include "sema/sema.h"
+#include "vm/tree.h"
+
+#include <iostream>
+
+using namespace lython;
+
+// A generator feeding a loop, every element suspends and resumes the generator frame
+String code = R"(
+def produce(n: i32) -> i32:
+    i: i32 = 0
+    while i < n:
+        yield i
+        i += 1
+
+def consume(n: i32) -> i32:
+    total: i32 = 0
+    for v in produce(n):
+        total += v % 3
+    return total
+
+result = consume(1000000)
+)";
+
+int main() {
+    StringBuffer     reader(code);
+    Lexer            lex(reader);
+    Parser           parser(lex);
+    SemanticAnalyser sema;
+
+    Module* mod = parser.parse_module();
+    sema.exec(mod, 0);
+
+    // the per node traces would dominate the measure
+    outlog().disable(LogLevel::Trace);
+    outlog().disable(LogLevel::Debug);
+
+    // clang-format off
+    Array<Benchmark<>> benchs = {
+        Benchmark<>("generator pipeline (1M)", [&]() {
+            TreeEvaluator eval;
+            eval.use_unboxed = false;
+            fakeuse(eval.module(mod, 0).tag());
+        }, 3, 1),
+    };
+    // clang-format on
+
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+
+    delete mod;
+    return 0;
+}
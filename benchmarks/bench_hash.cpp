@@ -58,7 +58,7 @@ int main() {
     make_string(64);
 
     // clang-format off
-    auto comp = lython::Compare<int>({
+    auto comp = lython::Comparison<int>({
         lython::Benchmark<int>("OLD HASH", [](int size) {
             //
             lython::fakeuse(old_hash(make_string(size)));
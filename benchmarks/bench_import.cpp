@@ -0,0 +1,76 @@
+#include "bench.h"
+
+#include "sema/importlib.h"
+#include "sema/sema.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace lython;
+
+namespace fs = std::filesystem;
+
+// 300 classes and 600 functions, about 4500 lines
+void write_module(fs::path const& folder) {
+    fs::create_directories(folder);
+    std::ofstream file(folder / "bench_import_module.py");
+
+    for (int i = 0; i < 300; i++) {
+        file << fmt::format("class C{0}:\n"
+                            "    x: i32 = 0\n"
+                            "    y: i32 = {0}\n\n"
+                            "def f{0}(a: i32, b: i32) -> i32:\n"
+                            "    t: i32 = a\n"
+                            "    for k in range(b):\n"
+                            "        t += k * {0}\n"
+                            "    if t > 10:\n"
+                            "        return t - a\n"
+                            "    return t + b\n\n"
+                            "def g{0}(p: C{0}) -> i32:\n"
+                            "    return p.x + p.y\n\n",
+                            i);
+    }
+}
+
+int main() {
+    fs::path root    = fs::temp_directory_path() / "lython_bench_import";
+    String   modules = String((root / "modules").string().c_str());
+    String   cache   = String((root / "cache").string().c_str());
+
+    fs::remove_all(root);
+    write_module(modules.c_str());
+
+    outlog().disable_all();
+
+    auto import = [&](bool cold) {
+        if (cold) {
+            fs::remove_all(cache.c_str());
+        }
+
+        ImportLib lib;
+        lib.set_cache_dir(cache);
+        lib.add_to_path(modules);
+        fakeuse(lib.importfile(StringRef("bench_import_module"))->key);
+    };
+
+    // cold: parse + SEMA + save, warm: parse + replay
+    // clang-format off
+    Array<Benchmark<>> benchs = {
+        Benchmark<>("import (cold)", [&]() { import(true); }, 10, 1),
+        Benchmark<>("import (warm)", [&]() { import(false); }, 10, 1),
+    };
+    // clang-format on
+
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+
+    fs::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "bench.h"
+
+#include "ast/values/value.h"
+
+#include <iostream>
+
+using namespace lython;
+
+float64 native_add(float64 a, float64 b) { return a + b; }
+
+int main() {
+    Function       generic = KIWI_WRAP(native_add);
+    BinaryFunction fixed   = KIWI_WRAP_FIXED(native_add);
+    DirectFunction direct  = Interop<float64(float64, float64)>::direct_wrapper<native_add>;
+
+    Value        a(1.0);
+    Value        b(2.0);
+    Array<Value> args = {a, b};
+    Value        stack[max_direct_args] = {a, b};
+
+    // 10 x 1'000'000 = 10M calls each
+    // clang-format off
+    Array<Benchmark<>> benchs = {
+        Benchmark<>("C++", [&]() {
+            fakeuse(native_add(a.holder().f64, b.holder().f64));
+        }, 10, 1000000),
+        Benchmark<>("Function (new args)", [&]() {
+            Array<Value> fresh = {a, b};
+            fakeuse(generic(nullptr, fresh).holder().f64);
+        }, 10, 1000000),
+        Benchmark<>("Function (reused args)", [&]() {
+            fakeuse(generic(nullptr, args).holder().f64);
+        }, 10, 1000000),
+        Benchmark<>("BinaryFunction", [&]() {
+            fakeuse(fixed(nullptr, a, b).holder().f64);
+        }, 10, 1000000),
+        Benchmark<>("DirectFunction", [&]() {
+            fakeuse(direct(nullptr, stack).holder().f64);
+        }, 10, 1000000),
+    };
+    // clang-format on
+
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "bench.h"
+
+#include "lexer/buffer.h"
+#include "parser/parser.h"
+#include "sema/sema.h"
+#include "vm/tree.h"
+
+#include <iostream>
+
+using namespace lython;
+
+// Same numeric loops executed on tagged Values and on untagged slots
+String code = R"(
+def accumulate(n: i32) -> f64:
+    total: f64 = 0.0
+    i: i32 = 0
+    while i < n:
+        total += 1.5
+        i += 1
+    return total
+
+def collatz(n: i32) -> i32:
+    steps: i32 = 0
+    i: i32 = 1
+    while i < n:
+        x: i32 = i
+        while x != 1:
+            if (x & 1) == 1:
+                x = x * 3
+                x += 1
+                steps += 1
+            x = x >> 1
+            steps += 1
+        i += 1
+    return steps
+)";
+
+struct Script {
+    Script(String const& source, String const& call_source):
+        reader(source), lex(reader), parser(lex) {
+        mod = parser.parse_module();
+        sema.exec(mod, 0);
+
+        StringBuffer call_reader(call_source);
+        Lexer        call_lex(call_reader);
+        Parser       call_parser(call_lex);
+
+        call = call_parser.parse_module();
+        sema.exec(call->body[0], 0);
+    }
+
+    ~Script() {
+        delete call;
+        delete mod;
+    }
+
+    StringBuffer     reader;
+    Lexer            lex;
+    Parser           parser;
+    SemanticAnalyser sema;
+    Module*          mod  = nullptr;
+    Module*          call = nullptr;
+};
+
+Benchmark<> make_bench(std::string const& name, Script& script, bool unboxed) {
+    return Benchmark<>(
+        name,
+        [&script, unboxed]() {
+            TreeEvaluator eval;
+            eval.use_unboxed = unboxed;
+            eval.module(script.mod, 0);
+            fakeuse(eval.eval(script.call->body[0]).tag());
+        },
+        10,
+        10);
+}
+
+int main() {
+    Script accumulate(code, "accumulate(10000)");
+    Script collatz(code, "collatz(1000)");
+
+    // the per node traces would dominate the measure
+    outlog().disable(LogLevel::Trace);
+    outlog().disable(LogLevel::Debug);
+
+    Array<Benchmark<>> benchs = {
+        make_bench("accumulate tagged", accumulate, false),
+        make_bench("accumulate unboxed", accumulate, true),
+        make_bench("collatz tagged", collatz, false),
+        make_bench("collatz unboxed", collatz, true),
+    };
+
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+    return 0;
+}
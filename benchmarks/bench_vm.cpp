@@ -0,0 +1,131 @@
+#include "bench.h"
+
+#include "lexer/buffer.h"
+#include "parser/parser.h"
+#include "sema/sema.h"
+#include "vm/memo.h"
+#include "vm/tree.h"
+#include "vm/vm.h"
+
+#include <iostream>
+
+using namespace lython;
+
+// Loops, calls and arithmetic executed by the tree evaluator and by the bytecode VM
+String code = R"(
+def loop(n: i32) -> i32:
+    total: i32 = 0
+    i: i32 = 0
+    while i < n:
+        total += 1
+        i += 1
+    return total
+
+def count(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(n):
+        total += i % 7
+    return total
+
+def fib(n: i32) -> i32:
+    if n < 2:
+        return n
+    return fib(n - 1) + fib(n - 2)
+
+def accumulate(n: i32, acc: i32) -> i32:
+    if n == 0:
+        return acc
+    return accumulate(n - 1, acc + n % 7)
+
+def arith(n: i32) -> f64:
+    x: f64 = 0.0
+    i: i32 = 0
+    while i < n:
+        x = (x * 0.5) + (2.0 * 3.0) - 1.0
+        i += 1
+    return x
+)";
+
+struct Script {
+    Script(String const& source, String const& call_source):
+        reader(source + "\nresult = " + call_source + "\n"), lex(reader), parser(lex) {
+        mod = parser.parse_module();
+        sema.exec(mod, 0);
+        program = compile(mod);
+    }
+
+    ~Script() { delete mod; }
+
+    StringBuffer     reader;
+    Lexer            lex;
+    Parser           parser;
+    SemanticAnalyser sema;
+    Module*          mod = nullptr;
+    Program          program;
+};
+
+// Memoized runs start from an empty cache
+Benchmark<> tree_bench(std::string const& name, Script& script, bool memoize = false) {
+    return Benchmark<>(
+        name,
+        [&script, memoize]() {
+            MemoCache     memo;
+            TreeEvaluator eval;
+            eval.use_unboxed = false;
+            eval.memo        = memoize ? &memo : nullptr;
+            fakeuse(eval.module(script.mod, 0).tag());
+        },
+        10,
+        10);
+}
+
+Benchmark<> vm_bench(std::string const& name, Script& script, bool memoize = false) {
+    return Benchmark<>(
+        name,
+        [&script, memoize]() {
+            MemoCache memo;
+            VMExec    exec;
+            exec.memo = memoize ? &memo : nullptr;
+            exec.execute(script.program, 0);
+            fakeuse(exec.global("result").tag());
+        },
+        10,
+        10);
+}
+
+int main() {
+    Script loop(code, "loop(100000)");
+    Script count(code, "count(100000)");
+    Script fib(code, "fib(20)");
+    Script arith(code, "arith(100000)");
+    Script accumulate(code, "accumulate(10000, 0)");
+
+    // the per node traces would dominate the measure
+    outlog().disable(LogLevel::Trace);
+    outlog().disable(LogLevel::Debug);
+
+    Array<Benchmark<>> benchs = {
+        tree_bench("loop tree", loop),
+        vm_bench("loop bytecode", loop),
+        tree_bench("range tree", count),
+        vm_bench("range bytecode", count),
+        tree_bench("fib tree", fib),
+        vm_bench("fib bytecode", fib),
+        tree_bench("fib memo tree", fib, true),
+        vm_bench("fib memo bytecode", fib, true),
+        tree_bench("arith tree", arith),
+        vm_bench("arith bytecode", arith),
+        tree_bench("tail call tree", accumulate),
+        vm_bench("tail call bytecode", accumulate),
+    };
+
+    std::cout << fmt::format(
+        "{:>30} | {:>10} | {:>10} | {:>10} \n", "bench", "mean (ms)", "std (ms)", "total (ms)");
+    std::cout << "---------------------------------------------------------------------\n";
+
+    for (auto& bench: benchs) {
+        bench.run();
+        bench.report(std::cout);
+    }
+    return 0;
+}
@@ -251,7 +251,7 @@ struct BoolOpType {
             Field(StringRef("values"), offsetof(BoolOp, values), sizeof(BoolOp::values), StringRef("int")),
             Field(StringRef("opcount"), offsetof(BoolOp, opcount), sizeof(BoolOp::opcount), StringRef("int")),
             Field(StringRef("resolved_operator"), offsetof(BoolOp, resolved_operator), sizeof(BoolOp::resolved_operator), StringRef("StmtNode *")),
-            Field(StringRef("native_operator"), offsetof(BoolOp, native_operator), sizeof(BoolOp::native_operator), StringRef("Function")),
+            Field(StringRef("native_operator"), offsetof(BoolOp, native_operator), sizeof(BoolOp::native_operator), StringRef("BinaryFunction")),
             Field(StringRef("varid"), offsetof(BoolOp, varid), sizeof(BoolOp::varid), StringRef("int")),
         };
         return fields;
@@ -288,7 +288,7 @@ struct BinOpType {
             Field(StringRef("op"), offsetof(BinOp, op), sizeof(BinOp::op), StringRef("BinaryOperator")),
             Field(StringRef("right"), offsetof(BinOp, right), sizeof(BinOp::right), StringRef("ExprNode *")),
             Field(StringRef("resolved_operator"), offsetof(BinOp, resolved_operator), sizeof(BinOp::resolved_operator), StringRef("StmtNode *")),
-            Field(StringRef("native_operator"), offsetof(BinOp, native_operator), sizeof(BinOp::native_operator), StringRef("Function")),
+            Field(StringRef("native_operator"), offsetof(BinOp, native_operator), sizeof(BinOp::native_operator), StringRef("BinaryFunction")),
             Field(StringRef("varid"), offsetof(BinOp, varid), sizeof(BinOp::varid), StringRef("int")),
         };
         return fields;
@@ -301,7 +301,7 @@ struct UnaryOpType {
             Field(StringRef("op"), offsetof(UnaryOp, op), sizeof(UnaryOp::op), StringRef("UnaryOperator")),
             Field(StringRef("operand"), offsetof(UnaryOp, operand), sizeof(UnaryOp::operand), StringRef("ExprNode *")),
             Field(StringRef("resolved_operator"), offsetof(UnaryOp, resolved_operator), sizeof(UnaryOp::resolved_operator), StringRef("StmtNode *")),
-            Field(StringRef("native_operator"), offsetof(UnaryOp, native_operator), sizeof(UnaryOp::native_operator), StringRef("Function")),
+            Field(StringRef("native_operator"), offsetof(UnaryOp, native_operator), sizeof(UnaryOp::native_operator), StringRef("UnaryFunction")),
         };
         return fields;
     }
@@ -423,6 +423,8 @@ struct CallType {
             Field(StringRef("keywords"), offsetof(Call, keywords), sizeof(Call::keywords), StringRef("int")),
             Field(StringRef("varargs"), offsetof(Call, varargs), sizeof(Call::varargs), StringRef("int")),
             Field(StringRef("jump_id"), offsetof(Call, jump_id), sizeof(Call::jump_id), StringRef("int")),
+            Field(StringRef("native_typed"), offsetof(Call, native_typed), sizeof(Call::native_typed), StringRef("bool")),
+            Field(StringRef("tail_call"), offsetof(Call, tail_call), sizeof(Call::tail_call), StringRef("bool")),
         };
         return fields;
     }
@@ -604,7 +606,11 @@ struct FunctionDefType {
             Field(StringRef("async"), offsetof(FunctionDef, async), sizeof(FunctionDef::async), StringRef("bool")),
             Field(StringRef("generator"), offsetof(FunctionDef, generator), sizeof(FunctionDef::generator), StringRef("bool")),
             Field(StringRef("type"), offsetof(FunctionDef, type), sizeof(FunctionDef::type), StringRef("struct Arrow *")),
+            Field(StringRef("pure"), offsetof(FunctionDef, pure), sizeof(FunctionDef::pure), StringRef("bool")),
             Field(StringRef("native"), offsetof(FunctionDef, native), sizeof(FunctionDef::native), StringRef("Function")),
+            Field(StringRef("native_direct"), offsetof(FunctionDef, native_direct), sizeof(FunctionDef::native_direct), StringRef("DirectFunction")),
+            Field(StringRef("unboxed"), offsetof(FunctionDef, unboxed), sizeof(FunctionDef::unboxed), StringRef("struct UnboxedFunction *")),
+            Field(StringRef("unboxed_compiled"), offsetof(FunctionDef, unboxed_compiled), sizeof(FunctionDef::unboxed_compiled), StringRef("bool")),
         };
         return fields;
     }
@@ -635,6 +641,7 @@ struct ClassDefType {
             Field(StringRef("ctor_t"), offsetof(ClassDef, ctor_t), sizeof(ClassDef::ctor_t), StringRef("Arrow *")),
             Field(StringRef("cls_namespace"), offsetof(ClassDef, cls_namespace), sizeof(ClassDef::cls_namespace), StringRef("int")),
             Field(StringRef("attributes"), offsetof(ClassDef, attributes), sizeof(ClassDef::attributes), StringRef("int")),
+            Field(StringRef("field_count"), offsetof(ClassDef, field_count), sizeof(ClassDef::field_count), StringRef("int")),
         };
         return fields;
     }
@@ -648,6 +655,7 @@ struct AttributeType {
             Field(StringRef("ctx"), offsetof(Attribute, ctx), sizeof(Attribute::ctx), StringRef("ExprContext")),
             Field(StringRef("resolved"), offsetof(Attribute, resolved), sizeof(Attribute::resolved), StringRef("ClassDef::Attr *")),
             Field(StringRef("attrid"), offsetof(Attribute, attrid), sizeof(Attribute::attrid), StringRef("int")),
+            Field(StringRef("cache"), offsetof(Attribute, cache), sizeof(Attribute::cache), StringRef("InlineCache")),
         };
         return fields;
     }
@@ -700,7 +708,7 @@ struct AugAssignType {
             Field(StringRef("op"), offsetof(AugAssign, op), sizeof(AugAssign::op), StringRef("BinaryOperator")),
             Field(StringRef("value"), offsetof(AugAssign, value), sizeof(AugAssign::value), StringRef("ExprNode *")),
             Field(StringRef("resolved_operator"), offsetof(AugAssign, resolved_operator), sizeof(AugAssign::resolved_operator), StringRef("StmtNode *")),
-            Field(StringRef("native_operator"), offsetof(AugAssign, native_operator), sizeof(AugAssign::native_operator), StringRef("Function")),
+            Field(StringRef("native_operator"), offsetof(AugAssign, native_operator), sizeof(AugAssign::native_operator), StringRef("BinaryFunction")),
         };
         return fields;
     }
@@ -727,6 +735,11 @@ struct ForType {
             Field(StringRef("orelse"), offsetof(For, orelse), sizeof(For::orelse), StringRef("int")),
             Field(StringRef("type_comment"), offsetof(For, type_comment), sizeof(For::type_comment), StringRef("int")),
             Field(StringRef("async"), offsetof(For, async), sizeof(For::async), StringRef("bool")),
+            Field(StringRef("counted"), offsetof(For, counted), sizeof(For::counted), StringRef("bool")),
+            Field(StringRef("start"), offsetof(For, start), sizeof(For::start), StringRef("Value")),
+            Field(StringRef("step"), offsetof(For, step), sizeof(For::step), StringRef("Value")),
+            Field(StringRef("native_compare"), offsetof(For, native_compare), sizeof(For::native_compare), StringRef("BinaryFunction")),
+            Field(StringRef("native_step"), offsetof(For, native_step), sizeof(For::native_step), StringRef("BinaryFunction")),
             Field(StringRef("else_comment"), offsetof(For, else_comment), sizeof(For::else_comment), StringRef("Comment *")),
         };
         return fields;
@@ -964,6 +977,7 @@ struct VMNativeFunctionType {
     static Array<Field> const& get_fields() {
         static Array<Field> fields = {
             Field(StringRef("fun"), offsetof(VMNativeFunction, fun), sizeof(VMNativeFunction::fun), StringRef("Function")),
+            Field(StringRef("direct"), offsetof(VMNativeFunction, direct), sizeof(VMNativeFunction::direct), StringRef("DirectFunction")),
         };
         return fields;
     }
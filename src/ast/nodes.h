@@ -491,9 +491,9 @@ struct BoolOp: public ExprNode {
     int opcount = 0;
 
     // Function to apply, resolved by the sema
-    StmtNode*     resolved_operator = nullptr;
-    Function      native_operator   = nullptr;
-    int           varid             = -1;
+    StmtNode*      resolved_operator = nullptr;
+    BinaryFunction native_operator   = nullptr;
+    int            varid             = -1;
 
     BoolOp(): ExprNode(NodeKind::BoolOp) {}
 
@@ -521,8 +521,8 @@ struct Compare: public ExprNode {
     Array<ExprNode*>   comparators;
 
     // Function to apply, resolved by the sema
-    Array<StmtNode*> resolved_operator;
-    Array<Function>  native_operator;
+    Array<StmtNode*>      resolved_operator;
+    Array<BinaryFunction> native_operator;
 
     bool safe_comparator_add(ExprNode* comp) {
         if (comp == this) {
@@ -558,7 +558,7 @@ struct BinOp: public ExprNode {
 
     // Function to apply, resolved by the sema
     StmtNode*      resolved_operator = nullptr;
-    Function       native_operator   = nullptr;
+    BinaryFunction native_operator   = nullptr;
     int            varid             = -1;
 
     BinOp(): ExprNode(NodeKind::BinOp) {}
@@ -569,8 +569,8 @@ struct UnaryOp: public ExprNode {
     ExprNode*     operand;
 
     // Function to apply, resolved by the sema
-    StmtNode* resolved_operator = nullptr;
-    Function  native_operator   = nullptr;
+    StmtNode*     resolved_operator = nullptr;
+    UnaryFunction native_operator   = nullptr;
 
     UnaryOp(): ExprNode(NodeKind::UnaryOp) {}
 };
@@ -660,6 +660,12 @@ struct Call: public ExprNode {
 
     int jump_id = -1;
 
+    // SEMA proved the argument types, native functions can be called directly
+    bool native_typed = false;
+
+    // `return f(...)`, the callee can reuse the frame of the caller
+    bool tail_call = false;
+
     Call(): ExprNode(NodeKind::Call) {}
 };
 
@@ -813,8 +819,19 @@ struct FunctionDef: public StmtNode {
     bool          generator;// : 1;
     struct Arrow* type = nullptr;
 
+    // Only reads its arguments and locals and only calls pure functions,
+    // its result can be reused for the same arguments. Natives are pure when registered as such
+    bool pure = false;
+
     Function native = nullptr;
 
+    // Specialized on the C++ signature, used when the argument types are known
+    DirectFunction native_direct = nullptr;
+
+    // Untagged version of the function, compiled on first call
+    struct UnboxedFunction* unboxed          = nullptr;
+    bool                    unboxed_compiled = false;
+
     FunctionDef(): StmtNode(NodeKind::FunctionDef), async(false), generator(false) {}
 };
 
@@ -861,6 +878,9 @@ struct ClassDef: public StmtNode {
     };
     // Dict<StringRef, Attr> attributes;
     Array<Attr> attributes;  // <= Instantiated Object
+
+    // Number of values stored in an instance, see `compute_layout`
+    int field_count = 0;
     // Array<Attr> static_attributes;  // <= Namespaced Globals
     // Array<Attr> methods;
 
@@ -873,6 +893,22 @@ struct ClassDef: public StmtNode {
         }
     }
 
+    // Instances store their data attributes in a flat array, `Attr::offset` is the index
+    // of the attribute in that array. Methods are shared by all the instances
+    // and are found through the class, their offset is -1
+    void compute_layout() {
+        field_count = 0;
+
+        for (Attr& attr: attributes) {
+            attr.offset = -1;
+
+            if (attr.stmt == nullptr || attr.stmt->kind != NodeKind::FunctionDef) {
+                attr.offset = field_count;
+                field_count += 1;
+            }
+        }
+    }
+
     int get_attribute(StringRef name) {
 
         int i = 0;
@@ -922,6 +958,38 @@ struct ClassDef: public StmtNode {
     }
 };
 
+// Filled during execution, maps the class of the receiver to the slot of the attribute.
+// Sites see a single class most of the time, a site that sees more than `Size` classes
+// stops caching and resolves the attribute by name
+struct InlineCache {
+    static constexpr int Size = 4;
+
+    struct Entry {
+        ClassDef*    cls    = nullptr;
+        int          slot   = -1;       // offset of the field inside the instance
+        FunctionDef* method = nullptr;  // methods are not stored in the instance
+    };
+
+    Entry entries[Size];
+    int   count = 0;
+
+    Entry const* find(ClassDef* cls) const {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].cls == cls) {
+                return &entries[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void insert(Entry const& entry) {
+        if (count < Size) {
+            entries[count] = entry;
+            count += 1;
+        }
+    }
+};
+
 // the following expression can appear in assignment context
 struct Attribute: public ExprNode {
     ExprNode*   value = nullptr;
@@ -934,6 +1002,9 @@ struct Attribute: public ExprNode {
     // SEMA
     int attrid = 0;
 
+    // VM
+    InlineCache cache;
+
     Attribute(): ExprNode(NodeKind::Attribute) {}
 };
 
@@ -977,7 +1048,7 @@ struct AugAssign: public StmtNode {
 
     // Function to apply, resolved by the sema
     StmtNode*      resolved_operator = nullptr;
-    Function       native_operator   = nullptr;
+    BinaryFunction native_operator   = nullptr;
 
     AugAssign(): StmtNode(NodeKind::AugAssign) {}
 };
@@ -1002,8 +1073,19 @@ struct For: public StmtNode {
 
     bool async = false;
 
+    // SEMA: `for i in range(...)` over builtin integers
+    // the loop is counted, evaluators do not go through the iterator protocol
+    bool           counted        = false;
+    Value          start;                     // used when range only receives the stop
+    Value          step;                      // 1 when omitted
+    BinaryFunction native_compare = nullptr;  // i < stop, i > stop when the step is negative
+    BinaryFunction native_step    = nullptr;  // i + step
+
     For(): StmtNode(NodeKind::For) {}
 
+    // range raises ValueError when the step is 0, `start` is the 0 of the counter type
+    bool zero_step() const { return counted && step == start; }
+
     Comment* else_comment = nullptr;
 };
 
@@ -1237,7 +1319,8 @@ struct Jump: public VMNode {
 struct VMNativeFunction: public VMNode {
     VMNativeFunction(): VMNode(NodeKind::VMNativeFunction) {}
 
-    Function fun;
+    Function       fun;
+    DirectFunction direct = nullptr;
 };
 
 /*
@@ -310,13 +310,13 @@ struct Equality {
     bool constant(Constant* a, Constant* b, int depth) {
         static int string_tid = meta::type_id<String>();
 
-        if (a->value.tag == b->value.tag) {
-            if (a->value.tag < int(meta::ValueTypes::Max)) {
+        if (a->value.tag() == b->value.tag()) {
+            if (a->value.tag() < int(meta::ValueTypes::Max)) {
                 return a->value == b->value; 
             }
 
             // FIXME: implement this in the value operator==
-            if (a->value.tag == string_tid) {
+            if (a->value.tag() == string_tid) {
                 String* stra = a->value.as<String*>();
                 String* strb = b->value.as<String*>();
 
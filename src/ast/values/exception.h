@@ -18,9 +18,11 @@ struct _LyException: public GCObject {
 
     Array<StackTrace> traces;
 
-    // type of the exception
-    // this is to help with exception matching
-    ExprNode* type = nullptr;
+    // class of the exception, handlers are matched on its runtime id
+    // an exception without a class (assert, internal errors) is only caught by a bare except
+    // (`class_id` is the GC type of the object, it is used to free it)
+    ClassDef* class_t    = nullptr;
+    int       runtime_id = -1;
 
     // Custom exception generated
     // this is what is created when raise AttributeError(...)
@@ -30,12 +32,31 @@ struct _LyException: public GCObject {
     Value cause;
 };
 
+template <>
+struct HeapTrace<_LyException> {
+    static void trace(RuntimeHeap& heap, _LyException& except) {
+        heap.mark(except.custom);
+        heap.mark(except.cause);
+
+        for (StackTrace& trace: except.traces) {
+            for (ExecBlock& block: trace.blocks) {
+                for (Value& resource: block.resources) {
+                    heap.mark(resource);
+                }
+            }
+        }
+    }
+};
+
+// the evaluator unwinds exceptions through raw pointers
+template <>
+struct HeapTenured<_LyException>: std::true_type {};
 
 // template <>
 // struct lython::meta::ReflectionTrait<_LyException> {
 //     static int register_members() {
 //         lython::meta::new_member<_LyException, Array<StackTrace>>("traces");
-//         lython::meta::new_member<_LyException, ExprNode*>("type");
+//         lython::meta::new_member<_LyException, int>("class_id");
 //         lython::meta::new_member<_LyException, ConstantValue>("custom");
 //         return 0;
 //     }
@@ -1,14 +1,15 @@
 #include "ast/values/value.h"
+#include "logging/logging.h"
 
 namespace lython {
 
 bool Value::operator==(Value const& val) const {
-    if (tag == val.tag) {
+    if (tag() == val.tag()) {
         // is there a risk that when the value is smaller some garbage remain ?
-        switch (meta::ValueTypes(tag)) {
+        switch (meta::ValueTypes(tag())) {
 
 #define CASE(type, name) \
-    case meta::ValueTypes::name: return value.name == val.value.name;
+    case meta::ValueTypes::name: return holder().name == val.holder().name;
             KIWI_VALUE_TYPES(CASE)
 #undef CASE
     case meta::ValueTypes::Max:
@@ -35,6 +36,51 @@ Value unary_invoke(void* ctx, Value fun, Value a) {
 
 GetterError Value::global_err = GetterError{false};
 
+#if KIWI_NANBOX
+// Boxes are carved out of chunks that are never given back,
+// released boxes are chained through their holder and reused.
+// Boxes all have the same size, a box released by another thread
+// than the one that allocated it simply joins the free list of the releasing thread
+struct ValueBoxPool {
+    static constexpr int chunk_size = 1024;
+
+    Value::Box* free_list = nullptr;
+    Value::Box* chunk     = nullptr;
+    int         used      = chunk_size;
+
+    Value::Box* allocate() {
+        if (free_list != nullptr) {
+            Value::Box* box = free_list;
+            free_list       = static_cast<Value::Box*>(box->value.obj);
+            return box;
+        }
+
+        if (used == chunk_size) {
+            chunk = static_cast<Value::Box*>(std::malloc(sizeof(Value::Box) * chunk_size));
+            used  = 0;
+        }
+
+        Value::Box* box = chunk + used;
+        used += 1;
+
+        kwassert((reinterpret_cast<uintptr_t>(box) & Value::marker_mask) == 0,
+                 "Box address does not fit in the NaN payload");
+        return box;
+    }
+
+    void release(Value::Box* box) {
+        box->value.obj = free_list;
+        free_list      = box;
+    }
+};
+
+static thread_local ValueBoxPool box_pool;
+
+Value::Box* new_value_box() { return box_pool.allocate(); }
+
+void free_value_box(Value::Box* box) { box_pool.release(box); }
+#endif
+
 
 std::ostream& ostream_op(std::ostream& os, bool const& v) { 
     if (v) 
@@ -70,10 +116,10 @@ std::ostream& ostream_op(std::ostream& os, Pointi const& v) { return os << "Poin
 std::ostream& ostream_op(std::ostream& os, Color const& v) { return os << "Color("<< v.r << ", " << v.g << v.b << ", " << v.a << ")"; }
 
 std::ostream& operator<<(std::ostream& os, Value const& v) {
-    switch (meta::ValueTypes(v.tag)) {
+    switch (meta::ValueTypes(v.tag())) {
 #define CASE(type, name)                            \
     case meta::ValueTypes::name:                    \
-            return ostream_op(os, v.value.name);
+            return ostream_op(os, v.holder().name);
         
         KIWI_VALUE_TYPES(CASE)
 #undef CASE
@@ -83,12 +129,12 @@ std::ostream& operator<<(std::ostream& os, Value const& v) {
 
     static int strtid = meta::type_id<String>();
 
-    if (strtid == v.tag) {
+    if (strtid == v.tag()) {
         return os << '"' << v.as<String const&>() << '"';
     }
 
     auto& registry = meta::TypeRegistry::instance();
-    auto& meta = registry.id_to_meta[v.tag];
+    auto& meta = registry.id_to_meta[v.tag()];
 
     if (meta.printer) {
         meta.printer(os, v);
@@ -110,10 +156,10 @@ String Value::__repr__() const {
 }
 
 std::ostream& Value::debug_print(std::ostream& os) const {
-    switch (meta::ValueTypes(tag)) {
+    switch (meta::ValueTypes(tag())) {
 #define CASE(type, name)                            \
     case meta::ValueTypes::name:                    \
-            return os << value.name << ": " << #type;
+            return os << holder().name << ": " << #type;
         
         KIWI_VALUE_TYPES(CASE)
 #undef CASE
@@ -121,7 +167,7 @@ std::ostream& Value::debug_print(std::ostream& os) const {
     case meta::ValueTypes::Max: break;
     }
 
-    meta::ClassMetadata& meta = meta::classmeta(tag);
+    meta::ClassMetadata& meta = meta::classmeta(tag());
     if (meta.printer) {
         meta.printer(os, *this);
         return os << ": " << meta.name;
@@ -131,18 +177,26 @@ std::ostream& Value::debug_print(std::ostream& os) const {
 
 
 bool Value::destroy() {
-    meta::ClassMetadata& metadata = meta::classmeta(tag);
+    meta::ClassMetadata& metadata = meta::classmeta(tag());
 
+    bool destroyed = false;
     if (metadata.deleter) {
         metadata.deleter(nullptr, *this);
-        return true;
+        destroyed = true;
     }
-    return false;
+
+#if KIWI_NANBOX
+    // the box of a scalar goes back to the pool right away
+    if (is_boxed()) {
+        store(meta::type_id<_Invalid>(), _Invalid());
+    }
+#endif
+    return destroyed;
 }
 
 Value Value::copy() const {
     auto& registry = meta::TypeRegistry::instance();
-    auto& meta = registry.id_to_meta[tag];
+    auto& meta = registry.id_to_meta[tag()];
     if (meta.copier) {
         return meta.copier(*this);
     }
@@ -151,7 +205,7 @@ Value Value::copy() const {
 
 Value Value::ref() {
     // skip lookup for common types
-    switch (meta::ValueTypes(tag)) {
+    switch (meta::ValueTypes(tag())) {
 #define CASE(type, name)                            \
     case meta::ValueTypes::name:                    \
             return _ref<type>::ref(*this);
@@ -162,7 +216,7 @@ Value Value::ref() {
     }
 
     auto& registry = meta::TypeRegistry::instance();
-    auto& meta = registry.id_to_meta[tag];
+    auto& meta = registry.id_to_meta[tag()];
     if (meta.ref) {
         return meta.ref(*this);
     }
@@ -172,7 +226,7 @@ Value Value::ref() {
 
 std::size_t Value::hash() const {
     auto& registry = meta::TypeRegistry::instance();
-    auto& meta = registry.id_to_meta[tag];
+    auto& meta = registry.id_to_meta[tag()];
     if (meta.hasher) {
         return meta.hasher(*this);
     }
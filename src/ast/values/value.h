@@ -2,8 +2,15 @@
 
 #include "utilities/metadata.h"
 
+#include <cstring>
+
 #define KIWI_SVO 1
 
+// 8-byte NaN-boxed Value instead of tag + holder (cmake -DWITH_NANBOX=ON)
+#ifndef KIWI_NANBOX
+#define KIWI_NANBOX 0
+#endif
+
 namespace lython {
 
 struct Value;
@@ -111,6 +118,22 @@ struct GarbageCollector {
 //
 // We could have a version that removes the tag
 // for speeding up execution more (once SEMA is mature enough)
+//
+// With KIWI_NANBOX the tag is folded inside the holder and Value is 8 bytes,
+// f64 are stored as is (NaN are canonicalized), anything else lives in the NaN space
+//
+//  | 63 | 62 .. 52 | 51 .. 48 | 47 .. 44 | 43 .. 32 | 31 .. 0 |
+//  | 1  |  0x7FF   |   0xF    |        tag          | payload |  <= types up to 32 bits (i32, f32, bool, Color, ...)
+//  | 1  |  0x7FF   |   0xE    |           Value::Box*          |  <= anything that does not fit
+//  | t8 |  0x7FF   |      t7 .. t0       |   address >> 3     |  <= 8 bytes payloads (pointers)
+//
+// A 8 bytes payload is stored inline when it looks like a pointer:
+// not null, 8 bytes aligned and below 2^47, with a tag below 480.
+// Other 8 bytes payloads (i64, Pointi, ...) are boxed.
+//
+// Copies share the box, the box is released when its last Value is destroyed or overwritten.
+// Taking the address of the payload (pointer, ref) gives the Value a box of its own
+// that is pinned: it is copied instead of shared so writes stay local to the Value
 struct Value {
     union Holder {
 #define ATTR(type, name) type name;
@@ -120,13 +143,120 @@ struct Value {
         void* obj;
     };
 
+#if KIWI_NANBOX
+    struct Box {
+        uint32 tag;
+        uint32 refs;  // Values sharing the box, `pinned` once the payload address was taken
+        Holder value;
+    };
+
+    static constexpr uint32 pinned = 0x80000000u;
+
+    static constexpr uint64 marker_mask    = 0xFFFF000000000000ull;
+    static constexpr uint64 inline_marker  = 0xFFFF000000000000ull;
+    static constexpr uint64 boxed_marker   = 0xFFFE000000000000ull;
+    static constexpr uint64 canonical_nan  = 0x7FF8000000000000ull;
+    static constexpr uint64 exponent_mask  = 0x7FF0000000000000ull;
+    static constexpr uint64 mantissa_mask  = 0x000FFFFFFFFFFFFFull;
+    static constexpr uint64 address_mask   = 0x00000FFFFFFFFFFFull;
+    static constexpr uint64 max_address    = 0x0000800000000000ull;
+    static constexpr uint32 max_inline_tag = 0xFFFF;
+    static constexpr uint32 max_pointer_tag = 0x1E0;
+
+    union {
+        uint64 bits = 0;
+        Holder inline_value;
+    };
+
+    bool is_boxed() const { return (bits & marker_mask) == boxed_marker; }
+
+    // NaN that is neither canonical nor one of the two markers above
+    bool is_pointer() const {
+        return (bits & exponent_mask) == exponent_mask && (bits & mantissa_mask) != 0 &&
+               bits != canonical_nan && (bits >> 49) != 0x7FFF;
+    }
+
+    static bool fits_pointer(uint32 type_tag, uint64 payload) {
+        return type_tag < max_pointer_tag && payload != 0 && (payload & 7) == 0 &&
+               payload < max_address;
+    }
+
+    Box* box() const { return reinterpret_cast<Box*>(bits & ~marker_mask); }
+
+    uint32 tag() const {
+        uint64 marker = bits & marker_mask;
+
+        if (marker == inline_marker) {
+            return uint32((bits >> 32) & max_inline_tag);
+        }
+        if (marker == boxed_marker) {
+            return box()->tag;
+        }
+        if (is_pointer()) {
+            return uint32(((bits >> 63) << 8) | ((bits >> 44) & 0xFF));
+        }
+        return uint32(meta::ValueTypes::f64);
+    }
+
+    // The payload is decoded, use `pointer` to get the address of the payload
+    Holder holder() const {
+        if (is_boxed()) {
+            return box()->value;
+        }
+        if (is_pointer()) {
+            Holder payload;
+            payload.obj = reinterpret_cast<void*>((bits & address_mask) << 3);
+            return payload;
+        }
+        return inline_value;
+    }
+
+    // Storage of the payload, an inline pointer is moved to a box first
+    Holder&       storage();
+    Holder const& storage() const;
+
+    Value(Value const& other);
+    Value(Value&& other) noexcept: bits(other.bits) { other.bits = 0; }
+
+    Value& operator=(Value const& other) {
+        Value copy(other);
+        std::swap(bits, copy.bits);
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept {
+        std::swap(bits, other.bits);
+        return *this;
+    }
+
+    ~Value();
+#else
     // The VM might not need the type tag
     // once sema is passed we should be able to guarantee
     // the oprations are ok
-    std::conditional_t<true, uint32, void> tag;
-    Holder                                 value;
+    uint32 _tag;
+    Holder _value;
+
+    uint32 tag() const { return _tag; }
+
+    Holder&       holder() { return _value; }
+    Holder const& holder() const { return _value; }
+
+    Holder&       storage() { return _value; }
+    Holder const& storage() const { return _value; }
+#endif
+
+    // Set the tag and copy the payload inside the holder
+    template <typename T>
+    void store(uint32 type_tag, T const& payload);
+
+    template <typename T>
+    static Value make(uint32 type_tag, T const& payload) {
+        Value result;
+        result.store(type_tag, payload);
+        return result;
+    }
 
-    Value(): tag(meta::type_id<_Invalid>()) {}
+    Value() { store(meta::type_id<_Invalid>(), _Invalid()); }
 
     // destroy the value using its tag to lookup the appropriate destructor
     bool  destroy();
@@ -136,15 +266,15 @@ struct Value {
     std::size_t hash() const;
 
 #define CTOR(type, name)                                        \
-    Value(type name): tag(meta::type_id<type>()) {              \
+    Value(type name) {                                          \
         static_assert(std::is_trivially_copyable<type>::value); \
-        value.name = name;                                      \
+        store(meta::type_id<type>(), name);                     \
     }
 
     KIWI_VALUE_TYPES(CTOR)
 #undef CTOR
 
-    Value(int tag, void* ptr): tag(tag) { value.obj = ptr; }
+    Value(int tag, void* ptr) { store(tag, ptr); }
 
     // Value(Value&& v)  {
     //     memcpy(this, &v, sizeof(Value));
@@ -154,7 +284,7 @@ struct Value {
     // Value(Value const&) = default;
     // Value& operator= (Value const&) = default;
 
-    bool is_type(int obj_type_id) const { return obj_type_id == tag; }
+    bool is_type(int obj_type_id) const { return obj_type_id == tag(); }
 
     template <typename T>
     bool is_type() const {
@@ -163,7 +293,7 @@ struct Value {
 
     template <typename T>
     bool operator==(T const& val) const {
-        if (tag == meta::type_id<T>()) {
+        if (tag() == meta::type_id<T>()) {
             return as<T>() == val;
         }
         return false;
@@ -232,10 +362,10 @@ struct Value {
     T* pointer() {
         // The pointer to the data is stored inside itself
         if constexpr (is_small<T>()) {
-            return reinterpret_cast<T*>(&value);
+            return reinterpret_cast<T*>(&storage());
         } else {
             // The data is stored in dynamically allocated memory
-            return reinterpret_cast<T*>(value.obj);
+            return reinterpret_cast<T*>(holder().obj);
         }
     }
 
@@ -243,19 +373,159 @@ struct Value {
     T const* pointer() const {
         // The pointer to the data is stored inside itself
         if constexpr (is_small<T>()) {
-            return reinterpret_cast<T const*>(&value);
+            return reinterpret_cast<T const*>(&storage());
         } else {
             // The data is stored in dynamically allocated memory
-            return reinterpret_cast<T const*>(value.obj);
+            return reinterpret_cast<T const*>(holder().obj);
         }
     }
 
+    // Copy of a small payload, does not need its address
+    template <typename T>
+    T load() const {
+        static_assert(is_small<T>());
+        Holder payload = holder();
+        T      result;
+        std::memcpy(&result, &payload, sizeof(T));
+        return result;
+    }
+
     std::ostream& print(std::ostream& out) const;
     std::ostream& debug_print(std::ostream& os) const;
 
     String __repr__() const;
 };
 
+#if KIWI_NANBOX
+// Out of line storage for the payloads that do not fit in the NaN space
+Value::Box* new_value_box();
+void        free_value_box(Value::Box* box);
+
+inline Value::Box* clone_value_box(Value::Box const* box) {
+    Value::Box* copy = new_value_box();
+    copy->tag        = box->tag;
+    copy->refs       = 1;
+    copy->value      = box->value;
+    return copy;
+}
+
+inline void release_value_box(Value::Box* box) {
+    if ((box->refs & ~Value::pinned) <= 1) {
+        free_value_box(box);
+    } else {
+        box->refs -= 1;
+    }
+}
+
+inline Value::Value(Value const& other): bits(other.bits) {
+    if (other.is_boxed()) {
+        Box* shared = other.box();
+
+        if (shared->refs & pinned) {
+            bits = boxed_marker | uint64(reinterpret_cast<uintptr_t>(clone_value_box(shared)));
+        } else {
+            shared->refs += 1;
+        }
+    }
+}
+
+inline Value::~Value() {
+    if (is_boxed()) {
+        release_value_box(box());
+    }
+}
+
+inline Value::Holder& Value::storage() {
+    if (is_pointer()) {
+        Box* storage   = new_value_box();
+        storage->tag   = tag();
+        storage->refs  = 1;
+        storage->value = holder();
+        bits           = boxed_marker | uint64(reinterpret_cast<uintptr_t>(storage));
+    }
+    if (!is_boxed()) {
+        return inline_value;
+    }
+
+    // the payload might be written through the address, stop sharing the box
+    Box* storage = box();
+    if ((storage->refs & ~pinned) > 1) {
+        storage->refs -= 1;
+        storage = clone_value_box(storage);
+        bits    = boxed_marker | uint64(reinterpret_cast<uintptr_t>(storage));
+    }
+    storage->refs |= pinned;
+    return storage->value;
+}
+
+inline Value::Holder const& Value::storage() const {
+    if (is_pointer()) {
+        // the value does not change, only its representation
+        Value* self    = const_cast<Value*>(this);
+        Box*   storage = new_value_box();
+        storage->tag   = tag();
+        storage->refs  = 1;
+        storage->value = holder();
+        self->bits     = boxed_marker | uint64(reinterpret_cast<uintptr_t>(storage));
+    }
+    return is_boxed() ? box()->value : inline_value;
+}
+#endif
+
+template <typename T>
+void Value::store(uint32 type_tag, T const& payload) {
+    static_assert(sizeof(T) <= sizeof(Holder));
+
+#if KIWI_NANBOX
+    // the previous payload might be boxed
+    if (is_boxed()) {
+        release_value_box(box());
+        bits = 0;
+    }
+
+    if constexpr (std::is_same_v<T, float64>) {
+        if (type_tag == uint32(meta::ValueTypes::f64)) {
+            // NaN are canonicalized so they cannot be mistaken for a tagged value
+            if (payload != payload) {
+                bits = canonical_nan;
+            } else {
+                inline_value.f64 = payload;
+            }
+            return;
+        }
+    }
+
+    if constexpr (sizeof(T) <= sizeof(uint32)) {
+        if (type_tag <= max_inline_tag) {
+            // little endian, the payload lands in the low 32 bits
+            bits = inline_marker | (uint64(type_tag) << 32);
+            new (&inline_value) T(payload);
+            return;
+        }
+    }
+
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        uint64 address = 0;
+        std::memcpy(&address, &payload, sizeof(T));
+
+        if (fits_pointer(type_tag, address)) {
+            bits = (uint64(type_tag >> 8) << 63) | exponent_mask | (uint64(type_tag & 0xFF) << 44) |
+                   (address >> 3);
+            return;
+        }
+    }
+
+    Box* storage  = new_value_box();
+    storage->tag  = type_tag;
+    storage->refs = 1;
+    new (&storage->value) T(payload);
+    bits = boxed_marker | uint64(reinterpret_cast<uintptr_t>(storage));
+#else
+    _tag = type_tag;
+    new (&_value) T(payload);
+#endif
+}
+
 //
 // Getter
 //
@@ -269,27 +539,30 @@ T Getter<T>::get(Value& v, GetterError& err) {
         return *v.as<NoConst*>(err);
     } else {
         // Storing int, we want int
-        if (v.tag == meta::type_id<NoConst>()) {
-            NoConst* ptr = v.pointer<NoConst>();
-            return *ptr;
+        if (v.tag() == meta::type_id<NoConst>()) {
+            if constexpr (Value::is_small<NoConst>()) {
+                return v.load<NoConst>();
+            } else {
+                NoConst* ptr = v.pointer<NoConst>();
+                return *ptr;
+            }
         }
 
         // Storing int*, we want int
-        if (v.tag == meta::type_id<NoConst*>()) {
-            NoConst** ptr = v.pointer<NoConst*>();
-            return **ptr;
+        if (v.tag() == meta::type_id<NoConst*>()) {
+            return *v.load<NoConst*>();
         }
 
         // Storing int, we want int*
         if constexpr (std::is_pointer_v<NoConst>) {
-            if (v.tag == meta::type_id<NoPointer>()) {
+            if (v.tag() == meta::type_id<NoPointer>()) {
                 NoPointer* ptr = v.pointer<NoPointer>();
                 return ptr;
             }
         }
 
         err.failed += 1;
-        err.value_type_id     = v.tag;
+        err.value_type_id     = v.tag();
         err.requested_type_id = meta::type_id<T>();
         return T();
     }
@@ -310,34 +583,37 @@ T const Getter<T>::get(Value const& v, GetterError& err) {
     } else {
         err.failed = false;
         // Storing int, we want int
-        if (v.tag == meta::type_id<NoConst>()) {
-            NoConst const* ptr = v.pointer<NoConst>();
-            return *ptr;
+        if (v.tag() == meta::type_id<NoConst>()) {
+            if constexpr (Value::is_small<NoConst>()) {
+                return v.load<NoConst>();
+            } else {
+                NoConst const* ptr = v.pointer<NoConst>();
+                return *ptr;
+            }
         }
 
         // is this possible ? we are returning a copy anyway
         // Storing int*, we want int
-        if (v.tag == meta::type_id<NoConst*>()) {
-            NoConst const* const* ptr = v.pointer<NoConst const*>();
-            return **ptr;
+        if (v.tag() == meta::type_id<NoConst*>()) {
+            return *v.load<NoConst const*>();
         }
 
         if constexpr (std::is_pointer_v<NoConst>) {
             // Storing int*, we want int const*
-            if (v.tag == meta::type_id<NoPointer*>()) {
+            if (v.tag() == meta::type_id<NoPointer*>()) {
                 NoPointer const* ptr = v.pointer<NoPointer const>();
                 return ptr;
             }
 
             // Storing int, we want int*
-            if (v.tag == meta::type_id<NoPointer>()) {
+            if (v.tag() == meta::type_id<NoPointer>()) {
                 NoPointer const* ptr = v.pointer<NoPointer const>();
                 return ptr;
             }
         }
 
         err.failed += 1;
-        err.value_type_id     = v.tag;
+        err.value_type_id     = v.tag();
         err.requested_type_id = meta::type_id<T>();
         return T();
     }
@@ -351,14 +627,14 @@ bool Query<T>::get(Value const& v) {
     if constexpr (std::is_reference<T>::value) {
         return Query<NoConst*>::get(v);
     } else {
-        if (v.tag == meta::type_id<NoConst>()) {
+        if (v.tag() == meta::type_id<NoConst>()) {
             return true;
         }
-        if (v.tag == meta::type_id<NoConst*>()) {
+        if (v.tag() == meta::type_id<NoConst*>()) {
             return true;
         }
         if constexpr (std::is_pointer_v<NoConst>) {
-            return v.tag == meta::type_id<NoPointer>();
+            return v.tag() == meta::type_id<NoPointer>();
         }
         return false;
     }
@@ -373,17 +649,17 @@ bool Query<T>::get(Value const& v) {
     template <>                                                                    \
     struct Getter<type> {                                                          \
         static type get(Value& v, GetterError& err) {                              \
-            err.failed = v.tag != meta::type_id<type>();                           \
-            return v.value.name;                                                   \
+            err.failed = v.tag() != meta::type_id<type>();                           \
+            return v.holder().name;                                                   \
         };                                                                         \
         static type get(Value const& v, GetterError& err) {                        \
-            err.failed = v.tag != meta::type_id<type>();                           \
-            return v.value.name;                                                   \
+            err.failed = v.tag() != meta::type_id<type>();                           \
+            return v.holder().name;                                                   \
         };                                                                         \
     };                                                                             \
     template <>                                                                    \
     struct Query<type> {                                                           \
-        static bool get(Value const& v) { return v.tag == meta::type_id<type>(); } \
+        static bool get(Value const& v) { return v.tag() == meta::type_id<type>(); } \
     };
 
 GETTER(Function, fun)
@@ -428,6 +704,41 @@ struct Interop<R(Args...)> {
     static ScriptValue wrapper(void* mem, ScriptArgs& args) {  //
         return call_function(func, mem, args, std::make_index_sequence<sizeof...(Args)>{});
     };
+
+    // Each argument is received as a Value
+    template <typename T>
+    using FixedArg = Value;
+
+    // Fixed arity version, the arguments are passed directly
+    // so no argument array needs to be allocated
+    template <FunctionType func>
+    static ScriptValue fixed_wrapper(void* mem, FixedArg<Args>... args) {  //
+        return func(to_native<Args>(args)...);
+    };
+
+    // The type was proven by SEMA, builtin types are read from the holder directly
+    template <typename T>
+    static T unchecked(Value const& val) {
+        using NoConst = std::remove_const_t<std::remove_reference_t<T>>;
+
+        if constexpr (std::is_arithmetic_v<NoConst>) {
+            return val.load<NoConst>();
+        } else {
+            return const_cast<Value&>(val).as<T>();
+        }
+    }
+
+    template <std::size_t... Indices>
+    static R call_direct(FunctionType func, Value const* args, std::index_sequence<Indices...>) {
+        return func(unchecked<Args>(args[Indices])...);
+    }
+
+    // Direct version, the arguments are read from a caller owned buffer
+    // without marshalling (see DirectFunction)
+    template <FunctionType func>
+    static ScriptValue direct_wrapper(void* mem, Value const* args) {  //
+        return call_direct(func, args, std::make_index_sequence<sizeof...(Args)>{});
+    };
 };
 
 template <typename R, typename... Args>
@@ -440,6 +751,12 @@ struct Interop<R (*)(Args...)> {
 
     template <FunctionType func>
     static auto constexpr wrapper = Interop<R(Args...)>::template wrapper<func>;
+
+    template <FunctionType func>
+    static auto constexpr fixed_wrapper = Interop<R(Args...)>::template fixed_wrapper<func>;
+
+    template <FunctionType func>
+    static auto constexpr direct_wrapper = Interop<R(Args...)>::template direct_wrapper<func>;
 };
 
 template <typename R, typename O, typename... Args>
@@ -507,20 +824,24 @@ struct Interop<R (O::*)(Args...) const> {
 
 #define KIWI_WRAP(funfun) Function(Interop<decltype(&funfun)>::wrapper<(&funfun)>)
 
+// Wrap a free function using the fixed arity convention
+// (UnaryFunction, BinaryFunction)
+#define KIWI_WRAP_FIXED(funfun) (Interop<decltype(&funfun)>::fixed_wrapper<(&funfun)>)
+
 // Specialization for C object that have a custom free
 using FreeFun = void (*)(void*);
 
 template <typename T, FreeFun free_fun = std::free>
 struct _destructor {
     static void free(void* ctx, Value& v) {
-        if (v.value.obj == nullptr) {
+        if (v.holder().obj == nullptr) {
             return;
         }
 
         // call the destructor
-        ((T*)(v.value.obj))->~T();
+        ((T*)(v.holder().obj))->~T();
 
-        free_fun(v.value.obj);
+        free_fun(v.holder().obj);
 
         // NOTE: this only nullify current value so other copy of this value
         // might still think the value is valid
@@ -528,14 +849,14 @@ struct _destructor {
         // on free the memory returns to the pool and it is marked as invalid
         // copied value will be able to check for the mark until the memory is reused
         // then same issue would be still be possible
-        v.value.obj = nullptr;  // just in case
+        v = Value(int(v.tag()), nullptr);  // just in case
     }
 };
 
 template <FreeFun free_fun>
 struct _custom_free {
     static void free(void* ctx, Value& v) {
-        free_fun(v.value.obj);
+        free_fun(v.holder().obj);
 
         // NOTE: this only nullify current value so other copy of this value
         // might still think the value is valid
@@ -543,7 +864,7 @@ struct _custom_free {
         // on free the memory returns to the pool and it is marked as invalid
         // copied value will be able to check for the mark until the memory is reused
         // then same issue would be still be possible
-        v.value.obj = nullptr;  // just in case
+        v = Value(int(v.tag()), nullptr);  // just in case
     }
 };
 
@@ -593,9 +914,7 @@ template <typename T, typename... Args>
 Value _new_value(int _typeid, Args... args) {
     // The value cannot have a destructor here
     static_assert(Value::is_small<T>());
-    Value value;
-    new (&value.value) T(args...);
-    value.tag = _typeid;
+    Value value = Value::make(_typeid, T(args...));
 
     meta::ClassMetadata& metadata = meta::classmeta(_typeid);
     metadata.deleter              = noop_destructor;
@@ -663,11 +982,9 @@ Value new_object(Args... args) {
 
 template <typename T, FreeFun fun, typename... Args>
 Value from_pointer(T* raw) {
-    Value v;
-    v.tag = meta::type_id<T*>();
-    new (v.pointer<T*>()) T*(raw);
+    Value v = Value::make(meta::type_id<T*>(), raw);
 
-    meta::ClassMetadata& metadata = meta::classmeta(v.tag);
+    meta::ClassMetadata& metadata = meta::classmeta(v.tag());
     metadata.deleter              = _custom_free<fun>::free;
 
     return v;
@@ -693,6 +1010,13 @@ Value binary_invoke(void* ctx, Value fun, Value a, Value b);
 
 Value unary_invoke(void* ctx, Value fun, Value a);
 
+// Fixed arity calls do not allocate
+inline Value binary_invoke(void* ctx, BinaryFunction fun, Value a, Value b) {
+    return fun(ctx, a, b);
+}
+
+inline Value unary_invoke(void* ctx, UnaryFunction fun, Value a) { return fun(ctx, a); }
+
 template <typename T>
 struct _copy {
     static Value copy(Value const& v) {
@@ -1,373 +1,456 @@
 #include "ast/values/value.h"
 #include "builtin/operators.inc"
+#include "builtin/operators.h"
 #include "ast/nodes.h"
 #include "dependencies/coz_wrap.h"
 #include "utilities/names.h"
 
-#define LAMBDA(op, type) KIWI_WRAP((op<type>::call));
+#define LAMBDA(op, type) KIWI_WRAP_FIXED((op<type>::call))
 
 namespace lython {
-Dict<StringRef, Function> build_native_binary_operators() {
+
+// clang-format off
+#define COUNT(name, ...) +1
+constexpr int n_types            = int(NativeType::Count);
+constexpr int n_binary_operators = 0 BINARY_OPERATORS(COUNT);
+constexpr int n_bool_operators   = 1 BOOL_OPERATORS(COUNT);
+constexpr int n_unary_operators  = 0 UNARY_OPERATORS(COUNT);
+constexpr int n_cmp_operators    = 0 COMP_OPERATORS(COUNT);
+#undef COUNT
+
+// Native types supported by the operators
+#define FLOAT_TYPES(TYPE) \
+    TYPE(f32, float32)    \
+    TYPE(f64, float64)
+
+#define SIGNED_TYPES(TYPE) \
+    TYPE(i8, int8)         \
+    TYPE(i16, int16)       \
+    TYPE(i32, int32)       \
+    TYPE(i64, int64)
+
+#define UNSIGNED_TYPES(TYPE) \
+    TYPE(u8, uint8)          \
+    TYPE(u16, uint16)        \
+    TYPE(u32, uint32)        \
+    TYPE(u64, uint64)
+
+// Operators supported by each type
+#define ARITHMETIC(OP, type, native) \
+    OP(Add, type, native)            \
+    OP(Sub, type, native)            \
+    OP(Mult, type, native)           \
+    OP(Div, type, native)            \
+    OP(Mod, type, native)            \
+    OP(Pow, type, native)
+
+#define BITWISE(OP, type, native) \
+    OP(LShift, type, native)      \
+    OP(RShift, type, native)      \
+    OP(BitOr, type, native)       \
+    OP(BitXor, type, native)      \
+    OP(BitAnd, type, native)
+
+#define SIGN(OP, type, native) \
+    OP(UAdd, type, native)     \
+    OP(USub, type, native)
+
+#define LOGICAL(OP, type, native) \
+    OP(Invert, type, native)      \
+    OP(Not, type, native)
+
+#define COMPARISON(OP, type, native) \
+    OP(Eq, type, native)             \
+    OP(NotEq, type, native)          \
+    OP(Lt, type, native)             \
+    OP(LtE, type, native)            \
+    OP(Gt, type, native)             \
+    OP(GtE, type, native)            \
+    OP(Is, type, native)             \
+    OP(IsNot, type, native)
+// clang-format on
+
+// Tables are indexed by (operator, lhs type, rhs type)
+// they are fully built at compile time
+struct BinaryTable {
+    BinaryFunction ops[n_binary_operators][n_types][n_types] = {};
+};
+
+struct BoolTable {
+    BinaryFunction ops[n_bool_operators][n_types][n_types] = {};
+};
+
+struct UnaryTable {
+    UnaryFunction ops[n_unary_operators][n_types] = {};
+};
+
+struct CmpTable {
+    BinaryFunction ops[n_cmp_operators][n_types][n_types] = {};
+};
+
+#define BINARY(op, type, native)                                              \
+    table.ops[int(BinaryOperator::op)][int(NativeType::type##_t)]             \
+             [int(NativeType::type##_t)] = LAMBDA(op, native);
+
+#define CMP(op, type, native)                                                 \
+    table.ops[int(CmpOperator::op)][int(NativeType::type##_t)]                \
+             [int(NativeType::type##_t)] = LAMBDA(op, native);
+
+#define UNARY(op, type, native) \
+    table.ops[int(UnaryOperator::op)][int(NativeType::type##_t)] = LAMBDA(op, native);
+
+#define ARITHMETIC_OPS(type, native) ARITHMETIC(BINARY, type, native)
+#define BITWISE_OPS(type, native)    BITWISE(BINARY, type, native)
+#define COMPARISON_OPS(type, native) COMPARISON(CMP, type, native)
+#define SIGN_OPS(type, native)       SIGN(UNARY, type, native)
+#define LOGICAL_OPS(type, native)    LOGICAL(UNARY, type, native)
+
+constexpr BinaryTable build_native_binary_operators() {
     // FIXME: add return type, the return type can be different
-    Dict<StringRef, Function> map;
+    BinaryTable table;
 
-    // clang-format off
-#define JOIN(op, t1, t2) op-t1-t2
-#define JOIN1(op, t1) op-t1
-    // clang-format on
+    FLOAT_TYPES(ARITHMETIC_OPS)
+    SIGNED_TYPES(ARITHMETIC_OPS)
+    SIGNED_TYPES(BITWISE_OPS)
+    UNSIGNED_TYPES(ARITHMETIC_OPS)
+    UNSIGNED_TYPES(BITWISE_OPS)
+
+    return table;
+}
+
+constexpr BoolTable build_native_bool_operators() {
+    BoolTable table;
+
+    table.ops[int(BoolOperator::And)][int(NativeType::bool_t)][int(NativeType::bool_t)] =
+        LAMBDA(And, bool);
+    table.ops[int(BoolOperator::Or)][int(NativeType::bool_t)][int(NativeType::bool_t)] =
+        LAMBDA(Or, bool);
+
+    return table;
+}
 
+constexpr UnaryTable build_native_unary_operators() {
+    UnaryTable table;
 
+    UNSIGNED_TYPES(LOGICAL_OPS)
+    UNSIGNED_TYPES(SIGN_OPS)
+    SIGNED_TYPES(LOGICAL_OPS)
+    SIGNED_TYPES(SIGN_OPS)
+    FLOAT_TYPES(SIGN_OPS)
 
+    return table;
+}
+
+constexpr CmpTable build_native_cmp_operators() {
+    CmpTable table;
+
+    UNSIGNED_TYPES(COMPARISON_OPS)
+    SIGNED_TYPES(COMPARISON_OPS)
+    FLOAT_TYPES(COMPARISON_OPS)
+
+    return table;
+}
+
+#undef BINARY
+#undef CMP
+#undef UNARY
+#undef ARITHMETIC_OPS
+#undef BITWISE_OPS
+#undef COMPARISON_OPS
+#undef SIGN_OPS
+#undef LOGICAL_OPS
+
+constexpr BinaryTable native_binary_operators = build_native_binary_operators();
+constexpr BoolTable   native_bool_operators   = build_native_bool_operators();
+constexpr UnaryTable  native_unary_operators  = build_native_unary_operators();
+constexpr CmpTable    native_cmp_operators    = build_native_cmp_operators();
+
+// Untagged tables, same layout without the lhs/rhs split
+// the operands always share the same type
+template <typename T>
+constexpr NativeType native_type_of() {
     // clang-format off
-    // Float
-    map[StringRef(STR(JOIN(Add, f32, f32)))] = LAMBDA(Add, float32);
-    map[StringRef(STR(JOIN(Add, f64, f64)))] = LAMBDA(Add, float64);
-
-    map[StringRef(STR(JOIN(Sub, f32, f32)))] = LAMBDA(Sub, float32);
-    map[StringRef(STR(JOIN(Sub, f64, f64)))] = LAMBDA(Sub, float64);
-
-    map[StringRef(STR(JOIN(Mult, f32, f32)))] = LAMBDA(Mult, float32);
-    map[StringRef(STR(JOIN(Mult, f64, f64)))] = LAMBDA(Mult, float64);
-
-    map[StringRef(STR(JOIN(Div, f32, f32)))] = LAMBDA(Div, float32);
-    map[StringRef(STR(JOIN(Div, f64, f64)))] = LAMBDA(Div, float64);
-
-    map[StringRef(STR(JOIN(Mod, f32, f32)))] = LAMBDA(Mod, float32);
-    map[StringRef(STR(JOIN(Mod, f64, f64)))] = LAMBDA(Mod, float64);
-
-    map[StringRef(STR(JOIN(Pow, f32, f32)))] = LAMBDA(Pow, float32);
-    map[StringRef(STR(JOIN(Pow, f64, f64)))] = LAMBDA(Pow, float64);
-
-    // Integer
-
-    map[StringRef(STR(JOIN(Add, i8, i8)))]   = LAMBDA(Add, int8);
-    map[StringRef(STR(JOIN(Add, i16, i16)))] = LAMBDA(Add, int16);
-    map[StringRef(STR(JOIN(Add, i32, i32)))] = LAMBDA(Add, int32);
-    map[StringRef(STR(JOIN(Add, i64, i64)))] = LAMBDA(Add, int64);
-
-    map[StringRef(STR(JOIN(Sub, i8, i8)))]   = LAMBDA(Sub, int8);
-    map[StringRef(STR(JOIN(Sub, i16, i16)))] = LAMBDA(Sub, int16);
-    map[StringRef(STR(JOIN(Sub, i32, i32)))] = LAMBDA(Sub, int32);
-    map[StringRef(STR(JOIN(Sub, i64, i64)))] = LAMBDA(Sub, int64);
-
-    map[StringRef(STR(JOIN(Mult, i8, i8)))]   = LAMBDA(Mult, int8);
-    map[StringRef(STR(JOIN(Mult, i16, i16)))] = LAMBDA(Mult, int16);
-    map[StringRef(STR(JOIN(Mult, i32, i32)))] = LAMBDA(Mult, int32);
-    map[StringRef(STR(JOIN(Mult, i64, i64)))] = LAMBDA(Mult, int64);
-
-    map[StringRef(STR(JOIN(Div, i8, i8)))]   = LAMBDA(Div, int8);
-    map[StringRef(STR(JOIN(Div, i16, i16)))] = LAMBDA(Div, int16);
-    map[StringRef(STR(JOIN(Div, i32, i32)))] = LAMBDA(Div, int32);
-    map[StringRef(STR(JOIN(Div, i64, i64)))] = LAMBDA(Div, int64);
-
-    map[StringRef(STR(JOIN(Mod, i8, i8)))]   = LAMBDA(Mod, int8);
-    map[StringRef(STR(JOIN(Mod, i16, i16)))] = LAMBDA(Mod, int16);
-    map[StringRef(STR(JOIN(Mod, i32, i32)))] = LAMBDA(Mod, int32);
-    map[StringRef(STR(JOIN(Mod, i64, i64)))] = LAMBDA(Mod, int64);
-
-    map[StringRef(STR(JOIN(Pow, i8, i8)))]   = LAMBDA(Pow, int8);
-    map[StringRef(STR(JOIN(Pow, i16, i16)))] = LAMBDA(Pow, int16);
-    map[StringRef(STR(JOIN(Pow, i32, i32)))] = LAMBDA(Pow, int32);
-    map[StringRef(STR(JOIN(Pow, i64, i64)))] = LAMBDA(Pow, int64);
-
-    map[StringRef(STR(JOIN(LShift, i8, i8)))]   = LAMBDA(LShift, int8);
-    map[StringRef(STR(JOIN(LShift, i16, i16)))] = LAMBDA(LShift, int16);
-    map[StringRef(STR(JOIN(LShift, i32, i32)))] = LAMBDA(LShift, int32);
-    map[StringRef(STR(JOIN(LShift, i64, i64)))] = LAMBDA(LShift, int64);
-
-    map[StringRef(STR(JOIN(RShift, i8, i8)))]   = LAMBDA(RShift, int8);
-    map[StringRef(STR(JOIN(RShift, i16, i16)))] = LAMBDA(RShift, int16);
-    map[StringRef(STR(JOIN(RShift, i32, i32)))] = LAMBDA(RShift, int32);
-    map[StringRef(STR(JOIN(RShift, i64, i64)))] = LAMBDA(RShift, int64);
-
-    map[StringRef(STR(JOIN(BitOr, i8, i8)))]   = LAMBDA(BitOr, int8);
-    map[StringRef(STR(JOIN(BitOr, i16, i16)))] = LAMBDA(BitOr, int16);
-    map[StringRef(STR(JOIN(BitOr, i32, i32)))] = LAMBDA(BitOr, int32);
-    map[StringRef(STR(JOIN(BitOr, i64, i64)))] = LAMBDA(BitOr, int64);
-
-    map[StringRef(STR(JOIN(BitXor, i8, i8)))]   = LAMBDA(BitXor, int8);
-    map[StringRef(STR(JOIN(BitXor, i16, i16)))] = LAMBDA(BitXor, int16);
-    map[StringRef(STR(JOIN(BitXor, i32, i32)))] = LAMBDA(BitXor, int32);
-    map[StringRef(STR(JOIN(BitXor, i64, i64)))] = LAMBDA(BitXor, int64);
-
-    map[StringRef(STR(JOIN(BitAnd, i8, i8)))]   = LAMBDA(BitAnd, int8);
-    map[StringRef(STR(JOIN(BitAnd, i16, i16)))] = LAMBDA(BitAnd, int16);
-    map[StringRef(STR(JOIN(BitAnd, i32, i32)))] = LAMBDA(BitAnd, int32);
-    map[StringRef(STR(JOIN(BitAnd, i64, i64)))] = LAMBDA(BitAnd, int64);
-
-    // Unsigned
-    map[StringRef(STR(JOIN(Add, u8, u8)))]   = LAMBDA(Add, uint8);
-    map[StringRef(STR(JOIN(Add, u16, u16)))] = LAMBDA(Add, uint16);
-    map[StringRef(STR(JOIN(Add, u32, u32)))] = LAMBDA(Add, uint32);
-    map[StringRef(STR(JOIN(Add, u64, u64)))] = LAMBDA(Add, uint64);
-
-    map[StringRef(STR(JOIN(Sub, u8, u8)))]   = LAMBDA(Sub, uint8);
-    map[StringRef(STR(JOIN(Sub, u16, u16)))] = LAMBDA(Sub, uint16);
-    map[StringRef(STR(JOIN(Sub, u32, u32)))] = LAMBDA(Sub, uint32);
-    map[StringRef(STR(JOIN(Sub, u64, u64)))] = LAMBDA(Sub, uint64);
-
-    map[StringRef(STR(JOIN(Mult, u8, u8)))]   = LAMBDA(Mult, uint8);
-    map[StringRef(STR(JOIN(Mult, u16, u16)))] = LAMBDA(Mult, uint16);
-    map[StringRef(STR(JOIN(Mult, u32, u32)))] = LAMBDA(Mult, uint32);
-    map[StringRef(STR(JOIN(Mult, u64, u64)))] = LAMBDA(Mult, uint64);
-
-    map[StringRef(STR(JOIN(Div, u8, u8)))]   = LAMBDA(Div, uint8);
-    map[StringRef(STR(JOIN(Div, u16, u16)))] = LAMBDA(Div, uint16);
-    map[StringRef(STR(JOIN(Div, u32, u32)))] = LAMBDA(Div, uint32);
-    map[StringRef(STR(JOIN(Div, u64, u64)))] = LAMBDA(Div, uint64);
-
-    map[StringRef(STR(JOIN(Mod, u8, u8)))]   = LAMBDA(Mod, uint8);
-    map[StringRef(STR(JOIN(Mod, u16, u16)))] = LAMBDA(Mod, uint16);
-    map[StringRef(STR(JOIN(Mod, u32, u32)))] = LAMBDA(Mod, uint32);
-    map[StringRef(STR(JOIN(Mod, u64, u64)))] = LAMBDA(Mod, uint64);
-
-    map[StringRef(STR(JOIN(Pow, u8, u8)))]   = LAMBDA(Pow, uint8);
-    map[StringRef(STR(JOIN(Pow, u16, u16)))] = LAMBDA(Pow, uint16);
-    map[StringRef(STR(JOIN(Pow, u32, u32)))] = LAMBDA(Pow, uint32);
-    map[StringRef(STR(JOIN(Pow, u64, u64)))] = LAMBDA(Pow, uint64);
-
-    map[StringRef(STR(JOIN(LShift, u8, u8)))]   = LAMBDA(LShift, uint8);
-    map[StringRef(STR(JOIN(LShift, u16, u16)))] = LAMBDA(LShift, uint16);
-    map[StringRef(STR(JOIN(LShift, u32, u32)))] = LAMBDA(LShift, uint32);
-    map[StringRef(STR(JOIN(LShift, u64, u64)))] = LAMBDA(LShift, uint64);
-
-    map[StringRef(STR(JOIN(RShift, u8, u8)))]   = LAMBDA(RShift, uint8);
-    map[StringRef(STR(JOIN(RShift, u16, u16)))] = LAMBDA(RShift, uint16);
-    map[StringRef(STR(JOIN(RShift, u32, u32)))] = LAMBDA(RShift, uint32);
-    map[StringRef(STR(JOIN(RShift, u64, u64)))] = LAMBDA(RShift, uint64);
-
-    map[StringRef(STR(JOIN(BitOr, u8, u8)))]   = LAMBDA(BitOr, uint8);
-    map[StringRef(STR(JOIN(BitOr, u16, u16)))] = LAMBDA(BitOr, uint16);
-    map[StringRef(STR(JOIN(BitOr, u32, u32)))] = LAMBDA(BitOr, uint32);
-    map[StringRef(STR(JOIN(BitOr, u64, u64)))] = LAMBDA(BitOr, uint64);
-
-    map[StringRef(STR(JOIN(BitXor, u8, u8)))]   = LAMBDA(BitXor, uint8);
-    map[StringRef(STR(JOIN(BitXor, u16, u16)))] = LAMBDA(BitXor, uint16);
-    map[StringRef(STR(JOIN(BitXor, u32, u32)))] = LAMBDA(BitXor, uint32);
-    map[StringRef(STR(JOIN(BitXor, u64, u64)))] = LAMBDA(BitXor, uint64);
-
-    map[StringRef(STR(JOIN(BitAnd, u8, u8)))]   = LAMBDA(BitAnd, uint8);
-    map[StringRef(STR(JOIN(BitAnd, u16, u16)))] = LAMBDA(BitAnd, uint16);
-    map[StringRef(STR(JOIN(BitAnd, u32, u32)))] = LAMBDA(BitAnd, uint32);
-    map[StringRef(STR(JOIN(BitAnd, u64, u64)))] = LAMBDA(BitAnd, uint64);
+    if constexpr (std::is_same_v<T, bool>)    { return NativeType::bool_t; }
+    if constexpr (std::is_same_v<T, int8>)    { return NativeType::i8_t; }
+    if constexpr (std::is_same_v<T, int16>)   { return NativeType::i16_t; }
+    if constexpr (std::is_same_v<T, int32>)   { return NativeType::i32_t; }
+    if constexpr (std::is_same_v<T, int64>)   { return NativeType::i64_t; }
+    if constexpr (std::is_same_v<T, uint8>)   { return NativeType::u8_t; }
+    if constexpr (std::is_same_v<T, uint16>)  { return NativeType::u16_t; }
+    if constexpr (std::is_same_v<T, uint32>)  { return NativeType::u32_t; }
+    if constexpr (std::is_same_v<T, uint64>)  { return NativeType::u64_t; }
+    if constexpr (std::is_same_v<T, float32>) { return NativeType::f32_t; }
+    if constexpr (std::is_same_v<T, float64>) { return NativeType::f64_t; }
     // clang-format on
+    return NativeType::Count;
+}
+
+template <typename Op, typename T>
+Value::Holder unboxed_binary_call(Value::Holder a, Value::Holder b) {
+    using R = decltype(Op::call(T(), T()));
 
-    return map;
+    Value::Holder result;
+    new (&result) R(Op::call(*reinterpret_cast<T*>(&a), *reinterpret_cast<T*>(&b)));
+    return result;
 }
 
-template <typename K, typename V>
-V get(Dict<K, V> const& map, K key, V value) {
-    using Iterator = typename Dict<K, V>::const_iterator;
+template <typename Op, typename T>
+Value::Holder unboxed_unary_call(Value::Holder a) {
+    using R = decltype(Op::call(T()));
 
-    Iterator maybe = map.find(key);
+    Value::Holder result;
+    new (&result) R(Op::call(*reinterpret_cast<T*>(&a)));
+    return result;
+}
 
-    if (maybe == map.end()) {
-        return value;
-    }
+template <typename Op, typename T>
+constexpr UnboxedBinaryOperation unboxed_binary() {
+    using R = decltype(Op::call(T(), T()));
+    return UnboxedBinaryOperation{unboxed_binary_call<Op, T>, native_type_of<R>()};
+}
 
-    return maybe->second;
+template <typename Op, typename T>
+constexpr UnboxedUnaryOperation unboxed_unary() {
+    using R = decltype(Op::call(T()));
+    return UnboxedUnaryOperation{unboxed_unary_call<Op, T>, native_type_of<R>()};
 }
 
-Dict<StringRef, Function> const& native_binary_operators() {
-    static Dict<StringRef, Function> ops = build_native_binary_operators();
-    return ops;
+struct UnboxedBinaryTable {
+    UnboxedBinaryOperation ops[n_binary_operators][n_types] = {};
+};
+
+struct UnboxedUnaryTable {
+    UnboxedUnaryOperation ops[n_unary_operators][n_types] = {};
+};
+
+struct UnboxedCmpTable {
+    UnboxedBinaryOperation ops[n_cmp_operators][n_types] = {};
+};
+
+#define BINARY(op, type, native) \
+    table.ops[int(BinaryOperator::op)][int(NativeType::type##_t)] = unboxed_binary<op<native>, native>();
+
+#define CMP(op, type, native) \
+    table.ops[int(CmpOperator::op)][int(NativeType::type##_t)] = unboxed_binary<op<native>, native>();
+
+#define UNARY(op, type, native) \
+    table.ops[int(UnaryOperator::op)][int(NativeType::type##_t)] = unboxed_unary<op<native>, native>();
+
+#define ARITHMETIC_OPS(type, native) ARITHMETIC(BINARY, type, native)
+#define BITWISE_OPS(type, native)    BITWISE(BINARY, type, native)
+#define COMPARISON_OPS(type, native) COMPARISON(CMP, type, native)
+#define SIGN_OPS(type, native)       SIGN(UNARY, type, native)
+#define LOGICAL_OPS(type, native)    LOGICAL(UNARY, type, native)
+
+constexpr UnboxedBinaryTable build_unboxed_binary_operators() {
+    UnboxedBinaryTable table;
+
+    FLOAT_TYPES(ARITHMETIC_OPS)
+    SIGNED_TYPES(ARITHMETIC_OPS)
+    SIGNED_TYPES(BITWISE_OPS)
+    UNSIGNED_TYPES(ARITHMETIC_OPS)
+    UNSIGNED_TYPES(BITWISE_OPS)
+
+    return table;
 }
 
-Function get_native_binary_operation(StringRef signature) {
-    return get(native_binary_operators(), signature, Function());
+constexpr UnboxedUnaryTable build_unboxed_unary_operators() {
+    UnboxedUnaryTable table;
+
+    UNSIGNED_TYPES(LOGICAL_OPS)
+    UNSIGNED_TYPES(SIGN_OPS)
+    SIGNED_TYPES(LOGICAL_OPS)
+    SIGNED_TYPES(SIGN_OPS)
+    FLOAT_TYPES(SIGN_OPS)
+
+    return table;
 }
 
-// Bool
-Dict<StringRef, Function> build_native_bool_operators() {
-    Dict<StringRef, Function> map;
+constexpr UnboxedCmpTable build_unboxed_cmp_operators() {
+    UnboxedCmpTable table;
 
-    // clang-format off
-    map[StringRef(STR(JOIN(and, bool, bool)))] = LAMBDA(And, bool);
-    map[StringRef(STR(JOIN(or, bool, bool)))] = LAMBDA(Or, bool);
-    // clang-format on
-    return map;
+    UNSIGNED_TYPES(COMPARISON_OPS)
+    SIGNED_TYPES(COMPARISON_OPS)
+    FLOAT_TYPES(COMPARISON_OPS)
+
+    return table;
 }
 
-Dict<StringRef, Function> const& native_bool_operators() {
-    static auto ops = build_native_bool_operators();
-    return ops;
+#undef BINARY
+#undef CMP
+#undef UNARY
+#undef ARITHMETIC_OPS
+#undef BITWISE_OPS
+#undef COMPARISON_OPS
+#undef SIGN_OPS
+#undef LOGICAL_OPS
+
+constexpr UnboxedBinaryTable unboxed_binary_operators = build_unboxed_binary_operators();
+constexpr UnboxedUnaryTable  unboxed_unary_operators  = build_unboxed_unary_operators();
+constexpr UnboxedCmpTable    unboxed_cmp_operators    = build_unboxed_cmp_operators();
+
+NativeType native_type(TypeExpr* type) {
+    // Names are interned, the lookup is a hash of their id
+    static Dict<StringRef, NativeType> types = []() {
+        Dict<StringRef, NativeType> result;
+#define TYPE(name, _) result[StringRef(#name)] = NativeType::name##_t;
+        BUILTIN_TYPES(TYPE)
+#undef TYPE
+        return result;
+    }();
+
+    StringRef name;
+    if (Name* ref = cast<Name>(type)) {
+        name = ref->id;
+    } else if (BuiltinType* builtin = cast<BuiltinType>(type)) {
+        name = builtin->name;
+    } else {
+        return NativeType::Count;
+    }
+
+    auto found = types.find(name);
+    if (found == types.end()) {
+        return NativeType::Count;
+    }
+    return found->second;
 }
 
-Function get_native_bool_operation(StringRef signature) {
-    return get(native_bool_operators(), signature, Function());
+Value native_integer(NativeType type, int64 value) {
+    switch (type) {
+    case NativeType::i8_t: return Value(int8(value));
+    case NativeType::i16_t: return Value(int16(value));
+    case NativeType::i32_t: return Value(int32(value));
+    case NativeType::i64_t: return Value(int64(value));
+    case NativeType::u8_t: return Value(uint8(value));
+    case NativeType::u16_t: return Value(uint16(value));
+    case NativeType::u32_t: return Value(uint32(value));
+    case NativeType::u64_t: return Value(uint64(value));
+    default: break;
+    }
+    return Value();
 }
 
-// Unary
-Dict<StringRef, Function> build_native_unary_operators() {
-    Dict<StringRef, Function> map;
+int64 native_integer_value(Value const& value) {
+    switch (meta::ValueTypes(value.tag())) {
+    case meta::ValueTypes::i8: return value.as<int8>();
+    case meta::ValueTypes::i16: return value.as<int16>();
+    case meta::ValueTypes::i32: return value.as<int32>();
+    case meta::ValueTypes::i64: return value.as<int64>();
+    case meta::ValueTypes::u8: return value.as<uint8>();
+    case meta::ValueTypes::u16: return value.as<uint16>();
+    case meta::ValueTypes::u32: return value.as<uint32>();
+    case meta::ValueTypes::u64: return int64(value.as<uint64>());
+    default: break;
+    }
+    return 0;
+}
 
-    // clang-format off
-    map[StringRef(STR(JOIN1(Invert, u8)))]  = LAMBDA(Invert, uint8);
-    map[StringRef(STR(JOIN1(Invert, u16)))] = LAMBDA(Invert, uint16);
-    map[StringRef(STR(JOIN1(Invert, u32)))] = LAMBDA(Invert, uint32);
-    map[StringRef(STR(JOIN1(Invert, u64)))] = LAMBDA(Invert, uint64);
-
-    map[StringRef(STR(JOIN1(Not   , u8)))]  = LAMBDA(Not   , uint8);
-    map[StringRef(STR(JOIN1(Not   , u16)))] = LAMBDA(Not   , uint16);
-    map[StringRef(STR(JOIN1(Not   , u32)))] = LAMBDA(Not   , uint32);
-    map[StringRef(STR(JOIN1(Not   , u64)))] = LAMBDA(Not   , uint64);
-
-    map[StringRef(STR(JOIN1(UAdd  , u8)))]  = LAMBDA(UAdd  , uint8);
-    map[StringRef(STR(JOIN1(UAdd  , u16)))] = LAMBDA(UAdd  , uint16);
-    map[StringRef(STR(JOIN1(UAdd  , u32)))] = LAMBDA(UAdd  , uint32);
-    map[StringRef(STR(JOIN1(UAdd  , u64)))] = LAMBDA(UAdd  , uint64);
-
-    map[StringRef(STR(JOIN1(USub  , u8)))]  = LAMBDA(USub  , uint8);
-    map[StringRef(STR(JOIN1(USub  , u16)))] = LAMBDA(USub  , uint16);
-    map[StringRef(STR(JOIN1(USub  , u32)))] = LAMBDA(USub  , uint32);
-    map[StringRef(STR(JOIN1(USub  , u64)))] = LAMBDA(USub  , uint64);
-
-    map[StringRef(STR(JOIN1(Invert, i8)))]  = LAMBDA(Invert, int8);
-    map[StringRef(STR(JOIN1(Invert, i16)))] = LAMBDA(Invert, int16);
-    map[StringRef(STR(JOIN1(Invert, i32)))] = LAMBDA(Invert, int32);
-    map[StringRef(STR(JOIN1(Invert, i64)))] = LAMBDA(Invert, int64);
-
-    map[StringRef(STR(JOIN1(Not   , i8)))]  = LAMBDA(Not   , int8);
-    map[StringRef(STR(JOIN1(Not   , i16)))] = LAMBDA(Not   , int16);
-    map[StringRef(STR(JOIN1(Not   , i32)))] = LAMBDA(Not   , int32);
-    map[StringRef(STR(JOIN1(Not   , i64)))] = LAMBDA(Not   , int64);
-
-    map[StringRef(STR(JOIN1(UAdd  , i8)))]  = LAMBDA(UAdd  , int8);
-    map[StringRef(STR(JOIN1(UAdd  , i16)))] = LAMBDA(UAdd  , int16);
-    map[StringRef(STR(JOIN1(UAdd  , i32)))] = LAMBDA(UAdd  , int32);
-    map[StringRef(STR(JOIN1(UAdd  , i64)))] = LAMBDA(UAdd  , int64);
-
-    map[StringRef(STR(JOIN1(USub  , i8)))]  = LAMBDA(USub  , int8);
-    map[StringRef(STR(JOIN1(USub  , i16)))] = LAMBDA(USub  , int16);
-    map[StringRef(STR(JOIN1(USub  , i32)))] = LAMBDA(USub  , int32);
-    map[StringRef(STR(JOIN1(USub  , i64)))] = LAMBDA(USub  , int64);
-
-    // Floats
-    map[StringRef(STR(JOIN1(UAdd  , f32)))] = LAMBDA(UAdd  , float32);
-    map[StringRef(STR(JOIN1(USub  , f32)))] = LAMBDA(USub  , float32);
-    map[StringRef(STR(JOIN1(UAdd  , f64)))] = LAMBDA(UAdd  , float64);
-    map[StringRef(STR(JOIN1(USub  , f64)))] = LAMBDA(USub  , float64);
+inline bool valid(NativeType type) { return int(type) >= 0 && type < NativeType::Count; }
 
-    // clang-format on
+inline bool valid(int op, int count) { return op >= 0 && op < count; }
 
-    return map;
+BinaryFunction get_native_binary_operation(BinaryOperator op, NativeType lhs, NativeType rhs) {
+    if (!valid(int(op), n_binary_operators) || !valid(lhs) || !valid(rhs)) {
+        return nullptr;
+    }
+    return native_binary_operators.ops[int(op)][int(lhs)][int(rhs)];
 }
 
-Dict<StringRef, Function> const& native_unary_operators() {
-    static auto ops = build_native_unary_operators();
-    return ops;
+BinaryFunction get_native_bool_operation(BoolOperator op, NativeType lhs, NativeType rhs) {
+    if (!valid(int(op), n_bool_operators) || !valid(lhs) || !valid(rhs)) {
+        return nullptr;
+    }
+    return native_bool_operators.ops[int(op)][int(lhs)][int(rhs)];
 }
 
-Function get_native_unary_operation(StringRef signature) {
-    return get(native_unary_operators(), signature, Function());
+UnaryFunction get_native_unary_operation(UnaryOperator op, NativeType operand) {
+    if (!valid(int(op), n_unary_operators) || !valid(operand)) {
+        return nullptr;
+    }
+    return native_unary_operators.ops[int(op)][int(operand)];
 }
 
-// Cmp
-Dict<StringRef, Function> build_native_cmp_operators() {
-    Dict<StringRef, Function> map;
+BinaryFunction get_native_cmp_operation(CmpOperator op, NativeType lhs, NativeType rhs) {
+    if (!valid(int(op), n_cmp_operators) || !valid(lhs) || !valid(rhs)) {
+        return nullptr;
+    }
+    return native_cmp_operators.ops[int(op)][int(lhs)][int(rhs)];
+}
 
-    // clang-format off
-    map[StringRef(STR(JOIN(Eq   , u8, u8)))] = LAMBDA(Eq   , uint8);
-    map[StringRef(STR(JOIN(NotEq, u8, u8)))] = LAMBDA(NotEq, uint8);
-    map[StringRef(STR(JOIN(Lt   , u8, u8)))] = LAMBDA(Lt   , uint8);
-    map[StringRef(STR(JOIN(LtE  , u8, u8)))] = LAMBDA(LtE  , uint8);
-    map[StringRef(STR(JOIN(Gt   , u8, u8)))] = LAMBDA(Gt   , uint8);
-    map[StringRef(STR(JOIN(GtE  , u8, u8)))] = LAMBDA(GtE  , uint8);
-    map[StringRef(STR(JOIN(Is   , u8, u8)))] = LAMBDA(Is   , uint8);
-    map[StringRef(STR(JOIN(IsNot, u8, u8)))] = LAMBDA(IsNot, uint8);
-
-    map[StringRef(STR(JOIN(Eq   , u16, u16)))] = LAMBDA(Eq   , uint16);
-    map[StringRef(STR(JOIN(NotEq, u16, u16)))] = LAMBDA(NotEq, uint16);
-    map[StringRef(STR(JOIN(Lt   , u16, u16)))] = LAMBDA(Lt   , uint16);
-    map[StringRef(STR(JOIN(LtE  , u16, u16)))] = LAMBDA(LtE  , uint16);
-    map[StringRef(STR(JOIN(Gt   , u16, u16)))] = LAMBDA(Gt   , uint16);
-    map[StringRef(STR(JOIN(GtE  , u16, u16)))] = LAMBDA(GtE  , uint16);
-    map[StringRef(STR(JOIN(Is   , u16, u16)))] = LAMBDA(Is   , uint16);
-    map[StringRef(STR(JOIN(IsNot, u16, u16)))] = LAMBDA(IsNot, uint16);
-
-    map[StringRef(STR(JOIN(Eq   , u32, u32)))] = LAMBDA(Eq   , uint32);
-    map[StringRef(STR(JOIN(NotEq, u32, u32)))] = LAMBDA(NotEq, uint32);
-    map[StringRef(STR(JOIN(Lt   , u32, u32)))] = LAMBDA(Lt   , uint32);
-    map[StringRef(STR(JOIN(LtE  , u32, u32)))] = LAMBDA(LtE  , uint32);
-    map[StringRef(STR(JOIN(Gt   , u32, u32)))] = LAMBDA(Gt   , uint32);
-    map[StringRef(STR(JOIN(GtE  , u32, u32)))] = LAMBDA(GtE  , uint32);
-    map[StringRef(STR(JOIN(Is   , u32, u32)))] = LAMBDA(Is   , uint32);
-    map[StringRef(STR(JOIN(IsNot, u32, u32)))] = LAMBDA(IsNot, uint32);
-
-    map[StringRef(STR(JOIN(Eq   , u64, u64)))] = LAMBDA(Eq   , uint64);
-    map[StringRef(STR(JOIN(NotEq, u64, u64)))] = LAMBDA(NotEq, uint64);
-    map[StringRef(STR(JOIN(Lt   , u64, u64)))] = LAMBDA(Lt   , uint64);
-    map[StringRef(STR(JOIN(LtE  , u64, u64)))] = LAMBDA(LtE  , uint64);
-    map[StringRef(STR(JOIN(Gt   , u64, u64)))] = LAMBDA(Gt   , uint64);
-    map[StringRef(STR(JOIN(GtE  , u64, u64)))] = LAMBDA(GtE  , uint64);
-    map[StringRef(STR(JOIN(Is   , u64, u64)))] = LAMBDA(Is   , uint64);
-    map[StringRef(STR(JOIN(IsNot, u64, u64)))] = LAMBDA(IsNot, uint64);
-
-    map[StringRef(STR(JOIN(Eq   , i8, i8)))] = LAMBDA(Eq   , int8);
-    map[StringRef(STR(JOIN(NotEq, i8, i8)))] = LAMBDA(NotEq, int8);
-    map[StringRef(STR(JOIN(Lt   , i8, i8)))] = LAMBDA(Lt   , int8);
-    map[StringRef(STR(JOIN(LtE  , i8, i8)))] = LAMBDA(LtE  , int8);
-    map[StringRef(STR(JOIN(Gt   , i8, i8)))] = LAMBDA(Gt   , int8);
-    map[StringRef(STR(JOIN(GtE  , i8, i8)))] = LAMBDA(GtE  , int8);
-    map[StringRef(STR(JOIN(Is   , i8, i8)))] = LAMBDA(Is   , int8);
-    map[StringRef(STR(JOIN(IsNot, i8, i8)))] = LAMBDA(IsNot, int8);
-
-    map[StringRef(STR(JOIN(Eq   , i16, i16)))] = LAMBDA(Eq   , int16);
-    map[StringRef(STR(JOIN(NotEq, i16, i16)))] = LAMBDA(NotEq, int16);
-    map[StringRef(STR(JOIN(Lt   , i16, i16)))] = LAMBDA(Lt   , int16);
-    map[StringRef(STR(JOIN(LtE  , i16, i16)))] = LAMBDA(LtE  , int16);
-    map[StringRef(STR(JOIN(Gt   , i16, i16)))] = LAMBDA(Gt   , int16);
-    map[StringRef(STR(JOIN(GtE  , i16, i16)))] = LAMBDA(GtE  , int16);
-    map[StringRef(STR(JOIN(Is   , i16, i16)))] = LAMBDA(Is   , int16);
-    map[StringRef(STR(JOIN(IsNot, i16, i16)))] = LAMBDA(IsNot, int16);
-
-    map[StringRef(STR(JOIN(Eq   , i32, i32)))] = LAMBDA(Eq   , int32);
-    map[StringRef(STR(JOIN(NotEq, i32, i32)))] = LAMBDA(NotEq, int32);
-    map[StringRef(STR(JOIN(Lt   , i32, i32)))] = LAMBDA(Lt   , int32);
-    map[StringRef(STR(JOIN(LtE  , i32, i32)))] = LAMBDA(LtE  , int32);
-    map[StringRef(STR(JOIN(Gt   , i32, i32)))] = LAMBDA(Gt   , int32);
-    map[StringRef(STR(JOIN(GtE  , i32, i32)))] = LAMBDA(GtE  , int32);
-    map[StringRef(STR(JOIN(Is   , i32, i32)))] = LAMBDA(Is   , int32);
-    map[StringRef(STR(JOIN(IsNot, i32, i32)))] = LAMBDA(IsNot, int32);
-
-    map[StringRef(STR(JOIN(Eq   , i64, i64)))] = LAMBDA(Eq   , int64);
-    map[StringRef(STR(JOIN(NotEq, i64, i64)))] = LAMBDA(NotEq, int64);
-    map[StringRef(STR(JOIN(Lt   , i64, i64)))] = LAMBDA(Lt   , int64);
-    map[StringRef(STR(JOIN(LtE  , i64, i64)))] = LAMBDA(LtE  , int64);
-    map[StringRef(STR(JOIN(Gt   , i64, i64)))] = LAMBDA(Gt   , int64);
-    map[StringRef(STR(JOIN(GtE  , i64, i64)))] = LAMBDA(GtE  , int64);
-    map[StringRef(STR(JOIN(Is   , i64, i64)))] = LAMBDA(Is   , int64);
-    map[StringRef(STR(JOIN(IsNot, i64, i64)))] = LAMBDA(IsNot, int64);
-
-    map[StringRef(STR(JOIN(Eq   , f32, f32)))] = LAMBDA(Eq   , float32);
-    map[StringRef(STR(JOIN(NotEq, f32, f32)))] = LAMBDA(NotEq, float32);
-    map[StringRef(STR(JOIN(Lt   , f32, f32)))] = LAMBDA(Lt   , float32);
-    map[StringRef(STR(JOIN(LtE  , f32, f32)))] = LAMBDA(LtE  , float32);
-    map[StringRef(STR(JOIN(Gt   , f32, f32)))] = LAMBDA(Gt   , float32);
-    map[StringRef(STR(JOIN(GtE  , f32, f32)))] = LAMBDA(GtE  , float32);
-    map[StringRef(STR(JOIN(Is   , f32, f32)))] = LAMBDA(Is   , float32);
-    map[StringRef(STR(JOIN(IsNot, f32, f32)))] = LAMBDA(IsNot, float32);
-
-    map[StringRef(STR(JOIN(Eq   , f64, f64)))] = LAMBDA(Eq   , float64);
-    map[StringRef(STR(JOIN(NotEq, f64, f64)))] = LAMBDA(NotEq, float64);
-    map[StringRef(STR(JOIN(Lt   , f64, f64)))] = LAMBDA(Lt   , float64);
-    map[StringRef(STR(JOIN(LtE  , f64, f64)))] = LAMBDA(LtE  , float64);
-    map[StringRef(STR(JOIN(Gt   , f64, i64)))] = LAMBDA(Gt   , float64);
-    map[StringRef(STR(JOIN(GtE  , f64, f64)))] = LAMBDA(GtE  , float64);
-    map[StringRef(STR(JOIN(Is   , f64, f64)))] = LAMBDA(Is   , float64);
-    map[StringRef(STR(JOIN(IsNot, f64, f64)))] = LAMBDA(IsNot, float64);
+UnboxedBinaryOperation get_unboxed_binary_operation(BinaryOperator op, NativeType operand) {
+    if (!valid(int(op), n_binary_operators) || !valid(operand)) {
+        return UnboxedBinaryOperation();
+    }
+    return unboxed_binary_operators.ops[int(op)][int(operand)];
+}
 
-    // clang-format on
-    return map;
+UnboxedBinaryOperation get_unboxed_cmp_operation(CmpOperator op, NativeType operand) {
+    if (!valid(int(op), n_cmp_operators) || !valid(operand)) {
+        return UnboxedBinaryOperation();
+    }
+    return unboxed_cmp_operators.ops[int(op)][int(operand)];
+}
+
+UnboxedUnaryOperation get_unboxed_unary_operation(UnaryOperator op, NativeType operand) {
+    if (!valid(int(op), n_unary_operators) || !valid(operand)) {
+        return UnboxedUnaryOperation();
+    }
+    return unboxed_unary_operators.ops[int(op)][int(operand)];
 }
 
-Dict<StringRef, Function> const& native_cmp_operators() {
-    static auto ops = build_native_cmp_operators();
-    return ops;
+template <int N>
+bool find_operation(BinaryFunction const (&ops)[N][n_types][n_types],
+                    BinaryFunction fun,
+                    NativeOperation&     result) {
+    for (int op = 0; op < N; op++) {
+        for (int lhs = 0; lhs < n_types; lhs++) {
+            for (int rhs = 0; rhs < n_types; rhs++) {
+                if (ops[op][lhs][rhs] == fun) {
+                    result.op  = op;
+                    result.lhs = NativeType(lhs);
+                    result.rhs = NativeType(rhs);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+NativeOperation get_native_operation(BinaryFunction fun) {
+    NativeOperation result;
+
+    if (fun == nullptr) {
+        return result;
+    }
+
+    if (find_operation(native_binary_operators.ops, fun, result)) {
+        return result;
+    }
+    if (find_operation(native_bool_operators.ops, fun, result)) {
+        return result;
+    }
+    find_operation(native_cmp_operators.ops, fun, result);
+    return result;
 }
 
-Function get_native_cmp_operation(StringRef signature) {
-    return get(native_cmp_operators(), signature, Function());
+NativeOperation get_native_operation(UnaryFunction fun) {
+    NativeOperation result;
+
+    if (fun == nullptr) {
+        return result;
+    }
+
+    for (int op = 0; op < n_unary_operators; op++) {
+        for (int operand = 0; operand < n_types; operand++) {
+            if (native_unary_operators.ops[op][operand] == fun) {
+                result.op  = op;
+                result.lhs = NativeType(operand);
+                return result;
+            }
+        }
+    }
+    return result;
 }
 
-}  // namespace lython
\ No newline at end of file
+}  // namespace lython
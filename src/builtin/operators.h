@@ -1,35 +1,71 @@
 #pragma once
 
 #include "ast/nodes.h"
+#include "sema/builtin.h"
 
 namespace lython {
 
-// Binary
-Dict<StringRef, Function> build_native_binary_operators();
+// Dense index of the builtin types, used to dispatch native operators
+enum class NativeType : int8_t
+{
+#define TYPE(name, _) name##_t,
+    BUILTIN_TYPES(TYPE)
+#undef TYPE
+        Count
+};
 
-Dict<StringRef, Function> const& native_binary_operators();
+// Returns NativeType::Count if the type is not a builtin
+NativeType native_type(TypeExpr* type);
 
-Function get_native_binary_operation(StringRef signature);
+// Integer constant of a builtin integer type, invalid Value for the other types
+Value native_integer(NativeType type, int64 value);
 
-// Bool
-Dict<StringRef, Function> build_native_bool_operators();
+// Reverse of native_integer, the value must hold a builtin integer
+int64 native_integer_value(Value const& value);
 
-Dict<StringRef, Function> const& native_bool_operators();
+// Binary
+BinaryFunction get_native_binary_operation(BinaryOperator op, NativeType lhs, NativeType rhs);
 
-Function get_native_bool_operation(StringRef signature);
+// Bool
+BinaryFunction get_native_bool_operation(BoolOperator op, NativeType lhs, NativeType rhs);
 
 // Unary
-Dict<StringRef, Function> build_native_unary_operators();
+UnaryFunction get_native_unary_operation(UnaryOperator op, NativeType operand);
 
-Dict<StringRef, Function> const& native_unary_operators();
+// Cmp
+BinaryFunction get_native_cmp_operation(CmpOperator op, NativeType lhs, NativeType rhs);
 
-Function get_native_unary_operation(StringRef signature);
+// Reverse lookup, returns the table entry of a native operator
+// so it can be found again without keeping the function pointer
+struct NativeOperation {
+    int        op  = -1;
+    NativeType lhs = NativeType::Count;
+    NativeType rhs = NativeType::Count;
+};
 
-// Cmp
-Dict<StringRef, Function> build_native_cmp_operators();
+NativeOperation get_native_operation(BinaryFunction fun);
+
+NativeOperation get_native_operation(UnaryFunction fun);
+
+// Untagged operators, the operands are read from the holder directly
+// they are only valid once every type is known (see vm/unboxed.h)
+using UnboxedBinary = Value::Holder (*)(Value::Holder, Value::Holder);
+using UnboxedUnary  = Value::Holder (*)(Value::Holder);
+
+struct UnboxedBinaryOperation {
+    UnboxedBinary fun    = nullptr;
+    NativeType    result = NativeType::Count;
+};
+
+struct UnboxedUnaryOperation {
+    UnboxedUnary fun    = nullptr;
+    NativeType   result = NativeType::Count;
+};
+
+UnboxedBinaryOperation get_unboxed_binary_operation(BinaryOperator op, NativeType operand);
 
-Dict<StringRef, Function> const& native_cmp_operators();
+UnboxedBinaryOperation get_unboxed_cmp_operation(CmpOperator op, NativeType operand);
 
-Function get_native_cmp_operation(StringRef signature);
+UnboxedUnaryOperation get_unboxed_unary_operation(UnaryOperator op, NativeType operand);
 
 }  // namespace lython
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include "lexer/lexer.h"
 #include "parser/parser.h"
 #include "sema/sema.h"
+#include "vm/partial.h"
 
 #include "codegen/clang/clang_gen.h"
 #include "codegen/llvm/llvm_gen.h"
@@ -19,6 +20,11 @@ argparse::ArgumentParser* CodegenCmd::parser() {
     p->add_argument("--file")  //
         .help("file to process");
 
+    p->add_argument("--no-fold")  //
+        .help("compile the program as written, skip the partial evaluation")
+        .default_value(false)
+        .implicit_value(true);
+
     return p;
 }
 
@@ -42,6 +48,12 @@ int CodegenCmd::main(argparse::ArgumentParser const& args) {
     sema.exec(mod, 0);
     sema.show_diagnostic(std::cout, &lex);
 
+    // Fold what is known at compile time before the code is generated
+    if (!sema.has_errors() && !args.get<bool>("--no-fold")) {
+        PartialEvaluator partial;
+        partial.module(mod, 0);
+    }
+
 #if WITH_CLANG_CODEGEN
     std::cout << "CLANG_CODE_GEN\n";
     ClangGen generator;
@@ -1 +1,131 @@
-#include "cli/commands/profile.h"
\ No newline at end of file
+#include "cli/commands/profile.h"
+
+#include "lexer/buffer.h"
+#include "lexer/lexer.h"
+#include "parser/parser.h"
+#include "sema/sema.h"
+#include "utilities/printing.h"
+#include "utilities/stopwatch.h"
+#include "vm/memo.h"
+#include "vm/tree.h"
+#include "vm/vm.h"
+
+namespace lython {
+
+argparse::ArgumentParser* ProfileCmd::parser() {
+    argparse::ArgumentParser* p = new_parser();
+
+    p->add_argument("--file")  //
+        .help("file to process");
+
+    p->add_argument("--tree")  //
+        .help("run the tree evaluator instead of the bytecode")
+        .default_value(false)
+        .implicit_value(true);
+
+    p->add_argument("--memo")  //
+        .help("memoize the calls to pure functions")
+        .default_value(false)
+        .implicit_value(true);
+
+    p->add_argument("--gc")  //
+        .help("show the heap statistics and the pauses of the collector (tree evaluator)")
+        .default_value(false)
+        .implicit_value(true);
+
+    p->add_argument("--gc-quantum")  //
+        .help("objects traced per step of the collector, 0 stops the world")
+        .default_value(0)
+        .scan<'i', int>();
+
+    return p;
+}
+
+int ProfileCmd::main(argparse::ArgumentParser const& args) {
+    std::string file = "";
+    if (args.is_used("--file")) {
+        file = args.get<std::string>("--file");
+    }
+
+    std::unique_ptr<AbstractBuffer> reader = std::make_unique<FileBuffer>(String(file.c_str()));
+
+    Lexer            lex(*reader.get());
+    Parser           parser(lex);
+    SemanticAnalyser sema;
+
+    StopWatch<> front;
+    Module*     mod = parser.parse_module();
+    parser.show_diagnostics(std::cout);
+
+    sema.exec(mod, 0);
+    sema.show_diagnostic(std::cout, &lex);
+    double analysis = front.stop();
+
+    if (parser.has_errors() || sema.has_errors()) {
+        return -1;
+    }
+
+    MemoCache    memo;
+    bool         use_memo = args.get<bool>("--memo");
+    bool         show_gc  = args.get<bool>("--gc");
+    bool         failed   = false;
+    double       compiled = 0;
+    double       executed = 0;
+    StringStream heap_stats;
+
+    bool    use_tree = args.get<bool>("--tree");
+    Program program;
+
+    if (!use_tree) {
+        StopWatch<> build;
+        program  = compile(mod);
+        compiled = build.stop();
+
+        // The bytecode does not cover the whole language yet
+        if (program.errors > 0) {
+            std::cout << "Could not compile to bytecode, running the tree evaluator\n";
+            use_tree = true;
+        }
+    }
+
+    if (use_tree) {
+        StopWatch<>   run;
+        TreeEvaluator eval;
+        eval.memo = use_memo ? &memo : nullptr;
+        eval.heap.set_quantum(std::size_t(args.get<int>("--gc-quantum")));
+        eval.module(mod, 0);
+        executed = run.stop();
+
+        if (show_gc) {
+            eval.heap.dump_heap_stats(heap_stats);
+        }
+    } else {
+        StopWatch<> run;
+        VMExec      exec;
+        exec.memo = use_memo ? &memo : nullptr;
+        exec.execute(program, 0);
+        executed = run.stop();
+        failed   = exec.has_error;
+    }
+
+    std::cout << "\nProfile\n";
+    std::cout << "=======\n";
+    std::cout << fmt::format("{:>30} | {:>12}\n", "step", "time (ms)");
+    std::cout << fmt::format("{:>30} | {:12.3f}\n", "parse + sema", analysis);
+    std::cout << fmt::format("{:>30} | {:12.3f}\n", "compile", compiled);
+    std::cout << fmt::format("{:>30} | {:12.3f}\n", "execute", executed);
+
+    if (use_memo) {
+        std::cout << "\n";
+        memo.dump_memo_stats(std::cout);
+    }
+
+    if (show_gc) {
+        std::cout << "\n" << heap_stats.str();
+    }
+
+    delete mod;
+    return failed ? -1 : 0;
+}
+
+}  // namespace lython
@@ -6,15 +6,8 @@ namespace lython {
 struct ProfileCmd: public Command {
     ProfileCmd(): Command("profile") {}
 
-    virtual argparse::ArgumentParser* parser() {
-        argparse::ArgumentParser* p = new_parser();
-        return p;
-    }
-
-    virtual int main(argparse::ArgumentParser const& args) {
-        //
-        return 0;
-    };
+    virtual argparse::ArgumentParser* parser();
+    virtual int main(argparse::ArgumentParser const& args);
 };
 
-}  // namespace lython
\ No newline at end of file
+}  // namespace lython
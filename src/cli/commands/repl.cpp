@@ -98,7 +98,7 @@ struct InteractiveContext {
                 String strval = str(val);
 
                 auto& registry = meta::TypeRegistry::instance();
-                auto& meta = registry.id_to_meta[val.tag];
+                auto& meta = registry.id_to_meta[val.tag()];
 
                 self->out() << format("      {:>20} | {:>20} | {}\n", var.name, strval, meta.name);
             }
@@ -160,9 +160,9 @@ struct InteractiveContext {
     }
 
     void output(Value v) {
-        if (v.tag == meta::type_id<_LyException*>()) {
+        if (v.tag() == meta::type_id<_LyException*>()) {
             out() << v << "\n";
-        } else if (v.tag != meta::type_id<_Invalid>()) {
+        } else if (v.tag() != meta::type_id<_Invalid>()) {
             out() << " [Out] " << v << "\n";
         }
         clear();
@@ -8,6 +8,8 @@
 #include "logging/logging.h"
 #include "parser/parser.h"
 #include "sema/sema.h"
+#include "vm/bytecode.h"
+#include "vm/partial.h"
 #include "vm/tree.h"
 #include "vm/vm.h"
 
@@ -21,11 +23,36 @@ argparse::ArgumentParser* VMCmd::parser() {
     p->add_argument("--file")  //
         .help("file to process");
 
+    p->add_argument("--emit")  //
+        .help("save the compiled program as bytecode");
+
+    p->add_argument("--run-bytecode")  //
+        .help("execute a bytecode file, the source is not read");
+
+    p->add_argument("--no-fold")  //
+        .help("compile the program as written, skip the partial evaluation")
+        .default_value(false)
+        .implicit_value(true);
+
     return p;
 }
 
 int VMCmd::main(argparse::ArgumentParser const& args)
 {    
+    // Production startup, skip the front end entirely
+    if (args.is_used("--run-bytecode")) {
+        String path = args.get<std::string>("--run-bytecode").c_str();
+
+        BytecodeFile bytecode;
+        if (!bytecode.open(path)) {
+            std::cout << "Could not load " << path << "\n";
+            return -1;
+        }
+
+        Value result = eval(bytecode.program());
+        return result.tag() == meta::type_id<_Invalid>() ? -1 : 0;
+    }
+
     std::string file = "";
     if (args.is_used("--file")) {
         file = args.get<std::string>("--file");
@@ -53,39 +80,36 @@ int VMCmd::main(argparse::ArgumentParser const& args)
     sema.exec(mod, 0);
     sema.show_diagnostic(std::cout, &lex);
 
+    // Fold what is known at compile time before the code is generated
+    if (!sema.has_errors() && !args.get<bool>("--no-fold")) {
+        PartialEvaluator partial;
+        partial.module(mod, 0);
+    }
 
-    Program p = compile(mod);
 
-    std::cout << "\nVM\n";
-    std::cout << "====\n";
+    Program p = compile(mod);
 
+    // The bytecode does not cover the whole language yet
+    if (p.errors > 0) {
+        std::cout << "\nCould not compile to bytecode, running the tree evaluator\n";
+        TreeEvaluator eval;
+        eval.module(mod, 0);
+        return eval.has_exceptions() ? -1 : 0;
+    }
 
-    Label* label = nullptr;
-    int count = 0;
+    if (args.is_used("--emit")) {
+        String path = args.get<std::string>("--emit").c_str();
 
-    for(int i = 0; i < p.instructions.size(); i++) {
-        Instruction& inst = p.instructions[i];
-        
-        count += 1;
-        for(Label& l: p.labels) {
-            if (l.index == i) {
-                label = &l;
-                count = 0;
-                break;
-            }
+        if (!BytecodeFile::write(p, path)) {
+            std::cout << "Could not save the bytecode to " << path << "\n";
         }
+    }
 
-        int idt = 2;
-        if (label)  {
-            idt *= label->depth;
+    std::cout << "\nVM\n";
+    std::cout << "====\n";
 
-            if (count == 0) {
-                std::cout << fmt::format("{:4d}", i)  << "|" << String(idt, ' ') << "." << label->name << "\n";
-            }
-        }
-        std::cout << "    |" << String(idt + 2, ' ') << str(inst.stmt) << "\n"; 
-    }
 
+    p.dump(std::cout);
 
     Value result = eval(p);
 
@@ -94,7 +118,7 @@ int VMCmd::main(argparse::ArgumentParser const& args)
     // std::cout << "====\n";
     // TreeEvaluator eval;
     // eval.module(mod, 0);
-    return result.tag != meta::type_id<_Invalid>();
+    return result.tag() == meta::type_id<_Invalid>() ? -1 : 0;
 };  
 
 }
\ No newline at end of file
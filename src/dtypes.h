@@ -71,6 +71,18 @@ struct Value;
 
 using Function = Value(*)(void*, Array<Value>&);
 
+// Fixed arity native functions, arguments are passed by value
+// so calling them does not require an argument array
+using UnaryFunction  = Value(*)(void*, Value);
+using BinaryFunction = Value(*)(void*, Value, Value);
+
+// Native function called with arguments whose types were proven by SEMA,
+// the arguments are read in place without checking their tags
+using DirectFunction = Value(*)(void*, Value const*);
+
+// Arguments of a direct call are held on the caller's stack
+constexpr int max_direct_args = 8;
+
 }  // namespace lython
 
 // ------------
@@ -119,10 +119,13 @@ String read_file(String const& name) {
         auto& buffer = *(data.end() - 1);
 
         read = fread(&buffer[0], 1, buffer_size, file);
+        buffer.resize(read);
 
         total += read;
     } while (read == buffer_size);
 
+    fclose(file);
+
     String aggregated(total, ' ');
 
     ptrdiff_t start = 0;
@@ -18,6 +18,13 @@ Bindings::Bindings() {
     add(String("None"), None(), None_t());
     add(String("True"), True(), bool_t());
     add(String("False"), False(), bool_t());
+
+    for (FunctionDef* def: builtin_functions()) {
+        add(def->name, def, def->type);
+    }
+    for (ClassDef* def: builtin_exceptions()) {
+        add(def->name, def, Type_t());
+    }
 }
 
 std::ostream& print(std::ostream& out, int i, BindingEntry const& entry);
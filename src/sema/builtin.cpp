@@ -1,4 +1,7 @@
 #include "sema/builtin.h"
+#include "sema/native_module.h"
+
+#include <cmath>
 
 namespace lython {
 
@@ -33,4 +36,58 @@ ExprNode* False() {
     return &constant;
 }
 
+namespace {
+float64 builtin_sqrt(float64 x) { return std::sqrt(x); }
+float64 builtin_exp(float64 x) { return std::exp(x); }
+float64 builtin_log(float64 x) { return std::log(x); }
+float64 builtin_sin(float64 x) { return std::sin(x); }
+float64 builtin_cos(float64 x) { return std::cos(x); }
+float64 builtin_pow(float64 x, float64 y) { return std::pow(x, y); }
+}  // namespace
+
+Array<FunctionDef*> const& builtin_functions() {
+    static Module              module;
+    static Array<FunctionDef*> functions = {
+        native_function<builtin_sqrt>(&module, "sqrt", true),
+        native_function<builtin_exp>(&module, "exp", true),
+        native_function<builtin_log>(&module, "log", true),
+        native_function<builtin_sin>(&module, "sin", true),
+        native_function<builtin_cos>(&module, "cos", true),
+        native_function<builtin_pow>(&module, "pow", true),
+    };
+    return functions;
+}
+
+FunctionDef* builtin_function(StringRef name) {
+    for (FunctionDef* def: builtin_functions()) {
+        if (def->name == name) {
+            return def;
+        }
+    }
+    return nullptr;
+}
+
+Array<ClassDef*> const& builtin_exceptions() {
+    static Module           module;
+    static Array<ClassDef*> classes = []() {
+        Array<ClassDef*> result;
+        for (char const* name: {"AssertionError", "NameError", "RuntimeError", "ValueError"}) {
+            ClassDef* def = module.new_object<ClassDef>();
+            def->name     = StringRef(name);
+            result.push_back(def);
+        }
+        return result;
+    }();
+    return classes;
+}
+
+ClassDef* builtin_exception(StringRef name) {
+    for (ClassDef* def: builtin_exceptions()) {
+        if (def->name == name) {
+            return def;
+        }
+    }
+    return nullptr;
+}
+
 }  // namespace lython
\ No newline at end of file
@@ -38,6 +38,17 @@ BUILTIN_TYPES(TYPE)
 
 #undef TYPE
 
+// Native functions every module can call, they are registered with `native_function`
+// so SEMA-checked calls go through their direct trampoline
+Array<FunctionDef*> const& builtin_functions();
+
+FunctionDef* builtin_function(StringRef name);
+
+// Exceptions the evaluators raise themselves, scripts can catch them by name
+Array<ClassDef*> const& builtin_exceptions();
+
+ClassDef* builtin_exception(StringRef name);
+
 }  // namespace lython
 
 #endif
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include "utilities/strings.h"
 #include "dependencies/formatter.h"
 #include "sema/importlib.h"
+#include "utilities/stopwatch.h"
 
 
 namespace lython {
@@ -172,67 +173,108 @@ ImportLib::ImportedLib* ImportLib::importfile(StringRef const& modulepath) {
     ImportedLib& importedlib = imported[modulepath];
 
     if (importedlib.mod == nullptr) {
-        Module* mod = internal_importfile(modulepath, syspaths);
-
-        if (mod != nullptr) {
-            // Check ownership of Module
-            // we could make the import statement the owner
-            // but it could be imported multiple times
-            // in that case we would like to avoid doing SEMA
-            // and reuse the same version
-            // we could also import modules using multiple threads
-            // so we will need a place to manage all those modules
-            // sounds like shared_ptr might the easiest
-            // mod->move(n);
-
-            // TODO: this needs to be kept somewhere
-            // TODO: this module also has init that will need to be called
+        String filepath = lookup_module(modulepath, syspaths);
 
+        if (filepath.empty()) {
+            kwwarn(outlog(), "Could not load file {}", modulepath);
+            return nullptr;
+        }
+
+        StopWatch<double, std::chrono::duration<double, std::milli>> timer;
+        String      name   = str(modulepath);
+        String      source = read_file(filepath);
+        Module*     mod    = internal_parse(source, filepath);
+
+        // Check ownership of Module
+        // we could make the import statement the owner
+        // but it could be imported multiple times
+        // in that case we would like to avoid doing SEMA
+        // and reuse the same version
+        // we could also import modules using multiple threads
+        // so we will need a place to manage all those modules
+        // sounds like shared_ptr might the easiest
+        // mod->move(n);
+
+        // TODO: this needs to be kept somewhere
+        // TODO: this module also has init that will need to be called
+
+        // The nodes need to be listed before SEMA adds its own
+        Array<Node*>      nodes = module_nodes(mod);
+        SemanticAnalyser* sema  = new SemanticAnalyser(this);
+        uint64            key   = 0;
+        bool              warm  = false;
+
+        if (cache.enabled()) {
+            warm = cache.load(this, name, source, nodes, sema, key);
+        }
+
+        if (!warm) {
             // Run sema on this module
-            SemanticAnalyser* sema = new SemanticAnalyser(this);
             sema->exec(mod, 0);
 
-            //
-            if (sema->has_errors()) {
-                // FIXME
+            auto deps = ModuleCache::module_dependencies(this, nodes);
+            key       = ModuleCache::module_key(source, deps);
+
+            // Modules with errors need to go through SEMA again
+            // so the errors are reported
+            if (cache.enabled() && !sema->has_errors()) {
+                cache.save(this, name, key, deps, nodes, sema);
             }
-            //
+        }
 
-            Dict<StringRef, ImportedLib>::iterator elem;
-            bool ok = false;
+        // Make the entry point referenceable by the modules importing this one
+        if (mod->__init__ != nullptr) {
+            nodes.push_back(mod->__init__);
+        }
 
-            importedlib.mod = mod;
-            importedlib.sema = sema;
+        importedlib.mod     = mod;
+        importedlib.sema    = sema;
+        importedlib.nodes   = std::move(nodes);
+        importedlib.key     = key;
+        importedlib.warm    = warm;
+        importedlib.elapsed = timer.stop();
 
-            return &importedlib;
-            // std::tie(elem, ok) = imported.insert({modulepath, ImportedLib{mod, sema}});
-            // if (ok) {
-            //     ImportedLib* val = &elem->second;
-            //     return val;
-            // }
-            // kwwarn("Could not insert imported module to system");
-        }
+        kwdebug(outlog(),
+                "Imported {} in {} ms ({})",
+                modulepath,
+                importedlib.elapsed,
+                warm ? "warm" : "cold");
 
-        kwwarn(outlog(), "Could not load file {}", modulepath);
-        return nullptr;;
+        return &importedlib;
     }
 
     return &importedlib;
 }
 
-Module* ImportLib::internal_importfile(StringRef const& modulepath, Array<String> const& paths) {
-    String filepath = lookup_module(modulepath, paths);
-    if (filepath.empty()) {
-        return nullptr;
-    }
-
-    FileBuffer buffer(filepath);
-    Lexer      lexer(buffer);
-    Parser     parser(lexer);
-    Module*    mod = parser.parse_module();
+Module* ImportLib::internal_parse(String const& source, String const& filepath) {
+    StringBuffer buffer(source, filepath);
+    Lexer        lexer(buffer);
+    Parser       parser(lexer);
+    Module*      mod = parser.parse_module();
     return mod;
 }
 
+void ImportLib::dump_import_stats(std::ostream& out) const {
+    double cold = 0;
+    double warm = 0;
+
+    out << fmt::format("{:>30} | {:>4} | {:>12}\n", "module", "mode", "time (ms)");
+    for (auto const& item: imported) {
+        ImportedLib const& lib = item.second;
+        if (lib.mod == nullptr) {
+            continue;
+        }
+
+        out << fmt::format("{:>30} | {:>4} | {:12.3f}\n",
+                           str(item.first),
+                           lib.warm ? "warm" : "cold",
+                           lib.elapsed);
+
+        (lib.warm ? warm : cold) += lib.elapsed;
+    }
+    out << fmt::format("{:>30} | {:>4} | {:12.3f}\n", "total", "cold", cold);
+    out << fmt::format("{:>30} | {:>4} | {:12.3f}\n", "total", "warm", warm);
+}
 
 void ImportLib::add_to_path(String const& path) {
     for (auto& other: syspaths) {
@@ -246,11 +288,23 @@ void ImportLib::add_to_path(String const& path) {
 
 bool ImportLib::add_module(String const& name, Module* module) 
 {
-    SemanticAnalyser* sema = new SemanticAnalyser(this);
+    StopWatch<double, std::chrono::duration<double, std::milli>> timer;
+
+    // Native modules are built in process, there is nothing to cache
+    // but dependent modules still need a key that changes with the revision
+    Array<Node*>      nodes = module_nodes(module);
+    SemanticAnalyser* sema  = new SemanticAnalyser(this);
     sema->exec(module, 0);
 
+    ImportedLib lib;
+    lib.mod     = module;
+    lib.sema    = sema;
+    lib.nodes   = std::move(nodes);
+    lib.key     = ModuleCache::module_key(name, {});
+    lib.elapsed = timer.stop();
+
     bool ok = false;
-    std::tie(std::ignore, ok) = imported.insert({name, ImportedLib{module, sema}});
+    std::tie(std::ignore, ok) = imported.insert({name, lib});
 
     if (ok) {
         return true;
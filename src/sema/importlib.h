@@ -4,6 +4,7 @@
 #include "dtypes.h"
 #include "ast/nodes.h"
 #include "utilities/names.h"
+#include "sema/module_cache.h"
 
 namespace lython {
 
@@ -22,6 +23,18 @@ public:
     struct ImportedLib {
         Module* mod = nullptr;
         struct SemanticAnalyser* sema = nullptr;
+
+        // Pre-order nodes of the module, used to reference nodes inside the module cache
+        Array<Node*> nodes;
+
+        // Hash of the module source and its transitive imports
+        uint64 key = 0;
+
+        // Sema annotations were restored from the module cache
+        bool warm = false;
+
+        // Time it took to import the module in milliseconds
+        double elapsed = 0;
     };
 
     ImportedLib* importfile(StringRef const& modulepath);
@@ -37,17 +50,27 @@ public:
 
     Module* newmodule(String const& name);
 
+    // Empty directory disables the module cache
+    void set_cache_dir(String const& dir) { cache.set_cache_dir(dir); }
+
+    Dict<StringRef, ImportedLib> const& imported_modules() const { return imported; }
+
+    // Print the time spent importing each module
+    void dump_import_stats(std::ostream& out) const;
+
 private:
 
     String lookup_module(StringRef const& module_path, Array<String> const& paths);
 
-    Module* internal_importfile(StringRef const& modulepath, Array<String> const& paths);
+    Module* internal_parse(String const& source, String const& filepath);
 
     Dict<StringRef, ImportedLib> imported;
 
     Array<String> syspaths = python_paths();
 
     Array<UniquePtr<Module>> modules;
+
+    ModuleCache cache;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,1112 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "builtin/operators.h"
+#include "dependencies/xx_hash.h"
+#include "revision_data.h"
+#include "sema/importlib.h"
+#include "sema/module_cache.h"
+#include "sema/sema.h"
+#include "utilities/strings.h"
+
+namespace lython {
+
+// Bump when the layout of the cache entries changes
+static constexpr int cache_version = 7;
+
+String internal_getenv(String const& name);
+
+Array<Node*> module_nodes(Module* mod) {
+    Array<Node*>      nodes;
+    Array<GCObject*>  stack = {mod};
+
+    while (!stack.empty()) {
+        GCObject* obj = stack.back();
+        stack.pop_back();
+
+        if (Node* node = dynamic_cast<Node*>(obj)) {
+            nodes.push_back(node);
+        }
+
+        auto const& children = obj->get_children();
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+            stack.push_back(*it);
+        }
+    }
+
+    return nodes;
+}
+
+ModuleCache::ModuleCache() { cache_dir = internal_getenv("LYTHON_CACHE"); }
+
+String ModuleCache::entry_path(String const& name) const { return cache_dir + "/" + name + ".lyc"; }
+
+Array<Tuple<String, uint64>> ModuleCache::module_dependencies(ImportLib*          importsys,
+                                                              Array<Node*> const& nodes) {
+    Array<String> names;
+
+    for (Node* node: nodes) {
+        if (Import* imp = cast<Import>(node)) {
+            for (Alias const& alias: imp->names) {
+                names.push_back(str(alias.name));
+            }
+        } else if (ImportFrom* imp = cast<ImportFrom>(node)) {
+            if (imp->module.has_value()) {
+                names.push_back(str(imp->module.value()));
+            }
+        }
+    }
+
+    Array<Tuple<String, uint64>> deps;
+    deps.reserve(names.size());
+
+    auto const& imported = importsys->imported_modules();
+    for (String const& name: names) {
+        auto   it  = imported.find(StringRef(name));
+        uint64 key = 0;
+
+        if (it != imported.end()) {
+            key = it->second.key;
+        }
+        deps.emplace_back(name, key);
+    }
+    return deps;
+}
+
+uint64 ModuleCache::module_key(String const& source, Array<Tuple<String, uint64>> const& deps) {
+    StringStream ss;
+    ss << cache_version << " " << _HASH << " " << xx_hash_3(source.data(), source.size());
+
+    for (auto const& dep: deps) {
+        ss << " " << std::get<0>(dep) << " " << std::get<1>(dep);
+    }
+
+    String data = ss.str();
+    return uint64(xx_hash_3(data.data(), data.size()));
+}
+
+namespace {
+
+// Nodes are referenced by their pre-order index
+//
+//  _                   null
+//  # <index>           node of the cached module
+//  @ <module> <index>  node of an imported module
+//
+// Types are written structurally when they are not part of a parsed module
+//
+//  N <id> <type>       Name
+//  A <n> <args...> <returns>
+//  L <value>           ArrayType
+//  D <key> <value>     DictType
+//  S <value>           SetType
+//  T <n> <types...>    TupleType
+//  B <name>            BuiltinType
+//
+struct CacheWriter {
+    CacheWriter(ImportLib* importsys, Array<Node*> const& nodes): importsys(importsys) {
+        int i = 0;
+        for (Node* node: nodes) {
+            local[node] = i;
+            i += 1;
+        }
+
+        // The module entry point is created by SEMA
+        if (Module* mod = cast<Module>(nodes[0])) {
+            if (mod->__init__ != nullptr) {
+                local[mod->__init__] = i;
+            }
+        }
+    }
+
+    void string(String const& value) { out << value.size() << " " << value << " "; }
+
+    void string(StringRef value) { string(str(value)); }
+
+    void integer(int64 value) { out << value << " "; }
+
+    // Native operators are written as their dispatch table entry
+    template <typename NativeFunction>
+    void native(NativeFunction fun) {
+        NativeOperation op = get_native_operation(fun);
+        integer(op.op);
+        integer(int(op.lhs));
+        integer(int(op.rhs));
+    }
+
+    void ref(Node const* node) {
+        if (node == nullptr) {
+            out << "_ ";
+            return;
+        }
+
+        auto it = local.find(node);
+        if (it != local.end()) {
+            out << "# " << it->second << " ";
+            return;
+        }
+
+        String mod;
+        int    index = -1;
+        if (find_foreign(node, mod, index)) {
+            out << "@ ";
+            string(mod);
+            integer(index);
+            return;
+        }
+
+        kwdebug(outlog(), "Node {} cannot be referenced from the module cache", str(node));
+        ok = false;
+        out << "_ ";
+    }
+
+    void type(ExprNode const* node) {
+        if (node == nullptr) {
+            out << "_ ";
+            return;
+        }
+
+        if (local.count(node) > 0) {
+            return ref(node);
+        }
+
+        switch (node->kind) {
+        case NodeKind::Name: {
+            auto* name = cast<Name>(node);
+            out << "N ";
+            string(name->id);
+            return type(name->type);
+        }
+        case NodeKind::Arrow: {
+            auto* arrow = cast<Arrow>(node);
+            out << "A ";
+            integer(arrow->args.size());
+            for (ExprNode* arg: arrow->args) {
+                type(arg);
+            }
+            return type(arrow->returns);
+        }
+        case NodeKind::ArrayType: {
+            out << "L ";
+            return type(cast<ArrayType>(node)->value);
+        }
+        case NodeKind::DictType: {
+            out << "D ";
+            type(cast<DictType>(node)->key);
+            return type(cast<DictType>(node)->value);
+        }
+        case NodeKind::SetType: {
+            out << "S ";
+            return type(cast<SetType>(node)->value);
+        }
+        case NodeKind::TupleType: {
+            auto* tuple = cast<TupleType>(node);
+            out << "T ";
+            integer(tuple->types.size());
+            for (ExprNode* elt: tuple->types) {
+                type(elt);
+            }
+            return;
+        }
+        case NodeKind::BuiltinType: {
+            out << "B ";
+            return string(cast<BuiltinType>(node)->name);
+        }
+        default: return ref(node);
+        }
+    }
+
+    bool find_foreign(Node const* node, String& mod, int& index) {
+        if (foreign.empty()) {
+            for (auto const& item: importsys->imported_modules()) {
+                int i = 0;
+                for (Node* n: item.second.nodes) {
+                    foreign[n] = std::make_tuple(str(item.first), i);
+                    i += 1;
+                }
+            }
+        }
+
+        auto it = foreign.find(node);
+        if (it != foreign.end()) {
+            std::tie(mod, index) = it->second;
+            return true;
+        }
+        return false;
+    }
+
+    // ClassDef owning the resolved attribute
+    Tuple<ClassDef const*, int> find_attribute(ClassDef::Attr const* attr, Array<Node*> const& nodes) {
+        auto lookup = [&](Array<Node*> const& candidates) -> Tuple<ClassDef const*, int> {
+            for (Node* node: candidates) {
+                if (ClassDef* cls = cast<ClassDef>(node)) {
+                    auto const& attrs = cls->attributes;
+                    if (attrs.size() > 0 && attr >= &attrs[0] && attr <= &attrs[attrs.size() - 1]) {
+                        return std::make_tuple(cls, int(attr - &attrs[0]));
+                    }
+                }
+            }
+            return std::make_tuple(nullptr, -1);
+        };
+
+        auto result = lookup(nodes);
+        if (std::get<0>(result) != nullptr) {
+            return result;
+        }
+
+        for (auto const& item: importsys->imported_modules()) {
+            result = lookup(item.second.nodes);
+            if (std::get<0>(result) != nullptr) {
+                return result;
+            }
+        }
+
+        ok = false;
+        return result;
+    }
+
+    ImportLib*                           importsys;
+    Dict<Node const*, int>               local;
+    Dict<Node const*, Tuple<String, int>> foreign;
+    StringStream                         out;
+    bool                                 ok = true;
+};
+
+struct CacheReader {
+    CacheReader(std::istream&       in,
+                ImportLib*          importsys,
+                Array<Node*> const& nodes,
+                SemanticAnalyser*   sema,
+                bool                apply):
+        in(in),
+        importsys(importsys), nodes(nodes), sema(sema), apply(apply) {}
+
+    String string() {
+        int64 size = -1;
+        in >> size;
+
+        if (!in || size < 0) {
+            ok = false;
+            return String();
+        }
+
+        // skip the separator
+        in.get();
+
+        String value(size, ' ');
+        in.read(value.data(), size);
+        ok = ok && bool(in);
+        return value;
+    }
+
+    int64 integer() {
+        int64 value = 0;
+        in >> value;
+        ok = ok && bool(in);
+        return value;
+    }
+
+    String token() {
+        String value;
+        in >> value;
+        ok = ok && bool(in);
+        return value;
+    }
+
+    Node* ref(String const& tag) {
+        if (tag == "_") {
+            return nullptr;
+        }
+
+        Array<Node*> const* candidates = &nodes;
+        if (tag == "@") {
+            String mod = string();
+            auto   it  = importsys->imported_modules().find(StringRef(mod));
+
+            if (it == importsys->imported_modules().end()) {
+                ok = false;
+                return nullptr;
+            }
+            candidates = &it->second.nodes;
+        } else if (tag != "#") {
+            ok = false;
+            return nullptr;
+        }
+
+        int64 index = integer();
+        int64 size  = int64(candidates->size());
+
+        // Nodes created by SEMA are indexed after the parsed nodes
+        if (candidates == &nodes && index >= size && index < size + int64(synthesized.size())) {
+            return synthesized[index - size];
+        }
+
+        if (!ok || index < 0 || index >= size) {
+            ok = false;
+            return nullptr;
+        }
+        return (*candidates)[index];
+    }
+
+    Node* ref() { return ref(token()); }
+
+    template <typename T>
+    T* ref_as() {
+        Node* node = ref();
+        if (node == nullptr) {
+            return nullptr;
+        }
+
+        bool valid = false;
+        if constexpr (std::is_same_v<T, StmtNode>) {
+            valid = node->family() == NodeFamily::Statement;
+        } else if constexpr (std::is_same_v<T, ExprNode>) {
+            valid = node->family() == NodeFamily::Expression;
+        } else {
+            valid = cast<T>(node) != nullptr;
+        }
+
+        if (!valid) {
+            ok = false;
+            return nullptr;
+        }
+        return static_cast<T*>(node);
+    }
+
+    // Types created by SEMA are owned by the node they annotate
+    ExprNode* type(Node* parent) {
+        String tag = token();
+
+        if (tag == "N") {
+            String id      = string();
+            auto*  subtype = type(parent);
+
+            if (!apply) {
+                return nullptr;
+            }
+            return sema->bindings.make_reference(parent, StringRef(id), subtype);
+        }
+        if (tag == "A") {
+            int64  n     = integer();
+            Arrow* arrow = apply ? parent->new_object<Arrow>() : nullptr;
+            for (int64 i = 0; i < n && ok; i++) {
+                auto* arg = type(parent);
+                if (arrow) {
+                    arrow->args.push_back(arg);
+                }
+            }
+            auto* returns = type(parent);
+            if (arrow) {
+                arrow->returns = returns;
+            }
+            return arrow;
+        }
+        if (tag == "L") {
+            auto* value = type(parent);
+            if (!apply) {
+                return nullptr;
+            }
+            auto* array  = parent->new_object<ArrayType>();
+            array->value = value;
+            return array;
+        }
+        if (tag == "D") {
+            auto* key   = type(parent);
+            auto* value = type(parent);
+            if (!apply) {
+                return nullptr;
+            }
+            auto* dict  = parent->new_object<DictType>();
+            dict->key   = key;
+            dict->value = value;
+            return dict;
+        }
+        if (tag == "S") {
+            auto* value = type(parent);
+            if (!apply) {
+                return nullptr;
+            }
+            auto* set  = parent->new_object<SetType>();
+            set->value = value;
+            return set;
+        }
+        if (tag == "T") {
+            int64      n     = integer();
+            TupleType* tuple = apply ? parent->new_object<TupleType>() : nullptr;
+            for (int64 i = 0; i < n && ok; i++) {
+                auto* elt = type(parent);
+                if (tuple) {
+                    tuple->types.push_back(elt);
+                }
+            }
+            return tuple;
+        }
+        if (tag == "B") {
+            String name = string();
+            if (!apply) {
+                return nullptr;
+            }
+            BindingEntry* entry = sema->bindings.find(StringRef(name));
+            if (entry == nullptr || entry->value == nullptr ||
+                entry->value->family() != NodeFamily::Expression) {
+                ok = false;
+                return nullptr;
+            }
+            return static_cast<ExprNode*>(entry->value);
+        }
+
+        Node* node = ref(tag);
+        if (node != nullptr && node->family() != NodeFamily::Expression) {
+            ok = false;
+            return nullptr;
+        }
+        return static_cast<ExprNode*>(node);
+    }
+
+    template <typename Operator>
+    BinaryFunction native_operator(BinaryFunction (*getter)(Operator, NativeType, NativeType)) {
+        int64 op  = integer();
+        int64 lhs = integer();
+        int64 rhs = integer();
+        if (op < 0 || !apply) {
+            return nullptr;
+        }
+
+        BinaryFunction fun = getter(Operator(op), NativeType(lhs), NativeType(rhs));
+        ok           = ok && fun != nullptr;
+        return fun;
+    }
+
+    UnaryFunction native_operator(UnaryFunction (*getter)(UnaryOperator, NativeType)) {
+        int64 op      = integer();
+        int64 operand = integer();
+        integer();
+        if (op < 0 || !apply) {
+            return nullptr;
+        }
+
+        UnaryFunction fun = getter(UnaryOperator(op), NativeType(operand));
+        ok           = ok && fun != nullptr;
+        return fun;
+    }
+
+    std::istream&       in;
+    ImportLib*          importsys;
+    Array<Node*> const& nodes;
+    SemanticAnalyser*   sema;
+    bool                apply;
+    bool                ok = true;
+
+    // Nodes created while restoring the annotations, null when validating
+    Array<Node*> synthesized;
+
+    // Number of attributes of the classes of this entry
+    Dict<ClassDef*, int64> attribute_counts;
+
+    // Attributes are resolved once every class of the entry has its final layout
+    Array<Tuple<Attribute*, ClassDef*, int>> attributes;
+};
+
+int builtin_bindings_count() {
+    static int count = int(Bindings().bindings.size());
+    return count;
+}
+
+// Nodes SEMA annotates
+bool is_annotated(NodeKind kind) {
+    switch (kind) {
+    case NodeKind::Module:
+    case NodeKind::Name:
+    case NodeKind::FunctionDef:
+    case NodeKind::ClassDef:
+    case NodeKind::BinOp:
+    case NodeKind::BoolOp:
+    case NodeKind::UnaryOp:
+    case NodeKind::AugAssign:
+    case NodeKind::Compare:
+    case NodeKind::Attribute:
+    case NodeKind::Call:
+    case NodeKind::AnnAssign:
+    case NodeKind::For: return true;
+    default: return false;
+    }
+}
+
+void write_node(CacheWriter& w, Node* node, Array<Node*> const& nodes) {
+    switch (node->kind) {
+    case NodeKind::Module: {
+        // SEMA creates the module entry point
+        // its body is made of the module statements
+        FunctionDef* init = cast<Module>(node)->__init__;
+        w.integer(init != nullptr);
+
+        if (init != nullptr) {
+            w.integer(init->body.size());
+            for (StmtNode* stmt: init->body) {
+                w.ref(stmt);
+            }
+            w.type(init->type);
+        }
+        return;
+    }
+    case NodeKind::Name: {
+        auto* n = cast<Name>(node);
+        w.integer(int(n->ctx));
+        w.integer(n->store_id);
+        w.integer(n->load_id);
+        w.type(n->type);
+        return;
+    }
+    case NodeKind::FunctionDef: {
+        auto* n = cast<FunctionDef>(node);
+        w.integer(n->generator);
+        w.integer(n->pure);
+        w.type(n->type);
+        return;
+    }
+    case NodeKind::ClassDef: {
+        auto* n = cast<ClassDef>(node);
+        w.string(n->cls_namespace);
+        w.type(n->ctor_t);
+        w.integer(n->attributes.size());
+        for (ClassDef::Attr const& attr: n->attributes) {
+            w.string(attr.name);
+            w.integer(attr.offset);
+            w.ref(attr.stmt);
+            w.type(attr.type);
+        }
+        return;
+    }
+    case NodeKind::BinOp: {
+        auto* n = cast<BinOp>(node);
+        w.native(n->native_operator);
+        w.ref(n->resolved_operator);
+        return;
+    }
+    case NodeKind::BoolOp: {
+        auto* n = cast<BoolOp>(node);
+        w.native(n->native_operator);
+        w.ref(n->resolved_operator);
+        return;
+    }
+    case NodeKind::UnaryOp: {
+        auto* n = cast<UnaryOp>(node);
+        w.native(n->native_operator);
+        w.ref(n->resolved_operator);
+        return;
+    }
+    case NodeKind::AugAssign: {
+        auto* n = cast<AugAssign>(node);
+        w.native(n->native_operator);
+        w.ref(n->resolved_operator);
+        return;
+    }
+    case NodeKind::Compare: {
+        auto* n = cast<Compare>(node);
+        w.integer(n->native_operator.size());
+        for (BinaryFunction fun: n->native_operator) {
+            w.native(fun);
+        }
+        w.integer(n->resolved_operator.size());
+        for (StmtNode* op: n->resolved_operator) {
+            w.ref(op);
+        }
+        return;
+    }
+    case NodeKind::Attribute: {
+        auto* n = cast<Attribute>(node);
+        w.integer(int(n->ctx));
+        w.integer(n->attrid);
+
+        ClassDef const* owner = nullptr;
+        int             index = -1;
+        if (n->resolved != nullptr) {
+            std::tie(owner, index) = w.find_attribute(n->resolved, nodes);
+        }
+        w.ref(owner);
+        w.integer(index);
+        return;
+    }
+    case NodeKind::Call: {
+        auto* n = cast<Call>(node);
+        w.integer(n->args.size());
+        for (ExprNode* arg: n->args) {
+            w.ref(arg);
+        }
+        w.integer(n->varargs.size());
+        for (ExprNode* arg: n->varargs) {
+            w.ref(arg);
+        }
+        w.integer(n->keywords.size());
+        for (Keyword const& kw: n->keywords) {
+            w.string(kw.arg);
+            w.ref(kw.value);
+        }
+        w.integer(n->native_typed);
+        w.integer(n->tail_call);
+        return;
+    }
+    case NodeKind::AnnAssign: {
+        w.type(cast<AnnAssign>(node)->annotation);
+        return;
+    }
+    case NodeKind::For: {
+        auto* n = cast<For>(node);
+        w.integer(n->counted);
+
+        if (n->counted) {
+            w.integer(native_integer_value(n->start));
+            w.integer(native_integer_value(n->step));
+            w.native(n->native_compare);
+            w.native(n->native_step);
+        }
+        return;
+    }
+    default: return;
+    }
+}
+
+void read_node(CacheReader& r, Node* node) {
+    bool apply = r.apply;
+
+    switch (node->kind) {
+    case NodeKind::Module: {
+        auto* mod = cast<Module>(node);
+        if (r.integer() == 0) {
+            return;
+        }
+
+        FunctionDef* init = nullptr;
+        if (apply) {
+            init       = mod->new_object<FunctionDef>();
+            init->name = "__init__";
+        }
+        r.synthesized.push_back(init);
+
+        int64 count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            auto* stmt = r.ref_as<StmtNode>();
+            if (init) {
+                init->body.push_back(stmt);
+            }
+        }
+
+        auto* type = r.type(mod);
+        if (init) {
+            init->type    = cast<Arrow>(type);
+            mod->__init__ = init;
+        }
+        return;
+    }
+    case NodeKind::Name: {
+        auto* n        = cast<Name>(node);
+        auto  ctx      = ExprContext(r.integer());
+        auto  store_id = int(r.integer());
+        auto  load_id  = int(r.integer());
+        auto* type     = r.type(n);
+        if (apply) {
+            n->ctx      = ctx;
+            n->store_id = store_id;
+            n->load_id  = load_id;
+            n->type     = type;
+        }
+        return;
+    }
+    case NodeKind::FunctionDef: {
+        auto* n         = cast<FunctionDef>(node);
+        bool  generator = r.integer() != 0;
+        bool  pure      = r.integer() != 0;
+        auto* type      = r.type(n);
+        if (apply) {
+            n->generator = generator;
+            n->pure      = pure;
+            n->type      = cast<Arrow>(type);
+        }
+        return;
+    }
+    case NodeKind::ClassDef: {
+        auto*  n             = cast<ClassDef>(node);
+        String cls_namespace = r.string();
+        auto*  ctor_t        = r.type(n);
+        int64  count         = r.integer();
+
+        Array<ClassDef::Attr> attributes;
+        for (int64 i = 0; i < count && r.ok; i++) {
+            String name   = r.string();
+            int    offset = int(r.integer());
+            auto*  stmt   = r.ref_as<StmtNode>();
+            auto*  type   = r.type(n);
+            attributes.emplace_back(StringRef(name), offset, stmt, type);
+        }
+        r.attribute_counts[n] = count;
+        if (apply) {
+            n->cls_namespace = cls_namespace;
+            n->ctor_t        = cast<Arrow>(ctor_t);
+            n->attributes    = attributes;
+            n->compute_layout();
+        }
+        return;
+    }
+    case NodeKind::BinOp: {
+        auto* n        = cast<BinOp>(node);
+        auto  native   = r.native_operator(get_native_binary_operation);
+        auto* resolved = r.ref_as<StmtNode>();
+        if (apply) {
+            n->native_operator   = native;
+            n->resolved_operator = resolved;
+        }
+        return;
+    }
+    case NodeKind::BoolOp: {
+        auto* n        = cast<BoolOp>(node);
+        auto  native   = r.native_operator(get_native_bool_operation);
+        auto* resolved = r.ref_as<StmtNode>();
+        if (apply) {
+            n->native_operator   = native;
+            n->resolved_operator = resolved;
+        }
+        return;
+    }
+    case NodeKind::UnaryOp: {
+        auto* n        = cast<UnaryOp>(node);
+        auto  native   = r.native_operator(get_native_unary_operation);
+        auto* resolved = r.ref_as<StmtNode>();
+        if (apply) {
+            n->native_operator   = native;
+            n->resolved_operator = resolved;
+        }
+        return;
+    }
+    case NodeKind::AugAssign: {
+        auto* n        = cast<AugAssign>(node);
+        auto  native   = r.native_operator(get_native_binary_operation);
+        auto* resolved = r.ref_as<StmtNode>();
+        if (apply) {
+            n->native_operator   = native;
+            n->resolved_operator = resolved;
+        }
+        return;
+    }
+    case NodeKind::Compare: {
+        auto* n = cast<Compare>(node);
+
+        Array<BinaryFunction> natives;
+        int64           count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            natives.push_back(r.native_operator(get_native_cmp_operation));
+        }
+
+        Array<StmtNode*> resolved;
+        count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            resolved.push_back(r.ref_as<StmtNode>());
+        }
+        if (apply) {
+            n->native_operator   = natives;
+            n->resolved_operator = resolved;
+        }
+        return;
+    }
+    case NodeKind::Attribute: {
+        auto* n      = cast<Attribute>(node);
+        auto  ctx    = ExprContext(r.integer());
+        int   attrid = int(r.integer());
+        auto* owner  = r.ref_as<ClassDef>();
+        int   index  = int(r.integer());
+        if (owner != nullptr) {
+            r.attributes.emplace_back(n, owner, index);
+        }
+        if (apply) {
+            n->ctx    = ctx;
+            n->attrid = attrid;
+        }
+        return;
+    }
+    case NodeKind::Call: {
+        auto* n = cast<Call>(node);
+
+        Array<ExprNode*> args;
+        int64            count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            args.push_back(r.ref_as<ExprNode>());
+        }
+
+        Array<ExprNode*> varargs;
+        count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            varargs.push_back(r.ref_as<ExprNode>());
+        }
+
+        Array<Keyword> keywords;
+        count = r.integer();
+        for (int64 i = 0; i < count && r.ok; i++) {
+            Keyword kw;
+            kw.arg   = StringRef(r.string());
+            kw.value = r.ref_as<ExprNode>();
+            keywords.push_back(kw);
+        }
+        bool native_typed = r.integer() != 0;
+        bool tail_call    = r.integer() != 0;
+        if (apply) {
+            n->args         = args;
+            n->varargs      = varargs;
+            n->keywords     = keywords;
+            n->native_typed = native_typed;
+            n->tail_call    = tail_call;
+        }
+        return;
+    }
+    case NodeKind::AnnAssign: {
+        auto* n    = cast<AnnAssign>(node);
+        auto* type = r.type(n);
+        if (apply) {
+            n->annotation = type;
+        }
+        return;
+    }
+    case NodeKind::For: {
+        auto* n = cast<For>(node);
+        if (r.integer() == 0) {
+            return;
+        }
+
+        int64 start     = r.integer();
+        int64 step      = r.integer();
+        auto  compare   = r.native_operator(get_native_cmp_operation);
+        auto  increment = r.native_operator(get_native_binary_operation);
+        if (apply && r.ok) {
+            // the bounds have the type of the operands of the increment
+            NativeType type   = get_native_operation(increment).lhs;
+            n->counted        = true;
+            n->start          = native_integer(type, start);
+            n->step           = native_integer(type, step);
+            n->native_compare = compare;
+            n->native_step    = increment;
+        }
+        return;
+    }
+    default: r.ok = false;
+    }
+}
+
+// Everything after the dependencies check
+bool read_entry(CacheReader& r, Module* mod) {
+    if (r.token() != "nodes" || r.integer() != int64(r.nodes.size())) {
+        return false;
+    }
+
+    if (r.token() != "records") {
+        return false;
+    }
+
+    int64 records = r.integer();
+    for (int64 i = 0; i < records && r.ok; i++) {
+        int64 index = r.integer();
+        int64 kind  = r.integer();
+
+        if (!r.ok || index < 0 || index >= int64(r.nodes.size())) {
+            return false;
+        }
+
+        Node* node = r.nodes[index];
+        if (int64(node->kind) != kind) {
+            return false;
+        }
+        read_node(r, node);
+    }
+
+    // Classes of imported modules are already analysed, ours might be restored
+    // after the attributes referencing them
+    for (auto const& item: r.attributes) {
+        ClassDef* owner = std::get<1>(item);
+        int       index = std::get<2>(item);
+        int64     count = int64(owner->attributes.size());
+
+        auto found = r.attribute_counts.find(owner);
+        if (found != r.attribute_counts.end()) {
+            count = found->second;
+        }
+
+        if (index < 0 || index >= count) {
+            return false;
+        }
+
+        if (r.apply) {
+            std::get<0>(item)->resolved = &owner->attributes[index];
+        }
+    }
+
+    if (!r.ok || r.token() != "bindings") {
+        return false;
+    }
+
+    Bindings& bindings = r.sema->bindings;
+    int64     count    = r.integer();
+    for (int64 i = 0; i < count && r.ok; i++) {
+        String name     = r.string();
+        Node*  value    = r.ref();
+        auto*  type     = r.type(mod);
+        int    type_id  = int(r.integer());
+        int    store_id = int(r.integer());
+        int    load_id  = int(r.integer());
+
+        if (r.apply) {
+            bindings.add(StringRef(name), value, type, type_id);
+
+            BindingEntry& entry = bindings.bindings.back();
+            entry.store_id      = store_id;
+            entry.load_id       = load_id;
+        }
+    }
+
+    return r.ok;
+}
+
+}  // namespace
+
+bool ModuleCache::save(ImportLib*                          importsys,
+                       String const&                       name,
+                       uint64                              key,
+                       Array<Tuple<String, uint64>> const& deps,
+                       Array<Node*> const&                 nodes,
+                       SemanticAnalyser const*             sema) {
+    CacheWriter w(importsys, nodes);
+
+    w.out << "lython-cache " << cache_version << " ";
+    w.string(String(_HASH));
+    w.out << "\nkey " << key << "\ndeps " << deps.size() << "\n";
+    for (auto const& dep: deps) {
+        w.string(std::get<0>(dep));
+        w.out << std::get<1>(dep) << "\n";
+    }
+
+    // Annotations
+    int count = int(std::count_if(
+        nodes.begin(), nodes.end(), [](Node* node) { return is_annotated(node->kind); }));
+
+    w.out << "nodes " << nodes.size() << "\nrecords " << count << "\n";
+
+    int i = 0;
+    for (Node* node: nodes) {
+        if (is_annotated(node->kind)) {
+            w.out << i << " " << int(node->kind) << " ";
+            write_node(w, node, nodes);
+            w.out << "\n";
+        }
+        i += 1;
+    }
+
+    // Exported bindings
+    auto const& entries = sema->bindings.bindings;
+    int         start   = builtin_bindings_count();
+
+    w.out << "bindings " << std::max(int(entries.size()) - start, 0) << "\n";
+    for (int j = start; j < entries.size(); j++) {
+        BindingEntry const& entry = entries[j];
+        w.string(entry.name);
+        w.ref(entry.value);
+        w.type(entry.type);
+        w.integer(entry.type_id);
+        w.integer(entry.store_id);
+        w.integer(entry.load_id);
+        w.out << "\n";
+    }
+
+    if (!w.ok) {
+        kwdebug(outlog(), "Module {} cannot be cached", name);
+        return false;
+    }
+
+    std::error_code err;
+    std::filesystem::create_directories(cache_dir.c_str(), err);
+
+    // Write to a temporary file first so concurrent
+    // readers never see a partial entry
+    String        path = entry_path(name);
+    String        tmp  = path + ".tmp";
+    std::ofstream file(tmp.c_str(), std::ios::binary);
+    file << w.out.str();
+    file.close();
+
+    if (!file) {
+        kwwarn(outlog(), "Could not write module cache {}", path);
+        return false;
+    }
+
+    std::filesystem::rename(tmp.c_str(), path.c_str(), err);
+    return !err;
+}
+
+bool ModuleCache::load(ImportLib*          importsys,
+                       String const&       name,
+                       String const&       source,
+                       Array<Node*> const& nodes,
+                       SemanticAnalyser*   sema,
+                       uint64&             key) {
+    std::ifstream file(entry_path(name).c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    CacheReader header(file, importsys, nodes, sema, false);
+    if (header.token() != "lython-cache" || header.integer() != cache_version ||
+        header.string() != _HASH) {
+        return false;
+    }
+
+    uint64 expected = 0;
+    if (header.token() != "key" || !(file >> expected) || header.token() != "deps") {
+        return false;
+    }
+
+    int64 count = header.integer();
+    if (!header.ok || count < 0) {
+        return false;
+    }
+
+    // Make sure our dependencies did not change
+    Array<Tuple<String, uint64>> deps;
+    for (int64 i = 0; i < count; i++) {
+        String dep     = header.string();
+        uint64 dep_key = 0;
+        if (!header.ok || !(file >> dep_key)) {
+            return false;
+        }
+
+        auto* imported = importsys->importfile(StringRef(dep));
+        if (imported == nullptr || imported->key != dep_key) {
+            kwdebug(outlog(), "Cache for {} is stale, {} changed", name, dep);
+            return false;
+        }
+        deps.emplace_back(dep, dep_key);
+    }
+
+    if (module_key(source, deps) != expected) {
+        kwdebug(outlog(), "Cache for {} is stale", name);
+        return false;
+    }
+
+    // Validate the whole entry before touching the module
+    Module*       mod  = cast<Module>(nodes[0]);
+    std::ios::pos_type body = file.tellg();
+
+    CacheReader check(file, importsys, nodes, sema, false);
+    if (!read_entry(check, mod)) {
+        kwwarn(outlog(), "Module cache for {} is corrupted", name);
+        return false;
+    }
+
+    file.clear();
+    file.seekg(body);
+
+    CacheReader restore(file, importsys, nodes, sema, true);
+    if (!read_entry(restore, mod)) {
+        return false;
+    }
+
+    key = expected;
+    return true;
+}
+
+}  // namespace lython
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ast/nodes.h"
+#include "dtypes.h"
+
+namespace lython {
+
+struct SemanticAnalyser;
+class ImportLib;
+
+// Pre-order list of the nodes owned by a module
+// The parser is deterministic so parsing the same source twice
+// yields the same list, we use the index inside that list
+// to refer to nodes across processes
+Array<Node*> module_nodes(Module* mod);
+
+// On disk cache of analysed modules
+//
+// SEMA annotates the AST in place (types, operators, variable ids, ...),
+// the cache records those annotations alongside the exported bindings
+// so a module can be reloaded from its source with a parse and a replay
+// instead of a full semantic analysis.
+//
+// The entries are keyed by the hash of the module source,
+// the keys of all its imports (which makes it transitive) and the compiler revision.
+//
+//  <cache_dir>/<module.path>.lyc
+//
+// The cache is opt-in, it is disabled until a directory is set
+// through LYTHON_CACHE or `set_cache_dir`
+//
+class ModuleCache {
+    public:
+    ModuleCache();
+
+    bool enabled() const { return !cache_dir.empty(); }
+
+    void set_cache_dir(String const& dir) { cache_dir = dir; }
+
+    String const& get_cache_dir() const { return cache_dir; }
+
+    // Names and keys of the modules imported by a module
+    static Array<Tuple<String, uint64>> module_dependencies(ImportLib*          importsys,
+                                                            Array<Node*> const& nodes);
+
+    // Key of a module given its source and the keys of its imports
+    static uint64 module_key(String const& source, Array<Tuple<String, uint64>> const& deps);
+
+    // Save the annotations of an analysed module
+    // returns false if the module could not be represented in the cache
+    bool save(ImportLib*                           importsys,
+              String const&                        name,
+              uint64                               key,
+              Array<Tuple<String, uint64>> const&  deps,
+              Array<Node*> const&                  nodes,
+              SemanticAnalyser const*              sema);
+
+    // Restore the annotations of a freshly parsed module
+    // returns false if the entry is missing or stale, the module is left untouched
+    bool load(ImportLib*          importsys,
+              String const&       name,
+              String const&       source,
+              Array<Node*> const& nodes,
+              SemanticAnalyser*   sema,
+              uint64&             key);
+
+    private:
+    String entry_path(String const& name) const;
+
+    String cache_dir;
+};
+
+}  // namespace lython
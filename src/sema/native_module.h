@@ -121,6 +121,14 @@ struct FunctionTypeBuilder<R(Args...)> {
         arrow->returns = lookup_type<return_t>();
         return arrow;
     }
+
+    // Trampoline specialized on the C++ signature,
+    // the arguments match the types returned by `function()`
+    // so once SEMA checked the call they can be read without marshalling
+    template<function_t* native>
+    static Value trampoline(void* mem, Value const* args) {
+        return Interop<function_t>::template direct_wrapper<native>(mem, args);
+    }
 };
 
 
@@ -131,6 +139,31 @@ Arrow* function_type_builder(Module* mod, R(*function)(Args...)) {
     return builder.function();
 }
 
+// Make a FunctionDef calling a native function
+// with both the generic and the direct calling convention.
+// `pure` natives neither do I/O nor touch global state, script functions calling them can be memoized
+template<auto native>
+FunctionDef* native_function(Module* mod, String const& name, bool pure = false) {
+    using Builder = FunctionTypeBuilder<std::remove_pointer_t<decltype(native)>>;
+
+    FunctionDef* def   = mod->new_object<FunctionDef>();
+    def->name          = StringRef(name);
+    def->type          = function_type_builder(mod, native);
+    def->native        = Function(Interop<decltype(native)>::template wrapper<native>);
+
+    // Positional arguments so calls are checked and reordered like script calls
+    for (int i = 0; i < def->type->arg_count(); i++) {
+        Arg arg;
+        arg.arg        = StringRef(String(fmt::format("_{}", i).c_str()));
+        arg.annotation = def->type->args[i];
+        def->args.args.push_back(arg);
+    }
+
+    def->native_direct = Builder::template trampoline<native>;
+    def->pure          = pure;
+    return def;
+}
+
 // MetaData: type -> id
 // Bendings: type -> id -> BuiltinType
 // 
@@ -0,0 +1,373 @@
+#include "sema/purity.h"
+
+namespace lython {
+
+namespace {
+// Names assigned in the body, they are local to the function
+void local_names(ExprNode* target, Set<StringRef>& names) {
+    if (Name* name = cast<Name>(target)) {
+        names.insert(name->id);
+        return;
+    }
+    if (TupleExpr* tuple = cast<TupleExpr>(target)) {
+        for (ExprNode* elt: tuple->elts) {
+            local_names(elt, names);
+        }
+    }
+}
+
+void local_names(Array<StmtNode*> const& body, Set<StringRef>& names) {
+    for (StmtNode* stmt: body) {
+        switch (stmt->kind) {
+        case NodeKind::Assign: {
+            for (ExprNode* target: cast<Assign>(stmt)->targets) {
+                local_names(target, names);
+            }
+            break;
+        }
+        case NodeKind::AnnAssign: local_names(cast<AnnAssign>(stmt)->target, names); break;
+        case NodeKind::AugAssign: local_names(cast<AugAssign>(stmt)->target, names); break;
+        case NodeKind::If: {
+            If* n = cast<If>(stmt);
+            local_names(n->body, names);
+            for (Array<StmtNode*> const& branch: n->bodies) {
+                local_names(branch, names);
+            }
+            local_names(n->orelse, names);
+            break;
+        }
+        case NodeKind::While: {
+            While* n = cast<While>(stmt);
+            local_names(n->body, names);
+            local_names(n->orelse, names);
+            break;
+        }
+        case NodeKind::For: {
+            For* n = cast<For>(stmt);
+            local_names(n->target, names);
+            local_names(n->body, names);
+            local_names(n->orelse, names);
+            break;
+        }
+        case NodeKind::Try: {
+            Try* n = cast<Try>(stmt);
+            local_names(n->body, names);
+            for (ExceptHandler const& handler: n->handlers) {
+                if (handler.name.has_value()) {
+                    names.insert(handler.name.value());
+                }
+                local_names(handler.body, names);
+            }
+            local_names(n->orelse, names);
+            local_names(n->finalbody, names);
+            break;
+        }
+        case NodeKind::Inline: local_names(cast<Inline>(stmt)->body, names); break;
+        default: break;
+        }
+    }
+}
+
+bool is_zero(Value const& value) {
+#define ZERO(T, _)                           \
+    if (value.tag() == meta::type_id<T>()) { \
+        return value.as<T>() == T(0);        \
+    }
+    ZERO(uint64, u64)
+    ZERO(int64, i64)
+    ZERO(uint32, u32)
+    ZERO(int32, i32)
+    ZERO(uint16, u16)
+    ZERO(int16, i16)
+    ZERO(uint8, u8)
+    ZERO(int8, i8)
+    ZERO(float32, f32)
+    ZERO(float64, f64)
+#undef ZERO
+    return false;
+}
+
+bool divides(BinaryOperator op) {
+    return op == BinaryOperator::Div || op == BinaryOperator::FloorDiv ||
+           op == BinaryOperator::Mod;
+}
+}  // namespace
+
+bool safe_division(BinaryOperator op, ExprNode* divisor) {
+    if (!divides(op)) {
+        return true;
+    }
+    Constant* value = cast<Constant>(divisor);
+    return value != nullptr && !is_zero(value->value);
+}
+
+bool PurityCheck::function(FunctionDef* fun) {
+    // Generators and coroutines resume, decorators can replace the function
+    if (fun->native != nullptr || fun->generator || fun->async || !fun->decorator_list.empty()) {
+        return false;
+    }
+
+    Arguments const& args = fun->args;
+
+    // Calls evaluated at compile time bind their arguments by position
+    if (strict && (!args.posonlyargs.empty() || !args.kwonlyargs.empty() ||
+                   !args.defaults.empty() || args.vararg.has_value() || args.kwarg.has_value())) {
+        return false;
+    }
+
+    locals.clear();
+    for (Arg const& arg: args.posonlyargs) {
+        locals.insert(arg.arg);
+    }
+    for (Arg const& arg: args.args) {
+        locals.insert(arg.arg);
+    }
+    for (Arg const& arg: args.kwonlyargs) {
+        locals.insert(arg.arg);
+    }
+    if (args.vararg.has_value()) {
+        locals.insert(args.vararg.value().arg);
+    }
+    if (args.kwarg.has_value()) {
+        locals.insert(args.kwarg.value().arg);
+    }
+    local_names(fun->body, locals);
+
+    return body(fun->body);
+}
+
+bool PurityCheck::store(ExprNode* target) const {
+    if (cast<Name>(target) != nullptr) {
+        return true;
+    }
+    if (TupleExpr* tuple = cast<TupleExpr>(target); tuple != nullptr && !strict) {
+        for (ExprNode* elt: tuple->elts) {
+            if (!store(elt)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool PurityCheck::body(Array<StmtNode*> const& stmts) {
+    auto opt = [&](Optional<ExprNode*> const& n) { return !n.has_value() || expr(n.value()); };
+
+    for (StmtNode* stmt: stmts) {
+        switch (stmt->kind) {
+        case NodeKind::Assign: {
+            Assign* n = cast<Assign>(stmt);
+            for (ExprNode* target: n->targets) {
+                if (!store(target)) {
+                    return false;
+                }
+            }
+            if (!expr(n->value)) {
+                return false;
+            }
+            break;
+        }
+        case NodeKind::AnnAssign: {
+            AnnAssign* n = cast<AnnAssign>(stmt);
+            if (!store(n->target) || !opt(n->value)) {
+                return false;
+            }
+            break;
+        }
+        case NodeKind::AugAssign: {
+            AugAssign* n = cast<AugAssign>(stmt);
+            if (strict && (n->native_operator == nullptr || !safe_division(n->op, n->value))) {
+                return false;
+            }
+            if (!store(n->target) || !expr(n->value)) {
+                return false;
+            }
+            break;
+        }
+        case NodeKind::Return:
+            if (!opt(cast<Return>(stmt)->value)) {
+                return false;
+            }
+            break;
+        case NodeKind::Expr:
+            if (!expr(cast<Expr>(stmt)->value)) {
+                return false;
+            }
+            break;
+        case NodeKind::If: {
+            If* n = cast<If>(stmt);
+            if (!expr(n->test) || !body(n->body) || !body(n->orelse)) {
+                return false;
+            }
+            for (int i = 0; i < n->tests.size(); i++) {
+                if (!expr(n->tests[i]) || !body(n->bodies[i])) {
+                    return false;
+                }
+            }
+            break;
+        }
+        case NodeKind::While: {
+            While* n = cast<While>(stmt);
+            if (!expr(n->test) || !body(n->body) || !body(n->orelse)) {
+                return false;
+            }
+            break;
+        }
+        case NodeKind::For: {
+            For* n = cast<For>(stmt);
+
+            // `range` is not bound, counted loops only need their bounds checked
+            if (n->counted) {
+                if (strict && n->zero_step()) {
+                    return false;
+                }
+                for (ExprNode* arg: cast<Call>(n->iter)->args) {
+                    if (!expr(arg)) {
+                        return false;
+                    }
+                }
+            } else if (strict || !expr(n->iter)) {
+                return false;
+            }
+
+            if (!store(n->target) || !body(n->body) || !body(n->orelse)) {
+                return false;
+            }
+            break;
+        }
+        case NodeKind::Inline:
+            if (!body(cast<Inline>(stmt)->body)) {
+                return false;
+            }
+            break;
+        case NodeKind::Pass:
+        case NodeKind::Break:
+        case NodeKind::Continue: break;
+
+        case NodeKind::Assert:
+            if (strict || !expr(cast<Assert>(stmt)->test)) {
+                return false;
+            }
+            break;
+        case NodeKind::Raise: {
+            // The exception is raised again on the next call, only its arguments are checked
+            Raise* n = cast<Raise>(stmt);
+            if (strict) {
+                return false;
+            }
+            if (n->exc.has_value()) {
+                Call* call = cast<Call>(n->exc.value());
+                if (call == nullptr || cast<Name>(call->func) == nullptr) {
+                    return false;
+                }
+                for (ExprNode* arg: call->args) {
+                    if (!expr(arg)) {
+                        return false;
+                    }
+                }
+            }
+            break;
+        }
+        case NodeKind::Try: {
+            Try* n = cast<Try>(stmt);
+            if (strict || !body(n->body) || !body(n->orelse) || !body(n->finalbody)) {
+                return false;
+            }
+            for (ExceptHandler const& handler: n->handlers) {
+                if (!body(handler.body)) {
+                    return false;
+                }
+            }
+            break;
+        }
+
+        // global, nonlocal, del, with, imports and nested definitions
+        default: return false;
+        }
+    }
+    return true;
+}
+
+bool PurityCheck::expr(ExprNode* n) {
+    auto all = [&](Array<ExprNode*> const& exprs) {
+        for (ExprNode* item: exprs) {
+            if (!expr(item)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    switch (n->kind) {
+    case NodeKind::Constant: return true;
+    case NodeKind::Name: {
+        Name* name = cast<Name>(n);
+        return locals.count(name->id) > 0 || global(name);
+    }
+    case NodeKind::BinOp: {
+        BinOp* op = cast<BinOp>(n);
+        if (strict && (op->native_operator == nullptr || !safe_division(op->op, op->right))) {
+            return false;
+        }
+        return expr(op->left) && expr(op->right);
+    }
+    case NodeKind::UnaryOp: {
+        UnaryOp* op = cast<UnaryOp>(n);
+        return (!strict || op->native_operator != nullptr) && expr(op->operand);
+    }
+    case NodeKind::BoolOp: {
+        BoolOp* op = cast<BoolOp>(n);
+        return (!strict || op->native_operator != nullptr) && all(op->values);
+    }
+    case NodeKind::Compare: {
+        Compare* cmp = cast<Compare>(n);
+        if (strict) {
+            if (cmp->native_operator.size() != cmp->comparators.size()) {
+                return false;
+            }
+            for (BinaryFunction native: cmp->native_operator) {
+                if (native == nullptr) {
+                    return false;
+                }
+            }
+        }
+        return expr(cmp->left) && all(cmp->comparators);
+    }
+    case NodeKind::IfExp: {
+        IfExp* ifexp = cast<IfExp>(n);
+        return expr(ifexp->test) && expr(ifexp->body) && expr(ifexp->orelse);
+    }
+    case NodeKind::Attribute: return !strict && expr(cast<Attribute>(n)->value);
+    case NodeKind::Subscript: {
+        Subscript* sub = cast<Subscript>(n);
+        return !strict && expr(sub->value) && expr(sub->slice);
+    }
+    case NodeKind::TupleExpr: return !strict && all(cast<TupleExpr>(n)->elts);
+    case NodeKind::ListExpr: return !strict && all(cast<ListExpr>(n)->elts);
+    case NodeKind::Call: {
+        Call* call = cast<Call>(n);
+        Name* func = cast<Name>(call->func);
+
+        // Methods can mutate their object, a local holding a function is not known
+        if (func == nullptr || locals.count(func->id) > 0) {
+            return false;
+        }
+        if (strict && (!call->varargs.empty() || !call->keywords.empty())) {
+            return false;
+        }
+        if (!all(call->args) || !all(call->varargs)) {
+            return false;
+        }
+        for (Keyword const& keyword: call->keywords) {
+            if (!expr(keyword.value)) {
+                return false;
+            }
+        }
+        return this->call(call, func);
+    }
+    default: return false;
+    }
+}
+
+}  // namespace lython
@@ -0,0 +1,47 @@
+#ifndef LYTHON_SEMA_PURITY_HEADER
+#define LYTHON_SEMA_PURITY_HEADER
+
+#include "ast/nodes.h"
+
+namespace lython {
+
+/* Checks that a function computes its result from its inputs only.
+ *
+ * SEMA uses it to find the functions whose calls can be memoized (see FunctionDef::pure),
+ * the partial evaluator to find the functions it can run at compile time.
+ * Both walk the same statements, they differ by the names and the functions the body
+ * can reach, which the subclasses decide.
+ *
+ * A `strict` check is for code run at compile time: native operators that cannot trap,
+ * counted loops, no exceptions, no attributes, subscripts or containers.
+ */
+struct PurityCheck {
+    // Arguments and names bound by the body, set by `function`
+    Set<StringRef> locals;
+
+    bool strict = false;
+
+    virtual ~PurityCheck() {}
+
+    // Name read by the body that is not one of its locals
+    virtual bool global(Name* name) = 0;
+
+    // Call by name of something that is not a local, its arguments were checked
+    virtual bool call(Call* call, Name* func) = 0;
+
+    // Rejects the functions that can be replaced or resumed and checks the body
+    bool function(FunctionDef* fun);
+
+    bool body(Array<StmtNode*> const& stmts);
+    bool expr(ExprNode* expr);
+
+    private:
+    bool store(ExprNode* target) const;
+};
+
+// Integer division by zero traps, only a known non zero divisor is safe to evaluate
+bool safe_division(BinaryOperator op, ExprNode* divisor);
+
+}  // namespace lython
+
+#endif
@@ -1,4 +1,5 @@
 #include "sema/sema.h"
+#include "sema/purity.h"
 #include "builtin/operators.h"
 #include "dependencies/fmt.h"
 #include "parser/format_spec.h"
@@ -123,8 +124,7 @@ TypeExpr* SemanticAnalyser::boolop(BoolOp* n, int depth) {
         rhs   = n->values[i];
         rhs_t = exec(rhs, depth);
 
-        String signature = join("-", Array<String>{str(n->op), str(lhs_t), str(rhs_t)});
-        auto   handler   = get_native_bool_operation(signature);
+        auto handler = get_native_bool_operation(n->op, native_type(lhs_t), native_type(rhs_t));
 
         if (handler != nullptr) {
             n->native_operator = handler;
@@ -246,10 +246,8 @@ TypeExpr* SemanticAnalyser::compare(Compare* n, int depth) {
         auto* cmp_t = exec(cmp, depth);
 
         // Check if we have a native function to handle this
-        String signature = join(String("-"), Array<String>{str(op), str(prev_t), str(cmp_t)});
-
         // TODO: get return type
-        auto handler = get_native_cmp_operation(signature);
+        auto handler = get_native_cmp_operation(op, native_type(prev_t), native_type(cmp_t));
         n->native_operator.push_back(handler);
 
         if (!handler) {
@@ -281,10 +279,8 @@ TypeExpr* SemanticAnalyser::binop(BinOp* n, int depth) {
 
     // Builtin type, all the operations are known
     if (blt) {
-        String signature = join(String("-"), Array<String>{str(n->op), str(lhs_t), str(rhs_t)});
-
-        kwdebug(semalog, "signature: {}", signature);
-        n->native_operator = get_native_binary_operation(signature);
+        n->native_operator =
+            get_native_binary_operation(n->op, native_type(lhs_t), native_type(rhs_t));
 
         // FIXME: get return type
         return lhs_t;
@@ -303,9 +299,7 @@ TypeExpr* SemanticAnalyser::binop(BinOp* n, int depth) {
 TypeExpr* SemanticAnalyser::unaryop(UnaryOp* n, int depth) {
     auto* expr_t = exec(n->operand, depth);
 
-    String signature = join("-", Array<String>{str(n->op), str(expr_t)});
-
-    Function handler = get_native_unary_operation(signature);
+    UnaryFunction handler = get_native_unary_operation(n->op, native_type(expr_t));
     if (!handler) {
         SEMA_ERROR(n, UnsupportedOperand, str(n->op), expr_t, nullptr);
     }
@@ -763,12 +757,14 @@ TypeExpr* SemanticAnalyser::call(Call* n, int depth) {
     auto* type = exec(n->func, depth);
 
     // 
-    bool is_call_valid = false;
+    bool         is_call_valid = false;
+    FunctionDef* callee        = nullptr;
     if (Name* name = cast<Name>(n->func)) {
         BindingEntry const* entry = lookup(name);
         if (entry) {
             if (FunctionDef* def = cast<FunctionDef>(entry->value)){
                 is_call_valid = reorder_arguments(n, def);
+                callee        = def;
             }
         }
     }
@@ -839,7 +835,13 @@ TypeExpr* SemanticAnalyser::call(Call* n, int depth) {
         kwdebug(semalog, "fun type: {}, {}", str(got), n->args.size());
         kwdebug(semalog, "fun type: {}", str(arrow));
 
-        typecheck(n, got, n->func, arrow, LOC);
+        bool typed = typecheck(n, got, n->func, arrow, LOC);
+
+        // Every argument is positional and matches the native signature
+        // the evaluators can skip the argument checks
+        n->native_typed = typed && callee != nullptr && callee->native_direct != nullptr &&
+                          n->keywords.empty() && n->varargs.empty() &&
+                          int(n->args.size()) == arrow->arg_count();
     }
 
     if (arrow != nullptr) {
@@ -947,7 +949,7 @@ TypeExpr* SemanticAnalyser::formattedvalue(FormattedValue* n, int depth) {
 
 TypeExpr* SemanticAnalyser::placeholder(Placeholder* n, int depth) { return nullptr; }
 TypeExpr* SemanticAnalyser::constant(Constant* n, int depth) {
-    switch (meta::ValueTypes(n->value.tag)) {
+    switch (meta::ValueTypes(n->value.tag())) {
     case meta::ValueTypes::i8: return make_ref(n, "i8", Type_t());
     case meta::ValueTypes::i16: return make_ref(n, "i16", Type_t());
     case meta::ValueTypes::i32: return make_ref(n, "i32", Type_t());
@@ -967,7 +969,7 @@ TypeExpr* SemanticAnalyser::constant(Constant* n, int depth) {
     }
 
     static int strid = meta::type_id<String>();
-    if (n->value.tag == strid) {
+    if (n->value.tag() == strid) {
         return make_ref(n, "str", Type_t());
     }
 
@@ -1357,9 +1359,87 @@ TypeExpr* SemanticAnalyser::functiondef(FunctionDef* n, int depth) {
 
     n->type      = fun_type;
     n->generator = get_context().yield;
+
+    // A generator keeps its frame between resumes
+    if (!n->generator) {
+        mark_tail_calls(n->body);
+    }
+    n->pure = is_pure(n);
     return fun_type;
 }
 
+void SemanticAnalyser::mark_tail_calls(Array<StmtNode*>& body) {
+    for (StmtNode* stmt: body) {
+        switch (stmt->kind) {
+        case NodeKind::Return: {
+            Return* ret = cast<Return>(stmt);
+            Call*   call = ret->value.has_value() ? cast<Call>(ret->value.value()) : nullptr;
+
+            // Only direct calls, the callee is checked by the evaluators
+            if (call != nullptr && cast<Name>(call->func) != nullptr && call->keywords.empty() &&
+                call->varargs.empty()) {
+                call->tail_call = true;
+            }
+            break;
+        }
+        case NodeKind::If: {
+            If* n = cast<If>(stmt);
+            mark_tail_calls(n->body);
+            for (Array<StmtNode*>& branch: n->bodies) {
+                mark_tail_calls(branch);
+            }
+            mark_tail_calls(n->orelse);
+            break;
+        }
+        case NodeKind::While: {
+            While* n = cast<While>(stmt);
+            mark_tail_calls(n->body);
+            mark_tail_calls(n->orelse);
+            break;
+        }
+        case NodeKind::For: {
+            For* n = cast<For>(stmt);
+            mark_tail_calls(n->body);
+            mark_tail_calls(n->orelse);
+            break;
+        }
+        case NodeKind::Inline: mark_tail_calls(cast<Inline>(stmt)->body); break;
+        // try and with are not traversed, a call returned from their body is not in tail
+        // position: the handlers, the finally block or __exit__ still run after it
+        default: break;
+        }
+    }
+}
+
+namespace {
+// Functions and classes are the only module names a pure function reads,
+// module variables can be reassigned between two calls
+struct PureFunction: public PurityCheck {
+    PureFunction(Bindings& bindings, FunctionDef* fun): bindings(bindings), fun(fun) {}
+
+    bool global(Name* name) override {
+        Node* value = bindings.value(name->id);
+        return value != nullptr &&
+               (value->kind == NodeKind::FunctionDef || value->kind == NodeKind::ClassDef);
+    }
+
+    // Constructing an object returns a new object on every call,
+    // natives are only pure when registered as such, they can do I/O
+    bool call(Call* call, Name* func) override {
+        FunctionDef* callee = cast<FunctionDef>(bindings.value(func->id));
+        return callee != nullptr && (callee == fun || callee->pure);
+    }
+
+    Bindings&    bindings;
+    FunctionDef* fun;
+};
+}  // namespace
+
+bool SemanticAnalyser::is_pure(FunctionDef* n) {
+    PureFunction check(bindings, n);
+    return check.function(n);
+}
+
 void SemanticAnalyser::record_attributes(ClassDef*               n,
                                          Array<StmtNode*> const& body,
                                          Array<StmtNode*>&       methods,
@@ -1570,8 +1650,14 @@ TypeExpr* SemanticAnalyser::classdef(ClassDef* n, int depth) {
                 fun_t->set_arg_type(0, class_t);
             }
         }
+
+        // the method was recorded before its type was known
+        n->insert_method(fun->name, fun, fun_t);
     }
 
+    // Every attribute is known, fix the layout of the instances
+    n->compute_layout();
+
     // ----
 
     for (auto deco: n->decorator_list) {
@@ -1647,9 +1733,8 @@ TypeExpr* SemanticAnalyser::augassign(AugAssign* n, int depth) {
     auto* expected_type = exec_with_ctx(ExprContext::LoadStore, n->target, depth);
     auto* type          = exec(n->value, depth);
 
-    String signature = join("-", Array<String>{str(n->op), str(expected_type), str(type)});
-
-    auto handler       = get_native_binary_operation(signature);
+    auto handler =
+        get_native_binary_operation(n->op, native_type(expected_type), native_type(type));
     n->native_operator = handler;
 
     if (handler == nullptr) {
@@ -1714,7 +1799,79 @@ TypeExpr* SemanticAnalyser::annassign(AnnAssign* n, int depth) {
 
     return constraint;
 }
+
+bool SemanticAnalyser::counted_loop(For* n, int depth) {
+    Call* call = cast<Call>(n->iter);
+    Name* fun  = call != nullptr ? cast<Name>(call->func) : nullptr;
+
+    // A user defined range shadows the builtin
+    if (fun == nullptr || fun->id != StringRef("range") || bindings.find(fun->id) != nullptr) {
+        return false;
+    }
+    if (call->args.empty() || call->args.size() > 3 || !call->keywords.empty() ||
+        cast<Name>(n->target) == nullptr) {
+        return false;
+    }
+
+    // The direction of the loop is known from the step, a variable step is a generic loop
+    UnaryOp*  negate = call->args.size() == 3 ? cast<UnaryOp>(call->args[2]) : nullptr;
+    Constant* step   = nullptr;
+    if (call->args.size() == 3) {
+        step = cast<Constant>(negate != nullptr ? negate->operand : call->args[2]);
+
+        if (step == nullptr || (negate != nullptr && negate->op != UnaryOperator::USub)) {
+            return false;
+        }
+    }
+
+    TypeExpr* type = nullptr;
+    for (ExprNode* arg: call->args) {
+        TypeExpr* arg_t = exec(arg, depth);
+
+        if (type == nullptr) {
+            type = arg_t;
+        } else {
+            typecheck(arg, arg_t, call->args[0], type, LOC);
+        }
+    }
+
+    NativeType native = native_type(type);
+    Value      zero   = native_integer(native, 0);
+    if (zero.tag() == meta::type_id<_Invalid>()) {
+        SEMA_ERROR(n, UnsupportedOperand, String("range"), type, type);
+        return true;
+    }
+
+    // A step of 0 is kept, the evaluators raise ValueError like range
+    n->start = zero;
+    n->step  = native_integer(native, 1);
+
+    if (step != nullptr) {
+        n->step = step->value;
+        if (negate != nullptr) {
+            n->step = get_native_unary_operation(UnaryOperator::USub, native)(nullptr, n->step);
+        }
+    }
+
+    bool negative = get_native_cmp_operation(CmpOperator::Lt, native, native)(nullptr, n->step, zero)
+                        .as<bool>();
+
+    n->native_compare =
+        get_native_cmp_operation(negative ? CmpOperator::Gt : CmpOperator::Lt, native, native);
+    n->native_step = get_native_binary_operation(BinaryOperator::Add, native, native);
+    n->counted     = true;
+
+    add_name(n->target, nullptr, type);
+    return true;
+}
+
 TypeExpr* SemanticAnalyser::forstmt(For* n, int depth) {
+    if (counted_loop(n, depth)) {
+        auto return_t1 = exec<TypeExpr*>(n->body, depth);
+        exec<TypeExpr*>(n->orelse, depth);
+        return oneof(return_t1);
+    }
+
     // This assume a function call
     // type could be an object with a __iter__ + __next__
     auto* iter_return_t = exec(n->iter, depth);
@@ -1795,8 +1952,15 @@ TypeExpr* SemanticAnalyser::trystmt(Try* n, int depth) {
         if (handler.type.has_value()) {
             exception_type = handler.type.value();
 
-            TypeExpr* type = exec(exception_type, depth);
-            typecheck(exception_type, type, nullptr, make_ref(n, "Type"), LOC);
+            // except (ValueError, TypeError):
+            if (TupleExpr* types = cast<TupleExpr>(exception_type)) {
+                for (ExprNode* type: types->elts) {
+                    is_type(type, depth, LOC);
+                }
+                exception_type = nullptr;
+            } else {
+                is_type(exception_type, depth, LOC);
+            }
         }
 
         if (handler.name.has_value()) {
@@ -1807,7 +1971,7 @@ TypeExpr* SemanticAnalyser::trystmt(Try* n, int depth) {
     }
 
     return_t3 = exec<TypeExpr*>(n->orelse, depth);
-    return_t4 = exec<TypeExpr*>(n->orelse, depth);
+    return_t4 = exec<TypeExpr*>(n->finalbody, depth);
 
     // TODO:
     return oneof(return_t1);
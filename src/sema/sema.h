@@ -143,6 +143,18 @@ struct SemanticAnalyser: public BaseVisitor<SemanticAnalyser, false, SemaVisitor
 
     bool reorder_arguments(Call* call, FunctionDef* def);
 
+    // Recognize `for i in range(...)` over builtin integers, returns false for any other loop
+    bool counted_loop(For* n, int depth);
+
+    // Flag `return f(...)` so the evaluators run the callee in the frame of the caller.
+    // try and with blocks are skipped, their handlers need the frame to stay alive
+    void mark_tail_calls(Array<StmtNode*>& body);
+
+    // Effect analysis, a function is pure when it only reads its arguments and locals
+    // and only calls pure functions: no `global` or `nonlocal`, no store to an attribute
+    // or a subscript, no read of a module variable and no native that was not registered as pure
+    bool is_pure(FunctionDef* n);
+
     template <typename T, typename... Args>
     void sema_error(Node* node, lython::CodeLocation const& loc, Args... args) {
         errors.push_back(std::unique_ptr<SemaException>(new T(args...)));
@@ -113,7 +113,7 @@ void show_alloc_stats() {
     int total = 0;
 
     for (auto& item: db) {
-        meta::ClassMetadata& klass = item.second;
+        meta::ClassMetadata& klass = item;
 
         std::string name = klass.name;
         auto& stat = klass.stat;
@@ -48,9 +48,9 @@ int _register_type_once(int tid, const char* str) {
         return 0;
 
     auto& db = TypeRegistry::instance().id_to_meta;
-    auto result = db.find(tid);
+    ClassMetadata* result = db.find(tid);
 
-    if (result == db.end() || result->second.name == "") {
+    if (result == nullptr || result->name == "") {
         db[tid].name = str;
         db[tid].type_id = tid;
     }
@@ -357,7 +357,7 @@ void track_static() {
     // this will only work if `metadata_init_names` is called
     // after the static variables got initialized
     for (auto& s: meta::TypeRegistry::instance().id_to_meta) {
-        s.second.stat.startup_count = 0;
+        s.stat.startup_count = 0;
         // s.allocated - s.deallocated;
     }
 }
@@ -374,10 +374,6 @@ void register_globals() {
             default_precedence();
             keywords();
             keyword_as_string();
-            native_binary_operators();
-            native_bool_operators();
-            native_unary_operators();
-            native_cmp_operators();
             operator_magic_name(BinaryOperator::Add);
             operator_magic_name(BoolOperator::And);
             operator_magic_name(UnaryOperator::Invert);
@@ -489,11 +485,11 @@ void print(std::ostream& ss, int typeid_, std::int8_t const* data) {
 void TypeRegistry::dump(std::ostream& out) {
 
     for(auto& item: id_to_meta) {
-        if (item.second.members.size() > 0) 
+        if (item.members.size() > 0) 
         {
-            out << item.first << " " 
-                << item.second.name  << " "
-                << item.second.members.size()
+            out << item.type_id << " " 
+                << item.name  << " "
+                << item.members.size()
                 << "\n";
         }
     }
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <deque>
 #include <unordered_map>
 #include <ostream>
 
@@ -109,10 +110,37 @@ struct ClassMetadata {
     ValueRef     ref     = nullptr;
 };
 
+// Type ids are dense integers handed out by `_new_type`
+// so the metadata is indexed directly by id instead of hashed.
+// A deque is used so references to an entry stay valid
+// when a new type is registered.
+struct TypeTable {
+    ClassMetadata& operator[](int id) {
+        if (id >= int(entries.size())) {
+            entries.resize(id + 1);
+        }
+        return entries[id];
+    }
+
+    ClassMetadata* find(int id) {
+        if (id < 0 || id >= int(entries.size())) {
+            return nullptr;
+        }
+        return &entries[id];
+    }
+
+    int size() const { return int(entries.size()); }
+
+    std::deque<ClassMetadata>::iterator begin() { return entries.begin(); }
+    std::deque<ClassMetadata>::iterator end() { return entries.end(); }
+
+    std::deque<ClassMetadata> entries;
+};
+
 struct TypeRegistry {
-    bool                                   print_stats = false;
-    std::unordered_map<int, ClassMetadata> id_to_meta;
-    int                                    type_counter = int(ValueTypes::Max);
+    bool      print_stats = false;
+    TypeTable id_to_meta;
+    int       type_counter = int(ValueTypes::Max);
 
     static TypeRegistry& instance();
 
@@ -174,14 +202,14 @@ template <typename T>
 const char* type_name() {
     auto& db = TypeRegistry::instance().id_to_meta;
 
-    auto result = db.find(type_id<T>());
+    ClassMetadata* result = db.find(type_id<T>());
 
-    if (result == db.end() || result->second.name == "") {
+    if (result == nullptr || result->name == "") {
         const char* name = typeid(T).name();
         return register_type<T>(name);
     }
 
-    return (result->second).name.c_str();
+    return result->name.c_str();
 };
 
 inline const char* type_name(int class_id) {
@@ -86,6 +86,8 @@ struct GCObject {
 
     void dump(std::ostream& out);
 
+    Array<GCObject*> const& get_children() const { return children; }
+
     virtual ~GCObject();
 
     int class_id;
@@ -0,0 +1,683 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if BUILD_POSIX
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include "builtin/operators.h"
+#include "utilities/helpers.h"
+#include "vm/bytecode.h"
+
+namespace lython {
+
+// Bump when the layout of the file changes
+static constexpr uint32 bytecode_version = 4;
+
+namespace {
+
+constexpr char   bytecode_magic[4] = {'L', 'Y', 'B', 'C'};
+constexpr uint32 byte_order        = 0x01020304;
+
+// Type of the string constants, the other constants use their ValueTypes
+constexpr int32 string_type = int32(meta::ValueTypes::Max);
+
+enum SectionId
+{
+    Strings,
+    Chars,
+    Code,
+    Constants,
+    Binary,
+    Unary,
+    Functions,
+    Globals,
+    Labels,
+    Lines,
+    Classes,
+    Handlers,
+    SectionCount
+};
+
+struct Section {
+    uint32 offset = 0;  // from the start of the file
+    uint32 count  = 0;  // number of records
+};
+
+struct Header {
+    char    magic[4];
+    uint32  version;
+    uint32  byte_order;
+    uint32  opcodes;  // hash of the opcode table of the build that wrote the file
+    Section sections[SectionCount];
+};
+
+struct StringRecord {
+    uint32 offset;  // inside the chars section
+    uint32 size;
+};
+
+struct ConstantRecord {
+    int32         type;
+    uint32        string;
+    Value::Holder payload;
+};
+
+enum class OperatorTable : int32
+{
+    Binary,
+    Bool,
+    Compare,
+    Unary,
+};
+
+struct OperatorRecord {
+    OperatorTable table;
+    int32         op;
+    int32         lhs;
+    int32         rhs;
+};
+
+struct FunctionRecord {
+    uint32 name;
+    int32  entry;
+    int32  argc;
+    int32  frame_size;
+    int32  pure;
+};
+
+struct LabelRecord {
+    uint32 name;
+    int32  index;
+};
+
+struct ClassRecord {
+    uint32 name;
+    int32  base;
+    int32  external;
+};
+
+struct BytecodeWriter {
+    uint32 string(String const& value) {
+        auto it = string_index.find(value);
+        if (it != string_index.end()) {
+            return it->second;
+        }
+
+        uint32 index        = uint32(strings.size());
+        string_index[value] = index;
+        strings.push_back(StringRecord{uint32(chars.size()), uint32(value.size())});
+        chars.insert(chars.end(), value.begin(), value.end());
+        return index;
+    }
+
+    bool constant(Value const& value, ConstantRecord& record) {
+        std::memset(&record, 0, sizeof(record));
+
+        if (value.tag() == meta::type_id<String>()) {
+            record.type   = string_type;
+            record.string = string(value.as<String>());
+            return true;
+        }
+
+        // Function pointers are only valid inside this process
+        if (value.tag() == meta::type_id<Function>()) {
+            return false;
+        }
+
+#define TYPE(T, field)                                        \
+    if (value.tag() == meta::type_id<T>()) {                  \
+        record.type          = int32(meta::ValueTypes::field); \
+        record.payload.field = value.as<T>();                 \
+        return true;                                          \
+    }
+        KIWI_VALUE_TYPES(TYPE)
+#undef TYPE
+
+        return false;
+    }
+
+    // Operators are written as their dispatch table entry
+    bool binary(BinaryFunction fun, OperatorRecord& record) {
+        NativeOperation op = get_native_operation(fun);
+        if (op.op < 0) {
+            return false;
+        }
+
+        record = OperatorRecord{OperatorTable::Binary, op.op, int32(op.lhs), int32(op.rhs)};
+
+        if (get_native_binary_operation(BinaryOperator(op.op), op.lhs, op.rhs) == fun) {
+            return true;
+        }
+        if (get_native_bool_operation(BoolOperator(op.op), op.lhs, op.rhs) == fun) {
+            record.table = OperatorTable::Bool;
+            return true;
+        }
+        record.table = OperatorTable::Compare;
+        return get_native_cmp_operation(CmpOperator(op.op), op.lhs, op.rhs) == fun;
+    }
+
+    bool unary(UnaryFunction fun, OperatorRecord& record) {
+        NativeOperation op = get_native_operation(fun);
+        record = OperatorRecord{OperatorTable::Unary, op.op, int32(op.lhs), 0};
+        return op.op >= 0;
+    }
+
+    template <typename T>
+    Section section(T const* records, std::size_t count) {
+        // Sections are aligned so their records can be read in place
+        while (out.size() % 8 != 0) {
+            out.push_back(0);
+        }
+
+        Section section{uint32(out.size()), uint32(count)};
+        char const* data = reinterpret_cast<char const*>(records);
+        out.insert(out.end(), data, data + count * sizeof(T));
+        return section;
+    }
+
+    template <typename T>
+    Section section(Array<T> const& records) {
+        return section(records.data(), records.size());
+    }
+
+    Dict<String, uint32> string_index;
+    Array<StringRecord>  strings;
+    Array<char>          chars;
+    Array<char>          out;
+};
+
+template <typename T>
+T const* records(char const* data, Section const& section) {
+    return reinterpret_cast<T const*>(data + section.offset);
+}
+
+// Renaming, adding or reordering opcodes changes the meaning of the code section
+uint32 opcode_hash() {
+    uint32 hash = 2166136261u;
+
+    for (int i = 0; i < int(OpCode::Size); i++) {
+        for (char const* c = to_string(OpCode(i)); *c != '\0'; c++) {
+            hash = (hash ^ uint8(*c)) * 16777619u;
+        }
+        hash = (hash ^ uint8(';')) * 16777619u;
+    }
+    return hash;
+}
+
+// Instructions are executed from the file without any check, every operand has to index
+// its table, every register has to fit the frame of the function and every jump has to stay
+// inside of it. `end` is the entry of the next function
+bool check_function(Program const& prog, VMFunction const& fun, int end) {
+    Instruction const* code = prog.code();
+
+    auto reg    = [&](int r) { return r < fun.frame_size; };
+    auto target = [&](int pc) { return pc >= fun.entry && pc < end; };
+    auto args   = [&](int c, int callee) {
+        return callee < int(prog.functions.size()) &&
+               c + prog.functions[callee].argc <= fun.frame_size;
+    };
+
+    int constants = int(prog.constants.size());
+    int globals   = int(prog.globals.size());
+
+    // The function cannot run into the next one
+    if (!in(code[end - 1].op, OpCode::Return, OpCode::ReturnNone)) {
+        return false;
+    }
+
+    for (int i = fun.entry; i < end; i++) {
+        Instruction const& inst = code[i];
+        Instruction const* ext  = nullptr;
+
+        // The operator is stored in the Ext word
+        if (in(inst.op, OpCode::Binary, OpCode::BinaryConst, OpCode::Test, OpCode::TestConst)) {
+            if (i + 1 >= end || code[i + 1].op != OpCode::Ext ||
+                code[i + 1].a >= prog.binary.size()) {
+                return false;
+            }
+            ext = &code[i + 1];
+        }
+
+        bool valid = false;
+        switch (inst.op) {
+        case OpCode::Nop:
+        case OpCode::Ext:
+        case OpCode::ReturnNone: valid = true; break;
+        case OpCode::LoadConst: valid = reg(inst.a) && inst.b < constants; break;
+        case OpCode::LoadNone: valid = reg(inst.a); break;
+        case OpCode::Move: valid = reg(inst.a) && reg(inst.b); break;
+        case OpCode::LoadGlobal: valid = reg(inst.a) && inst.b < globals; break;
+        case OpCode::StoreGlobal: valid = inst.a < globals && reg(inst.b); break;
+        case OpCode::Binary: valid = reg(inst.a) && reg(inst.b) && reg(inst.c); break;
+        case OpCode::BinaryConst:
+            valid = reg(inst.a) && reg(inst.b) && inst.c < constants;
+            break;
+        case OpCode::Unary:
+            valid = reg(inst.a) && reg(inst.b) && inst.c < prog.unary.size();
+            break;
+        case OpCode::Jump: valid = target(i + 1 + inst.offset()); break;
+        case OpCode::JumpIfFalse:
+        case OpCode::JumpIfTrue: valid = reg(inst.a) && target(i + 1 + inst.offset()); break;
+        case OpCode::Test:
+            valid = reg(inst.b) && reg(inst.c) && target(i + 2 + ext->offset());
+            break;
+        case OpCode::TestConst:
+            valid = reg(inst.b) && inst.c < constants && target(i + 2 + ext->offset());
+            break;
+        case OpCode::Call: valid = reg(inst.a) && args(inst.c, inst.b); break;
+        case OpCode::TailCall: valid = args(inst.c, inst.b); break;
+        case OpCode::Return:
+        case OpCode::Reraise: valid = reg(inst.a); break;
+        case OpCode::Raise: valid = inst.a < prog.classes.size(); break;
+        // Natives are not saved
+        case OpCode::CallNative:
+        case OpCode::CallDirect:
+        case OpCode::Size: valid = false; break;
+        }
+
+        if (!valid) {
+            kwwarn(outlog(), "Bytecode has an invalid operand at instruction {}", i);
+            return false;
+        }
+        if (ext != nullptr) {
+            i += 1;
+        }
+    }
+    return true;
+}
+
+bool check_code(Program const& prog) {
+    int size = prog.code_size();
+
+    // Functions are laid out one after the other, the module level code first
+    Array<int> order(prog.functions.size());
+    for (int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return prog.functions[a].entry < prog.functions[b].entry;
+    });
+
+    if (order.empty() || prog.functions[order[0]].entry != 0) {
+        return false;
+    }
+
+    for (int k = 0; k < order.size(); k++) {
+        int end = k + 1 < order.size() ? prog.functions[order[k + 1]].entry : size;
+
+        if (end <= prog.functions[order[k]].entry ||
+            !check_function(prog, prog.functions[order[k]], end)) {
+            return false;
+        }
+    }
+
+    // The handler stores the exception in the frame of the function it resumes
+    for (VMHandler const& handler: prog.handlers) {
+        auto owner = std::upper_bound(order.begin(), order.end(), handler.target, [&](int pc, int f) {
+            return pc < prog.functions[f].entry;
+        });
+
+        if (handler.reg < 0 || handler.reg >= prog.functions[*(owner - 1)].frame_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool BytecodeFile::write(Program const& program, String const& path) {
+    if (!program.natives.empty() || !program.relocations.empty() || program.mapped != nullptr) {
+        kwerror(outlog(), "Program cannot be saved as bytecode");
+        return false;
+    }
+
+    BytecodeWriter writer;
+
+    Array<ConstantRecord> constants(program.constants.size());
+    for (int i = 0; i < program.constants.size(); i++) {
+        if (!writer.constant(program.constants[i], constants[i])) {
+            kwerror(outlog(), "Constant {} cannot be saved as bytecode", i);
+            return false;
+        }
+    }
+
+    Array<OperatorRecord> binary(program.binary.size());
+    for (int i = 0; i < program.binary.size(); i++) {
+        if (!writer.binary(program.binary[i], binary[i])) {
+            kwerror(outlog(), "Operator {} is not a native operator", i);
+            return false;
+        }
+    }
+
+    Array<OperatorRecord> unary(program.unary.size());
+    for (int i = 0; i < program.unary.size(); i++) {
+        if (!writer.unary(program.unary[i], unary[i])) {
+            kwerror(outlog(), "Operator {} is not a native operator", i);
+            return false;
+        }
+    }
+
+    Array<FunctionRecord> functions;
+    for (VMFunction const& fun: program.functions) {
+        functions.push_back(
+            FunctionRecord{writer.string(fun.name), fun.entry, fun.argc, fun.frame_size, fun.pure});
+    }
+
+    Array<uint32> globals;
+    for (String const& global: program.globals) {
+        globals.push_back(writer.string(global));
+    }
+
+    Array<LabelRecord> labels;
+    for (Label const& label: program.labels) {
+        labels.push_back(LabelRecord{writer.string(label.name), label.index});
+    }
+
+    Array<ClassRecord> classes;
+    for (VMClass const& cls: program.classes) {
+        classes.push_back(ClassRecord{writer.string(cls.name), cls.base, int32(cls.external)});
+    }
+
+    Header header{};
+    std::memcpy(header.magic, bytecode_magic, sizeof(bytecode_magic));
+    header.version    = bytecode_version;
+    header.byte_order = byte_order;
+    header.opcodes    = opcode_hash();
+
+    writer.section(&header, 1);
+    header.sections[Strings]   = writer.section(writer.strings);
+    header.sections[Chars]     = writer.section(writer.chars);
+    header.sections[Code]      = writer.section(program.code(), program.code_size());
+    header.sections[Constants] = writer.section(constants);
+    header.sections[Binary]    = writer.section(binary);
+    header.sections[Unary]     = writer.section(unary);
+    header.sections[Functions] = writer.section(functions);
+    header.sections[Globals]   = writer.section(globals);
+    header.sections[Labels]    = writer.section(labels);
+    header.sections[Lines]     = writer.section(program.lines);
+    header.sections[Classes]   = writer.section(classes);
+    header.sections[Handlers]  = writer.section(program.handlers);
+    std::memcpy(writer.out.data(), &header, sizeof(header));
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        kwerror(outlog(), "Could not open {}", path);
+        return false;
+    }
+    file.write(writer.out.data(), std::streamsize(writer.out.size()));
+    return bool(file);
+}
+
+bool BytecodeFile::open(String const& path) {
+    close();
+
+#if BUILD_POSIX
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            mapping = data;
+            size    = std::size_t(info.st_size);
+        }
+    }
+    ::close(fd);
+
+    if (mapping != nullptr) {
+        if (load(static_cast<char const*>(mapping), size)) {
+            return true;
+        }
+        close();
+        return false;
+    }
+#endif
+
+    // Read the whole file, the buffer keeps the sections aligned
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+
+    std::size_t file_size = std::size_t(file.tellg());
+    buffer.resize((file_size + sizeof(int64) - 1) / sizeof(int64));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(buffer.data()), std::streamsize(file_size));
+
+    if (!file || !load(reinterpret_cast<char const*>(buffer.data()), file_size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void BytecodeFile::close() {
+#if BUILD_POSIX
+    if (mapping != nullptr) {
+        munmap(mapping, size);
+    }
+#endif
+    mapping = nullptr;
+    size    = 0;
+    buffer.clear();
+    prog = Program();
+}
+
+bool BytecodeFile::load(char const* data, std::size_t data_size) {
+    if (data_size < sizeof(Header)) {
+        return false;
+    }
+
+    Header header{};
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, bytecode_magic, sizeof(bytecode_magic)) != 0 ||
+        header.version != bytecode_version || header.byte_order != byte_order ||
+        header.opcodes != opcode_hash()) {
+        kwwarn(outlog(), "Bytecode was written by another version");
+        return false;
+    }
+
+    std::size_t const record_size[SectionCount] = {
+        sizeof(StringRecord),
+        sizeof(char),
+        sizeof(Instruction),
+        sizeof(ConstantRecord),
+        sizeof(OperatorRecord),
+        sizeof(OperatorRecord),
+        sizeof(FunctionRecord),
+        sizeof(uint32),
+        sizeof(LabelRecord),
+        sizeof(SourceLine),
+        sizeof(ClassRecord),
+        sizeof(VMHandler),
+    };
+
+    for (int i = 0; i < SectionCount; i++) {
+        Section const& section = header.sections[i];
+
+        if (section.offset % 8 != 0 ||
+            std::size_t(section.offset) + std::size_t(section.count) * record_size[i] > data_size) {
+            kwwarn(outlog(), "Bytecode is truncated");
+            return false;
+        }
+    }
+
+    Section const* sections = header.sections;
+
+    // Strings
+    Array<String>       strings;
+    StringRecord const* string_records = records<StringRecord>(data, sections[Strings]);
+    char const*         chars          = records<char>(data, sections[Chars]);
+
+    for (uint32 i = 0; i < sections[Strings].count; i++) {
+        StringRecord const& record = string_records[i];
+        if (std::size_t(record.offset) + record.size > sections[Chars].count) {
+            return false;
+        }
+        strings.emplace_back(chars + record.offset, record.size);
+    }
+
+    auto name = [&](uint32 index, String& out) {
+        if (index >= strings.size()) {
+            return false;
+        }
+        out = strings[index];
+        return true;
+    };
+
+    // Instructions are executed from the file, they only need to be checked
+    Instruction const* code      = records<Instruction>(data, sections[Code]);
+    int                code_size = int(sections[Code].count);
+
+    for (int i = 0; i < code_size; i++) {
+        if (int(code[i].op) >= int(OpCode::Size)) {
+            return false;
+        }
+    }
+
+    prog.mapped      = code;
+    prog.mapped_size = code_size;
+
+    ConstantRecord const* constants = records<ConstantRecord>(data, sections[Constants]);
+    for (uint32 i = 0; i < sections[Constants].count; i++) {
+        ConstantRecord const& record = constants[i];
+
+        if (record.type == string_type) {
+            String value;
+            if (!name(record.string, value)) {
+                return false;
+            }
+            prog.constants.push_back(make_value<String>(value));
+            continue;
+        }
+
+        if (record.type == int32(meta::ValueTypes::fun)) {
+            return false;
+        }
+
+        switch (meta::ValueTypes(record.type)) {
+#define TYPE(T, field)                                         \
+    case meta::ValueTypes::field:                              \
+        prog.constants.push_back(Value(record.payload.field)); \
+        break;
+            KIWI_VALUE_TYPES(TYPE)
+#undef TYPE
+        default: return false;
+        }
+    }
+
+    OperatorRecord const* binary = records<OperatorRecord>(data, sections[Binary]);
+    for (uint32 i = 0; i < sections[Binary].count; i++) {
+        OperatorRecord const& record = binary[i];
+        NativeType            lhs    = NativeType(record.lhs);
+        NativeType            rhs    = NativeType(record.rhs);
+        BinaryFunction        fun    = nullptr;
+
+        switch (record.table) {
+        case OperatorTable::Binary:
+            fun = get_native_binary_operation(BinaryOperator(record.op), lhs, rhs);
+            break;
+        case OperatorTable::Bool:
+            fun = get_native_bool_operation(BoolOperator(record.op), lhs, rhs);
+            break;
+        case OperatorTable::Compare:
+            fun = get_native_cmp_operation(CmpOperator(record.op), lhs, rhs);
+            break;
+        default: break;
+        }
+
+        if (fun == nullptr) {
+            return false;
+        }
+        prog.binary.push_back(fun);
+    }
+
+    OperatorRecord const* unary = records<OperatorRecord>(data, sections[Unary]);
+    for (uint32 i = 0; i < sections[Unary].count; i++) {
+        OperatorRecord const& record = unary[i];
+        UnaryFunction         fun =
+            get_native_unary_operation(UnaryOperator(record.op), NativeType(record.lhs));
+
+        if (record.table != OperatorTable::Unary || fun == nullptr) {
+            return false;
+        }
+        prog.unary.push_back(fun);
+    }
+
+    FunctionRecord const* functions = records<FunctionRecord>(data, sections[Functions]);
+    for (uint32 i = 0; i < sections[Functions].count; i++) {
+        FunctionRecord const& record = functions[i];
+        VMFunction            fun;
+
+        // Registers are 16 bit operands
+        if (!name(record.name, fun.name) || record.entry < 0 || record.entry >= code_size ||
+            record.argc < 0 || record.frame_size < record.argc || record.frame_size > 0x10000) {
+            return false;
+        }
+        fun.entry      = record.entry;
+        fun.argc       = record.argc;
+        fun.frame_size = record.frame_size;
+        fun.pure       = record.pure != 0;
+        prog.functions.push_back(fun);
+    }
+
+    uint32 const* globals = records<uint32>(data, sections[Globals]);
+    for (uint32 i = 0; i < sections[Globals].count; i++) {
+        String global;
+        if (!name(globals[i], global)) {
+            return false;
+        }
+        prog.globals.push_back(global);
+    }
+
+    LabelRecord const* labels = records<LabelRecord>(data, sections[Labels]);
+    for (uint32 i = 0; i < sections[Labels].count; i++) {
+        Label label;
+        if (!name(labels[i].name, label.name)) {
+            return false;
+        }
+        label.index = labels[i].index;
+        label.depth = 0;
+        prog.labels.push_back(label);
+    }
+
+    SourceLine const* lines = records<SourceLine>(data, sections[Lines]);
+    prog.lines.assign(lines, lines + sections[Lines].count);
+
+    int                class_count = int(sections[Classes].count);
+    ClassRecord const* classes     = records<ClassRecord>(data, sections[Classes]);
+    for (int i = 0; i < class_count; i++) {
+        VMClass cls;
+        if (!name(classes[i].name, cls.name) || classes[i].base >= class_count) {
+            return false;
+        }
+        cls.base     = classes[i].base;
+        cls.external = classes[i].external != 0;
+        prog.classes.push_back(cls);
+    }
+
+    VMHandler const* handlers = records<VMHandler>(data, sections[Handlers]);
+    for (uint32 i = 0; i < sections[Handlers].count; i++) {
+        VMHandler const& handler = handlers[i];
+        if (handler.start < 0 || handler.start > handler.end || handler.end > code_size ||
+            handler.target < 0 || handler.target >= code_size || handler.klass >= class_count) {
+            return false;
+        }
+    }
+    prog.handlers.assign(handlers, handlers + sections[Handlers].count);
+
+    return check_code(prog);
+}
+
+}  // namespace lython
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "vm/vm.h"
+
+namespace lython {
+
+// On disk bytecode
+//
+// A linked program can be saved so later runs skip the parser, SEMA and the code generation.
+// The file is a header followed by sections, each section starts on an 8 bytes boundary
+// so the instructions can be executed in place once the file is mapped.
+//
+//  header      magic, version, byte order check and location of the sections
+//  strings     string table, names and string constants are indices inside it
+//  code        instructions, stored as they are executed
+//  constants   type and payload
+//  binary      native operators as their dispatch table entry (table, op, lhs, rhs)
+//  unary       same for the unary operators
+//  functions   name, entry, argc, frame size, pure
+//  globals     names
+//  labels      name, instruction
+//  lines       debug line table (instruction, line)
+//  classes     exception classes, name and base
+//  handlers    try regions (start, end, target, class, register)
+//
+// The format is tied to the opcodes of the build that wrote it, files from another
+// version are rejected. Programs calling native functions or holding objects in their
+// constant table cannot be saved, there is nothing to bind them to without the front end.
+//
+struct BytecodeFile {
+    BytecodeFile() = default;
+    BytecodeFile(BytecodeFile const&) = delete;
+    BytecodeFile& operator=(BytecodeFile const&) = delete;
+
+    ~BytecodeFile() { close(); }
+
+    // Save the program, returns false if it cannot be represented
+    static bool write(Program const& program, String const& path);
+
+    // Map the file and rebuild the tables of the program,
+    // returns false if the file is missing, truncated or was written by another version
+    bool open(String const& path);
+
+    void close();
+
+    Program const& program() const { return prog; }
+
+    private:
+    bool load(char const* data, std::size_t size);
+
+    Program      prog;
+    void*        mapping = nullptr;
+    std::size_t  size    = 0;
+    Array<int64> buffer;  // file content when it cannot be mapped
+};
+
+}  // namespace lython
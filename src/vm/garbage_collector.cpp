@@ -1,61 +1,490 @@
-#include "garbage_collector.h"
-#include "sema/bindings.h"
+#include "vm/garbage_collector.h"
+#include "utilities/printing.h"
 
 namespace lython {
 
-#if 0
-GargabeCollector::GargabeCollector(struct Bindings& bindings, struct Expression& root):
-    bindings(bindings), root(root)  //
-{}
+RuntimeHeap::RuntimeHeap(std::size_t threshold, std::size_t nursery): min_threshold(threshold) {
+    stats.threshold = threshold;
+    set_nursery_size(nursery);
+}
+
+RuntimeHeap::~RuntimeHeap() {
+    for (HeapObject* list: {head, unswept}) {
+        while (list != nullptr) {
+            HeapObject* next = list->next;
+            free_object(list);
+            list = next;
+        }
+    }
+
+    for (Chunk& chunk: chunks) {
+        for (char* ptr = chunk.start; ptr < chunk.top;) {
+            HeapObject* obj = reinterpret_cast<HeapObject*>(ptr);
+            ptr += obj->size;
+
+            if (!obj->destroyed) {
+                obj->destroy(obj->object());
+                manual_free(obj->type_id, 1);
+            }
+        }
+    }
+
+    if (nursery != nullptr) {
+        device::CPU::free(nursery, nursery_size);
+    }
+}
+
+void RuntimeHeap::set_nursery_size(std::size_t bytes) {
+    for (Chunk const& chunk: chunks) {
+        kwassert(chunk.top == chunk.start, "Nursery should be empty");
+    }
+
+    if (nursery != nullptr) {
+        device::CPU::free(nursery, nursery_size);
+    }
+
+    nursery_size = bytes - bytes % chunk_size;
+    nursery      = nullptr;
+    current      = 0;
+    chunks.clear();
+
+    if (nursery_size == 0) {
+        return;
+    }
+
+    nursery = static_cast<char*>(device::CPU::malloc(nursery_size));
+    for (std::size_t offset = 0; offset < nursery_size; offset += chunk_size) {
+        chunks.push_back(Chunk{nursery + offset, nursery + offset, false});
+    }
+}
+
+HeapObject* RuntimeHeap::allocate(std::size_t size, int type_id) {
+    HeapObject* header = new (device::CPU::malloc(size)) HeapObject();
+
+    header->size    = size;
+    header->type_id = type_id;
+    header->next    = head;
+    head            = header;
+
+    objects.insert(header->object());
+    since_collection += size;
+    stats.allocated += size;
+    stats.live += size;
+    stats.objects += 1;
+    return header;
+}
+
+bool RuntimeHeap::fits_young(std::size_t size) const {
+    if (chunks.empty() || size > chunk_size / 4) {
+        return true;  // allocated in the main heap
+    }
+
+    for (Chunk const& chunk: chunks) {
+        if (!chunk.retained && chunk.top + size <= chunk.start + chunk_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HeapObject* RuntimeHeap::allocate_young(std::size_t size, int type_id) {
+    // Large objects would waste the chunks
+    if (chunks.empty() || size > chunk_size / 4) {
+        return nullptr;
+    }
+
+    // Chunks are filled in order, a chunk holding survivors is skipped
+    while (chunks[current].retained || chunks[current].top + size > chunks[current].start + chunk_size) {
+        current += 1;
+
+        if (current == int(chunks.size())) {
+            current = 0;
+            return nullptr;
+        }
+    }
+
+    Chunk&      chunk  = chunks[current];
+    HeapObject* header = new (chunk.top) HeapObject();
+    chunk.top += size;
+
+    header->size    = size;
+    header->type_id = type_id;
+
+    young_since_collection += size;
+    stats.allocated += size;
+    stats.live += size;
+    stats.young += size;
+    stats.objects += 1;
+    return header;
+}
+
+void RuntimeHeap::free_object(HeapObject* header) {
+    header->destroy(header->object());
+    manual_free(header->type_id, 1);
+    device::CPU::free(header, header->size);
+}
+
+bool RuntimeHeap::owns(void const* object) const {
+    if (is_young(object)) {
+        HeapObject* obj = header(object);
+        return !obj->destroyed;
+    }
+    return objects.count(object) > 0;
+}
+
+bool RuntimeHeap::is_young(Value const& value) const {
+    // builtin values are held inline
+    return value.tag() >= uint32(meta::ValueTypes::Max) && is_young(value.holder().obj);
+}
+
+void RuntimeHeap::remember(void const* object) {
+    if (!owns(object) || is_young(object)) {
+        return;
+    }
+
+    // its values are traced again by the marking in progress
+    HeapObject* obj = header(object);
+    if (phase == Phase::Marking && obj->marked) {
+        gray.push_back(obj);
+    }
+
+    if (nursery != nullptr && !obj->remembered) {
+        obj->remembered = true;
+        remembered.push_back(obj);
+    }
+}
+
+void RuntimeHeap::begin(Collection kind) {
+    collecting = kind;
+    draining   = false;
+
+    // The main heap objects pointing to the nursery are roots of the minor collection
+    if (kind == Collection::Minor) {
+        for (HeapObject* obj: remembered) {
+            obj->remembered = false;
+            scan.push_back(obj);
+        }
+        remembered.clear();
+        return;
+    }
+
+    kwassert(phase != Phase::Sweeping, "The previous collection should be swept");
+    if (phase == Phase::Idle) {
+        phase            = Phase::Marking;
+        since_collection = 0;
+    }
+}
+
+void RuntimeHeap::mark(Value& slot) {
+    if (collecting == Collection::Full) {
+        pin(slot);
+        return;
+    }
+
+    // Minor collections only look at the nursery
+    if (is_young(slot)) {
+        // the slots are only forwarded once every root was pinned
+        if (!draining) {
+            slots.push_back(&slot);
+            return;
+        }
+
+        promote(slot);
+        if (is_young(slot)) {
+            young_refs = true;
+            return;
+        }
+    }
+
+    // the marking in progress does not trace the young objects
+    // and did not see the slots updated by the promotions
+    if (phase == Phase::Marking && shading && slot.tag() >= uint32(meta::ValueTypes::Max)) {
+        shade(slot.holder().obj);
+    }
+}
+
+void RuntimeHeap::pin(Value const& value) {
+    // builtin values are held inline
+    if (value.tag() < uint32(meta::ValueTypes::Max)) {
+        return;
+    }
+    mark(value.holder().obj);
+}
 
-void GargabeCollector::mark() {
-    // For generational collection we could start
-    // the check later into the binding array
-    int i = bindings.global_index;
+void RuntimeHeap::mark(void const* object) {
+    if (object == nullptr || !owns(object)) {
+        return;
+    }
 
-    for (; i < bindings.bindings.size(); i++) {
-        //
-        BindingEntry& entry = bindings.bindings[i];
+    HeapObject* obj = header(object);
 
-        // Mark the object as viewed
-        GCObject* value = entry.value;
+    if (collecting == Collection::Minor) {
+        if (!is_young(object)) {
+            // a root of the main heap, its values are roots as well
+            scan.push_back(obj);
+            if (phase == Phase::Marking) {
+                shade(object);
+            }
+            return;
+        }
 
-        // TODO: fetch the GC metadata
-        RTGCObject* mapped = nullptr;
-        if (mapped != nullptr) {
-            mapped->cycle = cycle;
+        kwassert(draining == false, "Pinned objects are only known from the roots");
+        if (!obj->pinned) {
+            obj->pinned = true;
+            scan.push_back(obj);
         }
+        return;
+    }
+
+    // the nursery is traced by the minor collections
+    if (!is_young(object)) {
+        shade(object);
     }
 }
 
-void GargabeCollector::free_object(RTGCObject* obj) {
-    root.remove_child((GCObject*)obj->object, true);
+void RuntimeHeap::shade(void const* object) {
+    if (!owns(object) || is_young(object)) {
+        return;
+    }
+
+    HeapObject* obj = header(object);
+    if (!obj->marked) {
+        obj->marked = true;
+        gray.push_back(obj);
+    }
 }
 
-void GargabeCollector::sweep() { shrink(); }
+void RuntimeHeap::promote(Value& slot) {
+    HeapObject* obj = header(slot.holder().obj);
 
-void GargabeCollector::shrink() {
-    int        deleted   = 0;
-    int        i         = 0;
-    int        free_spot = 0;
-    Array<int> free_spots;
+    if (obj->pinned) {
+        return;
+    }
 
-    for (RTGCObject& obj: tracked) {
-        if (obj.cycle < cycle) {
-            deleted += 1;
-            free_object(&obj);
-            free_spots.push_back(i);
-        } else if (!free_spots.empty()) {
-            tracked[free_spot] = obj;
-            tracked[i]         = RTGCObject{0, nullptr};
-            free_spots.push_back(i);
-            free_spot += 1;
+    if (obj->next == nullptr) {
+        // Copy the object to the main heap, its values are traced from there
+        HeapObject* copy = new (device::CPU::malloc(obj->size)) HeapObject(*obj);
+
+        copy->next = head;
+        head       = copy;
+        obj->relocate(copy->object(), obj->object());
+
+        obj->next      = copy;
+        obj->destroyed = true;
+
+        objects.insert(copy->object());
+        since_collection += obj->size;
+        stats.promoted += obj->size;
+        stats.young -= obj->size;
+        scan.push_back(copy);
+    }
+
+    slot = Value(int(slot.tag()), obj->next->object());
+}
+
+void RuntimeHeap::sweep() {
+    if (collecting == Collection::Minor) {
+        draining = true;
+
+        for (Value* slot: slots) {
+            promote(*slot);
         }
-        i += 1;
+        slots.clear();
+
+        // An explicit stack, long chains of objects do not recurse
+        while (!scan.empty()) {
+            HeapObject* obj = scan.back();
+            scan.pop_back();
+
+            young_refs = false;
+            shading    = is_young(obj) || obj->marked;
+            obj->trace(*this, obj->object());
+
+            // still points to a pinned object
+            if (young_refs && !is_young(obj)) {
+                remember(obj->object());
+            }
+        }
+
+        sweep_nursery();
+        stats.minor_collections += 1;
+        collecting = Collection::Full;
+        draining   = false;
+        shading    = false;
+        return;
+    }
+
+    // Ends the marking
+    step(std::size_t(-1));
+
+    // the unreachable objects are freed below
+    std::size_t n = 0;
+    for (HeapObject* obj: remembered) {
+        if (obj->marked) {
+            remembered[n++] = obj;
+        }
+    }
+    remembered.resize(n);
+
+    // objects allocated from now on are not swept
+    phase   = Phase::Sweeping;
+    unswept = head;
+    head    = nullptr;
+
+    if (quantum == 0) {
+        sweep_old(std::size_t(-1));
+    }
+}
+
+bool RuntimeHeap::step(std::size_t budget) {
+    if (phase == Phase::Sweeping) {
+        sweep_old(budget);
+        return false;
     }
 
-    tracked.resize(int(tracked.size()) - deleted);
-    cycle += 1;
+    while (budget > 0 && !gray.empty()) {
+        HeapObject* obj = gray.back();
+        gray.pop_back();
+
+        obj->trace(*this, obj->object());
+        budget -= 1;
+    }
+    return phase == Phase::Marking && gray.empty();
 }
-#endif
-}  // namespace lython
\ No newline at end of file
+
+void RuntimeHeap::sweep_old(std::size_t budget) {
+    for (; unswept != nullptr && budget > 0; budget--) {
+        HeapObject* obj = unswept;
+        unswept         = obj->next;
+
+        if (obj->marked) {
+            obj->marked = false;
+            obj->next   = head;
+            head        = obj;
+            continue;
+        }
+
+        objects.erase(obj->object());
+        stats.freed += obj->size;
+        stats.live -= obj->size;
+        stats.objects -= 1;
+        free_object(obj);
+    }
+
+    if (unswept == nullptr) {
+        phase           = Phase::Idle;
+        stats.threshold = std::max(min_threshold, stats.live);
+        stats.collections += 1;
+    }
+}
+
+void RuntimeHeap::sweep_nursery() {
+    for (Chunk& chunk: chunks) {
+        chunk.retained = false;
+
+        for (char* ptr = chunk.start; ptr < chunk.top;) {
+            HeapObject* obj = reinterpret_cast<HeapObject*>(ptr);
+            ptr += obj->size;
+
+            if (obj->destroyed) {
+                continue;
+            }
+
+            if (obj->pinned) {
+                obj->pinned    = false;
+                chunk.retained = true;
+                continue;
+            }
+
+            obj->destroy(obj->object());
+            manual_free(obj->type_id, 1);
+            obj->destroyed = true;
+
+            stats.freed += obj->size;
+            stats.live -= obj->size;
+            stats.young -= obj->size;
+            stats.objects -= 1;
+        }
+
+        if (!chunk.retained) {
+            chunk.top = chunk.start;
+        }
+    }
+
+    current                = 0;
+    young_since_collection = 0;
+}
+
+void PauseHistogram::add(double us) {
+    int bucket = 0;
+    while (bucket < size - 1 && us >= double(std::size_t(1) << bucket)) {
+        bucket += 1;
+    }
+
+    buckets[bucket] += 1;
+    count += 1;
+    total += us;
+    longest = std::max(longest, us);
+}
+
+void RuntimeHeap::record_pause(Pause kind, double us) {
+    switch (kind) {
+    case Pause::Minor: stats.minor_pauses.add(us); return;
+    case Pause::Increment: stats.increment_pauses.add(us); return;
+    case Pause::Final: stats.final_pauses.add(us); return;
+    }
+}
+
+void RuntimeHeap::dump_heap_stats(std::ostream& out) const {
+    out << fmt::format("{:>30} | {:>12}\n", "heap", "count");
+    out << fmt::format("{:>30} | {:12d}\n", "collections", stats.collections);
+    out << fmt::format("{:>30} | {:12d}\n", "minor collections", stats.minor_collections);
+    out << fmt::format("{:>30} | {:12d}\n", "objects", stats.objects);
+    out << fmt::format("{:>30} | {:12d}\n", "live (bytes)", stats.live);
+    out << fmt::format("{:>30} | {:12d}\n", "nursery (bytes)", stats.young);
+    out << fmt::format("{:>30} | {:12d}\n", "allocated (bytes)", stats.allocated);
+    out << fmt::format("{:>30} | {:12d}\n", "promoted (bytes)", stats.promoted);
+    out << fmt::format("{:>30} | {:12d}\n", "freed (bytes)", stats.freed);
+    out << fmt::format("{:>30} | {:12d}\n", "threshold (bytes)", stats.threshold);
+
+    PauseHistogram const* pauses[] = {
+        &stats.minor_pauses, &stats.increment_pauses, &stats.final_pauses};
+
+    auto mean = [](PauseHistogram const* p) { return p->count > 0 ? p->total / p->count : 0.0; };
+
+    out << "\n";
+    out << fmt::format(
+        "{:>30} | {:>12} | {:>12} | {:>12}\n", "pauses (us)", "minor", "increment", "final");
+    out << fmt::format("{:>30} | {:12d} | {:12d} | {:12d}\n",
+                       "count",
+                       pauses[0]->count,
+                       pauses[1]->count,
+                       pauses[2]->count);
+    out << fmt::format("{:>30} | {:12.1f} | {:12.1f} | {:12.1f}\n",
+                       "mean",
+                       mean(pauses[0]),
+                       mean(pauses[1]),
+                       mean(pauses[2]));
+    out << fmt::format("{:>30} | {:12.1f} | {:12.1f} | {:12.1f}\n",
+                       "longest",
+                       pauses[0]->longest,
+                       pauses[1]->longest,
+                       pauses[2]->longest);
+
+    for (int i = 0; i < PauseHistogram::size; i++) {
+        std::size_t minor     = pauses[0]->buckets[i];
+        std::size_t increment = pauses[1]->buckets[i];
+        std::size_t final     = pauses[2]->buckets[i];
+
+        if (minor + increment + final == 0) {
+            continue;
+        }
+
+        String bucket = i + 1 < PauseHistogram::size
+                            ? String(fmt::format("< {}", std::size_t(1) << i).c_str())
+                            : String(fmt::format(">= {}", std::size_t(1) << (i - 1)).c_str());
+        out << fmt::format("{:>30} | {:12d} | {:12d} | {:12d}\n", bucket, minor, increment, final);
+    }
+}
+
+}  // namespace lython
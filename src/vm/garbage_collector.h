@@ -1,48 +1,304 @@
 #pragma once
 
+#include "ast/values/value.h"
 #include "dtypes.h"
-#include "utilities/object.h"
+#include "utilities/allocator.h"
+
+#include <ostream>
+#include <type_traits>
 
 namespace lython {
 
-#if 0
-// runtime gcobject, as opposed to the compiler gcobject that behave differently
-struct RTGCObject {
-    int   cycle  = false;  // collection cycle, collect if gc cycle <= collection cycle
-    void* object = nullptr;
+struct RuntimeHeap;
+
+// Marks the values held by an object of the heap,
+// runtime types referencing other values specialize it next to their definition
+template <typename T>
+struct HeapTrace {
+    static void trace(RuntimeHeap& heap, T& object) {}
+};
+
+// Objects the evaluator references through raw pointers cannot move,
+// they skip the nursery and are allocated in the main heap
+template <typename T>
+struct HeapTenured: std::false_type {};
+
+// Header in front of every object of the heap, the object follows it
+struct alignas(16) HeapObject {
+    // main heap: objects of the heap, most recent first
+    // nursery:   copy of the object once it was promoted
+    HeapObject* next = nullptr;
+    std::size_t size = 0;  // header included
+
+    void (*trace)(RuntimeHeap& heap, void* object)  = nullptr;
+    void (*destroy)(void* object)                   = nullptr;
+    void (*relocate)(void* dest, void* object)      = nullptr;  // move and destroy
+
+    int  type_id    = -1;
+    bool marked     = false;
+    bool pinned     = false;  // nursery: held by a value the collector cannot update
+    bool remembered = false;  // main heap: might point to the nursery
+    bool destroyed  = false;  // nursery: promoted or freed
+
+    void* object() { return this + 1; }
+};
+
+// Pauses of one kind, bucket `i` counts the pauses shorter than 2^i microseconds
+struct PauseHistogram {
+    static constexpr int size = 24;
+
+    std::size_t count         = 0;
+    double      total         = 0;  // microseconds
+    double      longest       = 0;  // microseconds
+    std::size_t buckets[size] = {};
+
+    void add(double us);
+};
+
+struct HeapStats {
+    std::size_t collections       = 0;
+    std::size_t minor_collections = 0;
+    std::size_t allocated         = 0;  // bytes allocated since the heap was created
+    std::size_t freed             = 0;  // bytes reclaimed by the collections
+    std::size_t promoted          = 0;  // bytes copied from the nursery to the main heap
+    std::size_t live              = 0;  // bytes held by the objects of the heap
+    std::size_t young             = 0;  // bytes held by the objects of the nursery
+    std::size_t objects           = 0;  // objects in the heap
+    std::size_t threshold         = 0;  // bytes allocated between two collections
+
+    PauseHistogram minor_pauses;      // minor collections
+    PauseHistogram increment_pauses;  // quanta of the full collections, roots included
+    PauseHistogram final_pauses;      // end of the marking, complete full collections
 };
 
-// Very simple garbage collector
-class GargabeCollectorOld {
-    GargabeCollector(struct Bindings& bindings, struct Expression& root);
+/* Mark and sweep collector for the values created by the scripts
+ * (objects, generators, exceptions and strings).
+ *
+ * The heap does not know its roots, the owner (see TreeEvaluator::collect_garbage)
+ * starts a collection, marks the values it holds and calls `sweep`, the objects reachable
+ * from the marked ones are kept, the others are destroyed.
+ *
+ * New objects are bump allocated in a nursery, most of them are dead by the time it is full.
+ * A minor collection only traces the nursery: the survivors are copied to the main heap
+ * and the values pointing to them are updated. Values the collector cannot update
+ * (held by the C++ stack) are pinned, their object stays in the nursery.
+ * Main heap objects pointing to the nursery are found through `write_barrier`.
+ *
+ * The owner runs a full collection once `should_collect` says enough memory reached
+ * the main heap since the last one. The threshold grows with the live memory so the cost
+ * of a collection stays proportional to the memory allocated in between.
+ * A full collection does not move objects.
+ *
+ * Full collections can be incremental (`set_quantum`), the owner marks the roots
+ * to start it and `step` traces a few objects at a time while the scripts run:
+ *
+ *  - white objects are not marked, gray ones are marked but their values are not,
+ *    black ones are marked and so are their values
+ *  - a black object never points to a white one: values stored in the main heap
+ *    while marking go through `write_barrier` which marks them gray
+ *  - the frames are not protected by the barrier, once `step` ran out of gray objects
+ *    the owner runs a minor collection and marks the roots again, `sweep` ends the marking
+ *  - objects allocated while marking are white, they are found from the roots at the end
+ *    of the marking, the unmarked objects are then freed a quantum at a time
+ *
+ * Values that do not point to an object of the heap (AST constants, builtin values)
+ * are ignored when marked.
+ */
+struct RuntimeHeap {
+    enum class Collection
+    {
+        Minor,
+        Full,
+    };
+
+    enum class Phase
+    {
+        Idle,
+        Marking,
+        Sweeping,
+    };
+
+    enum class Pause
+    {
+        Minor,
+        Increment,
+        Final,
+    };
+
+    RuntimeHeap(std::size_t threshold = 1024 * 1024, std::size_t nursery = 256 * 1024);
+
+    RuntimeHeap(RuntimeHeap const&)            = delete;
+    RuntimeHeap& operator=(RuntimeHeap const&) = delete;
+
+    ~RuntimeHeap();
 
-    // Allocation hook
     template <typename T, typename... Args>
-    T* new_object(Args... args) {
-        T* obj = root.new_object(args...);
-        tracked.push_back(RTGCObject{false, obj});
-        return obj;
+    T* new_object(Args&&... args) {
+        std::size_t size   = sizeof(HeapObject) + align(sizeof(T));
+        HeapObject* header = nullptr;
+
+        if (!HeapTenured<T>::value) {
+            header = allocate_young(size, meta::type_id<T>());
+        }
+        if (header == nullptr) {
+            header = allocate(size, meta::type_id<T>());
+        }
+
+        header->trace = [](RuntimeHeap& heap, void* object) {
+            HeapTrace<T>::trace(heap, *static_cast<T*>(object));
+        };
+        header->destroy = [](void* object) { static_cast<T*>(object)->~T(); };
+
+        if constexpr (!HeapTenured<T>::value) {
+            header->relocate = [](void* dest, void* object) {
+                new (dest) T(std::move(*static_cast<T*>(object)));
+                static_cast<T*>(object)->~T();
+            };
+        }
+
+        meta::get_stat<T>().allocated += 1;
+        T* object = new (header->object()) T(std::forward<Args>(args)...);
+
+        // the constructor might have copied values of the nursery
+        if (!is_young(object)) {
+            remember(object);
+        }
+        return object;
     }
 
-    void free_object(RTGCObject* obj);
+    // Value pointing to a new object, like `make_value<T>` for types stored out of line
+    template <typename T, typename... Args>
+    Value new_value(Args&&... args) {
+        return Value(meta::type_id<T>(), (void*)new_object<T>(std::forward<Args>(args)...));
+    }
 
-    void mark();
+    // A full collection should start or is in progress
+    bool should_collect() const {
+        return phase != Phase::Idle || since_collection >= stats.threshold;
+    }
 
+    Phase get_phase() const { return phase; }
+
+    // A new `T` does not fit in the nursery anymore
+    template <typename T>
+    bool nursery_full() const {
+        return !HeapTenured<T>::value && young_since_collection > 0 &&
+               !fits_young(sizeof(HeapObject) + align(sizeof(T)));
+    }
+
+    bool owns(void const* object) const;
+
+    bool is_young(void const* object) const {
+        return object >= nursery && object < nursery + nursery_size;
+    }
+    bool is_young(Value const& value) const;
+
+    // `object` now holds `value`, objects of the main heap pointing to the nursery
+    // are traced by the minor collections, the marking in progress sees `value`
+    void write_barrier(Value const& object, Value const& value) {
+        if (is_young(value)) {
+            if (!is_young(object.holder().obj)) {
+                remember(object.holder().obj);
+            }
+        } else if (phase == Phase::Marking && value.tag() >= uint32(meta::ValueTypes::Max)) {
+            shade(value.holder().obj);
+        }
+    }
+
+    // `object` was written to in bulk (a generator frame)
+    void remember(void const* object);
+
+    // Starts a collection, the owner marks the roots and calls `sweep`.
+    // Starting a full collection while marking marks the roots again
+    void begin(Collection kind);
+
+    // Marks the object the value points to, when it belongs to the heap.
+    // `slot` is updated when the object moves
+    void mark(Value& slot);
+    void mark(void const* object);
+
+    // Marks a value that is also held where the collector cannot update it,
+    // the object does not move during this collection
+    void pin(Value const& value);
+
+    // Marks everything reachable from the marked objects and frees the others,
+    // incremental collections free them in the next steps
     void sweep();
 
-    // Compact and collect memory
-    void shrink();
+    // Runs at most `budget` objects of the full collection in progress,
+    // returns true once the marking ran out of gray objects
+    bool step(std::size_t budget);
+
+    HeapStats const& get_stats() const { return stats; }
+
+    void record_pause(Pause kind, double us);
+
+    void dump_heap_stats(std::ostream& out) const;
+
+    // Bytes allocated before the first collection, the threshold never goes below it
+    void set_threshold(std::size_t bytes) {
+        min_threshold   = bytes;
+        stats.threshold = bytes;
+    }
+
+    // Objects traced or swept by a step, 0 runs full collections in one go
+    void        set_quantum(std::size_t objects) { quantum = objects; }
+    std::size_t get_quantum() const { return quantum; }
+
+    // Size of the nursery, 0 allocates every object in the main heap.
+    // The nursery can only be resized while it is empty
+    void set_nursery_size(std::size_t bytes);
 
     private:
-    // this is the state of the execution
-    struct Bindings& bindings;
+    struct Chunk {
+        char* start;
+        char* top;
+        bool  retained;  // holds objects that survived a collection
+    };
+
+    static std::size_t align(std::size_t size) { return (size + 15) & ~std::size_t(15); }
+
+    HeapObject* allocate(std::size_t size, int type_id);
+    HeapObject* allocate_young(std::size_t size, int type_id);
+    bool        fits_young(std::size_t size) const;
+    void        free_object(HeapObject* header);
+
+    void shade(void const* object);
+    void promote(Value& slot);
+    void sweep_old(std::size_t budget);
+    void sweep_nursery();
+
+    static HeapObject* header(void const* object) {
+        return static_cast<HeapObject*>(const_cast<void*>(object)) - 1;
+    }
+
+    std::size_t        min_threshold;
+    HeapObject*        head = nullptr;
+    Set<void const*>   objects;
+    Array<HeapObject*> gray;  // marked objects whose values are not marked yet
+    Array<HeapObject*> remembered;
+    std::size_t        since_collection = 0;
+    HeapStats          stats;
+
+    Phase       phase    = Phase::Idle;
+    std::size_t quantum  = 0;
+    HeapObject* unswept  = nullptr;  // objects of the main heap the sweep did not reach yet
+
+    // Minor collections forward the slots once every pinned object is known
+    Collection         collecting   = Collection::Full;
+    bool               draining     = false;
+    bool               young_refs   = false;  // the object being traced points to the nursery
+    bool               shading      = false;  // the marking will not trace the object being traced
+    Array<Value*>      slots;
+    Array<HeapObject*> scan;  // objects of the minor collection whose values are not traced
 
-    // this is the root node that holds all the temporaries
-    struct GCObject& root;
+    char*        nursery      = nullptr;
+    std::size_t  nursery_size = 0;
+    Array<Chunk> chunks;
+    int          current                = 0;
+    std::size_t  young_since_collection = 0;
 
-    int               cycle = 0;
-    Array<RTGCObject> tracked;
+    static constexpr std::size_t chunk_size = 32 * 1024;
 };
 
-#endif
-}  // namespace lython
\ No newline at end of file
+}  // namespace lython
@@ -0,0 +1,99 @@
+#include "vm/memo.h"
+#include "utilities/printing.h"
+
+namespace lython {
+
+namespace {
+// Builtin values compare by value, see Value::operator==
+bool is_builtin(Value const& value) {
+    switch (meta::ValueTypes(value.tag())) {
+    case meta::ValueTypes::fun:
+    case meta::ValueTypes::invalid:
+    case meta::ValueTypes::Max: return false;
+    default: return value.tag() < int(meta::ValueTypes::Max);
+    }
+}
+
+std::size_t combine(std::size_t seed, std::size_t hash) {
+    return seed ^ (hash + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+}  // namespace
+
+bool MemoCache::Key::operator==(Key const& other) const {
+    if (function != other.function || args.size() != other.args.size()) {
+        return false;
+    }
+    for (int i = 0; i < args.size(); i++) {
+        if (args[i].tag() != other.args[i].tag() || !(args[i] == other.args[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MemoCache::make_key(void const* function, Value const* args, int argc, Key& key) {
+    key.function = function;
+    key.hash     = std::hash<void const*>()(function);
+    key.args.clear();
+    key.args.reserve(argc);
+
+    for (int i = 0; i < argc; i++) {
+        if (!is_builtin(args[i])) {
+            return false;
+        }
+        key.hash = combine(key.hash, combine(std::size_t(args[i].tag()), args[i].hash()));
+        key.args.push_back(args[i]);
+    }
+    return true;
+}
+
+Value const* MemoCache::find(Key const& key) {
+    auto item = index.find(key);
+
+    if (item == index.end()) {
+        misses += 1;
+        return nullptr;
+    }
+
+    hits += 1;
+    entries.splice(entries.begin(), entries, item->second);
+    return &item->second->result;
+}
+
+void MemoCache::insert(Key key, Value result) {
+    if (capacity == 0 || !is_builtin(result) || index.count(key) > 0) {
+        return;
+    }
+
+    if (entries.size() >= capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+        evictions += 1;
+    }
+
+    entries.push_front(Entry{std::move(key), result});
+    index[entries.front().key] = entries.begin();
+}
+
+void MemoCache::clear() {
+    entries.clear();
+    index.clear();
+    hits      = 0;
+    misses    = 0;
+    evictions = 0;
+}
+
+void MemoCache::dump_memo_stats(std::ostream& out) const {
+    std::size_t calls = hits + misses;
+    double      rate  = calls > 0 ? double(hits) * 100.0 / double(calls) : 0.0;
+
+    out << fmt::format("{:>30} | {:>12}\n", "memo", "count");
+    out << fmt::format("{:>30} | {:12d}\n", "hits", hits);
+    out << fmt::format("{:>30} | {:12d}\n", "misses", misses);
+    out << fmt::format("{:>30} | {:12.2f}\n", "hit rate (%)", rate);
+    out << fmt::format("{:>30} | {:12d}\n", "evictions", evictions);
+    out << fmt::format("{:>30} | {:12d}\n", "entries", entries.size());
+    out << fmt::format("{:>30} | {:12d}\n", "capacity", capacity);
+}
+
+}  // namespace lython
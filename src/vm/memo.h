@@ -0,0 +1,66 @@
+#ifndef LYTHON_VM_MEMO_HEADER
+#define LYTHON_VM_MEMO_HEADER
+
+#include "ast/values/value.h"
+#include "dtypes.h"
+
+#include <ostream>
+
+namespace lython {
+
+/* Results of pure functions (see FunctionDef::pure) keyed by the callee and its arguments.
+ *
+ * Memoization is opt-in, an evaluator only consults the cache once it is given one.
+ * Only builtin values are remembered, arguments and results holding an object
+ * could be mutated between two calls.
+ *
+ * The cache holds at most `capacity` results, the least recently used one is evicted first.
+ */
+struct MemoCache {
+    struct Key {
+        void const*  function = nullptr;
+        Array<Value> args;
+        std::size_t  hash = 0;
+
+        bool operator==(Key const& other) const;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(Key const& key) const { return key.hash; }
+    };
+
+    MemoCache(std::size_t capacity = 4096): capacity(capacity) {}
+
+    // Builds the key of the call, false when an argument cannot be remembered
+    static bool make_key(void const* function, Value const* args, int argc, Key& key);
+
+    // Result of a previous call, counts a hit or a miss
+    Value const* find(Key const& key);
+
+    void insert(Key key, Value result);
+
+    void clear();
+
+    std::size_t size() const { return entries.size(); }
+
+    void dump_memo_stats(std::ostream& out) const;
+
+    std::size_t capacity  = 4096;
+    std::size_t hits      = 0;
+    std::size_t misses    = 0;
+    std::size_t evictions = 0;
+
+    private:
+    struct Entry {
+        Key   key;
+        Value result;
+    };
+
+    // Most recently used first
+    List<Entry>                                  entries;
+    Dict<Key, List<Entry>::iterator, KeyHash> index;
+};
+
+}  // namespace lython
+
+#endif
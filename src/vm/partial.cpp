@@ -0,0 +1,877 @@
+#include "vm/partial.h"
+#include "sema/purity.h"
+#include "vm/tree.h"
+
+namespace lython {
+
+namespace {
+
+// Values a Constant can hand to the VM and to codegen
+bool is_literal(Value const& value) {
+    switch (meta::ValueTypes(value.tag())) {
+    case meta::ValueTypes::i1:
+    case meta::ValueTypes::u64:
+    case meta::ValueTypes::i64:
+    case meta::ValueTypes::u32:
+    case meta::ValueTypes::i32:
+    case meta::ValueTypes::u16:
+    case meta::ValueTypes::i16:
+    case meta::ValueTypes::u8:
+    case meta::ValueTypes::i8:
+    case meta::ValueTypes::f32:
+    case meta::ValueTypes::f64:
+    case meta::ValueTypes::none: return true;
+    default: return false;
+    }
+}
+
+bool known_bool(ExprNode* expr, bool& value) {
+    Constant* cst = cast<Constant>(expr);
+    if (cst == nullptr || !cst->value.is_type<bool>()) {
+        return false;
+    }
+    value = cst->value.as<bool>();
+    return true;
+}
+
+void bind(ExprNode* target, Dict<StringRef, int>& names) {
+    if (Name* name = cast<Name>(target)) {
+        names[name->id] += 1;
+    } else if (TupleExpr* tuple = cast<TupleExpr>(target)) {
+        for (ExprNode* elt: tuple->elts) {
+            bind(elt, names);
+        }
+    } else if (ListExpr* list = cast<ListExpr>(target)) {
+        for (ExprNode* elt: list->elts) {
+            bind(elt, names);
+        }
+    } else if (Starred* starred = cast<Starred>(target)) {
+        bind(starred->value, names);
+    }
+}
+
+void bind(Pattern* pattern, Dict<StringRef, int>& names) {
+    auto bind_all = [&](Array<Pattern*> const& patterns) {
+        for (Pattern* p: patterns) {
+            bind(p, names);
+        }
+    };
+
+    if (MatchAs* as = cast<MatchAs>(pattern)) {
+        if (as->name.has_value()) {
+            names[as->name.value()] += 1;
+        }
+        if (as->pattern.has_value()) {
+            bind(as->pattern.value(), names);
+        }
+    } else if (MatchStar* star = cast<MatchStar>(pattern)) {
+        if (star->name.has_value()) {
+            names[star->name.value()] += 1;
+        }
+    } else if (MatchMapping* mapping = cast<MatchMapping>(pattern)) {
+        if (mapping->rest.has_value()) {
+            names[mapping->rest.value()] += 1;
+        }
+        bind_all(mapping->patterns);
+    } else if (MatchSequence* sequence = cast<MatchSequence>(pattern)) {
+        bind_all(sequence->patterns);
+    } else if (MatchOr* alternatives = cast<MatchOr>(pattern)) {
+        bind_all(alternatives->patterns);
+    } else if (MatchClass* cls = cast<MatchClass>(pattern)) {
+        bind_all(cls->patterns);
+        bind_all(cls->kwd_patterns);
+    }
+}
+
+// Counts the names bound by the statements of a scope,
+// nested functions and classes bind their name and only contribute their `global` declarations
+void bindings(Array<StmtNode*> const& body, Dict<StringRef, int>& names, Dict<StringRef, int>& globals) {
+    for (StmtNode* stmt: body) {
+        switch (stmt->kind) {
+        case NodeKind::Assign:
+            for (ExprNode* target: cast<Assign>(stmt)->targets) {
+                bind(target, names);
+            }
+            break;
+        case NodeKind::AnnAssign: bind(cast<AnnAssign>(stmt)->target, names); break;
+        case NodeKind::AugAssign: bind(cast<AugAssign>(stmt)->target, names); break;
+        case NodeKind::Delete:
+            for (ExprNode* target: cast<Delete>(stmt)->targets) {
+                bind(target, names);
+            }
+            break;
+        case NodeKind::For: {
+            For* n = cast<For>(stmt);
+            bind(n->target, names);
+            bindings(n->body, names, globals);
+            bindings(n->orelse, names, globals);
+            break;
+        }
+        case NodeKind::While: {
+            While* n = cast<While>(stmt);
+            bindings(n->body, names, globals);
+            bindings(n->orelse, names, globals);
+            break;
+        }
+        case NodeKind::If: {
+            If* n = cast<If>(stmt);
+            bindings(n->body, names, globals);
+            for (Array<StmtNode*> const& branch: n->bodies) {
+                bindings(branch, names, globals);
+            }
+            bindings(n->orelse, names, globals);
+            break;
+        }
+        case NodeKind::With: {
+            With* n = cast<With>(stmt);
+            for (WithItem& item: n->items) {
+                if (item.optional_vars.has_value()) {
+                    bind(item.optional_vars.value(), names);
+                }
+            }
+            bindings(n->body, names, globals);
+            break;
+        }
+        case NodeKind::Try: {
+            Try* n = cast<Try>(stmt);
+            bindings(n->body, names, globals);
+            for (ExceptHandler& handler: n->handlers) {
+                if (handler.name.has_value()) {
+                    names[handler.name.value()] += 1;
+                }
+                bindings(handler.body, names, globals);
+            }
+            bindings(n->orelse, names, globals);
+            bindings(n->finalbody, names, globals);
+            break;
+        }
+        case NodeKind::Match:
+            for (MatchCase& branch: cast<Match>(stmt)->cases) {
+                bind(branch.pattern, names);
+                bindings(branch.body, names, globals);
+            }
+            break;
+        case NodeKind::Inline: bindings(cast<Inline>(stmt)->body, names, globals); break;
+        case NodeKind::Import:
+            for (Alias& alias: cast<Import>(stmt)->names) {
+                names[alias.asname.has_value() ? alias.asname.value() : alias.name] += 1;
+            }
+            break;
+        case NodeKind::ImportFrom:
+            for (Alias& alias: cast<ImportFrom>(stmt)->names) {
+                names[alias.asname.has_value() ? alias.asname.value() : alias.name] += 1;
+            }
+            break;
+        case NodeKind::FunctionDef: {
+            FunctionDef* n = cast<FunctionDef>(stmt);
+            names[n->name] += 1;
+
+            Dict<StringRef, int> inner;
+            bindings(n->body, inner, globals);
+            break;
+        }
+        case NodeKind::ClassDef: {
+            ClassDef* n = cast<ClassDef>(stmt);
+            names[n->name] += 1;
+
+            Dict<StringRef, int> inner;
+            bindings(n->body, inner, globals);
+            break;
+        }
+        case NodeKind::Global:
+            for (Identifier name: cast<Global>(stmt)->names) {
+                globals[name] += 1;
+            }
+            break;
+        case NodeKind::Nonlocal:
+            for (Identifier name: cast<Nonlocal>(stmt)->names) {
+                names[name] += 1;
+            }
+            break;
+        default: break;
+        }
+    }
+}
+
+}  // namespace
+
+ModNode* PartialEvaluator::module(Module_t* n, int depth) {
+    root = n;
+
+    // Names declared `global` can be assigned from any function
+    Dict<StringRef, int> globals;
+    bindings(n->body, stores, globals);
+    for (auto& item: globals) {
+        stores[item.first] += 2;
+    }
+
+    fold_body(n->body, depth);
+    return n;
+}
+
+ModNode* PartialEvaluator::interactive(Interactive_t* n, int depth) { return n; }
+ModNode* PartialEvaluator::expression(Expression_t* n, int depth) { return n; }
+ModNode* PartialEvaluator::functiontype(FunctionType_t* n, int depth) { return n; }
+
+void PartialEvaluator::fold(ExprNode*& expr, int depth) {
+    if (expr != nullptr) {
+        expr = exec(expr, depth);
+    }
+}
+
+void PartialEvaluator::fold(Optional<ExprNode*>& expr, int depth) {
+    if (expr.has_value()) {
+        fold(expr.value(), depth);
+    }
+}
+
+void PartialEvaluator::fold(Array<ExprNode*>& exprs, int depth) {
+    for (ExprNode*& expr: exprs) {
+        fold(expr, depth);
+    }
+}
+
+void PartialEvaluator::fold_body(Array<StmtNode*>& body, int depth) {
+    Array<StmtNode*> folded_body;
+    folded_body.reserve(body.size());
+
+    for (StmtNode* stmt: body) {
+        if (If* branch = cast<If>(stmt)) {
+            if (fold_branches(branch, depth)) {
+                folded_body.insert(folded_body.end(), branch->body.begin(), branch->body.end());
+            } else {
+                folded_body.push_back(branch);
+            }
+            continue;
+        }
+
+        // Removed statements return null
+        if (StmtNode* result = exec(stmt, depth)) {
+            folded_body.push_back(result);
+        }
+    }
+
+    // Blocks cannot be empty
+    if (folded_body.empty() && !body.empty()) {
+        Pass* pass       = root->new_object<Pass>();
+        pass->lineno     = body[0]->lineno;
+        pass->col_offset = body[0]->col_offset;
+        folded_body.push_back(pass);
+    }
+
+    body = std::move(folded_body);
+}
+
+bool PartialEvaluator::fold_branches(If_t* n, int depth) {
+    nested += 1;
+
+    // The first branch is stored apart from the `elif`
+    Array<ExprNode*>          tests    = {n->test};
+    Array<Array<StmtNode*>*>  branches = {&n->body};
+    Array<Comment*>           comments = {nullptr};
+
+    for (int i = 0; i < n->tests.size(); i++) {
+        tests.push_back(n->tests[i]);
+        branches.push_back(&n->bodies[i]);
+        comments.push_back(i < n->tests_comment.size() ? n->tests_comment[i] : nullptr);
+    }
+
+    Array<ExprNode*>        kept_tests;
+    Array<Array<StmtNode*>> kept_bodies;
+    Array<Comment*>         kept_comments;
+
+    // Taken when none of the tests we kept are true
+    Array<StmtNode*> orelse = std::move(n->orelse);
+
+    for (int i = 0; i < tests.size(); i++) {
+        ExprNode* test = exec(tests[i], depth);
+        bool      value;
+
+        if (known_bool(test, value)) {
+            if (value) {
+                // The next branches are never reached
+                orelse = std::move(*branches[i]);
+                break;
+            }
+            continue;
+        }
+
+        kept_tests.push_back(test);
+        kept_bodies.push_back(std::move(*branches[i]));
+        kept_comments.push_back(comments[i]);
+    }
+
+    for (Array<StmtNode*>& body: kept_bodies) {
+        fold_body(body, depth);
+    }
+    fold_body(orelse, depth);
+    nested -= 1;
+
+    n->tests.clear();
+    n->bodies.clear();
+    n->tests_comment.clear();
+
+    if (kept_tests.empty()) {
+        Constant* taken   = root->new_object<Constant>(Value(true));
+        taken->lineno     = n->test->lineno;
+        taken->col_offset = n->test->col_offset;
+
+        n->test = taken;
+        n->body = std::move(orelse);
+        return true;
+    }
+
+    n->test   = kept_tests[0];
+    n->body   = std::move(kept_bodies[0]);
+    n->orelse = std::move(orelse);
+
+    for (int i = 1; i < kept_tests.size(); i++) {
+        n->tests.push_back(kept_tests[i]);
+        n->bodies.push_back(std::move(kept_bodies[i]));
+        n->tests_comment.push_back(kept_comments[i]);
+    }
+    return false;
+}
+
+void PartialEvaluator::record_constant(ExprNode* target, ExprNode* value) {
+    Name*     name = cast<Name>(target);
+    Constant* cst  = cast<Constant>(value);
+
+    if (name == nullptr || cst == nullptr || !scopes.empty() || nested > 0) {
+        return;
+    }
+
+    auto count = stores.find(name->id);
+    if (count != stores.end() && count->second == 1 && is_literal(cst->value)) {
+        constants[name->id] = cst;
+    }
+}
+
+ExprNode* PartialEvaluator::evaluate(ExprNode* n) {
+    TreeEvaluator eval;
+    // Unboxed functions run natively, only the tree evaluator spends the budget
+    eval.use_unboxed = false;
+    eval.budget      = budget;
+
+    for (auto& item: functions) {
+        eval.add_variable(item.first, make_value<Node*>(item.second));
+    }
+    for (auto& item: constants) {
+        eval.add_variable(item.first, item.second->value);
+    }
+
+    Value result = eval.exec(n, 0);
+
+    if (eval.has_exceptions()) {
+        kwdebug(outlog(), "Call left to the runtime {}", str(n));
+        return n;
+    }
+    return replace(n, result);
+}
+
+ExprNode* PartialEvaluator::replace(ExprNode* n, Value value) {
+    if (!is_literal(value)) {
+        return n;
+    }
+
+    Constant* cst   = root->new_object<Constant>(value);
+    cst->lineno     = n->lineno;
+    cst->col_offset = n->col_offset;
+
+    folded += 1;
+    return cst;
+}
+
+bool PartialEvaluator::is_local(StringRef name) const {
+    for (Set<StringRef> const& scope: scopes) {
+        if (scope.count(name) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Constant* PartialEvaluator::known(StringRef name) const {
+    auto cst = constants.find(name);
+    if (cst == constants.end()) {
+        return nullptr;
+    }
+    return cst->second;
+}
+
+FunctionDef* PartialEvaluator::callee(Call_t* n) const {
+    Name* name = cast<Name>(n->func);
+
+    if (name == nullptr || !n->keywords.empty() || !n->varargs.empty()) {
+        return nullptr;
+    }
+
+    auto fun = functions.find(name->id);
+    if (fun == functions.end() || fun->second->args.args.size() != n->args.size()) {
+        return nullptr;
+    }
+    return fun->second;
+}
+
+bool PartialEvaluator::foldable(FunctionDef* fun) {
+    auto cached = checked.find(fun);
+
+    if (cached != checked.end()) {
+        Foldable const& previous = cached->second;
+
+        if (previous.value || previous.known == constants.size()) {
+            return previous.value;
+        }
+    }
+
+    Set<FunctionDef*> visited;
+    bool              value = foldable(fun, visited);
+
+    checked[fun] = Foldable{value, constants.size()};
+    return value;
+}
+
+// Compile time rules of the purity check, module names have to be known constants
+struct PartialEvaluator::FoldableCheck: public PurityCheck {
+    FoldableCheck(PartialEvaluator& partial, Set<FunctionDef*>& visited):
+        partial(partial), visited(visited) {
+        strict = true;
+    }
+
+    bool global(Name* name) override { return partial.known(name->id) != nullptr; }
+
+    bool call(Call* call, Name* func) override {
+        FunctionDef* fun = partial.callee(call);
+        return fun != nullptr && partial.foldable(fun, visited);
+    }
+
+    PartialEvaluator&  partial;
+    Set<FunctionDef*>& visited;
+};
+
+bool PartialEvaluator::foldable(FunctionDef* fun, Set<FunctionDef*>& visited) {
+    // Recursive calls are checked once
+    if (!visited.insert(fun).second) {
+        return true;
+    }
+
+    FoldableCheck check(*this, visited);
+    return check.function(fun);
+}
+
+// Expressions
+// -----------
+
+ExprNode* PartialEvaluator::constant(Constant_t* n, int depth) { return n; }
+
+ExprNode* PartialEvaluator::name(Name_t* n, int depth) {
+    if (n->ctx != ExprContext::Load || is_local(n->id)) {
+        return n;
+    }
+
+    Constant* value = known(n->id);
+    if (value == nullptr) {
+        return n;
+    }
+    return replace(n, value->value);
+}
+
+ExprNode* PartialEvaluator::binop(BinOp_t* n, int depth) {
+    fold(n->left, depth);
+    fold(n->right, depth);
+
+    Constant* lhs = cast<Constant>(n->left);
+    Constant* rhs = cast<Constant>(n->right);
+
+    // Script operators are only run through calls
+    if (lhs == nullptr || rhs == nullptr || n->native_operator == nullptr ||
+        !safe_division(n->op, rhs)) {
+        return n;
+    }
+    return replace(n, binary_invoke(nullptr, n->native_operator, lhs->value, rhs->value));
+}
+
+ExprNode* PartialEvaluator::unaryop(UnaryOp_t* n, int depth) {
+    fold(n->operand, depth);
+
+    Constant* operand = cast<Constant>(n->operand);
+    if (operand == nullptr || n->native_operator == nullptr) {
+        return n;
+    }
+    return replace(n, unary_invoke(nullptr, n->native_operator, operand->value));
+}
+
+ExprNode* PartialEvaluator::boolop(BoolOp_t* n, int depth) {
+    fold(n->values, depth);
+
+    // `or` stops on the first true value, `and` on the first false
+    bool decides = n->op == BoolOperator::Or;
+
+    Array<ExprNode*> values;
+    values.reserve(n->values.size());
+
+    for (int i = 0; i < n->values.size(); i++) {
+        ExprNode* value = n->values[i];
+        bool      last  = i + 1 == n->values.size();
+        bool      known;
+
+        if (!known_bool(value, known)) {
+            values.push_back(value);
+            continue;
+        }
+
+        // The operands after it are never evaluated
+        if (known == decides) {
+            values.push_back(value);
+            break;
+        }
+
+        // `a and True and b` is `a and b`, the last operand is the result
+        if (last) {
+            values.push_back(value);
+        }
+    }
+
+    if (values.size() == 1) {
+        if (cast<Constant>(values[0]) != nullptr) {
+            folded += 1;
+        }
+        return values[0];
+    }
+
+    n->values  = std::move(values);
+    n->opcount = int(n->values.size()) - 1;
+    return n;
+}
+
+ExprNode* PartialEvaluator::compare(Compare_t* n, int depth) {
+    fold(n->left, depth);
+    fold(n->comparators, depth);
+
+    Constant* left = cast<Constant>(n->left);
+    if (left == nullptr || n->native_operator.size() != n->comparators.size()) {
+        return n;
+    }
+
+    for (int i = 0; i < n->comparators.size(); i++) {
+        if (cast<Constant>(n->comparators[i]) == nullptr || n->native_operator[i] == nullptr) {
+            return n;
+        }
+    }
+
+    // `a < b < c` is `a < b and b < c`
+    Value lhs    = left->value;
+    bool  result = true;
+
+    for (int i = 0; i < n->comparators.size() && result; i++) {
+        Value rhs = cast<Constant>(n->comparators[i])->value;
+        result    = binary_invoke(nullptr, n->native_operator[i], lhs, rhs).as<bool>();
+        lhs       = rhs;
+    }
+    return replace(n, Value(result));
+}
+
+ExprNode* PartialEvaluator::ifexp(IfExp_t* n, int depth) {
+    fold(n->test, depth);
+
+    bool taken;
+    if (known_bool(n->test, taken)) {
+        return exec(taken ? n->body : n->orelse, depth);
+    }
+
+    fold(n->body, depth);
+    fold(n->orelse, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::call(Call_t* n, int depth) {
+    fold(n->args, depth);
+    fold(n->varargs, depth);
+    for (Keyword& keyword: n->keywords) {
+        fold(keyword.value, depth);
+    }
+
+    Name* name = cast<Name>(n->func);
+    if (name == nullptr || is_local(name->id)) {
+        return n;
+    }
+
+    FunctionDef* fun = callee(n);
+    if (fun == nullptr) {
+        return n;
+    }
+
+    for (ExprNode* arg: n->args) {
+        if (cast<Constant>(arg) == nullptr) {
+            return n;
+        }
+    }
+
+    if (!foldable(fun)) {
+        return n;
+    }
+    return evaluate(n);
+}
+
+ExprNode* PartialEvaluator::namedexpr(NamedExpr_t* n, int depth) {
+    fold(n->value, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::dictexpr(DictExpr_t* n, int depth) {
+    fold(n->keys, depth);
+    fold(n->values, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::setexpr(SetExpr_t* n, int depth) {
+    fold(n->elts, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::listexpr(ListExpr_t* n, int depth) {
+    fold(n->elts, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::tupleexpr(TupleExpr_t* n, int depth) {
+    fold(n->elts, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::yield(Yield_t* n, int depth) {
+    fold(n->value, depth);
+    return n;
+}
+
+ExprNode* PartialEvaluator::subscript(Subscript_t* n, int depth) {
+    fold(n->slice, depth);
+    return n;
+}
+
+// Parameters and comprehension targets shadow the module names
+ExprNode* PartialEvaluator::lambda(Lambda_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::listcomp(ListComp_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::generateexpr(GeneratorExp_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::setcomp(SetComp_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::dictcomp(DictComp_t* n, int depth) { return n; }
+
+ExprNode* PartialEvaluator::await(Await_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::yieldfrom(YieldFrom_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::joinedstr(JoinedStr_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::formattedvalue(FormattedValue_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::attribute(Attribute_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::starred(Starred_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::slice(Slice_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::exported(Exported_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::placeholder(Placeholder_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::comment(Comment_t* n, int depth) { return n; }
+
+ExprNode* PartialEvaluator::dicttype(DictType_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::arraytype(ArrayType_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::tupletype(TupleType_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::arrow(Arrow_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::classtype(ClassType_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::settype(SetType_t* n, int depth) { return n; }
+ExprNode* PartialEvaluator::builtintype(BuiltinType_t* n, int depth) { return n; }
+
+// Statements
+// ----------
+
+StmtNode* PartialEvaluator::functiondef(FunctionDef_t* n, int depth) {
+    // Defaults are evaluated in the enclosing scope
+    fold(n->args.defaults, depth);
+
+    // Module functions can be called at compile time once defined
+    auto count = stores.find(n->name);
+    if (scopes.empty() && nested == 0 && count != stores.end() && count->second == 1) {
+        functions[n->name] = n;
+    }
+
+    Set<StringRef> names;
+    for (Arg const& arg: n->args.posonlyargs) {
+        names.insert(arg.arg);
+    }
+    for (Arg const& arg: n->args.args) {
+        names.insert(arg.arg);
+    }
+    for (Arg const& arg: n->args.kwonlyargs) {
+        names.insert(arg.arg);
+    }
+    if (n->args.vararg.has_value()) {
+        names.insert(n->args.vararg.value().arg);
+    }
+    if (n->args.kwarg.has_value()) {
+        names.insert(n->args.kwarg.value().arg);
+    }
+
+    Dict<StringRef, int> bound;
+    Dict<StringRef, int> globals;
+    bindings(n->body, bound, globals);
+
+    for (auto& item: bound) {
+        names.insert(item.first);
+    }
+    for (auto& item: globals) {
+        names.insert(item.first);
+    }
+
+    scopes.push_back(std::move(names));
+    fold_body(n->body, depth);
+    scopes.pop_back();
+    return n;
+}
+
+StmtNode* PartialEvaluator::classdef(ClassDef_t* n, int depth) {
+    Dict<StringRef, int> bound;
+    Dict<StringRef, int> globals;
+    bindings(n->body, bound, globals);
+
+    Set<StringRef> names;
+    for (auto& item: bound) {
+        names.insert(item.first);
+    }
+
+    scopes.push_back(std::move(names));
+    fold_body(n->body, depth);
+    scopes.pop_back();
+    return n;
+}
+
+StmtNode* PartialEvaluator::returnstmt(Return_t* n, int depth) {
+    fold(n->value, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::assign(Assign_t* n, int depth) {
+    fold(n->value, depth);
+
+    if (n->targets.size() == 1) {
+        record_constant(n->targets[0], n->value);
+    }
+    return n;
+}
+
+StmtNode* PartialEvaluator::annassign(AnnAssign_t* n, int depth) {
+    fold(n->value, depth);
+
+    if (n->value.has_value()) {
+        record_constant(n->target, n->value.value());
+    }
+    return n;
+}
+
+StmtNode* PartialEvaluator::augassign(AugAssign_t* n, int depth) {
+    fold(n->value, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::exprstmt(Expr_t* n, int depth) {
+    fold(n->value, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::assertstmt(Assert_t* n, int depth) {
+    fold(n->test, depth);
+
+    // Always true, the check is dropped
+    bool value;
+    if (known_bool(n->test, value) && value) {
+        return nullptr;
+    }
+
+    fold(n->msg, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::raise(Raise_t* n, int depth) {
+    fold(n->exc, depth);
+    fold(n->cause, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::ifstmt(If_t* n, int depth) {
+    fold_branches(n, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::whilestmt(While_t* n, int depth) {
+    nested += 1;
+    fold(n->test, depth);
+    fold_body(n->body, depth);
+    fold_body(n->orelse, depth);
+    nested -= 1;
+    return n;
+}
+
+StmtNode* PartialEvaluator::forstmt(For_t* n, int depth) {
+    nested += 1;
+    fold(n->iter, depth);
+    fold_body(n->body, depth);
+    fold_body(n->orelse, depth);
+    nested -= 1;
+    return n;
+}
+
+StmtNode* PartialEvaluator::with(With_t* n, int depth) {
+    nested += 1;
+    for (WithItem& item: n->items) {
+        fold(item.context_expr, depth);
+    }
+    fold_body(n->body, depth);
+    nested -= 1;
+    return n;
+}
+
+StmtNode* PartialEvaluator::trystmt(Try_t* n, int depth) {
+    nested += 1;
+    fold_body(n->body, depth);
+    for (ExceptHandler& handler: n->handlers) {
+        fold_body(handler.body, depth);
+    }
+    fold_body(n->orelse, depth);
+    fold_body(n->finalbody, depth);
+    nested -= 1;
+    return n;
+}
+
+StmtNode* PartialEvaluator::match(Match_t* n, int depth) {
+    fold(n->subject, depth);
+
+    nested += 1;
+    for (MatchCase& branch: n->cases) {
+        fold(branch.guard, depth);
+        fold_body(branch.body, depth);
+    }
+    nested -= 1;
+    return n;
+}
+
+StmtNode* PartialEvaluator::inlinestmt(Inline_t* n, int depth) {
+    fold_body(n->body, depth);
+    return n;
+}
+
+StmtNode* PartialEvaluator::invalidstmt(InvalidStatement_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::deletestmt(Delete_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::import(Import_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::importfrom(ImportFrom_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::global(Global_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::nonlocal(Nonlocal_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::pass(Pass_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::breakstmt(Break_t* n, int depth) { return n; }
+StmtNode* PartialEvaluator::continuestmt(Continue_t* n, int depth) { return n; }
+
+// Patterns
+// --------
+
+Pattern* PartialEvaluator::matchvalue(MatchValue_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchsingleton(MatchSingleton_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchsequence(MatchSequence_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchmapping(MatchMapping_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchclass(MatchClass_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchstar(MatchStar_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchas(MatchAs_t* n, int depth) { return n; }
+Pattern* PartialEvaluator::matchor(MatchOr_t* n, int depth) { return n; }
+
+}  // namespace lython
@@ -0,0 +1,133 @@
+#ifndef LYTHON_VM_PARTIAL_HEADER
+#define LYTHON_VM_PARTIAL_HEADER
+
+#include "ast/nodes.h"
+#include "ast/visitor.h"
+
+namespace lython {
+
+struct PartialEvaluatorTrait {
+    using StmtRet = StmtNode*;
+    using ExprRet = ExprNode*;
+    using ModRet  = ModNode*;
+    using PatRet  = Pattern*;
+    using Trace   = std::true_type;
+
+    enum
+    { MaxRecursionDepth = LY_MAX_VISITOR_RECURSION_DEPTH };
+};
+
+/* Partial evaluation of an analysed module, runs between SEMA and the VM or codegen.
+ *
+ * Expressions whose inputs are known at compile time are replaced by a Constant,
+ * the others are kept as residual code with their known operands folded.
+ *
+ * .. code-block:: python
+ *
+ *    SIZE = 4 * 1024                  # SIZE = 4096
+ *
+ *    def blocks(n: i32) -> i32:
+ *        return n // SIZE + 1         # return n // 4096 + 1
+ *
+ *    count = blocks(SIZE * 3)         # count = 4
+ *
+ * Known values are literals, module names assigned once at the top level and calls
+ * to pure script functions with known arguments. Calls are run by the TreeEvaluator
+ * under a budget, a call that raises or runs out of budget is left to the runtime.
+ *
+ * Branches with a known test are removed, the statements of the branch taken replace the `if`.
+ *
+ * Nodes are rewritten in place, the SEMA annotations of the residual nodes stay valid.
+ * Names assigned through `:=` are not tracked.
+ */
+struct PartialEvaluator: public BaseVisitor<PartialEvaluator, false, PartialEvaluatorTrait> {
+    using Super = BaseVisitor<PartialEvaluator, false, PartialEvaluatorTrait>;
+
+#define FUNCTION_GEN(name, fun, rtype) rtype fun(name##_t* n, int depth);
+
+#define X(name, _)
+#define SSECTION(name)
+#define EXPR(name, fun)  FUNCTION_GEN(name, fun, ExprNode*)
+#define STMT(name, fun)  FUNCTION_GEN(name, fun, StmtNode*)
+#define MOD(name, fun)   FUNCTION_GEN(name, fun, ModNode*)
+#define MATCH(name, fun) FUNCTION_GEN(name, fun, Pattern*)
+#define VM(name, fun)
+
+    NODEKIND_ENUM(X, SSECTION, EXPR, STMT, MOD, MATCH, VM)
+
+#undef X
+#undef SSECTION
+#undef EXPR
+#undef STMT
+#undef MOD
+#undef MATCH
+#undef VM
+
+#undef FUNCTION_GEN
+
+    // Calls and loop iterations a single compile time call can use
+    int budget = 100000;
+
+    // Number of expressions replaced by a constant
+    int folded = 0;
+
+    private:
+    void fold(ExprNode*& expr, int depth);
+    void fold(Optional<ExprNode*>& expr, int depth);
+    void fold(Array<ExprNode*>& exprs, int depth);
+
+    // Folds the statements, resolved branches are spliced in and removed statements dropped
+    void fold_body(Array<StmtNode*>& body, int depth);
+
+    // Removes the branches with a known test,
+    // true when the branch taken is known, its statements are left in `n->body`
+    bool fold_branches(If_t* n, int depth);
+
+    // Records `name = <constant>` at the top level of the module
+    void record_constant(ExprNode* target, ExprNode* value);
+
+    // Runs an expression with known inputs in the tree evaluator
+    ExprNode* evaluate(ExprNode* n);
+
+    // Constant holding the value, the node is kept when the value cannot be a literal
+    ExprNode* replace(ExprNode* n, Value value);
+
+    bool      is_local(StringRef name) const;
+    Constant* known(StringRef name) const;
+
+    // Script function called by name, only module functions that are never reassigned
+    FunctionDef* callee(Call_t* n) const;
+
+    // The body only reads its arguments, locals and known names,
+    // and only calls foldable functions
+    bool foldable(FunctionDef* fun);
+    bool foldable(FunctionDef* fun, Set<FunctionDef*>& visited);
+
+    struct FoldableCheck;
+
+    Module* root = nullptr;
+
+    // Number of assignments of each module name
+    Dict<StringRef, int> stores;
+
+    // Module names with a known value, and the functions that can be called by name
+    Dict<StringRef, Constant*>    constants;
+    Dict<StringRef, FunctionDef*> functions;
+
+    // Names bound by the functions and classes being folded, they shadow the module names
+    Array<Set<StringRef>> scopes;
+
+    // Statements nested in a control flow block of the module are not always executed
+    int nested = 0;
+
+    // A negative answer is only kept until new constants are known
+    struct Foldable {
+        bool        value;
+        std::size_t known;
+    };
+    Dict<FunctionDef*, Foldable> checked;
+};
+
+}  // namespace lython
+
+#endif
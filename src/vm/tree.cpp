@@ -1,13 +1,14 @@
 
 #include "vm/tree.h"
+#include "vm/unboxed.h"
+#include "builtin/operators.h"
 #include "ast/values/exception.h"
 #include "dependencies/formatter.h"
 #include "dtypes.h"
 #include "logging/logging.h"
 #include "parser/parsing_error.h"
 #include "utilities/guard.h"
-
-#define MAKE_NAME(type, name) ((StringStream() << type << (name)).str())
+#include "utilities/stopwatch.h"
 
 namespace lython {
 template<typename T>
@@ -26,20 +27,22 @@ void pop(Array<T>& array, CodeLocation const& loc) {
     }, variables.size())               
 
 
-#define KW_EXEC_BLOCK_BODY(body, start, dbname, tryhandler, withhandler)            \
+#define KW_EXEC_BLOCK_BODY(body, start, owner_node, tryhandler, withhandler)        \
     {                                                                               \
         auto* blocks = get_blocks();                                                \
         ExecBlock& _block = blocks->emplace_back();                                 \
         kwdebug(outlog(), "Insert block {} {}", (void*)blocks, blocks->size());     \
-        _block.block      = (body);                                                 \
-        _block.name       = (dbname);                                               \
+        _block.block      = &(body);                                                \
+        _block.owner      = (owner_node);                                           \
         _block.exception_handler = tryhandler;                                      \
         _block.resources         = withhandler;                                     \
         _block.i = start;                                                           \
-        for (int i = start; i < body.size(); i++) {                                 \
-            StmtNode* stmt = body[i];                                               \
+        /* nested blocks can reallocate the array, the block is found by index */   \
+        std::size_t _block_index = blocks->size() - 1;                              \
+        for (int i = start; i < (body).size(); i++) {                               \
+            StmtNode* stmt = (body)[i];                                             \
             exec(stmt, depth);                                                      \
-            _block.i = i + 1;                                                       \
+            (*get_blocks())[_block_index].i = i + 1;                                \
             if (has_exceptions()) {                                                 \
                 pop(*get_blocks(), LOC);                                            \
                 return flag::done();                                                \
@@ -57,7 +60,7 @@ void pop(Array<T>& array, CodeLocation const& loc) {
     }
 
 
-#define EXEC_BODY(body, start, dbname) KW_EXEC_BLOCK_BODY(body, start, dbname, nullptr, {})
+#define EXEC_BODY(body, start, owner_node) KW_EXEC_BLOCK_BODY(body, start, owner_node, nullptr, {})
 
 struct EvaluationResult {};
 
@@ -86,11 +89,19 @@ namespace flag {
 // }
 
 
+String ExecBlock::name() const {
+    if (owner == nullptr) {
+        return "block";
+    }
+    if (FunctionDef* fun = cast<FunctionDef>(owner)) {
+        return str(owner->kind) + " " + str(fun->name);
+    }
+    return str(owner->kind);
+}
+
 Value TreeEvaluator::execbody(Array<StmtNode*>& body, Array<StmtNode*>& newbod, int depth) {
     ExecBlock& block = get_blocks()->emplace_back();
-    block.block      = newbod;
-    block.name = "here";
-    auto* blocks = get_blocks();
+    block.block      = &newbod;
 
     for (int i = 0; i < body.size(); i++) {
         block.i          = i + 1;
@@ -103,7 +114,7 @@ Value TreeEvaluator::execbody(Array<StmtNode*>& body, Array<StmtNode*>& newbod,
 
         // We cannot proceed, essentially found a compile time issue
         if (has_exceptions()) {
-            pop(*blocks, LOC);
+            pop(*get_blocks(), LOC);
             return flag::done();
         }
 
@@ -113,36 +124,195 @@ Value TreeEvaluator::execbody(Array<StmtNode*>& body, Array<StmtNode*>& newbod,
         // if not we can return right away
         if (has_returned()) {
             if (!yielding) {
-                    pop(*blocks, LOC);
+                    pop(*get_blocks(), LOC);
                     return flag::done();
                 }
                 return flag::paused();
         }
     }
-    pop(*blocks, LOC);
+    pop(*get_blocks(), LOC);
     return flag::done();
 }
-void TreeEvaluator::raise_exception(Value exception, Value cause) {
-    // Create the exception object
 
-    _LyException* except = root.new_object<_LyException>(traces);
+using PauseWatch = StopWatch<double, std::chrono::duration<double, std::micro>>;
+
+void TreeEvaluator::collect_garbage() {
+    PauseWatch pause;
+
+    // the collection in progress might have missed the latest garbage
+    finish_collection();
+    start_collection();
+    finish_collection();
+
+    heap.record_pause(RuntimeHeap::Pause::Final, pause.stop());
+}
+
+void TreeEvaluator::collect_nursery() {
+    PauseWatch pause;
+
+    mark_roots(RuntimeHeap::Collection::Minor);
+    heap.sweep();
+
+    heap.record_pause(RuntimeHeap::Pause::Minor, pause.stop());
+}
+
+void TreeEvaluator::collect_step() {
+    if (heap.get_quantum() == 0) {
+        return collect_garbage();
+    }
+
+    PauseWatch pause;
+
+    switch (heap.get_phase()) {
+    case RuntimeHeap::Phase::Idle: start_collection(); break;
+    case RuntimeHeap::Phase::Marking:
+        if (heap.step(heap.get_quantum())) {
+            finish_collection();
+            heap.record_pause(RuntimeHeap::Pause::Final, pause.stop());
+            return;
+        }
+        break;
+    case RuntimeHeap::Phase::Sweeping: heap.step(heap.get_quantum()); break;
+    }
+
+    heap.record_pause(RuntimeHeap::Pause::Increment, pause.stop());
+}
+
+void TreeEvaluator::start_collection() {
+    // The marking does not trace the nursery, the objects behind young ones
+    // would only be found at the end
+    mark_roots(RuntimeHeap::Collection::Minor);
+    heap.sweep();
+
+    mark_roots(RuntimeHeap::Collection::Full);
+}
+
+void TreeEvaluator::finish_collection() {
+    // The frames changed since the marking started, the young objects
+    // and the roots give the objects the marking could not see
+    if (heap.get_phase() == RuntimeHeap::Phase::Marking) {
+        mark_roots(RuntimeHeap::Collection::Minor);
+        heap.sweep();
+
+        mark_roots(RuntimeHeap::Collection::Full);
+        heap.sweep();
+    }
+
+    // frees what the steps did not sweep yet
+    if (heap.get_phase() == RuntimeHeap::Phase::Sweeping) {
+        heap.step(std::size_t(-1));
+    }
+}
+
+void TreeEvaluator::mark_roots(RuntimeHeap::Collection kind) {
+    heap.begin(kind);
+
+    // Frames of the running calls, a suspended generator holds its own
+    for (ValuePair& var: variables) {
+        heap.mark(var.value);
+    }
+
+    // Copies of these are held by the C++ stack, they cannot move
+    for (Value const& value: temporaries) {
+        heap.pin(value);
+    }
+    for (Value const& value: tail_args) {
+        heap.pin(value);
+    }
+    heap.pin(return_value);
+    heap.pin(method_value);
+    heap.pin(cause);
+
+    // Generators being resumed hold the frame of their caller
+    for (Generator* gen: gens) {
+        heap.mark(gen);
+    }
+    for (_LyException* except: exceptions) {
+        heap.mark(except);
+    }
+    for (StackTrace const& trace: traces) {
+        for (ExecBlock const& block: trace.blocks) {
+            for (Value const& resource: block.resources) {
+                heap.pin(resource);
+            }
+        }
+    }
+}
+
+int       runtime_class_id(ClassDef* class_t);
+ClassDef* exception_class(Value exception);
+
+void TreeEvaluator::raise_exception(Value exception, Value cause, StmtNode const* origin) {
+    if (origin != nullptr) {
+        get_trace().stmt = origin;
+    }
+
+    // Create the exception object, the values it wraps are only held by the caller
+    auto KW_IDT(_) = new_temporaries();
+    temporaries.push_back(exception);
+    temporaries.push_back(cause);
+
+    _LyException* except = new_object<_LyException>(traces);
     except->custom       = exception;
     except->cause        = cause;
     except->traces       = traces;
+    except->class_t      = exception_class(exception);
+
+    if (except->class_t != nullptr) {
+        except->runtime_id = runtime_class_id(except->class_t);
+    }
 
     exceptions.push_back(except);
 }
 
+bool TreeEvaluator::is_subclass(ClassDef* class_t, int class_id, int depth) {
+    if (class_t == nullptr) {
+        return false;
+    }
+    if (runtime_class_id(class_t) == class_id) {
+        return true;
+    }
+
+    // Bases are only resolved when an exception is being matched
+    for (ExprNode* base: class_t->bases) {
+        if (is_subclass(exception_class(exec(base, depth)), class_id, depth)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TreeEvaluator::handles(ExprNode* handler_type, _LyException* exception, int depth) {
+    if (exception == nullptr || exception->class_t == nullptr) {
+        return false;
+    }
+
+    // except (ValueError, TypeError):
+    if (TupleExpr* types = cast<TupleExpr>(handler_type)) {
+        for (ExprNode* type: types->elts) {
+            if (handles(type, exception, depth)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ClassDef* handler_class = exception_class(exec(handler_type, depth));
+    if (handler_class == nullptr) {
+        return false;
+    }
+    return is_subclass(exception->class_t, runtime_class_id(handler_class), depth);
+}
+
 Value TreeEvaluator::exported(Exported* n, int depth) { return nullptr; }
 
 Value TreeEvaluator::compare(Compare_t* n, int depth) {
 
     // a and b and c and d
     //
-    Value left = exec(n->left, depth);
-
-    Array<Value> partials;
-    partials.reserve(n->comparators.size());
+    auto  KW_IDT(_) = new_temporaries();
+    Value left      = exec(n->left, depth);
+    temporaries.push_back(left);
 
     bool bnative   = !n->native_operator.empty();
     bool full_eval = true;
@@ -150,7 +320,6 @@ Value TreeEvaluator::compare(Compare_t* n, int depth) {
 
     for (int i = 0; i < n->comparators.size(); i++) {
         Value right = exec(n->comparators[i], depth);
-        partials.push_back(right);
 
         if (is_concrete(left) && is_concrete(right)) {
             Value value;
@@ -162,7 +331,7 @@ Value TreeEvaluator::compare(Compare_t* n, int depth) {
                 value = exec(n->resolved_operator[i], depth);
 
             } else if (bnative) {
-                Function native = n->native_operator[i];
+                BinaryFunction native = n->native_operator[i];
                 lyassert(native, "Operator needs to be set");
 
                 value = binary_invoke((void*)this, native, left, right);
@@ -178,6 +347,7 @@ Value TreeEvaluator::compare(Compare_t* n, int depth) {
             }
 
             left = right;
+            temporaries.push_back(left);
         } else {
             full_eval = false;
         }
@@ -206,7 +376,9 @@ Value TreeEvaluator::compare(Compare_t* n, int depth) {
 Value TreeEvaluator::boolop(BoolOp_t* n, int depth) {
     // a and b or c and d
     //
-    Value first = exec(n->values[0], depth);
+    auto  KW_IDT(_) = new_temporaries();
+    Value first     = exec(n->values[0], depth);
+    temporaries.push_back(first);
 
     Array<Value> partials;
     partials.reserve(n->values.size());
@@ -224,6 +396,7 @@ Value TreeEvaluator::boolop(BoolOp_t* n, int depth) {
     for (int i = 1; i < n->values.size(); i++) {
         Value second = exec(n->values[i], depth);
         partials.push_back(second);
+        temporaries.push_back(second);
 
         if (is_concrete(first) && is_concrete(second)) {
             Value value;
@@ -276,7 +449,10 @@ Value TreeEvaluator::boolop(BoolOp_t* n, int depth) {
 
 Value TreeEvaluator::binop(BinOp_t* n, int depth) {
 
-    auto lhs = exec(n->left, depth);
+    auto KW_IDT(_) = new_temporaries();
+    auto lhs       = exec(n->left, depth);
+    temporaries.push_back(lhs);
+
     auto rhs = exec(n->right, depth);
 
     // TODO: if they evaluate to constant that belong to the value root
@@ -398,6 +574,18 @@ Value TreeEvaluator::ifexp(IfExp_t* n, int depth) {
 }
 
 Value TreeEvaluator::call_native(Call_t* call, FunctionDef_t* function, int depth) {
+    auto KW_IDT(_) = new_temporaries();
+
+    // Arguments were checked by SEMA, call the native function directly
+    if (call->native_typed && function->native_direct && call->args.size() <= max_direct_args) {
+        Value args[max_direct_args];
+        for (int i = 0; i < call->args.size(); i++) {
+            args[i] = exec(call->args[i], depth);
+            temporaries.push_back(args[i]);
+        }
+        return function->native_direct((void*)this, args);
+    }
+
     Array<Value> args;
     StackTrace&  trace = traces[traces.size() - 1];
 
@@ -412,6 +600,7 @@ Value TreeEvaluator::call_native(Call_t* call, FunctionDef_t* function, int dept
     for (int i = 0; i < call->args.size(); i++) {
         Value arg = exec(call->args[i], depth);
         args.push_back(arg);
+        temporaries.push_back(arg);
 
         if (!is_concrete(arg)) {
             // trace.args.push_back(value);
@@ -422,6 +611,7 @@ Value TreeEvaluator::call_native(Call_t* call, FunctionDef_t* function, int dept
     Value ret_result;
 
     if (compile_time) {
+        ret_result = function->native((void*)this, args);
         // ConstantValue result = function->native_function(&root, value_args);
         // ret_result = function->native(&root, trace.args);
         // ret_result           = root.new_object<Constant>(result);
@@ -436,63 +626,250 @@ Value TreeEvaluator::call_native(Call_t* call, FunctionDef_t* function, int dept
 
     return ret_result;
 }
-Value TreeEvaluator::call_script(Call_t* call, FunctionDef_t* function, int depth) {
+bool TreeEvaluator::tail_call(Call_t* call, int depth) {
+    if (!get_trace().tail_calls) {
+        return false;
+    }
+
+    Value function = exec(call->func, depth);
+    if (!function.is_valid<Node*>()) {
+        return false;
+    }
+
+    FunctionDef* callee = cast<FunctionDef>(function.as<Node*>());
+    if (callee == nullptr || callee->native || callee->generator ||
+        callee->args.args.size() != call->args.size()) {
+        return false;
+    }
+
+    // Arguments can make calls of their own, they are only handed over once evaluated
+    auto         KW_IDT(_) = new_temporaries();
+    Array<Value> args;
+    args.reserve(call->args.size());
+
+    for (ExprNode* arg: call->args) {
+        args.push_back(exec(arg, depth));
+        temporaries.push_back(args.back());
+    }
+
+    if (!has_exceptions()) {
+        tail_function = callee;
+        tail_args     = std::move(args);
+    }
+    return true;
+}
+
+Value TreeEvaluator::call_script(Call_t* call, FunctionDef_t* function, int depth, Value const* self) {
     auto KW_IDT(_) = new_scope();
+    auto KW_IDT(_) = new_frame();
+    int  scope     = int(variables.size());
 
     bool partial_call = false;
 
-    // insert arguments to the context
+    // Most calls fit in the small buffer
+    Value        small[8];
+    Array<Value> large;
+    Value*       args  = small;
+    int          count = 0;
+
+    if (call->args.size() + 1 > 8) {
+        large.resize(call->args.size() + 1);
+        args = large.data();
+    }
+
+    if (self != nullptr) {
+        args[count++] = *self;
+    }
+
+    // the arguments are only held by `args` until they are added to the frame
+    auto KW_IDT(_) = new_temporaries();
     for (int i = 0; i < call->args.size(); i++) {
-        Value arg = exec(call->args[i], depth);
+        args[count] = exec(call->args[i], depth);
+        temporaries.push_back(args[count++]);
+    }
 
-        if (is_concrete(arg)) {
-            partial_call = true;
+    // A pure function called with the same arguments returns the same value,
+    // functions reached through a tail call return it as well
+    MemoCache::Key  key;
+    MemoCache::Key* memo_key = nullptr;
+
+    if (memo != nullptr && function->pure && !has_exceptions() &&
+        MemoCache::make_key(function, args, count, key)) {
+        if (Value const* result = memo->find(key)) {
+            return *result;
         }
+        memo_key = &key;
+    }
 
-        StringRef arg_name = function->args.args[i].arg;
-        add_variable(arg_name, arg);
+    // `return f(...)` hands the callee back to this frame (see returnstmt),
+    // it replaces the function that returned instead of nesting a new call
+    get_trace().tail_calls = true;
+
+    while (true) {
+        // The arguments raised or the evaluation ran out of budget
+        if (has_exceptions() || exhausted(function)) {
+            break;
+        }
+
+        // Fully typed functions run on untagged slots
+        if (use_unboxed) {
+            UnboxedFunction* unboxed = get_unboxed(function);
+            Value            result;
+
+            if (unboxed != nullptr && unboxed->call(args, count, result)) {
+                return memoize(memo_key, result);
+            }
+        }
+
+        // insert arguments to the context
+        for (int i = 0; i < count; i++) {
+            Value arg = args[i];
+
+            if (is_concrete(arg)) {
+                partial_call = true;
+            }
+
+            StringRef arg_name = function->args.args[i].arg;
+            add_variable(arg_name, arg);
+        }
+
+        // EXEC_BODY returns early on `return`, run it in its own frame
+        // so the return value is collected below
+        partial.push_back(partial_call);
+        [&]() -> Value {
+            EXEC_BODY(function->body, 0, function);
+            return flag::done();
+        }();
+        partial.pop_back();
+
+        if (tail_function == nullptr) {
+            break;
+        }
+
+        function      = tail_function;
+        tail_function = nullptr;
+        partial_call  = false;
+
+        // the arguments of the tail call replace ours
+        count = int(tail_args.size());
+        if (count > 8) {
+            large = std::move(tail_args);
+            args  = large.data();
+        } else {
+            for (int i = 0; i < count; i++) {
+                small[i] = tail_args[i];
+            }
+            args = small;
+        }
+        tail_args.clear();
+
+        reset();
+        variables.resize(scope);
     }
 
-    partial.push_back(partial_call);
-    EXEC_BODY(function->body, 0, MAKE_NAME("call ", str(function->name)));
-    partial.pop_back();
-    return returned();
+    // The return value belongs to this call, the caller keeps executing
+    Value result = returned();
+    reset();
+    return memoize(memo_key, result);
+}
+
+Value TreeEvaluator::memoize(MemoCache::Key* key, Value result) {
+    if (key != nullptr && !has_exceptions()) {
+        memo->insert(std::move(*key), result);
+    }
+    return result;
 }
 
 struct ScriptObject {
-    // Name - Value
-    // We would like to get rid of the name if possible
-    // during SEMA we can resolve the name to the ID
-    // so we would never have to lookup by name
-    // If some need the name at runtime this is reflection stuff
-    // and that would be handled by a different datastructure
-    // for now it will have to do
-    //
-    // Usually methods will not be stored there
-    // but it can happen when the code assign method as attributes
-    //
-    Array<Tuple<String, Value>> attributes;
+    // Data attributes at the offsets computed by SEMA (`ClassDef::compute_layout`),
+    // names and methods are found through the class
+    Array<Value> fields;
+
+    // Class the object was instantiated from, keys the inline caches
+    ClassDef* class_t = nullptr;
 
-    ScriptObject(std::size_t reserve) { attributes.reserve(reserve); }
+    // Attributes that are not part of the class layout
+    Dict<StringRef, Value> extra;
+
+    ScriptObject(std::size_t size): fields(size) {}
 };
 
-Value object__new__(GCObject* parent, ClassDef* class_t) {
+template <>
+struct HeapTrace<ScriptObject> {
+    static void trace(RuntimeHeap& heap, ScriptObject& obj) {
+        for (Value& field: obj.fields) {
+            heap.mark(field);
+        }
+        for (auto& item: obj.extra) {
+            heap.mark(item.second);
+        }
+    }
+};
+
+// Script classes get their runtime id the first time they are instantiated or raised
+int runtime_class_id(ClassDef* class_t) {
+    if (class_t->type_id < 0) {
+        class_t->type_id = meta::_new_type();
+    }
+    return class_t->type_id;
+}
+
+// `raise Error()` raises an instance, `raise Error` the class itself
+ClassDef* exception_class(Value exception) {
+    if (exception.tag() == meta::type_id<ScriptObject>()) {
+        return exception.as<ScriptObject const&>().class_t;
+    }
+    if (exception.tag() == meta::type_id<Node*>()) {
+        return cast<ClassDef>(exception.as<Node*>());
+    }
+    return nullptr;
+}
+
+// Resolve the attribute for the class of the receiver,
+// the lookup by name only happens the first time a class is seen at this site
+InlineCache::Entry resolve_attribute(Attribute* n, ClassDef* cls) {
+    if (InlineCache::Entry const* entry = n->cache.find(cls)) {
+        return *entry;
+    }
+
+    InlineCache::Entry entry;
+    entry.cls = cls;
+
+    int attrid = cls->get_attribute(n->attr);
+    if (attrid >= 0) {
+        ClassDef::Attr& attr = cls->attributes[attrid];
+
+        entry.slot = attr.offset;
+        if (attr.offset < 0) {
+            entry.method = cast<FunctionDef>(attr.stmt);
+        }
+    }
+
+    n->cache.insert(entry);
+    return entry;
+}
+
+Value object__new__(TreeEvaluator& eval, ClassDef* class_t) {
     // Move this to sema
     ValuePrinter printer = [](std::ostream& out, Value const& val) {
-        Array<int> attributes;
-
         auto& obj = val.as<ScriptObject const&>();
-        for (int i = 0; i < obj.attributes.size(); i++) {
-            if (std::get<1>(obj.attributes[i]).is_valid<Node*>()) {
-                continue;
+
+        Array<Tuple<StringRef, Value>> attributes;
+        if (obj.class_t != nullptr) {
+            for (ClassDef::Attr const& attr: obj.class_t->attributes) {
+                if (attr.offset >= 0) {
+                    attributes.emplace_back(attr.name, obj.fields[attr.offset]);
+                }
             }
-            attributes.push_back(i);
+        }
+        for (auto const& item: obj.extra) {
+            attributes.emplace_back(item.first, item.second);
         }
 
         int n = int(attributes.size()) - 1;
         out << "(";
         for (int i = 0; i < attributes.size(); i++) {
-            auto& attr = obj.attributes[attributes[i]];
+            auto& attr = attributes[i];
             out << std::get<0>(attr) << "=" << std::get<1>(attr);
             if (i < n) {
                 out << ", ";
@@ -502,23 +879,13 @@ Value object__new__(GCObject* parent, ClassDef* class_t) {
     };
     register_value<ScriptObject>(printer);
 
-    if (class_t->type_id < 0) {
-        class_t->type_id = meta::_new_type();
-    }
+    runtime_class_id(class_t);
     // <<<
 
     // Create a new runtime object of a specific type
-    auto val = make_value<ScriptObject>(class_t->attributes.size());
+    auto val = eval.new_value<ScriptObject>(class_t->field_count);
     ScriptObject& obj   = val.as<ScriptObject&>();
-
-    for (int i = 0; i < class_t->attributes.size(); i++) {
-        auto  attr = class_t->attributes[i];
-        Value value;
-        if (FunctionDef* def = cast<FunctionDef>(attr.stmt)) {
-            value = make_value<Node*>(def);
-        }
-        obj.attributes.emplace_back(attr.name, value);
-    }
+    obj.class_t         = class_t;
 
     //
     // Note maybe we could save a template object and simply copy it every time
@@ -527,8 +894,11 @@ Value object__new__(GCObject* parent, ClassDef* class_t) {
 }
 
 Value TreeEvaluator::call_constructor(Call_t* call, ClassDef_t* cls, int depth) {
-    // Create the object
-    Value obj = object__new__(&root, cls);
+    // Create the object, the temporaries pin it: the arguments and __init__ can collect
+    // and `self` alone would let the object move out of the nursery
+    auto        KW_IDT(_) = new_temporaries();
+    std::size_t obj_index = temporaries.size();
+    temporaries.push_back(object__new__(*this, cls));
 
     // std::cout << "wtf" << std::endl;
     FunctionDef* ctor = nullptr;
@@ -552,6 +922,11 @@ Value TreeEvaluator::call_constructor(Call_t* call, ClassDef_t* cls, int depth)
         }
     }
 
+    // Nothing to initialize, `class Error: pass`
+    if (ctor == nullptr) {
+        return temporaries[obj_index];
+    }
+
     if (ctor->native) {
         Array<Value> value_args;
         value_args.reserve(call->args.size());
@@ -572,9 +947,10 @@ Value TreeEvaluator::call_constructor(Call_t* call, ClassDef_t* cls, int depth)
 
     // execute function
     auto KW_IDT(_) = new_scope();
+    auto KW_IDT(_) = new_frame();
 
     if (ctor != nullptr) {
-        add_variable(ctor->args.args[0].arg, obj);
+        add_variable(ctor->args.args[0].arg, temporaries[obj_index]);
 
         int i = 0;
         for (auto& arg: call->args) {
@@ -590,10 +966,10 @@ Value TreeEvaluator::call_constructor(Call_t* call, ClassDef_t* cls, int depth)
             }
         }
 
-        return obj;
+        return temporaries[obj_index];
     }
 
-    return obj;
+    return temporaries[obj_index];
 }
 
 Value TreeEvaluator::make(ClassDef* class_t, Array<Value> args, int depth) {
@@ -662,7 +1038,7 @@ void TreeEvaluator::show_variables(std::ostream& out, Variables& variables) {
 }
 
 Value TreeEvaluator::make_generator(Call_t* call, FunctionDef_t* n, int depth) {
-    Generator* gen = root.new_object<Generator>();
+    Generator* gen = new_object<Generator>();
     gens.push_back(gen);
 
     auto KW_IDT(_) = new_scope();
@@ -675,13 +1051,11 @@ Value TreeEvaluator::make_generator(Call_t* call, FunctionDef_t* n, int depth) {
         add_variable(arg_name, arg);
     }
 
-    // Save the execution state for resuming
+    // The generator owns its frame from now on, resuming swaps it in and out
     gen->environment = variables;
-    gen->blocks      = *get_blocks();
     gen->function    = n;
-    gen->blocks.push_back(ExecBlock{0, n->body, MAKE_NAME("generator ", n->name)});
-
-    show_variables(std::cout, gen->environment);
+    heap.remember(gen);
+    gen->blocks.push_back(ExecBlock{0, &n->body, n});
 
     // Call to function that yields only create the generator
     // to fetch values from it
@@ -695,7 +1069,9 @@ Value TreeEvaluator::make_generator(Call_t* call, FunctionDef_t* n, int depth) {
 
 Value TreeEvaluator::call(Call_t* n, int depth) {
     // Populate current stack with the expression that will branch out
-    get_trace().expr = n;
+    StackTrace& caller = get_trace();
+    caller.stmt        = nullptr;
+    caller.expr        = n;
 
     StackTrace& trace = traces.emplace_back();
     KW_DEFERRED([&]{
@@ -704,8 +1080,35 @@ Value TreeEvaluator::call(Call_t* n, int depth) {
     });
 
     // fetch the function we need to call
-    // the issue is that we need the object called in the case of a method
-    Value function = exec(n->func, depth);
+    // in the case of a method the object is passed as the first argument
+    Value function;
+    Value self;
+    bool  method = false;
+
+    auto KW_IDT(_) = new_temporaries();
+
+    if (Attribute* attr = cast<Attribute>(n->func)) {
+        self = exec(attr->value, depth);
+        temporaries.push_back(self);
+        kwassert(self.tag() == meta::type_id<ScriptObject>(), "Attribute should be an object");
+
+        // Methods are found through the class
+        ClassDef* cls = self.as<ScriptObject&>().class_t;
+        if (cls != nullptr) {
+            InlineCache::Entry entry = resolve_attribute(attr, cls);
+
+            if (entry.method != nullptr) {
+                function = make_value<Node*>(entry.method);
+                method   = true;
+            }
+        }
+
+        if (!method) {
+            function = *fetch_attribute(attr, self);
+        }
+    } else {
+        function = exec(n->func, depth);
+    }
 
     if (function.is_valid<Function>()) {
         return Value();
@@ -723,7 +1126,7 @@ Value TreeEvaluator::call(Call_t* n, int depth) {
             if (fun->native) {
                 return call_native(n, fun, depth);
             }
-            return call_script(n, fun, depth);
+            return call_script(n, fun, depth, method ? &self : nullptr);
         }
 
         if (ClassDef_t* cls = cast<ClassDef_t>(node)) {
@@ -764,6 +1167,24 @@ Value* TreeEvaluator::fetch_name(Name_t* n, int depth) {
         }
     }
 
+    // Native builtins are not variables of the module
+    static Array<ValuePair> builtins = []() {
+        Array<ValuePair> values;
+        for (FunctionDef* def: builtin_functions()) {
+            values.push_back(ValuePair{str(def->name), make_value<Node*>(def)});
+        }
+        for (ClassDef* def: builtin_exceptions()) {
+            values.push_back(ValuePair{str(def->name), make_value<Node*>(def)});
+        }
+        return values;
+    }();
+
+    for (ValuePair& entry: builtins) {
+        if (n->id == entry.name) {
+            return &entry.value;
+        }
+    }
+
     kwwarn(treelog, "Could not find variable");
     return nullptr;
 }
@@ -774,7 +1195,12 @@ Value TreeEvaluator::name(Name_t* n, int depth) {
         return add_variable(n->id, Value());
     }
 
-    return *fetch_name(n, depth);
+    Value* value = fetch_name(n, depth);
+    if (value == nullptr) {
+        raise_exception(nullptr, nullptr);
+        return Value();
+    }
+    return *value;
 }
 
 Value TreeEvaluator::functiondef(FunctionDef_t* n, int depth) {
@@ -787,7 +1213,7 @@ Value TreeEvaluator::functiondef(FunctionDef_t* n, int depth) {
 
 Value TreeEvaluator::invalidstmt(InvalidStatement_t* n, int depth) {
     // FIXME: raise exception here
-    raise_exception(nullptr, nullptr);
+    raise_exception(nullptr, nullptr, n);
     return flag::done();
 }
 
@@ -795,6 +1221,14 @@ Value TreeEvaluator::returnstmt(Return_t* n, int depth) {
     kwdebug(treelog, "Compute return {}", str(n));
 
     if (n->value.has_value()) {
+        Call* call = cast<Call>(n->value.value());
+
+        // The callee is run by call_script once this frame has returned
+        if (call != nullptr && call->tail_call && tail_call(call, depth)) {
+            set_return_value(Value(_None()));
+            return return_value;
+        }
+
         set_return_value(exec(n->value.value(), depth));
         kwdebug(treelog, "Returning {}", str(return_value));
         return return_value;
@@ -805,7 +1239,9 @@ Value TreeEvaluator::returnstmt(Return_t* n, int depth) {
 }
 
 Value TreeEvaluator::assign(Assign_t* n, int depth) {
-    Value value = exec(n->value, depth);
+    auto  KW_IDT(_) = new_temporaries();
+    Value value     = exec(n->value, depth);
+    temporaries.push_back(value);
 
     // Unpacking a, b, c = ...
     TupleExpr* targets = nullptr;  // cast<TupleExpr>(n->targets[0]);
@@ -838,12 +1274,14 @@ Value TreeEvaluator::assign(Assign_t* n, int depth) {
         auto* target = n->targets[0];
 
         if (Attribute* attr = cast<Attribute>(target)) {
-            Value* val = fetch_attribute(attr, depth);
-            (*val)     = value;
+            Value obj = exec(attr->value, depth);
+
+            *fetch_attribute(attr, obj) = value;
+            heap.write_barrier(obj, value);
         }
 
         if (Name* name = cast<Name>(target)) {
-            add_variable(name->id, value);
+            set_variable(name->id, value);
         }
 
         return flag::done();
@@ -866,8 +1304,26 @@ Value* TreeEvaluator::fetch_store_target(ExprNode* n, int depth) {
 }
 
 Value TreeEvaluator::augassign(AugAssign_t* n, int depth) {
-    Value* left  = fetch_store_target(n->target, depth);  // load a
-    Value  right = exec(n->value, depth);                 // load b
+    // The value can grow the frame or collect the objects,
+    // the target is only resolved once it is evaluated
+    auto        KW_IDT(_) = new_temporaries();
+    Attribute*  attr      = cast<Attribute>(n->target);
+    std::size_t obj_index = temporaries.size();
+
+    if (attr != nullptr) {
+        temporaries.push_back(exec(attr->value, depth));  // load a
+    }
+
+    Value right = exec(n->value, depth);  // load b
+
+    // The operator can grow the frame or collect the objects too,
+    // the target is read before it runs and resolved again to store the result
+    auto target = [&]() {
+        return attr != nullptr ? fetch_attribute(attr, temporaries[obj_index])
+                               : fetch_store_target(n->target, depth);
+    };
+
+    Value left = *target();
 
     if (is_concrete(left) && is_concrete(right)) {
         Value value = nullptr;
@@ -877,16 +1333,21 @@ Value TreeEvaluator::augassign(AugAssign_t* n, int depth) {
             auto KW_IDT(_) = new_scope();
 
             // Fetch the argument name from the operator
-            add_variable(StringRef(), (*left));
+            add_variable(StringRef(), left);
             add_variable(StringRef(), right);
-            (*left) = exec(n->resolved_operator, depth);
+            value = exec(n->resolved_operator, depth);
         } else if (n->native_operator != nullptr) {
-            Value oldleft = (*left);
-
-            (*left) = binary_invoke((void*)this, n->native_operator, oldleft, right);
-            kwdebug(treelog, "{} = {} {} {}", str(*left), str(oldleft), str(n->op), str(right));
+            value = binary_invoke((void*)this, n->native_operator, left, right);
+            kwdebug(treelog, "{} = {} {} {}", str(value), str(left), str(n->op), str(right));
         } else {
             kwerror(treelog, "Operator does not have implementation!");
+            return flag::done();
+        }
+
+        (*target()) = value;
+
+        if (attr != nullptr) {
+            heap.write_barrier(temporaries[obj_index], value);
         }
         return flag::done();
     }
@@ -912,7 +1373,7 @@ Value TreeEvaluator::annassign(AnnAssign_t* n, int depth) {
         name = node_name->id;
     }
 
-    add_variable(name, value);
+    set_variable(name, value);
     return flag::done();
 }
 
@@ -923,21 +1384,106 @@ StringRef TreeEvaluator::get_name(ExprNode* expression) {
     return StringRef();
 }
 
+// Iterations of `range(counter, stop, step)`, the step is not zero
+int64 trip_count(Value const& counter, Value const& stop, Value const& step) {
+    int64 first = native_integer_value(counter);
+    int64 last  = native_integer_value(stop);
+    int64 by    = native_integer_value(step);
+
+    if (by < 0) {
+        first = -first;
+        last  = -last;
+        by    = -by;
+    }
+    if (last <= first) {
+        return 0;
+    }
+    return (last - first + by - 1) / by;
+}
+
+Value TreeEvaluator::forrange(For_t* n, int depth) {
+    Array<ExprNode*> const& args = cast<Call>(n->iter)->args;
+
+    Value counter = args.size() > 1 ? exec(args[0], depth) : n->start;
+    Value stop    = exec(args.size() > 1 ? args[1] : args[0], depth);
+
+    if (n->zero_step()) {
+        ClassDef* error = builtin_exception(StringRef("ValueError"));
+        raise_exception(make_value<Node*>(error), Value(), n);
+        return flag::done();
+    }
+
+    if (budget >= 0 && exhausted(n, trip_count(counter, stop, n->step))) {
+        return flag::done();
+    }
+
+    // the counter is kept aside, the body can reassign the target.
+    // Assignments rebind the target in place (see set_variable), its slot does not change
+    int value_idx = set_variable(get_name(n->target), counter);
+
+    bool broke    = false;
+    loop_break    = false;
+    loop_continue = false;
+
+    while (n->native_compare(nullptr, counter, stop).as<bool>()) {
+        variables[value_idx].value = counter;
+
+        for (StmtNode* stmt: n->body) {
+            exec(stmt, depth);
+
+            if (has_exceptions()) {
+                return flag::done();
+            }
+
+            if (has_returned()) {
+                if (yielding) {
+                    return flag::paused();
+                }
+                return flag::done();
+            }
+
+            if (loop_break || loop_continue) {
+                break;
+            }
+        }
+
+        broke         = loop_break;
+        loop_break    = false;
+        loop_continue = false;
+
+        if (broke) {
+            return flag::done();
+        }
+        counter = n->native_step(nullptr, counter, n->step);
+    }
+
+    EXEC_BODY(n->orelse, 0, n);
+    return flag::done();
+}
+
 Value TreeEvaluator::forstmt(For_t* n, int depth) {
+    if (n->counted) {
+        return forrange(n, depth);
+    }
 
     // insert target into the context
     // exec(n->target, depth);
     StringRef target_name = get_name(n->target);
-    int       value_idx   = int(variables.size());
-    Value*    target      = add_variable(target_name, Value());
+    int       value_idx   = set_variable(target_name, Value());
 
-    Value iterator = exec(n->iter, depth);
+    auto  KW_IDT(_) = new_temporaries();
+    Value iterator  = exec(n->iter, depth);
+    temporaries.push_back(iterator);
 
     bool broke    = false;
     loop_break    = false;
     loop_continue = false;
 
     while (true) {
+        if (exhausted(n)) {
+            return flag::done();
+        }
+
         // Python does not create a new scope for `for`
         // auto KW_IDT(_) = new_scope();
 
@@ -951,8 +1497,6 @@ Value TreeEvaluator::forstmt(For_t* n, int depth) {
             break;
         }
 
-        show_variables(std::cout, variables);
-
         for (StmtNode* stmt: n->body) {
             exec(stmt, depth);
 
@@ -985,7 +1529,7 @@ Value TreeEvaluator::forstmt(For_t* n, int depth) {
         }
     }
 
-    EXEC_BODY(n->orelse, 0, MAKE_NAME("for ", "orlese"));
+    EXEC_BODY(n->orelse, 0, n);
     return flag::done();
 }
 Value TreeEvaluator::whilestmt(While_t* n, int depth) {
@@ -995,6 +1539,10 @@ Value TreeEvaluator::whilestmt(While_t* n, int depth) {
     loop_continue = false;
 
     while (true) {
+        if (exhausted(n)) {
+            return Value();
+        }
+
         Value value     = exec(n->test, depth);
         bool  bcontinue = value.as<bool>();
 
@@ -1002,10 +1550,12 @@ Value TreeEvaluator::whilestmt(While_t* n, int depth) {
             break;
         }
 
+        // calls push a new trace which can move the blocks,
+        // they are fetched again after each statement
         auto*      blocks = get_blocks();
         ExecBlock& _block = blocks->emplace_back();
-        _block.block      = n->body;
-        _block.name       = "while body";
+        _block.block      = &n->body;
+        _block.owner      = n;
         kwdebug(outlog(), "Insert block {} {} + 1", (void*)blocks, blocks->size());
 
         _block.i = 0;
@@ -1014,13 +1564,13 @@ Value TreeEvaluator::whilestmt(While_t* n, int depth) {
             _block.i += 1;
 
             if (has_exceptions()) {
-                pop(*blocks, LOC);
+                pop(*get_blocks(), LOC);
                 return Value();
             }
 
             if (has_returned()) {
                 if (!yielding) {
-                    pop(*blocks, LOC);
+                    pop(*get_blocks(), LOC);
                     return flag::done();
                 }
                 return flag::paused();
@@ -1035,7 +1585,7 @@ Value TreeEvaluator::whilestmt(While_t* n, int depth) {
                 break;
             }
         }
-        pop(*blocks, LOC);
+        pop(*get_blocks(), LOC);
 
         // reset
         loop_break    = false;
@@ -1046,31 +1596,15 @@ Value TreeEvaluator::whilestmt(While_t* n, int depth) {
         }
     }
 
-    EXEC_BODY(n->orelse, 0, MAKE_NAME("while ", "orelse"));
+    EXEC_BODY(n->orelse, 0, n);
     return flag::done();
 }
 
 Value TreeEvaluator::ifstmt(If_t* n, int depth) {
 
-    Array<StmtNode*>& body = n->orelse;
-    // Chained
-    if (!n->tests.empty()) {
-        for (int i = 0; i < n->tests.size(); i++) {
-            Value value = exec(n->test, depth);
+    // Point to the branch taken, the node keeps its bodies
+    Array<StmtNode*>* body = &n->orelse;
 
-            bool btrue = value.as<bool>();
-            if (btrue) {
-                body = n->bodies[i];
-                break;
-            }
-        }
-
-        EXEC_BODY(body, 0, MAKE_NAME("if ", "body"));
-
-        return flag::done();
-    }
-
-    // Simple
     Value test  = exec(n->test, depth);
     bool  btrue = test.as<bool>();
 
@@ -1078,21 +1612,37 @@ Value TreeEvaluator::ifstmt(If_t* n, int depth) {
     // ic() += 1;
 
     if (btrue) {
-        body = n->body;
+        body = &n->body;
+    } else {
+        // Chained, `elif` are tested in order
+        for (int i = 0; i < n->tests.size(); i++) {
+            Value value = exec(n->tests[i], depth);
+
+            if (value.as<bool>()) {
+                body = &n->bodies[i];
+                break;
+            }
+        }
     }
 
-    EXEC_BODY(body, 0, MAKE_NAME("if ", "body"));
+    EXEC_BODY(*body, 0, n);
     return flag::done();
 }
 
-Value assert_error(Value message) {
-    auto v        = make_value<ScriptObject>(2);
-    ScriptObject& self = v.as<ScriptObject&>();
+Value assert_error(TreeEvaluator& eval, Value message) {
+    auto KW_IDT(_) = eval.new_temporaries();
+    eval.temporaries.push_back(message);
 
-    auto t = make_value<String>("AssertionError");
+    auto t = eval.new_value<String>("AssertionError");
+    eval.temporaries.push_back(t);
 
-    self.attributes.emplace_back("type", t);
-    self.attributes.emplace_back("message", message);
+    auto v             = eval.new_value<ScriptObject>(2);
+    ScriptObject& self = v.as<ScriptObject&>();
+
+    // handlers match the builtin class, like the VM
+    self.class_t   = builtin_exception(StringRef("AssertionError"));
+    self.fields[0] = t;
+    self.fields[1] = message;
     return v;
 }
 
@@ -1105,7 +1655,7 @@ Value TreeEvaluator::assertstmt(Assert_t* n, int depth) {
             if (n->msg.has_value()) {
                 msg = exec(n->msg.value(), depth);
             }
-            raise_exception(assert_error(msg), Value());
+            raise_exception(assert_error(*this, msg), Value(), n);
             return flag::done();
         }
 
@@ -1136,7 +1686,7 @@ Value TreeEvaluator::continuestmt(Continue_t* n, int depth) {
 
 Value TreeEvaluator::inlinestmt(Inline_t* n, int depth) {
 
-    EXEC_BODY(n->body, 0, MAKE_NAME("inline ", "body"));
+    EXEC_BODY(n->body, 0, n);
 
     return flag::done();
 }
@@ -1145,13 +1695,16 @@ Value TreeEvaluator::raise(Raise_t* n, int depth) {
 
     if (n->exc.has_value()) {
         // create a new exceptins
-        auto obj = exec(n->exc.value(), depth);
+        auto KW_IDT(_) = new_temporaries();
+        auto obj       = exec(n->exc.value(), depth);
+        temporaries.push_back(obj);
 
         if (n->cause.has_value()) {
             cause = exec(n->cause.value(), depth);
         }
 
-        raise_exception(obj, cause);
+        raise_exception(obj, cause, n);
+        return nullptr;
     }
 
     // FIXME: this re-reraise current exception
@@ -1179,8 +1732,7 @@ Value TreeEvaluator::except(Try_t* n, int depth) {
                 found_matcher = true;
             }
 
-            // FIXME: we do not have the type at runtime!!!
-            else if (equal(handler.type.value(), latest_exception->type)) {
+            else if (handles(handler.type.value(), latest_exception, depth)) {
                 matched       = &handler;
                 found_matcher = true;
             }
@@ -1195,28 +1747,38 @@ Value TreeEvaluator::except(Try_t* n, int depth) {
             Constant exception;
 
             // Execute Handler
+            // the constant holds a copy of the exception
+            auto KW_IDT(_) = new_temporaries();
+            temporaries.push_back(latest_exception->custom);
+
             if (matched->name.has_value()) {
                 exception.value = latest_exception->custom;
                 add_variable(matched->name.value(), &exception);
             }
 
-            EXEC_BODY(matched->body, 0, MAKE_NAME("match ", "body"));
+            // EXEC_BODY returns early on `return`, the exception is handled all the same
+            [&]() -> Value {
+                EXEC_BODY(matched->body, 0, n);
+                return flag::done();
+            }();
 
-            // Exception was handled!
-            exceptions.pop_back();
-            cause = nullptr;
+            // Exception was handled! unless the handler raised one of its own
+            if (!has_exceptions()) {
+                exceptions.pop_back();
+                cause = nullptr;
+            }
         }
         // Exception was NOT handled
         // leave the exception as is so we continue moving back
 
-    } else {
-        EXEC_BODY(n->orelse, 0, MAKE_NAME("match ", "orelse"));
+    } else if (!has_returned()) {
+        EXEC_BODY(n->orelse, 0, n);
     }
 
     auto _ = HandleException(this);
 
     {   //
-        EXEC_BODY(n->finalbody, 0, MAKE_NAME("match ", "finalbody")); 
+        EXEC_BODY(n->finalbody, 0, n);
         //
     }
     // we are not handling exception anymore
@@ -1228,10 +1790,11 @@ Value TreeEvaluator::trystmt(Try_t* n, int depth) {
     // FIXME: how do I pause/resume exception handling ?
     // the block needs to be aware of the exceptions
 
-    {   //
-        KW_EXEC_BLOCK_BODY(n->body, 0, MAKE_NAME("trystmt ", "body"), n, {}); 
-        //    
-    }
+    // the block returns as soon as an exception is raised, the handlers run after it
+    [&]() -> Value {
+        KW_EXEC_BLOCK_BODY(n->body, 0, n, n, {});
+        return flag::done();
+    }();
 
     if (!yielding) {
         except(n, depth);
@@ -1274,10 +1837,12 @@ Value TreeEvaluator::with_exit(With_t* n, Array<Value>& contexts, int depth) {
 Value TreeEvaluator::with(With_t* n, int depth) {
     // Call enter
     Array<Value> contexts;
+    auto         KW_IDT(_) = new_temporaries();
 
     for (auto& item: n->items) {
         auto ctx = exec(item.context_expr, depth);
         contexts.push_back(ctx);
+        temporaries.push_back(ctx);
 
         auto result = call_enter(ctx, depth);
 
@@ -1289,7 +1854,7 @@ Value TreeEvaluator::with(With_t* n, int depth) {
         add_variable(name, result);
     }
 
-    KW_EXEC_BLOCK_BODY(n->body, 0, MAKE_NAME("with ", "body"), nullptr, contexts);
+    KW_EXEC_BLOCK_BODY(n->body, 0, n, nullptr, contexts);
 
     if (!yielding) {
         with_exit(n, contexts, depth);
@@ -1341,11 +1906,7 @@ Value TreeEvaluator::yield(Yield_t* n, int depth) {
     if (n->value.has_value()) {
         auto value = exec(n->value.value(), depth);
 
-        Generator* gen   = (*gens.rbegin());
-        gen->environment = variables;
-        gen->blocks      = *get_blocks();
-
-        // Get the top level functions and create a lambda
+        // The frame and the blocks are given back to the generator when resume unwinds
         yielding     = true;
         return_value = value;
         return flag::done();
@@ -1368,11 +1929,29 @@ Value TreeEvaluator::slice(Slice_t* n, int depth) { return nullptr; }
 
 Value* TreeEvaluator::fetch_attribute(Attribute_t* n, int depth) {
     Value obj = exec(n->value, depth);
-    kwassert(obj.tag == meta::type_id<ScriptObject>(), "Attribute should be an object");
+    return fetch_attribute(n, obj);
+}
+
+Value* TreeEvaluator::fetch_attribute(Attribute_t* n, Value& obj) {
+    kwassert(obj.tag() == meta::type_id<ScriptObject>(), "Attribute should be an object");
+
+    ScriptObject& dat = obj.as<ScriptObject&>();
+
+    if (dat.class_t != nullptr) {
+        InlineCache::Entry entry = resolve_attribute(n, dat.class_t);
 
-    ScriptObject&         dat  = obj.as<ScriptObject&>();
-    Tuple<String, Value>& attr = dat.attributes[n->attrid];
-    return &std::get<1>(attr);
+        if (entry.slot >= 0) {
+            return &dat.fields[entry.slot];
+        }
+
+        // Unbound method
+        if (entry.method != nullptr) {
+            method_value = make_value<Node*>(entry.method);
+            return &method_value;
+        }
+    }
+
+    return &dat.extra[n->attr];
 }
 
 Value TreeEvaluator::attribute(Attribute_t* n, int depth) { return *fetch_attribute(n, depth); }
@@ -1380,7 +1959,7 @@ Value TreeEvaluator::subscript(Subscript_t* n, int depth) { return nullptr; }
 
 // Call __next__ for a given object
 Value TreeEvaluator::get_next(Value v, int depth) {
-    if (v.tag == meta::type_id<Generator*>()) {
+    if (v.tag() == meta::type_id<Generator*>()) {
         return resume(v.as<Generator*>(), depth);
     }
     // FIXME: implement me
@@ -1445,14 +2024,19 @@ void printkwtrace(std::ostream& out, StackTrace const& trace) {
     String parent = "<module>";
     String expr;
 
-    if (trace.stmt != nullptr) {
-        line   = trace.stmt->lineno;
-        parent = shortprint(get_parent(trace.stmt));
-        expr   = shortprint(trace.stmt);
+    // Reconstruct the statement of the frame from the call it was executing
+    StmtNode const* stmt = trace.stmt;
+    if (stmt == nullptr && trace.expr != nullptr) {
+        stmt = get_parent_stmt(const_cast<ExprNode*>(trace.expr));
+    }
+
+    if (stmt != nullptr) {
+        line   = stmt->lineno;
+        parent = shortprint(get_parent(stmt));
+        expr   = shortprint(stmt);
     } else if (trace.expr != nullptr) {
-        line   = trace.expr->lineno;
-        parent = shortprint(trace.stmt);
-        expr   = shortprint(trace.stmt);
+        line = trace.expr->lineno;
+        expr = shortprint(trace.expr);
     }
 
     fmt::print(out, "  File \"{}\", line {}, in {}\n", file, line, parent);
@@ -1481,13 +2065,21 @@ Value TreeEvaluator::eval(StmtNode_t* stmt) {
                 printkwtrace(out, st);
             }
 
-            String exception_type = str(except->type);
+            String exception_type = "None";
             String exception_msg  = "";
 
-            if (except->custom.is_valid<ScriptObject const&>()) {
+            if (except->class_t != nullptr) {
+                exception_type = str(except->class_t->name);
+            }
+
+            // Failed assertions hold their message
+            if (except->class_t == builtin_exception(StringRef("AssertionError")) &&
+                except->custom.is_valid<ScriptObject const&>()) {
                 ScriptObject const& obj = except->custom.as<ScriptObject const&>();
-                exception_type          = std::get<1>(obj.attributes[0]).as<String>();
-                exception_msg           = std::get<1>(obj.attributes[1]).as<String>();
+
+                if (obj.fields.size() > 1 && obj.fields[1].is_valid<String>()) {
+                    exception_msg = obj.fields[1].as<String>();
+                }
             }
 
             fmt::print(out, "{}: {}\n", exception_type, exception_msg);
@@ -1498,6 +2090,10 @@ Value TreeEvaluator::eval(StmtNode_t* stmt) {
         return v;
     }
     //
+    // Calls consume their return value, the result is the value of the statement
+    if (!has_returned()) {
+        return result;
+    }
     return return_value;
 }
 
@@ -1532,13 +2128,13 @@ int TreeEvaluator::eval() {
 }
 
 Value TreeEvaluator::resume(Generator* n, int depth) {
-    // Save current state
-    Variables previous;
-    std::swap(variables, previous);
-
-    // Restore generator state
+    // Swap the generator frame in, the caller frame is kept in its place until we return
     std::swap(variables, n->environment);
 
+    // The generator owns a copy of its environment, its assignments can rebind any of it
+    auto KW_IDT(_) = guard([&](int caller) { frame = caller; }, frame);
+    frame          = 0;
+
     int   finished_block = 0;
     Value result;
     {
@@ -1547,7 +2143,7 @@ Value TreeEvaluator::resume(Generator* n, int depth) {
         // Insert a call
         TraceGuard  _(traces);
         StackTrace& trace = traces.emplace_back();
-        trace.blocks      = n->blocks;
+        std::swap(trace.blocks, n->blocks);
 
         gens.emplace_back(n);
 
@@ -1555,22 +2151,22 @@ Value TreeEvaluator::resume(Generator* n, int depth) {
         //show_variables(std::cout, variables);
 
         auto execbloc = [&]() -> Value {
-            Array<ExecBlock>& blocks = trace.blocks;
+            // nested calls and blocks can reallocate the arrays, the block is found by index
+            auto blocks = [&]() -> Array<ExecBlock>& { return *get_blocks(); };
 
-            for (int k = int(blocks.size()) - 1; k >= 0; k--) {
-                ExecBlock& block = blocks[k];
-                auto& body = block.block;
+            for (int k = int(blocks().size()) - 1; k >= 0; k--) {
+                auto& body = *blocks()[k].block;
 
-                kwdebug(treelog, "Resume {} at {}", block.name, block.i);
+                kwdebug(treelog, "Resume {} at {}", blocks()[k].name(), blocks()[k].i);
 
                 if (!has_exceptions()) {
-                    for (int i = block.i; i < body.size(); i++) {
+                    for (int i = blocks()[k].i; i < body.size(); i++) {
                         StmtNode* stmt = body[i];
                         Value flag = exec(stmt, depth);
 
                         // We cannot always increase like this
                         // if stmt is a while loop, the while might not be done
-                        block.i = i + int(flag.tag != meta::type_id<_paused>());
+                        blocks()[k].i = i + int(flag.tag() != meta::type_id<_paused>());
 
                         if (has_exceptions()) {
                             // we should probably break here and
@@ -1579,31 +2175,22 @@ Value TreeEvaluator::resume(Generator* n, int depth) {
                             break;
                         }
                         if (has_returned()) {
-                            // n->environment = variables;
-                            n->blocks      = *get_blocks();
-                            
-                            //
-                            // So yield does it for us
-                            // BUT when yield save the blocks it has not advanced past the yield
-                            // so when resuming it should jump past it
-                            //
-                            // So this does not work because it does not handle nested blocks
-                            // n->blocks[int(n->blocks.size()) -  1].i += 1;
+                            // the blocks are left as they are, they are the resume point
                             return returned();
                         }
                     }
                 }
 
                 // try block
-                if (block.exception_handler != nullptr) {
-                    except(block.exception_handler, depth);
+                if (blocks()[k].exception_handler != nullptr) {
+                    except(blocks()[k].exception_handler, depth);
                 }
 
                 // with block
-                if (!block.resources.empty()) {
-                    with_exit(nullptr, block.resources, depth);
+                if (!blocks()[k].resources.empty()) {
+                    with_exit(nullptr, blocks()[k].resources, depth);
                 }
-                pop(blocks, LOC);
+                pop(blocks(), LOC);
             }
 
             // Technically in python we would raise StopIteration
@@ -1612,24 +2199,17 @@ Value TreeEvaluator::resume(Generator* n, int depth) {
 
         result = execbloc();
 
-        // result = fun();
-        StringStream ss;
-        result.debug_print(ss);
-        kwdebug(treelog, "Yielded {}", ss.str());
-
-        // if (finished_block > 0) {
-        //    n->blocks.erase(n->blocks.begin() + k, n->blocks.end());
-        ///}
+        // Save the resume point, once exhausted no blocks are left
+        std::swap(get_trace().blocks, n->blocks);
         gens.pop_back();
     }
 
-    show_variables(std::cout, variables);
-
     yielding = false;
     return_value = Value();
 
-    // Restore state
-    std::swap(variables, previous);
+    // Restore state, the generator frame can point to the nursery now
+    std::swap(variables, n->environment);
+    heap.remember(n);
     return result;
 }
 
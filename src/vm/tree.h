@@ -10,6 +10,8 @@
 #include "utilities/guard.h"
 #include "utilities/printing.h"
 #include "utilities/strings.h"
+#include "vm/garbage_collector.h"
+#include "vm/memo.h"
 
 namespace lython {
 
@@ -29,24 +31,32 @@ struct TreeEvaluatorTrait {
     //{ MaxRecursionDepth = 15 };
 };
 
+// Entering a block does not allocate, the statements are owned by the AST
 struct ExecBlock {
-    int              i = 0;  // Instruction pointer
-    Array<StmtNode*> block;  // List of instructions
-    String           name;   // Name of the block for debugging
+    int                     i     = 0;        // Instruction pointer
+    Array<StmtNode*> const* block = nullptr;  // List of instructions
+    Node*                   owner = nullptr;  // Node holding the block, names it for debugging
 
     Try*         exception_handler = nullptr;
     Array<Value> resources;
+
+    String name() const;
 };
 
+// Nothing is recorded while the nodes execute,
+// the location of a frame is only known when it calls or raises
 struct StackTrace {
-    // The statement point to the line
-    // while the expression points to a specific location in the line
-    StmtNode const*  stmt;
-    ExprNode const*  expr;
+    // Statement raising the exception, only set on the innermost frame
+    StmtNode const*  stmt = nullptr;
+    // Call the frame is executing, its statement is found when the trace is printed
+    ExprNode const*  expr = nullptr;
     Array<Constant*> args;
 
     // Execution blocks for resume
     Array<ExecBlock> blocks;
+
+    // Frame of a script function, calls in tail position can reuse it
+    bool tail_calls = false;
 };
 
 struct ValuePair {
@@ -64,6 +74,24 @@ struct Generator: public GCObject {
     Variables        environment;
 };
 
+template <>
+struct HeapTrace<Generator> {
+    static void trace(RuntimeHeap& heap, Generator& gen) {
+        for (ValuePair& var: gen.environment) {
+            heap.mark(var.value);
+        }
+        for (ExecBlock& block: gen.blocks) {
+            for (Value& resource: block.resources) {
+                heap.mark(resource);
+            }
+        }
+    }
+};
+
+// the evaluator resumes generators through raw pointers
+template <>
+struct HeapTenured<Generator>: std::true_type {};
+
 struct VariableAddress {
     int i;
 };
@@ -147,6 +175,47 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
         return guard([&](std::size_t size) { variables.resize(size); }, variables.size());
     }
 
+    // Values only held by the C++ stack while an expression evaluates (operands, arguments),
+    // the collector sees them until the scope ends
+    Array<Value> temporaries;
+
+    auto new_temporaries() {
+        return guard([&](std::size_t size) { temporaries.resize(size); }, temporaries.size());
+    }
+
+    // Objects created by the scripts, the evaluator holds the roots
+    RuntimeHeap heap;
+
+    template <typename T, typename... Args>
+    T* new_object(Args&&... args) {
+        if (heap.should_collect()) {
+            collect_step();
+        }
+        if (heap.nursery_full<T>()) {
+            collect_nursery();
+        }
+        return heap.new_object<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    Value new_value(Args&&... args) {
+        return Value(meta::type_id<T>(), (void*)new_object<T>(std::forward<Args>(args)...));
+    }
+
+    // Marks the values held by the frames, the registers and the pending exceptions,
+    // then frees the objects that cannot be reached
+    void collect_garbage();
+
+    // Promotes the objects of the nursery that are still reachable
+    void collect_nursery();
+
+    // Runs a quantum of the full collection in progress, starts one if none is
+    void collect_step();
+
+    void start_collection();
+    void finish_collection();
+    void mark_roots(RuntimeHeap::Collection kind);
+
     void show_variables(std::ostream& out, Variables& variables);
 
     StringRef get_name(ExprNode* expression);
@@ -154,6 +223,7 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
     Value* fetch_name(Name_t* name, int depth);
 
     Value* fetch_attribute(Attribute_t* n, int depth);
+    Value* fetch_attribute(Attribute_t* n, Value& obj);
 
     Value* fetch_store_target(ExprNode* n, int depth);
 
@@ -164,6 +234,30 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
         return &variables[i].value;
     }
 
+    // Assignments rebind the variable of the executing call, a name keeps its slot
+    // and the frame does not grow with the iterations of a loop.
+    // Variables below `frame` belong to the callers, assigning creates a local.
+    // Returns the slot of the variable
+    int set_variable(StringRef name, Value val) {
+        for (int i = int(variables.size()) - 1; i >= frame; i--) {
+            if (name == variables[i].name) {
+                variables[i].value = val;
+                return i;
+            }
+        }
+        add_variable(name, val);
+        return int(variables.size()) - 1;
+    }
+
+    // First variable of the executing call
+    int frame = 0;
+
+    auto new_frame() {
+        int caller = frame;
+        frame      = int(variables.size());
+        return guard([&](int previous) { frame = previous; }, caller);
+    }
+
     bool is_concrete(Value val) { return true; }
 
     void set_value(VariableAddress addr, Value v) { variables[addr.i].value = v; }
@@ -208,22 +302,36 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
 
     Value execbody(Array<StmtNode*>& body, Array<StmtNode*>& newbod, int depth);
 
+    // `for i in range(...)` resolved by SEMA, runs as a native counted loop
+    Value forrange(For_t* n, int depth);
+
     // Helpers
     Value get_next(Value iterator, int depth);
     Value call_enter(Value ctx, int depth);
     Value call_exit(Value ctx, int depth);
 
     Value call_native(Call_t* call, FunctionDef_t* n, int depth);
-    Value call_script(Call_t* call, FunctionDef_t* n, int depth);
+    Value call_script(Call_t* call, FunctionDef_t* n, int depth, Value const* self = nullptr);
+
+    // Remember the result of a pure call, `key` is null when the call is not memoized
+    Value memoize(MemoCache::Key* key, Value result);
+
+    // Evaluate the callee and the arguments of `return f(...)` for call_script,
+    // false if the call has to be made as usual
+    bool tail_call(Call_t* call, int depth);
     Value call_constructor(Call_t* call, ClassDef_t* cls, int depth);
     Value make_generator(Call_t* call, FunctionDef_t* n, int depth);
 
     // Exception handling that comes after `try`
     Value except(Try_t* n, int depth);
+    // the handler type is only evaluated once an exception reaches it
+    bool handles(ExprNode* handler_type, struct _LyException* exception, int depth);
+    bool is_subclass(ClassDef* class_t, int class_id, int depth);
     // Resource closing
     Value with_exit(With_t* n, Array<Value>& contexts, int depth);
 
-    void raise_exception(Value exception, Value cause);
+    // `origin` is the statement raising, it locates the innermost frame of the traceback
+    void raise_exception(Value exception, Value cause, StmtNode const* origin = nullptr);
 
     // Only returns true when new exceptions pop up
     // we usually expect 0 exceptions,
@@ -236,21 +344,9 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
     Value make(ClassDef* class_t, Array<Value> args, int depth);
     Value resume(Generator* n, int depth);
 
-    Value exec(StmtNode_t* stmt, int depth) {
-        StackTrace& trace = get_trace();
-        trace.stmt        = stmt;
-        return Super::exec(stmt, depth);
-    }
-
     template <typename T>
     bool is(Value v) {
-        return v.tag == meta::type_id<T>();
-    }
-
-    Value exec(ExprNode_t* expr, int depth) {
-        StackTrace& trace = get_trace();
-        trace.expr        = expr;
-        return Super::exec(expr, depth);
+        return v.tag() == meta::type_id<T>();
     }
 
     StackTrace& get_trace() {
@@ -309,6 +405,9 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
     Expression root;
     Value      return_value;
 
+    // Unbound method read from an object, methods are stored in the class
+    Value method_value;
+
     bool is_partial() const {
         if (partial.empty())
             return false;
@@ -323,7 +422,31 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
         partial[partial.size() - 1] = true;
     }
 
-    bool has_returned() { return return_value.tag != meta::type_id<_Invalid>(); }
+    // Run fully typed functions on untagged slots when possible
+    bool use_unboxed = true;
+
+    // Results of pure functions, memoization is off when null
+    MemoCache* memo = nullptr;
+
+    // Calls and loop iterations left, unlimited when negative.
+    // Code run at compile time (see PartialEvaluator) is stopped by an exception once it is spent
+    int budget = -1;
+
+    // Counted loops are charged their trip count once, before their first iteration
+    bool exhausted(StmtNode const* origin, int64 cost = 1) {
+        if (budget < 0) {
+            return false;
+        }
+        if (budget < cost) {
+            budget = 0;
+            raise_exception(nullptr, nullptr, origin);
+            return true;
+        }
+        budget -= int(cost);
+        return false;
+    }
+
+    bool has_returned() { return return_value.tag() != meta::type_id<_Invalid>(); }
 
     void reset() { return_value = Value(); }
 
@@ -342,6 +465,10 @@ struct TreeEvaluator: public BaseVisitor<TreeEvaluator, false, TreeEvaluatorTrai
     Value cause               = nullptr;
     int   handling_exceptions = 0;
 
+    // Pending call in tail position, see call_script
+    FunctionDef* tail_function = nullptr;
+    Array<Value> tail_args;
+
     Array<Generator*>           gens;
     Array<struct _LyException*> exceptions;
     Array<StackTrace>           traces;
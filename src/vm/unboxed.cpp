@@ -0,0 +1,668 @@
+#include "vm/unboxed.h"
+#include "logging/logging.h"
+#include "utilities/printing.h"
+
+namespace lython {
+
+int native_type_tag(NativeType type) {
+    switch (type) {
+    case NativeType::bool_t: return meta::type_id<bool>();
+    case NativeType::i8_t: return meta::type_id<int8>();
+    case NativeType::i16_t: return meta::type_id<int16>();
+    case NativeType::i32_t: return meta::type_id<int32>();
+    case NativeType::i64_t: return meta::type_id<int64>();
+    case NativeType::u8_t: return meta::type_id<uint8>();
+    case NativeType::u16_t: return meta::type_id<uint16>();
+    case NativeType::u32_t: return meta::type_id<uint32>();
+    case NativeType::u64_t: return meta::type_id<uint64>();
+    case NativeType::f32_t: return meta::type_id<float32>();
+    case NativeType::f64_t: return meta::type_id<float64>();
+    default: break;
+    }
+    return -1;
+}
+
+NativeType native_type_of_tag(int tag) {
+    switch (meta::ValueTypes(tag)) {
+    case meta::ValueTypes::i1: return NativeType::bool_t;
+    case meta::ValueTypes::i8: return NativeType::i8_t;
+    case meta::ValueTypes::i16: return NativeType::i16_t;
+    case meta::ValueTypes::i32: return NativeType::i32_t;
+    case meta::ValueTypes::i64: return NativeType::i64_t;
+    case meta::ValueTypes::u8: return NativeType::u8_t;
+    case meta::ValueTypes::u16: return NativeType::u16_t;
+    case meta::ValueTypes::u32: return NativeType::u32_t;
+    case meta::ValueTypes::u64: return NativeType::u64_t;
+    case meta::ValueTypes::f32: return NativeType::f32_t;
+    case meta::ValueTypes::f64: return NativeType::f64_t;
+    default: break;
+    }
+    return NativeType::Count;
+}
+
+// Only numbers and booleans can live in an untagged slot
+bool is_unboxable(NativeType type) { return native_type_tag(type) >= 0; }
+
+Value materialize(NativeType type, Slot slot) {
+    switch (type) {
+    case NativeType::bool_t: return Value(slot.i1);
+    case NativeType::i8_t: return Value(slot.i8);
+    case NativeType::i16_t: return Value(slot.i16);
+    case NativeType::i32_t: return Value(slot.i32);
+    case NativeType::i64_t: return Value(slot.i64);
+    case NativeType::u8_t: return Value(slot.u8);
+    case NativeType::u16_t: return Value(slot.u16);
+    case NativeType::u32_t: return Value(slot.u32);
+    case NativeType::u64_t: return Value(slot.u64);
+    case NativeType::f32_t: return Value(slot.f32);
+    case NativeType::f64_t: return Value(slot.f64);
+    default: break;
+    }
+    return Value();
+}
+
+//
+// Evaluation
+//
+Slot eval_constant(UnboxedExpr const* self, Slot* frame) { return self->constant; }
+
+Slot eval_load(UnboxedExpr const* self, Slot* frame) { return frame[self->slot]; }
+
+Slot eval_binary(UnboxedExpr const* self, Slot* frame) {
+    return self->binary(self->lhs->eval(self->lhs, frame), self->rhs->eval(self->rhs, frame));
+}
+
+Slot eval_unary(UnboxedExpr const* self, Slot* frame) {
+    return self->unary(self->lhs->eval(self->lhs, frame));
+}
+
+Slot eval_and(UnboxedExpr const* self, Slot* frame) {
+    Slot lhs = self->lhs->eval(self->lhs, frame);
+    if (!lhs.i1) {
+        return lhs;
+    }
+    return self->rhs->eval(self->rhs, frame);
+}
+
+Slot eval_or(UnboxedExpr const* self, Slot* frame) {
+    Slot lhs = self->lhs->eval(self->lhs, frame);
+    if (lhs.i1) {
+        return lhs;
+    }
+    return self->rhs->eval(self->rhs, frame);
+}
+
+enum class Flow
+{
+    Next,
+    Break,
+    Continue,
+    Return,
+};
+
+inline bool test(UnboxedExpr const* expr, Slot* frame) { return expr->eval(expr, frame).i1; }
+
+Flow exec_block(Array<UnboxedStmt*> const& body, Slot* frame, Slot& ret) {
+    using Kind = UnboxedStmt::Kind;
+
+    for (UnboxedStmt const* stmt: body) {
+        switch (stmt->kind) {
+        case Kind::Store: {
+            frame[stmt->slot] = stmt->expr->eval(stmt->expr, frame);
+            break;
+        }
+        case Kind::If: {
+            Flow flow = exec_block(test(stmt->expr, frame) ? stmt->body : stmt->orelse, frame, ret);
+            if (flow != Flow::Next) {
+                return flow;
+            }
+            break;
+        }
+        case Kind::While: {
+            bool broke = false;
+
+            while (test(stmt->expr, frame)) {
+                Flow flow = exec_block(stmt->body, frame, ret);
+
+                if (flow == Flow::Return) {
+                    return flow;
+                }
+                if (flow == Flow::Break) {
+                    broke = true;
+                    break;
+                }
+            }
+
+            if (!broke) {
+                Flow flow = exec_block(stmt->orelse, frame, ret);
+                if (flow != Flow::Next) {
+                    return flow;
+                }
+            }
+            break;
+        }
+        case Kind::For: {
+            Slot counter = stmt->expr->eval(stmt->expr, frame);
+            Slot stop    = stmt->stop->eval(stmt->stop, frame);
+            bool broke   = false;
+
+            while (stmt->compare(counter, stop).i1) {
+                frame[stmt->slot] = counter;
+                Flow flow         = exec_block(stmt->body, frame, ret);
+
+                if (flow == Flow::Return) {
+                    return flow;
+                }
+                if (flow == Flow::Break) {
+                    broke = true;
+                    break;
+                }
+                counter = stmt->increment(counter, stmt->step);
+            }
+
+            if (!broke) {
+                Flow flow = exec_block(stmt->orelse, frame, ret);
+                if (flow != Flow::Next) {
+                    return flow;
+                }
+            }
+            break;
+        }
+        case Kind::Return: {
+            ret = stmt->expr->eval(stmt->expr, frame);
+            return Flow::Return;
+        }
+        case Kind::Expr: {
+            stmt->expr->eval(stmt->expr, frame);
+            break;
+        }
+        case Kind::Break: return Flow::Break;
+        case Kind::Continue: return Flow::Continue;
+        case Kind::Pass: break;
+        }
+    }
+    return Flow::Next;
+}
+
+bool UnboxedFunction::call(Value const* args, int count, Value& result) const {
+    if (count != int(arg_types.size())) {
+        return false;
+    }
+
+    // Most functions fit in the small frame
+    Slot        small[32] = {};
+    Array<Slot> large;
+    Slot*       frame = small;
+
+    if (slot_count > 32) {
+        large.resize(slot_count);
+        frame = large.data();
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (int(args[i].tag()) != native_type_tag(arg_types[i])) {
+            return false;
+        }
+        frame[i] = args[i].holder();
+    }
+
+    Slot ret;
+    if (exec_block(body, frame, ret) == Flow::Return) {
+        result = materialize(return_type, ret);
+    } else {
+        result = Value();
+    }
+    return true;
+}
+
+UnboxedFunction::~UnboxedFunction() {
+    for (UnboxedExpr* expr: exprs) {
+        delete expr;
+    }
+    for (UnboxedStmt* stmt: stmts) {
+        delete stmt;
+    }
+}
+
+//
+// Compilation
+//
+struct UnboxedCompiler {
+    UnboxedFunction* fun;
+
+    Dict<StringRef, int> names;
+    Array<NativeType>    slots;
+
+    UnboxedExpr* new_expr(UnboxedExpr::Eval eval, NativeType type) {
+        UnboxedExpr* expr = new UnboxedExpr();
+        expr->eval        = eval;
+        expr->type        = type;
+        fun->exprs.push_back(expr);
+        return expr;
+    }
+
+    UnboxedStmt* new_stmt(UnboxedStmt::Kind kind) {
+        UnboxedStmt* stmt = new UnboxedStmt();
+        stmt->kind        = kind;
+        fun->stmts.push_back(stmt);
+        return stmt;
+    }
+
+    // Returns -1 if the name already lives in a slot of a different type
+    int declare(StringRef name, NativeType type) {
+        auto it = names.find(name);
+        if (it != names.end()) {
+            return slots[it->second] == type ? it->second : -1;
+        }
+
+        int slot    = int(slots.size());
+        names[name] = slot;
+        slots.push_back(type);
+        return slot;
+    }
+
+    int lookup(StringRef name) {
+        auto it = names.find(name);
+        if (it == names.end()) {
+            return -1;
+        }
+        return it->second;
+    }
+
+    UnboxedExpr* binary(UnboxedBinaryOperation op, UnboxedExpr* lhs, UnboxedExpr* rhs) {
+        if (op.fun == nullptr || lhs == nullptr || rhs == nullptr || lhs->type != rhs->type) {
+            return nullptr;
+        }
+
+        UnboxedExpr* expr = new_expr(eval_binary, op.result);
+        expr->binary      = op.fun;
+        expr->lhs         = lhs;
+        expr->rhs         = rhs;
+        return expr;
+    }
+
+    UnboxedExpr* logical(BoolOperator op, UnboxedExpr* lhs, UnboxedExpr* rhs) {
+        if (lhs == nullptr || rhs == nullptr) {
+            return nullptr;
+        }
+        if (lhs->type != NativeType::bool_t || rhs->type != NativeType::bool_t) {
+            return nullptr;
+        }
+
+        UnboxedExpr* expr =
+            new_expr(op == BoolOperator::And ? eval_and : eval_or, NativeType::bool_t);
+        expr->lhs = lhs;
+        expr->rhs = rhs;
+        return expr;
+    }
+
+    UnboxedExpr* expr(ExprNode* node) {
+        if (node == nullptr) {
+            return nullptr;
+        }
+
+        if (Constant* n = cast<Constant>(node)) {
+            NativeType type = native_type_of_tag(n->value.tag());
+            if (!is_unboxable(type)) {
+                return nullptr;
+            }
+            UnboxedExpr* expr = new_expr(eval_constant, type);
+            expr->constant    = n->value.holder();
+            return expr;
+        }
+
+        if (Name* n = cast<Name>(node)) {
+            int slot = lookup(n->id);
+            if (slot < 0) {
+                return nullptr;
+            }
+            UnboxedExpr* expr = new_expr(eval_load, slots[slot]);
+            expr->slot        = slot;
+            return expr;
+        }
+
+        if (BinOp* n = cast<BinOp>(node)) {
+            if (n->resolved_operator != nullptr || n->native_operator == nullptr) {
+                return nullptr;
+            }
+
+            UnboxedExpr* lhs = expr(n->left);
+            UnboxedExpr* rhs = expr(n->right);
+            if (lhs == nullptr || rhs == nullptr) {
+                return nullptr;
+            }
+
+            // make sure we agree with SEMA
+            if (get_native_binary_operation(n->op, lhs->type, rhs->type) != n->native_operator) {
+                return nullptr;
+            }
+            return binary(get_unboxed_binary_operation(n->op, lhs->type), lhs, rhs);
+        }
+
+        if (UnaryOp* n = cast<UnaryOp>(node)) {
+            if (n->resolved_operator != nullptr || n->native_operator == nullptr) {
+                return nullptr;
+            }
+
+            UnboxedExpr* operand = expr(n->operand);
+            if (operand == nullptr) {
+                return nullptr;
+            }
+            if (get_native_unary_operation(n->op, operand->type) != n->native_operator) {
+                return nullptr;
+            }
+
+            UnboxedUnaryOperation op = get_unboxed_unary_operation(n->op, operand->type);
+            if (op.fun == nullptr) {
+                return nullptr;
+            }
+
+            UnboxedExpr* expr = new_expr(eval_unary, op.result);
+            expr->unary       = op.fun;
+            expr->lhs         = operand;
+            return expr;
+        }
+
+        if (BoolOp* n = cast<BoolOp>(node)) {
+            if (n->resolved_operator != nullptr || n->native_operator == nullptr) {
+                return nullptr;
+            }
+            if (n->values.size() < 2) {
+                return nullptr;
+            }
+
+            UnboxedExpr* result = expr(n->values[0]);
+            for (int i = 1; i < n->values.size(); i++) {
+                result = logical(n->op, result, expr(n->values[i]));
+            }
+            return result;
+        }
+
+        // a < b < c => (a < b) and (b < c)
+        // operands are pure so evaluating b twice is fine
+        if (Compare* n = cast<Compare>(node)) {
+            if (n->ops.size() != n->comparators.size() ||
+                n->native_operator.size() != n->ops.size()) {
+                return nullptr;
+            }
+
+            UnboxedExpr* result = nullptr;
+            ExprNode*    prev   = n->left;
+
+            for (int i = 0; i < n->ops.size(); i++) {
+                UnboxedExpr* lhs = expr(prev);
+                UnboxedExpr* rhs = expr(n->comparators[i]);
+
+                if (lhs == nullptr || rhs == nullptr || n->native_operator[i] == nullptr) {
+                    return nullptr;
+                }
+                if (get_native_cmp_operation(n->ops[i], lhs->type, rhs->type) !=
+                    n->native_operator[i]) {
+                    return nullptr;
+                }
+
+                UnboxedExpr* cmp =
+                    binary(get_unboxed_cmp_operation(n->ops[i], lhs->type), lhs, rhs);
+
+                result = result == nullptr ? cmp : logical(BoolOperator::And, result, cmp);
+                if (result == nullptr) {
+                    return nullptr;
+                }
+                prev = n->comparators[i];
+            }
+            return result;
+        }
+
+        return nullptr;
+    }
+
+    bool store(Array<UnboxedStmt*>& out, ExprNode* target, NativeType type, UnboxedExpr* value) {
+        Name* name = cast<Name>(target);
+
+        if (name == nullptr || value == nullptr || value->type != type) {
+            return false;
+        }
+
+        int slot = declare(name->id, type);
+        if (slot < 0) {
+            return false;
+        }
+
+        UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::Store);
+        stmt->slot        = slot;
+        stmt->expr        = value;
+        out.push_back(stmt);
+        return true;
+    }
+
+    bool test(UnboxedStmt* stmt, ExprNode* test) {
+        stmt->expr = expr(test);
+        return stmt->expr != nullptr && stmt->expr->type == NativeType::bool_t;
+    }
+
+    bool stmt(StmtNode* node, Array<UnboxedStmt*>& out) {
+        if (AnnAssign* n = cast<AnnAssign>(node)) {
+            NativeType type = native_type(n->annotation);
+            if (!is_unboxable(type)) {
+                return false;
+            }
+
+            // uninitialized variables start at zero
+            UnboxedExpr* value = nullptr;
+            if (n->value.has_value()) {
+                value = expr(n->value.value());
+            } else {
+                value           = new_expr(eval_constant, type);
+                value->constant = Slot();
+                value->constant.u64 = 0;
+            }
+            return store(out, n->target, type, value);
+        }
+
+        if (Assign* n = cast<Assign>(node)) {
+            if (n->targets.size() != 1) {
+                return false;
+            }
+            UnboxedExpr* value = expr(n->value);
+            return value != nullptr && store(out, n->targets[0], value->type, value);
+        }
+
+        if (AugAssign* n = cast<AugAssign>(node)) {
+            if (n->resolved_operator != nullptr || n->native_operator == nullptr) {
+                return false;
+            }
+
+            UnboxedExpr* target = expr(n->target);
+            UnboxedExpr* value  = expr(n->value);
+            if (target == nullptr || value == nullptr) {
+                return false;
+            }
+            if (get_native_binary_operation(n->op, target->type, value->type) !=
+                n->native_operator) {
+                return false;
+            }
+
+            UnboxedExpr* result =
+                binary(get_unboxed_binary_operation(n->op, target->type), target, value);
+            return result != nullptr && store(out, n->target, target->type, result);
+        }
+
+        if (If* n = cast<If>(node)) {
+            // if/elif/else is lowered to nested ifs
+            UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::If);
+            out.push_back(stmt);
+
+            if (!test(stmt, n->test) || !body(n->body, stmt->body)) {
+                return false;
+            }
+
+            for (int i = 0; i < n->tests.size(); i++) {
+                UnboxedStmt* elif = new_stmt(UnboxedStmt::Kind::If);
+                stmt->orelse.push_back(elif);
+
+                if (!test(elif, n->tests[i]) || !body(n->bodies[i], elif->body)) {
+                    return false;
+                }
+                stmt = elif;
+            }
+            return body(n->orelse, stmt->orelse);
+        }
+
+        if (While* n = cast<While>(node)) {
+            UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::While);
+            out.push_back(stmt);
+
+            return test(stmt, n->test) && body(n->body, stmt->body) &&
+                   body(n->orelse, stmt->orelse);
+        }
+
+        if (For* n = cast<For>(node)) {
+            // The boxed evaluator raises for a step of 0
+            if (!n->counted || n->zero_step()) {
+                return false;
+            }
+
+            Array<ExprNode*> const& args = cast<Call>(n->iter)->args;
+            NativeType              type = native_type_of_tag(n->step.tag());
+
+            UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::For);
+            out.push_back(stmt);
+
+            if (args.size() > 1) {
+                stmt->expr = expr(args[0]);
+            } else {
+                stmt->expr           = new_expr(eval_constant, type);
+                stmt->expr->constant = n->start.holder();
+            }
+            // SEMA picked the comparison from the sign of the step
+            CmpOperator cmp = CmpOperator::Gt;
+            if (n->native_compare == get_native_cmp_operation(CmpOperator::Lt, type, type)) {
+                cmp = CmpOperator::Lt;
+            }
+
+            stmt->stop      = expr(args.size() > 1 ? args[1] : args[0]);
+            stmt->step      = n->step.holder();
+            stmt->compare   = get_unboxed_cmp_operation(cmp, type).fun;
+            stmt->increment = get_unboxed_binary_operation(BinaryOperator::Add, type).fun;
+            stmt->slot      = declare(cast<Name>(n->target)->id, type);
+
+            if (stmt->expr == nullptr || stmt->stop == nullptr || stmt->expr->type != type ||
+                stmt->stop->type != type || stmt->compare == nullptr ||
+                stmt->increment == nullptr || stmt->slot < 0) {
+                return false;
+            }
+            return body(n->body, stmt->body) && body(n->orelse, stmt->orelse);
+        }
+
+        if (Return* n = cast<Return>(node)) {
+            if (!n->value.has_value()) {
+                return false;
+            }
+
+            UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::Return);
+            stmt->expr        = expr(n->value.value());
+            out.push_back(stmt);
+            return stmt->expr != nullptr && stmt->expr->type == fun->return_type;
+        }
+
+        if (Expr* n = cast<Expr>(node)) {
+            if (cast<Comment>(n->value) != nullptr) {
+                return true;
+            }
+
+            UnboxedStmt* stmt = new_stmt(UnboxedStmt::Kind::Expr);
+            stmt->expr        = expr(n->value);
+            out.push_back(stmt);
+            return stmt->expr != nullptr;
+        }
+
+        if (cast<Break>(node) != nullptr) {
+            out.push_back(new_stmt(UnboxedStmt::Kind::Break));
+            return true;
+        }
+
+        if (cast<Continue>(node) != nullptr) {
+            out.push_back(new_stmt(UnboxedStmt::Kind::Continue));
+            return true;
+        }
+
+        if (cast<Pass>(node) != nullptr) {
+            return true;
+        }
+
+        return false;
+    }
+
+    bool body(Array<StmtNode*> const& stmts, Array<UnboxedStmt*>& out) {
+        for (StmtNode* node: stmts) {
+            if (!stmt(node, out)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool function(FunctionDef* def) {
+        if (def->native || def->generator || def->type == nullptr) {
+            return false;
+        }
+
+        Arguments const& args = def->args;
+        if (!args.posonlyargs.empty() || !args.kwonlyargs.empty() || args.vararg.has_value() ||
+            args.kwarg.has_value() || !args.defaults.empty()) {
+            return false;
+        }
+
+        Arrow* arrow = def->type;
+        if (arrow->arg_count() != int(args.args.size())) {
+            return false;
+        }
+
+        // Arguments occupy the first slots
+        for (int i = 0; i < arrow->arg_count(); i++) {
+            NativeType type = native_type(arrow->args[i]);
+            if (!is_unboxable(type) || declare(args.args[i].arg, type) != i) {
+                return false;
+            }
+            fun->arg_types.push_back(type);
+        }
+
+        fun->return_type = native_type(arrow->returns);
+        if (!is_unboxable(fun->return_type)) {
+            return false;
+        }
+
+        if (!body(def->body, fun->body)) {
+            return false;
+        }
+
+        fun->slot_count = int(slots.size());
+        return true;
+    }
+};
+
+UnboxedFunction* compile_unboxed(FunctionDef* fun) {
+    UnboxedFunction* unboxed = fun->new_object<UnboxedFunction>();
+
+    UnboxedCompiler compiler;
+    compiler.fun = unboxed;
+
+    if (!compiler.function(fun)) {
+        kwdebug(outlog(), "{} is not fully typed, it will run tagged", str(fun->name));
+        fun->remove_child(unboxed, true);
+        return nullptr;
+    }
+
+    kwdebug(outlog(), "{} runs unboxed with {} slots", str(fun->name), unboxed->slot_count);
+    return unboxed;
+}
+
+UnboxedFunction* get_unboxed(FunctionDef* fun) {
+    if (!fun->unboxed_compiled) {
+        fun->unboxed          = compile_unboxed(fun);
+        fun->unboxed_compiled = true;
+    }
+    return fun->unboxed;
+}
+
+}  // namespace lython
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ast/nodes.h"
+#include "builtin/operators.h"
+
+namespace lython {
+
+// Tagless execution of fully typed functions
+//
+// When SEMA resolved every operation of a function to a native operator
+// working on builtin types, the function is compiled to a small tree
+// where locals live in untagged slots (Value::Holder) and operators read
+// the payload directly.
+//
+// A tagged Value is only materialized at the boundary,
+// i.e when the arguments are received and when the result is returned.
+// Anything the compiler does not understand (calls, attributes, objects...)
+// keeps the function on the tagged path.
+//
+// .. code-block:: python
+//
+//    def sum(n: i32) -> f64:          # <= i32 slot
+//        total: f64 = 0.0             # <= f64 slot
+//        i: i32 = 0
+//        while i < n:                 # <= Lt<int32> called on the raw payload
+//            total += 1.5
+//            i += 1
+//        return total                 # <= Value(f64) materialized here
+//
+using Slot = Value::Holder;
+
+struct UnboxedExpr {
+    using Eval = Slot (*)(UnboxedExpr const* self, Slot* frame);
+
+    Eval       eval = nullptr;
+    NativeType type = NativeType::Count;
+
+    // operands
+    UnboxedExpr* lhs = nullptr;
+    UnboxedExpr* rhs = nullptr;
+
+    UnboxedBinary binary = nullptr;
+    UnboxedUnary  unary  = nullptr;
+
+    Slot constant;
+    int  slot = -1;
+};
+
+struct UnboxedStmt {
+    enum class Kind
+    {
+        Store,
+        If,
+        While,
+        For,
+        Return,
+        Expr,
+        Break,
+        Continue,
+        Pass,
+    };
+
+    Kind         kind;
+    int          slot = -1;
+    UnboxedExpr* expr = nullptr;
+
+    Array<UnboxedStmt*> body;
+    Array<UnboxedStmt*> orelse;
+
+    // For: counts from `expr` to `stop`, the counter is written to `slot` every iteration
+    UnboxedExpr*  stop      = nullptr;
+    Slot          step;
+    UnboxedBinary compare   = nullptr;
+    UnboxedBinary increment = nullptr;
+};
+
+struct UnboxedFunction: public GCObject {
+    Array<NativeType>   arg_types;
+    NativeType          return_type = NativeType::Count;
+    int                 slot_count  = 0;
+    Array<UnboxedStmt*> body;
+
+    // Checks the tags of the arguments and run the function
+    // returns false if the arguments do not match the compiled signature
+    bool call(Value const* args, int count, Value& result) const;
+
+    ~UnboxedFunction();
+
+    Array<UnboxedExpr*> exprs;
+    Array<UnboxedStmt*> stmts;
+};
+
+// Returns nullptr if the function is not fully typed
+UnboxedFunction* compile_unboxed(FunctionDef* fun);
+
+// Returns the compiled version of the function,
+// the compilation only happens once and is cached on the function
+UnboxedFunction* get_unboxed(FunctionDef* fun);
+
+// Type id of the Value holding a native type
+int native_type_tag(NativeType type);
+
+}  // namespace lython
@@ -1,5 +1,6 @@
 #include "vm/vm.h"
 #include "builtin/operators.h"
+#include "sema/importlib.h"
 #include "utilities/guard.h"
 #include "utilities/printing.h"
 #include "utilities/strings.h"
@@ -7,1098 +8,1747 @@
 
 namespace lython {
 
-using StmtRet = VMGen::StmtRet;
-using ExprRet = VMGen::ExprRet;
-using ModRet  = VMGen::ModRet;
-using PatRet  = VMGen::PatRet;
+const char* to_string(OpCode op) {
+    switch (op) {
+#define OPCODE(name) \
+    case OpCode::name: return #name;
+        KW_VM_OPCODES(OPCODE)
+#undef OPCODE
+    case OpCode::Size: break;
+    }
+    return "<invalid>";
+}
+
+bool is_jump(OpCode op) { return in(op, OpCode::Jump, OpCode::JumpIfFalse, OpCode::JumpIfTrue); }
+
+// Jumps storing their offset in the following Ext word
+bool is_test(OpCode op) { return in(op, OpCode::Test, OpCode::TestConst); }
+
+// Instructions writing their result to R[a]
+bool writes_register(OpCode op) {
+    switch (op) {
+    case OpCode::LoadConst:
+    case OpCode::LoadNone:
+    case OpCode::Move:
+    case OpCode::LoadGlobal:
+    case OpCode::Binary:
+    case OpCode::BinaryConst:
+    case OpCode::Unary:
+    case OpCode::Call:
+    case OpCode::CallNative:
+    case OpCode::CallDirect: return true;
+    default: return false;
+    }
+}
 
+int Program::line(int instruction) const {
+    auto it = std::upper_bound(
+        lines.begin(), lines.end(), instruction, [](int inst, SourceLine const& entry) {
+            return inst < entry.instruction;
+        });
 
-ExprRet VMGen::namedexpr(NamedExpr_t* n, int depth) { 
-    exec(n->target, depth);
-    exec(n->value, depth);
-    return ExprRet(); 
-}
-ExprRet VMGen::boolop(BoolOp_t* n, int depth) { 
-    for(auto* expr: n->values) {
-        exec(expr, depth);
-    }
-    return ExprRet(); }
-ExprRet VMGen::compare(Compare_t* n, int depth) { 
-    exec(n->left, depth);
-    for(auto* expr: n->comparators) {
-        exec(expr, depth);
-    }
-    return ExprRet(); 
-}
-ExprRet VMGen::binop(BinOp_t* n, int depth) { 
-    exec(n->left, depth);
-    exec(n->right, depth);
-    return ExprRet(); 
-}
-ExprRet VMGen::unaryop(UnaryOp_t* n, int depth) {
-    exec(n->operand, depth);
-    return ExprRet(); 
-}
-ExprRet VMGen::lambda(Lambda_t* n, int depth) { 
-    exec(n->body, depth);
-    return ExprRet(); 
-}
-ExprRet VMGen::ifexp(IfExp_t* n, int depth) { 
-    exec(n->test, depth);
-    exec(n->body, depth);
-    exec(n->orelse, depth);
-    return ExprRet(); 
-}
-ExprRet VMGen::dictexpr(DictExpr_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::setexpr(SetExpr_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::generateexpr(GeneratorExp_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::listexpr(ListExpr_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::tupleexpr(TupleExpr_t* n, int depth) { return ExprRet(); }
-
-ExprRet VMGen::listcomp(ListComp_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::setcomp(SetComp_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::dictcomp(DictComp_t* n, int depth) { return ExprRet(); }
-
-ExprRet VMGen::await(Await_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::yield(Yield_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::yieldfrom(YieldFrom_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::joinedstr(JoinedStr_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::formattedvalue(FormattedValue_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::constant(Constant_t* n, int depth) { 
-    return ExprRet();
-}
-ExprRet VMGen::attribute(Attribute_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::subscript(Subscript_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::starred(Starred_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::slice(Slice_t* n, int depth) { return ExprRet(); }
-
-ExprRet VMGen::dicttype(DictType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::arraytype(ArrayType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::arrow(Arrow_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::builtintype(BuiltinType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::tupletype(TupleType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::settype(SetType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::classtype(ClassType_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::comment(Comment_t* n, int depth) { return ExprRet(); }
-ExprRet VMGen::name(Name_t* n, int depth) { return ExprRet(); }
-
-// JUMP
-ExprRet VMGen::call(Call_t* n, int depth) { 
-    calls_to_be_resolved.push_back({
-        n,
-    });
-    return ExprRet(); 
-}
-
-// Leaves
-StmtRet VMGen::invalidstmt(InvalidStatement_t* n, int depth) {
-    kwerror(outlog(), "Invalid statement");
-    return StmtRet();
-}
-StmtRet VMGen::returnstmt(Return_t* n, int depth) {
-    add_instruction(n);
-    if (n->value.has_value()) {
-        exec(n->value.value(), depth);
+    if (it == lines.begin()) {
+        return -1;
     }
-    return StmtRet();
+    return (it - 1)->line;
 }
-StmtRet VMGen::deletestmt(Delete_t* n, int depth) {
-    add_instruction(n);
-    for(auto* target : n->targets) {
-        exec(target, depth);
+
+void Program::dump(std::ostream& out) const {
+    Instruction const* instructions = code();
+
+    for (int i = 0; i < code_size(); i++) {
+        for (Label const& label: labels) {
+            if (label.index == i) {
+                out << fmt::format("{}:\n", label.name);
+            }
+        }
+
+        Instruction const& inst = instructions[i];
+        if (inst.op == OpCode::Ext) {
+            continue;
+        }
+
+        if (is_jump(inst.op)) {
+            out << fmt::format("{:4d} {:>12} {:3d} -> {}\n",
+                               i,
+                               to_string(inst.op),
+                               inst.a,
+                               i + 1 + inst.offset());
+            continue;
+        }
+
+        if (is_test(inst.op)) {
+            Instruction const& ext = instructions[i + 1];
+            out << fmt::format("{:4d} {:>12} {:3d} {:3d} -> {}\n",
+                               i,
+                               to_string(inst.op),
+                               inst.b,
+                               inst.c,
+                               i + 2 + ext.offset());
+            continue;
+        }
+
+        out << fmt::format(
+            "{:4d} {:>12} {:3d} {:3d} {:3d}\n", i, to_string(inst.op), inst.a, inst.b, inst.c);
+    }
+
+    for (VMHandler const& handler: handlers) {
+        String klass = handler.klass >= 0 ? classes[handler.klass].name : String("*");
+        out << fmt::format(
+            "except {} [{}, {}) -> {}\n", klass, handler.start, handler.end, handler.target);
     }
-    return StmtRet();
 }
-StmtRet VMGen::assign(Assign_t* n, int depth) {
-    add_instruction(n);
-    exec(n->value, depth);
-    return StmtRet();
+
+//
+// Compile
+// =======
+//
+
+int VMGen::emit(OpCode op, int a, int b, int c) {
+    kwassert(a >= 0 && a <= 0xFFFF, "Operand out of range");
+    kwassert(b >= 0 && b <= 0xFFFF, "Operand out of range");
+    kwassert(c >= 0 && c <= 0xFFFF, "Operand out of range");
+
+    program.instructions.push_back(Instruction{op, uint16(a), uint16(b), uint16(c)});
+    return instruction_counter() - 1;
 }
-StmtRet VMGen::augassign(AugAssign_t* n, int depth) {
-    add_instruction(n);
-    exec(n->value, depth);
-    return StmtRet();
+
+int VMGen::emit_jump(OpCode op, int a) { return emit(op, a); }
+
+void VMGen::patch_jump(int jump) {
+    program.instructions[jump].set_offset(instruction_counter() - (jump + 1));
+    barrier = instruction_counter();
 }
-StmtRet VMGen::annassign(AnnAssign_t* n, int depth) {
-    add_instruction(n);
-    if (n->value.has_value()) {
-        exec(n->value.value(), depth);
-    }
-    return StmtRet();
+
+void VMGen::emit_jump_to(OpCode op, int a, int destination) {
+    int jump = emit(op, a);
+    program.instructions[jump].set_offset(destination - (jump + 1));
 }
-StmtRet VMGen::exprstmt(Expr_t* n, int depth) {
-    if (Comment* cmt = cast<Comment>(n->value)) {
-        return StmtRet();
-    }
-    add_instruction(n);
-    exec(n->value, depth);
-    return StmtRet();
+
+int VMGen::new_temp() {
+    int reg     = frame->top;
+    frame->top += 1;
+    frame->size = std::max(frame->size, frame->top);
+    return reg;
 }
-StmtRet VMGen::pass(Pass_t* n, int depth) { return StmtRet(); }
-StmtRet VMGen::breakstmt(Break_t* n, int depth) {
-    // jump out
-    Jump* jmp = n->new_object<Jump>();
-    add_instruction(jmp);
-    (*loop_ctx.rbegin()).breakjmp = jmp;
 
-    //
-    // add_instruction(n);
-    return StmtRet();
+int VMGen::new_constant(Value value) {
+    program.constants.push_back(value);
+    return int(program.constants.size()) - 1;
 }
-StmtRet VMGen::continuestmt(Continue_t* n, int depth) {
-    Jump* jmp = n->new_object<Jump>();
-    add_instruction(jmp);
-    (*loop_ctx.rbegin()).continuejmp = jmp;
 
-    // add_instruction(n);
-    return StmtRet();
+int VMGen::declare_local(StringRef name) {
+    auto it = frame->locals.find(name);
+    if (it != frame->locals.end()) {
+        return it->second;
+    }
+
+    int reg             = frame->local_count;
+    frame->locals[name] = reg;
+    frame->local_count += 1;
+    frame->size         = std::max(frame->size, frame->local_count);
+    return reg;
 }
-StmtRet VMGen::assertstmt(Assert_t* n, int depth) {
-    CondJump* jmp = n->new_object<CondJump>();
 
-    // TODO: build the exception AssertionError + assert msg
-    Raise* raise = n->new_object<Raise>();
+int VMGen::global_index(StringRef name) {
+    auto it = globals.find(name);
+    if (it != globals.end()) {
+        return it->second;
+    }
 
-    add_instruction(jmp);
+    int idx       = int(program.globals.size());
+    globals[name] = idx;
+    program.globals.push_back(str(name));
+    return idx;
+}
 
-    int raise_idx = instruction_counter();
-    add_instruction(raise);
+void VMGen::exec_into(ExprNode* expr, int dest, int depth) { move(dest, exec(expr, depth)); }
 
-    exec(n->test, depth);
-    jmp->condition = n->test;
-    jmp->then_jmp  = raise_idx + 1;
-    jmp->else_jmp  = raise_idx;
+void VMGen::move(int dest, int reg) {
+    if (reg == dest) {
+        return;
+    }
 
-    return StmtRet();
-}
-StmtRet VMGen::raise(Raise_t* n, int depth) {
-    // this is an implicit jump out to an unknown location
-    //
-    add_instruction(n);
-    return StmtRet();
-}
-StmtRet VMGen::global(Global_t* n, int depth) {
-    add_instruction(n);
-    return StmtRet();
-}
-StmtRet VMGen::nonlocal(Nonlocal_t* n, int depth) {
-    add_instruction(n);
-    return StmtRet();
+    // Make the last instruction write to dest directly
+    // if its result was going to a temporary
+    int last = instruction_counter() - 1;
+    if (reg >= frame->local_count && last >= barrier && last >= 0) {
+        int writer = program.instructions[last].op == OpCode::Ext ? last - 1 : last;
+
+        Instruction& inst = program.instructions[writer];
+        if (writes_register(inst.op) && inst.a == reg) {
+            inst.a = uint16(dest);
+            return;
+        }
+    }
+
+    emit(OpCode::Move, dest, reg);
 }
 
-// StmtRet VMGen::condjump(CondJump_t* n, int depth) {
-//     return StmtRet();
-// }
+int VMGen::emit_call(OpCode op, int function, Array<ExprNode*> const& args, int depth) {
+    int base = frame->top;
+    for (int i = 0; i < args.size(); i++) {
+        new_temp();
+    }
+    // make sure the result has a register even without arguments
+    if (args.empty()) {
+        new_temp();
+    }
 
-StmtRet VMGen::import(Import_t* n, int depth) { return StmtRet(); }
-StmtRet VMGen::importfrom(ImportFrom_t* n, int depth) { return StmtRet(); }
+    for (int i = 0; i < args.size(); i++) {
+        exec_into(args[i], base + i, depth);
+    }
 
-StmtRet VMGen::inlinestmt(Inline_t* n, int depth) {
-    add_body("body", n, n->body, depth);
-    return StmtRet();
+    emit(op, base, function, base);
+    return base;
 }
-StmtRet VMGen::functiondef(FunctionDef_t* n, int depth) {
-    // we cannot add a call instruction because we ignore expression in this VM
-    if (n->native) {
-        VMNativeFunction* fun = n->new_object<VMNativeFunction>();
-        fun->fun              = n->native;
-        labels.push_back({n, str(n->name), int(program.size()), depth});
-        add_instruction(fun);
-    } else {
-        add_body(str(n->name), n, n->body, depth);
+
+int VMGen::binary_index(BinaryFunction fun) {
+    for (int i = 0; i < program.binary.size(); i++) {
+        if (program.binary[i] == fun) {
+            return i;
+        }
     }
-    return StmtRet();
+    program.binary.push_back(fun);
+    return int(program.binary.size()) - 1;
 }
-StmtRet VMGen::classdef(ClassDef_t* n, int depth) {
-    // Do we need to insert/generate some more functions ?
-    //
-    //
 
-    // Only functions end up in the final program
-    for (auto* stmt: n->body) {
-        if (FunctionDef* def = cast<FunctionDef>(stmt)) {
-            functiondef(def, depth + 1);
+int VMGen::binary_operator(
+    BinaryFunction fun, int lhs, int rhs, StmtNode* resolved, int depth) {
+    if (fun != nullptr) {
+        int idx = binary_index(fun);
+
+        int dest = new_temp();
+        emit(OpCode::Binary, dest, lhs, rhs);
+        emit(OpCode::Ext, idx);
+        return dest;
+    }
+
+    // Operator implemented in script
+    if (FunctionDef* def = cast<FunctionDef>(resolved)) {
+        auto it = function_index.find(def);
+
+        if (it != function_index.end()) {
+            int base = new_temp();
+            new_temp();
+
+            emit(OpCode::Move, base, lhs);
+            emit(OpCode::Move, base + 1, rhs);
+            emit(OpCode::Call, base, it->second, base);
+            return base;
         }
     }
 
-    return StmtRet();
+    return unsupported(resolved, depth);
 }
 
-StmtRet VMGen::forstmt(For_t* n, int depth) {
-
-    // Target push some value or values to be modified
-    // n->target
+int VMGen::binary_expr(BinaryFunction fun, int lhs, ExprNode* rhs, StmtNode* resolved, int depth) {
+    Constant* cst = cast<Constant>(rhs);
 
-    // call next on iter and condjump
-    // add_body("test", n, n->iter)
+    if (fun != nullptr && cst != nullptr) {
+        int dest = new_temp();
+        emit(OpCode::BinaryConst, dest, lhs, new_constant(cst->value));
+        emit(OpCode::Ext, binary_index(fun));
+        return dest;
+    }
 
-    LoopContext& loopctx = loop_ctx.emplace_back();
-    KW_DEFERRED([&]() { loop_ctx.pop_back(); });
+    return binary_operator(fun, lhs, exec(rhs, depth), resolved, depth);
+}
 
-    int       start = instruction_counter();
-    CondJump* jmp   = n->new_object<CondJump>();
+int VMGen::emit_test(ExprNode* test, int depth) {
+    Compare* cmp = cast<Compare>(test);
 
-    // Get next, if stop iteration jump to
-    // we need a break tag and a continue tag
-    exec(n->iter, depth);
+    // Compare and branch in one instruction
+    if (cmp != nullptr && cmp->comparators.size() == 1 && cmp->native_operator.size() == 1 &&
+        cmp->native_operator[0] != nullptr) {
+        int lhs = exec(cmp->left, depth);
+        int idx = binary_index(cmp->native_operator[0]);
 
-    add_instruction(jmp);
+        ExprNode* rhs = cmp->comparators[0];
+        if (Constant* cst = cast<Constant>(rhs)) {
+            emit(OpCode::TestConst, 0, lhs, new_constant(cst->value));
+        } else {
+            emit(OpCode::Test, 0, lhs, exec(rhs, depth));
+        }
+        return emit(OpCode::Ext, idx);
+    }
 
-    jmp->then_jmp = instruction_counter();
-    add_body("body", n, n->body, depth);
+    return emit_jump(OpCode::JumpIfFalse, exec(test, depth));
+}
 
-    jmp->else_jmp = instruction_counter();
-    add_body("orelse", n, n->orelse, depth);
+void VMGen::store_name(Name* name, int value) {
+    auto it = frame->locals.find(name->id);
+    if (it != frame->locals.end()) {
+        move(it->second, value);
+        return;
+    }
+    emit(OpCode::StoreGlobal, global_index(name->id), value);
+}
 
-    int end = instruction_counter();
+void VMGen::collect_locals(Array<StmtNode*> const& stmts) {
+    auto local = [&](ExprNode* target) {
+        if (Name* name = cast<Name>(target)) {
+            if (frame->declared_globals.count(name->id) == 0) {
+                declare_local(name->id);
+            }
+        }
+    };
 
-    if (Jump* brk = loopctx.breakjmp) {
-        // Skip orelse
-        brk->destination = end;
+    for (StmtNode* stmt: stmts) {
+        switch (stmt->kind) {
+        case NodeKind::Global: {
+            for (Identifier const& name: cast<Global>(stmt)->names) {
+                frame->declared_globals[name] = global_index(name);
+            }
+            break;
+        }
+        case NodeKind::Assign: {
+            for (ExprNode* target: cast<Assign>(stmt)->targets) {
+                local(target);
+            }
+            break;
+        }
+        case NodeKind::AnnAssign: local(cast<AnnAssign>(stmt)->target); break;
+        case NodeKind::AugAssign: local(cast<AugAssign>(stmt)->target); break;
+        case NodeKind::For: {
+            For* n = cast<For>(stmt);
+            local(n->target);
+            collect_locals(n->body);
+            collect_locals(n->orelse);
+            break;
+        }
+        case NodeKind::While: {
+            While* n = cast<While>(stmt);
+            collect_locals(n->body);
+            collect_locals(n->orelse);
+            break;
+        }
+        case NodeKind::If: {
+            If* n = cast<If>(stmt);
+            collect_locals(n->body);
+            for (auto& body: n->bodies) {
+                collect_locals(body);
+            }
+            collect_locals(n->orelse);
+            break;
+        }
+        case NodeKind::With: collect_locals(cast<With>(stmt)->body); break;
+        case NodeKind::Try: {
+            Try* n = cast<Try>(stmt);
+            collect_locals(n->body);
+            for (ExceptHandler& handler: n->handlers) {
+                collect_locals(handler.body);
+            }
+            collect_locals(n->orelse);
+            collect_locals(n->finalbody);
+            break;
+        }
+        default: break;
+        }
     }
-    if (Jump* cte = loopctx.continuejmp) {
-        // go top of loop
-        cte->destination = start;
+}
+
+void VMGen::register_function(FunctionDef* def, String const& name) {
+    int argc = int(def->args.args.size());
+
+    if (def->native) {
+        native_names[def->name] = int(program.natives.size());
+        program.natives.push_back(VMNative{name, def->native, def->native_direct, argc});
+        return;
     }
 
-    return StmtRet();
+    int idx = int(program.functions.size());
+    function_index[def] = idx;
+    if (name == str(def->name)) {
+        function_names[def->name] = idx;
+    }
+    program.functions.push_back(VMFunction{name, def, -1, argc, 0, def->pure});
 }
 
-StmtRet VMGen::whilestmt(While_t* n, int depth) {
-    LoopContext& loopctx = loop_ctx.emplace_back();
-    KW_DEFERRED([&]() { loop_ctx.pop_back(); });
+void VMGen::compile_function(VMFunction& fun, int depth) {
+    FunctionDef* def = fun.def;
 
-    int       start = instruction_counter();
-    CondJump* jmp   = n->new_object<CondJump>();
-    exec(n->test, depth);
-    jmp->condition  = n->test;
-    add_instruction(jmp);
+    Frame function_frame;
+    frame = &function_frame;
 
-    jmp->then_jmp = instruction_counter();
-    add_body("body", n, n->body, depth);
+    // Arguments are the first registers
+    for (Arg& arg: def->args.args) {
+        declare_local(arg.arg);
+    }
+    collect_locals(def->body);
+    frame->top = frame->local_count;
 
-    jmp->else_jmp = instruction_counter();
-    add_body("orelse", n, n->orelse, depth);
+    fun.entry = instruction_counter();
+    program.labels.push_back({def, fun.name, fun.entry, depth});
 
-    int end = instruction_counter();
-    if (Jump* brk = loopctx.breakjmp) {
-        // Skip orelse
-        brk->destination = end;
-    }
-    if (Jump* cte = loopctx.continuejmp) {
-        // go top of loop
-        cte->destination = start;
+    if (def->generator) {
+        unsupported(def, depth);
     }
 
-    return StmtRet();
-}
+    body(def->body, depth);
+    emit(OpCode::ReturnNone);
 
-StmtRet VMGen::ifstmt(If_t* n, int depth) {
-    CondJump* jmp  = n->new_object<CondJump>();
-    jmp->condition = n->test;
-    exec(n->test, depth);
-    add_instruction(jmp);
+    fun.frame_size = frame->size;
+    frame          = nullptr;
+}
 
-    jmp->then_jmp = instruction_counter();
-    add_body("body", n, n->body, depth);
+void VMGen::mark_line(StmtNode* stmt) {
+    if (stmt->lineno < 0) {
+        return;
+    }
 
-    jmp->else_jmp = instruction_counter();
-    add_body("orelse", n, n->orelse, depth);
+    Array<SourceLine>& lines = program.lines;
+    int                pc    = instruction_counter();
 
-    return StmtRet();
+    // The previous statement did not generate any code
+    if (!lines.empty() && lines.back().instruction == pc) {
+        lines.back().line = stmt->lineno;
+        return;
+    }
+    if (lines.empty() || lines.back().line != stmt->lineno) {
+        lines.push_back(SourceLine{pc, stmt->lineno});
+    }
 }
 
-StmtRet VMGen::with(With_t* n, int depth) {
+void VMGen::body(Array<StmtNode*> const& stmts, int depth) {
+    for (StmtNode* stmt: stmts) {
+        mark_line(stmt);
 
-    // Add enter instructions
-    for (WithItem& item: n->items) {
-        item.context_expr;
-        item.optional_vars;
+        // Temporaries do not outlive their statement
+        int top = frame->top;
+        exec(stmt, depth);
+        frame->top = top;
     }
+}
 
-    // Needs to handle jump to OUTSIDE
+int VMGen::unsupported(Node* n, int depth) {
+    errors += 1;
+    program.errors += 1;
+    if (n != nullptr) {
+        kwerror(outlog(), "VM does not support {} yet", str(n->kind));
+    }
+
+    // Nothing is emitted, the register only keeps the allocation consistent
+    return new_temp();
+}
 
-    add_body("body", n, n->body, depth);
+// Expressions
+// -----------
 
-    // jump to here
-    // resume after
+int VMGen::constant(Constant_t* n, int depth) {
+    int dest = new_temp();
+    emit(OpCode::LoadConst, dest, new_constant(n->value));
+    return dest;
+}
 
-    // Add exit instructions
-    for (WithItem& item: n->items) {
-        item.context_expr;
-        item.optional_vars;
+int VMGen::name(Name_t* n, int depth) {
+    auto local = frame->locals.find(n->id);
+    if (local != frame->locals.end()) {
+        return local->second;
     }
 
-    return StmtRet();
+    auto global = globals.find(n->id);
+    if (global != globals.end()) {
+        int dest = new_temp();
+        emit(OpCode::LoadGlobal, dest, global->second);
+        return dest;
+    }
+
+    return unsupported(n, depth);
 }
-StmtRet VMGen::trystmt(Try_t* n, int depth) {
-    // register the exception handler addresses
-    // could `raise Exception` just lookup if "Exception has a registered handler"
 
-    add_body("body", n, n->body, depth);
-    // jump to orelse
+int VMGen::binop(BinOp_t* n, int depth) {
+    int lhs = exec(n->left, depth);
+    return binary_expr(n->native_operator, lhs, n->right, n->resolved_operator, depth);
+}
 
-    // on exception needs to jump to the right address
-    for (auto& handler: n->handlers) {
-        add_body("except_", n, handler.body, depth);
-        // jump to final
-    }
+int VMGen::unaryop(UnaryOp_t* n, int depth) {
+    int operand = exec(n->operand, depth);
 
-    // regular operation
-    add_body("orelse", n, n->orelse, depth);
+    if (n->native_operator != nullptr) {
+        int idx = int(program.unary.size());
+        program.unary.push_back(n->native_operator);
 
-    // Needs to handle jump to OUTSIDE
-    add_body("finalbody", n, n->finalbody, depth);
+        int dest = new_temp();
+        emit(OpCode::Unary, dest, operand, idx);
+        return dest;
+    }
 
-    return StmtRet();
+    if (FunctionDef* def = cast<FunctionDef>(n->resolved_operator)) {
+        auto it = function_index.find(def);
+        if (it != function_index.end()) {
+            int base = new_temp();
+            emit(OpCode::Move, base, operand);
+            emit(OpCode::Call, base, it->second, base);
+            return base;
+        }
+    }
+    return unsupported(n, depth);
 }
 
-StmtRet VMGen::match(Match_t* n, int depth) { return StmtRet(); }
+int VMGen::boolop(BoolOp_t* n, int depth) {
+    // Short circuit, the result is the last evaluated operand
+    OpCode     skip = n->op == BoolOperator::And ? OpCode::JumpIfFalse : OpCode::JumpIfTrue;
+    int        dest = new_temp();
+    Array<int> jumps;
 
-PatRet VMGen::matchvalue(MatchValue_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchsingleton(MatchSingleton_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchsequence(MatchSequence_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchmapping(MatchMapping_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchclass(MatchClass_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchstar(MatchStar_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchas(MatchAs_t* n, int depth) { return PatRet(); }
-PatRet VMGen::matchor(MatchOr_t* n, int depth) { return PatRet(); }
+    exec_into(n->values[0], dest, depth);
+    for (int i = 1; i < n->values.size(); i++) {
+        jumps.push_back(emit_jump(skip, dest));
+        exec_into(n->values[i], dest, depth);
+    }
 
-ModRet VMGen::module(Module_t* n, int depth) {
-    Array<StmtNode*> entry_point;
-    Array<StmtNode*> others;
+    for (int jump: jumps) {
+        patch_jump(jump);
+    }
+    return dest;
+}
 
-    for (auto* stmt: n->body) {
-        if (!in(stmt->kind, NodeKind::FunctionDef, NodeKind::ClassDef)) {
-            entry_point.push_back(stmt);
-        } else {
-            others.push_back(stmt);
+int VMGen::compare(Compare_t* n, int depth) {
+    // a < b < c => (a < b) and (b < c)
+    int        dest = new_temp();
+    int        prev = exec(n->left, depth);
+    Array<int> jumps;
+
+    for (int i = 0; i < n->comparators.size(); i++) {
+        BinaryFunction native   = i < n->native_operator.size() ? n->native_operator[i] : nullptr;
+        StmtNode*      resolved = i < n->resolved_operator.size() ? n->resolved_operator[i] : nullptr;
+
+        // The last operand is not reused, it can be read from the constant table
+        if (i + 1 == n->comparators.size()) {
+            move(dest, binary_expr(native, prev, n->comparators[i], resolved, depth));
+            break;
         }
+
+        int next = exec(n->comparators[i], depth);
+        move(dest, binary_operator(native, prev, next, resolved, depth));
+        jumps.push_back(emit_jump(OpCode::JumpIfFalse, dest));
+        prev = next;
     }
 
-    for (auto* stmt: entry_point) {
-        Super::exec(stmt, depth);
+    for (int jump: jumps) {
+        patch_jump(jump);
     }
+    return dest;
+}
 
-    // generate a (return None) as the last instruction of the entry point
-    Return* stop = n->new_object<Return>();
-    add_instruction(stop);
+int VMGen::ifexp(IfExp_t* n, int depth) {
+    int dest = new_temp();
+    int test = exec(n->test, depth);
 
-     for (auto* stmt: others) {
-        Super::exec(stmt, depth);
+    int orelse = emit_jump(OpCode::JumpIfFalse, test);
+    exec_into(n->body, dest, depth);
+    int end = emit_jump(OpCode::Jump);
+
+    patch_jump(orelse);
+    exec_into(n->orelse, dest, depth);
+    patch_jump(end);
+    return dest;
+}
+
+int VMGen::call(Call_t* n, int depth) {
+    Name* fun = cast<Name>(n->func);
+
+    if (fun == nullptr || !n->keywords.empty() || !n->varargs.empty()) {
+        return unsupported(n, depth);
     }
 
-    // Resolve Call
-    /*
-    for(LazyCallResolve& pending: calls_to_be_resolved) {
-        ExprNode* fun = pending.call->func;
-        switch (fun->kind) {
-            case NodeKind::Name: {
-                Name* name = cast<Name>(fun);
-                for(auto& label: labels) {
-                    if (str(name->id) == label.name) {
-                        pending.call->jump_id = label.index;
-                    }
-                }
-                continue;
-            }
-            default: {
-                kwerror(outlog(), "unsupported call to {}", str(fun->kind));
-                continue;
-            }
+    auto script = function_names.find(fun->id);
+    if (script != function_names.end()) {
+        if (program.functions[script->second].argc != int(n->args.size())) {
+            return unsupported(n, depth);
         }
+        return emit_call(OpCode::Call, script->second, n->args, depth);
     }
-    */
-    return ModRet();
-};
-ModRet VMGen::interactive(Interactive_t* n, int depth) { return ModRet(); }
-ModRet VMGen::functiontype(FunctionType_t* n, int depth) { return ModRet(); }
-ModRet VMGen::expression(Expression_t* n, int depth) { return ModRet(); }
 
-ModRet VMGen::exported(Exported_t* n, int depth) { return ModRet(); }
-ModRet VMGen::placeholder(Placeholder_t* n, int depth) { return ModRet(); }
+    // Function of another module, the linker patches the call
+    auto imported = imports.find(fun->id);
+    if (imported != imports.end()) {
+        int base = emit_call(OpCode::Call, 0, n->args, depth);
 
-//
-// Execute
-// =======
-void exec(int ic, int depth);
-//
+        program.relocations.push_back(Relocation{instruction_counter() - 1,
+                                                 imported->second.module,
+                                                 imported->second.name,
+                                                 int(n->args.size())});
+        return base;
+    }
 
-Value VMExec::execute(Program const& prog, int entry) {
-    set_program(&prog);
-    execute(entry);
-    return Value();
-}
+    // Builtins are only added to the program once called
+    auto native = native_names.find(fun->id);
+    if (native == native_names.end()) {
+        if (FunctionDef* def = builtin_function(fun->id)) {
+            register_function(def, str(def->name));
+            native = native_names.find(fun->id);
+        }
+    }
 
-Value VMExec::execute(int entry) {
-    set_ic(entry);
+    if (native != native_names.end()) {
+        VMNative const& target = program.natives[native->second];
 
+        // Arguments were checked by SEMA, call the native function directly
+        bool direct =
+            n->native_typed && target.direct != nullptr && int(n->args.size()) <= max_direct_args;
 
-    while (true) {
-        if (ic >= program->instructions.size() || ic < 0) {
-            return getreg(Registers::ReturnValue);
-        }
+        return emit_call(
+            direct ? OpCode::CallDirect : OpCode::CallNative, native->second, n->args, depth);
+    }
+
+    return unsupported(n, depth);
+}
+
+int VMGen::namedexpr(NamedExpr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::lambda(Lambda_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::dictexpr(DictExpr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::setexpr(SetExpr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::generateexpr(GeneratorExp_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::listexpr(ListExpr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::tupleexpr(TupleExpr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::listcomp(ListComp_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::setcomp(SetComp_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::dictcomp(DictComp_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::await(Await_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::yield(Yield_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::yieldfrom(YieldFrom_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::joinedstr(JoinedStr_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::formattedvalue(FormattedValue_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::attribute(Attribute_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::subscript(Subscript_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::starred(Starred_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::slice(Slice_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::exported(Exported_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::placeholder(Placeholder_t* n, int depth) { return unsupported(n, depth); }
+
+// No types during runtime
+int VMGen::dicttype(DictType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::arraytype(ArrayType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::arrow(Arrow_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::builtintype(BuiltinType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::tupletype(TupleType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::settype(SetType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::classtype(ClassType_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::comment(Comment_t* n, int depth) { return 0; }
+
+// Statements
+// ----------
+
+int VMGen::invalidstmt(InvalidStatement_t* n, int depth) { return unsupported(n, depth); }
+
+int VMGen::returnstmt(Return_t* n, int depth) {
+    if (finally_depth > 0) {
+        return unsupported(n, depth);
+    }
+    if (n->value.has_value()) {
+        Call* call = cast<Call>(n->value.value());
 
-        Instruction const& inst = program->instructions[ic];
-        Super::exec(inst.stmt, 0);
+        // Script functions of this unit can take over the frame,
+        // the result is returned to the caller of this function directly
+        if (call != nullptr && call->tail_call) {
+            auto script = function_names.find(cast<Name>(call->func)->id);
 
-        if (ic < 0) {
-            return getreg(Registers::ReturnValue);
+            if (script != function_names.end() &&
+                program.functions[script->second].argc == int(call->args.size())) {
+                emit_call(OpCode::TailCall, script->second, call->args, depth);
+                return 0;
+            }
         }
 
-        inc_ic();
+        emit(OpCode::Return, exec(n->value.value(), depth));
+    } else {
+        emit(OpCode::ReturnNone);
     }
+    return 0;
 }
 
-ExprRet VMExec::boolop(BoolOp_t* n, int depth) { 
-    StackTrace& trace = stacktrace.emplace_back();
-    KW_DEFERRED(
-    [&](std::size_t old_size) {
-        stacktrace.pop_back();
-        variables.resize(old_size);
-    },
-    variables.size());
+int VMGen::assign(Assign_t* n, int depth) {
+    if (n->targets.size() != 1) {
+        return unsupported(n, depth);
+    }
 
-    using ExecFun = Value(*)(VMExec*, BoolOp_t*, Value, Value);
+    Name* target = cast<Name>(n->targets[0]);
+    if (target == nullptr) {
+        return unsupported(n, depth);
+    }
 
-    ExecFun exec_native = [](VMExec* self, BoolOp_t* n, Value acc, Value val) -> Value {
-        return n->native_operator(self, self->makeargs(acc, val));
-    };
-    ExecFun exec_script = [](VMExec* self, BoolOp_t* n, Value acc, Value val) -> Value {
-        self->add_value(acc);
-        self->add_value(val);
-        // TODO
-        // jump to the right function
-
-        self->variables.resize(len(self->variables) - 2);
-        return self->getreg(Registers::ReturnValue);
-    };
+    auto local = frame->locals.find(target->id);
+    if (local != frame->locals.end()) {
+        exec_into(n->value, local->second, depth);
+        return 0;
+    }
 
-    ExecFun impl = n->native_operator ? exec_native: exec_script;
-    
-    Value result = Super::exec(n->values[0], depth);
+    store_name(target, exec(n->value, depth));
+    return 0;
+}
 
-    for(int i = 1; i < len(n->values); i++) {
-        // shortcut
-        // if true and OR
-        if (result.as<bool>() && n->op == BoolOperator::Or) {
-            return Value(true);
-        }
-        // if false and AND
-        if (!result.as<bool>() && n->op == BoolOperator::And) {
-            return Value(false);
+int VMGen::annassign(AnnAssign_t* n, int depth) {
+    Name* target = cast<Name>(n->target);
+    if (target == nullptr) {
+        return unsupported(n, depth);
+    }
+
+    auto local = frame->locals.find(target->id);
+    if (local != frame->locals.end()) {
+        if (n->value.has_value()) {
+            exec_into(n->value.value(), local->second, depth);
+        } else {
+            emit(OpCode::LoadNone, local->second);
         }
+        return 0;
+    }
 
-        Value val = Super::exec(n->values[i], depth);
+    int value = 0;
+    if (n->value.has_value()) {
+        value = exec(n->value.value(), depth);
+    } else {
+        value = new_temp();
+        emit(OpCode::LoadNone, value);
+    }
+    store_name(target, value);
+    return 0;
+}
 
-        result = impl(this, n, result, n->values[i]);
+int VMGen::augassign(AugAssign_t* n, int depth) {
+    Name* target = cast<Name>(n->target);
+    if (target == nullptr) {
+        return unsupported(n, depth);
     }
 
-    return Value();
+    int current = exec(target, depth);
+    int result  = binary_expr(n->native_operator, current, n->value, n->resolved_operator, depth);
+
+    store_name(target, result);
+    return 0;
 }
-ExprRet VMExec::namedexpr(NamedExpr_t* n, int depth) {
-    Value val = Super::exec(n->value, depth);
-    add_value(val);
-    return val; 
-}
-ExprRet VMExec::compare(Compare_t* n, int depth) {
-    StackTrace& trace = stacktrace.emplace_back();
-    KW_DEFERRED(
-    [&](std::size_t old_size) {
-        stacktrace.pop_back();
-        variables.resize(old_size);
-    },
-    variables.size());
-
-    auto exec_native = [](VMExec* self, Function fun, Value prev, Value next) -> Value {
-        return fun(self, self->makeargs(prev, next));
-    };
 
-    auto exec_script = [](VMExec* self, int jump, Value prev, Value next) -> Value {
-        self->add_value(prev);
-        self->add_value(next);
-        // TODO
-        // jump to the right function
+int VMGen::exprstmt(Expr_t* n, int depth) {
+    if (cast<Comment>(n->value) != nullptr) {
+        return 0;
+    }
+    exec(n->value, depth);
+    return 0;
+}
 
-        self->variables.resize(len(self->variables) - 2);
-        return self->getreg(Registers::ReturnValue);
-    };
+int VMGen::pass(Pass_t* n, int depth) { return 0; }
 
-    Value prev = Super::exec(n->left, depth);
-    for(int i = 0; i < len(n->comparators); i++) {
-        Value next = Super::exec(n->comparators[i], depth);
+int VMGen::breakstmt(Break_t* n, int depth) {
+    if (loop_ctx.empty() || loop_ctx.back().finally_depth != finally_depth) {
+        return unsupported(n, depth);
+    }
+    loop_ctx.back().breaks.push_back(emit_jump(OpCode::Jump));
+    return 0;
+}
 
-        // TODO
-        // get function implementation index
-        // n->varid
-        Function impl = n->native_operator[i];
+int VMGen::continuestmt(Continue_t* n, int depth) {
+    if (loop_ctx.empty() || loop_ctx.back().finally_depth != finally_depth) {
+        return unsupported(n, depth);
+    }
+    loop_ctx.back().continues.push_back(emit_jump(OpCode::Jump));
+    return 0;
+}
 
-        Value result = impl ? exec_native(this, impl, prev, next) : exec_script(this, 0, prev, next);
+int VMGen::assertstmt(Assert_t* n, int depth) {
+    // The message is only used by the traceback of the other evaluators
+    int test = exec(n->test, depth);
+    int jump = emit_jump(OpCode::JumpIfTrue, test);
+    emit(OpCode::Raise, program.external_class("AssertionError"));
+    patch_jump(jump);
+    return 0;
+}
 
-        if (!result.as<bool>()){
-            return Value(false);
+int VMGen::raise(Raise_t* n, int depth) {
+    // this is an implicit jump out to a location found in the handler table
+    if (!n->exc.has_value()) {
+        if (handling.empty()) {
+            emit(OpCode::Raise, program.external_class("RuntimeError"));
+        } else {
+            emit(OpCode::Reraise, handling.back());
         }
-        prev = next;
-    }   
+        return 0;
+    }
 
-    return Value(true);
+    // Objects do not exist in the VM, only the class of the exception is raised
+    int klass = exception_class(n->exc.value());
+    if (klass < 0) {
+        return unsupported(n, depth);
+    }
+    emit(OpCode::Raise, klass);
+    return 0;
 }
-ExprRet VMExec::binop(BinOp_t* n, int depth) 
-{ 
-    StackTrace& trace = stacktrace.emplace_back();
-    KW_DEFERRED(
-    [&](std::size_t old_size) {
-        stacktrace.pop_back();
-        variables.resize(old_size);
-    },
-    variables.size());
 
-    Value left = Super::exec(n->left, depth);
-    Value right = Super::exec(n->right, depth);
+int VMGen::exception_class(ExprNode* exc) {
+    if (Call* call = cast<Call>(exc)) {
+        exc = call->func;
+    }
 
-    if (n->native_operator) {
-        return n->native_operator(this, makeargs(left, right));
+    Name* name = cast<Name>(exc);
+    if (name == nullptr) {
+        return -1;
     }
 
-    add_value(left);
-    add_value(right);
-    
-    // TODO
-    // get function implementation index
-    // n->varid
-    return Value();
-}
-ExprRet VMExec::unaryop(UnaryOp_t* n, int depth) { 
-    
-    StackTrace& trace = stacktrace.emplace_back();
-    KW_DEFERRED(
-    [&](std::size_t old_size) {
-        stacktrace.pop_back();
-        variables.resize(old_size);
-    },
-    variables.size());
-
-    Value operand = Super::exec(n->operand, depth);
-    if (n->native_operator) {
-        return n->native_operator(this, makeargs(operand));
-    }
-
-    add_value(operand);
-    // TODO
-    // get function implementation index
-    // n->varid
-    return Value();
+    auto local = class_names.find(name->id);
+    if (local != class_names.end()) {
+        return local->second;
+    }
+
+    auto imported = imports.find(name->id);
+    if (imported != imports.end()) {
+        return program.external_class(imported->second.module + "." + imported->second.name);
+    }
+
+    if (builtin_exception(name->id) != nullptr) {
+        return program.external_class(str(name->id));
+    }
+    return -1;
 }
-ExprRet VMExec::ifexp(IfExp_t* n, int depth) { 
-    Value cond = Super::exec(n->test, depth);
-    if (cond.as<bool>()) {
-        return Super::exec(n->body, depth);
+
+void VMGen::register_class(ClassDef* def) {
+    VMClass cls{str(def->name)};
+
+    if (!def->bases.empty()) {
+        cls.base = exception_class(def->bases[0]);
     }
-    return Super::exec(n->orelse, depth); 
-}
-
-
-ExprRet VMExec::joinedstr(JoinedStr_t* n, int depth) { return ExprRet(); }
-ExprRet VMExec::formattedvalue(FormattedValue_t* n, int depth) { return ExprRet(); }
-
-ExprRet VMExec::yield(Yield_t* n, int depth) { 
-    // save the current excution state and return to main execution thread
-    return ExprRet(); 
-}
-ExprRet VMExec::yieldfrom(YieldFrom_t* n, int depth) { return ExprRet(); }
 
-
-ExprRet VMExec::constant(Constant_t* n, int depth) { 
-    return n->value; 
+    class_names[def->name] = int(program.classes.size());
+    program.classes.push_back(cls);
 }
-ExprRet VMExec::attribute(Attribute_t* n, int depth) { 
-    // get the value or set the value of an attribute
 
-    return ExprRet(); 
+bool VMGen::add_handler(ExprNode* type, VMHandler handler) {
+    // except (ValueError, TypeError):
+    if (TupleExpr* types = cast<TupleExpr>(type)) {
+        for (ExprNode* elt: types->elts) {
+            if (!add_handler(elt, handler)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    handler.klass = exception_class(type);
+    if (handler.klass < 0) {
+        return false;
+    }
+    program.handlers.push_back(handler);
+    return true;
 }
-ExprRet VMExec::subscript(Subscript_t* n, int depth) { 
-    // call native []
-    // or call __getitem__ / __setitem__
-    return ExprRet(); 
+
+int VMGen::global(Global_t* n, int depth) {
+    // resolved by collect_locals
+    return 0;
 }
 
-ExprRet VMExec::dictexpr(DictExpr_t* n, int depth) { 
-    //
-    // How would the GC interact here
-    //  1. we need the GC to know about the memory allocation
-    //     a. _new_object should call placement new and the memory should be allocated for it by the GC
-    //        or it should take a reference to a `GarbageCollector` that will allocate the memory for it
-    //     b. we could move the tag out of Value and into the GC
-    //        Makes Value cheaper overall, plus once sema is run type safety should be guaranteed
-    //
-    //  2. it needs to know HOW to free it
-    //     a. Here the value is a C++ class, so the constructor can be called
-    //        BUT the value it holds might need to be deleted by a special destructor
-    //     b. If Value is a Script class, its destructor need to be called
-    //        which requires VMExec to be available
-    //     c. ValueDeleter = void(*)(Value&) so the function is not compatible with VMExec
-    //        we could change the signature to be void(*)(GarbageCollector* gc, Value&)
-    //        and VMExec would implement the `GarbageCollector` interface
-    //
-    //  3. So now we have a list of Values allocated
-    //     We can iterate over all the addressable value and mark
-    //     the reachable value
-    //
-    Value val = make_value<Dict<Value, Value>>();
-    
-    Dict<Value, Value>& dict = val.as<Dict<Value, Value>&>();
-    dict.reserve(len(n->keys));
+int VMGen::nonlocal(Nonlocal_t* n, int depth) { return unsupported(n, depth); }
 
-    for(int i = 0; i < len(n->keys); i++) {
-        Value key = Super::exec(n->keys[i], depth);
-        Value value = Super::exec(n->values[i], depth);
-        // dict[key] = val;
-        dict.insert({key, val});
+// Imported modules are initialized by the entry point of the linked program
+int VMGen::import(Import_t* n, int depth) {
+    for (Alias const& alias: n->names) {
+        String module = str(alias.name);
+
+        if (!contains(program.dependencies, module)) {
+            program.dependencies.push_back(module);
+        }
     }
-    return val;
+    return 0;
 }
-ExprRet VMExec::setexpr(SetExpr_t* n, int depth) { 
-    Value val = make_value<Array<Value>>();
-    
-    Array<Value>& array = val.as<Array<Value>&>();
-    array.reserve(len(n->elts));
 
-    for(auto* elt: n->elts) {
-        Value element = Super::exec(elt, depth);
-        array.push_back(elt);
+int VMGen::importfrom(ImportFrom_t* n, int depth) {
+    if (!n->module.has_value() || n->level.has_value()) {
+        kwdebug(outlog(), "relative imports are resolved by sema");
+        return 0;
+    }
+
+    String module = str(n->module.value());
+    if (!contains(program.dependencies, module)) {
+        program.dependencies.push_back(module);
+    }
+
+    for (Alias const& alias: n->names) {
+        StringRef name = alias.asname.has_value() ? alias.asname.value() : alias.name;
+        imports[name]  = ImportedSymbol{module, str(alias.name)};
     }
-    return val; 
+    return 0;
+}
+
+int VMGen::inlinestmt(Inline_t* n, int depth) {
+    body(n->body, depth);
+    return 0;
 }
-ExprRet VMExec::listexpr(ListExpr_t* n, int depth) { 
-    Value val = make_value<Array<Value>>();
-    
-    Array<Value>& array = val.as<Array<Value>&>();
-    array.reserve(len(n->elts));
 
-    for(auto* elt: n->elts) {
-        Value element = Super::exec(elt, depth);
-        array.push_back(elt);
+int VMGen::functiondef(FunctionDef_t* n, int depth) {
+    // Module level functions are compiled after the entry point
+    if (frame->is_module) {
+        return 0;
     }
-    return val; 
+    return unsupported(n, depth);
 }
-ExprRet VMExec::tupleexpr(TupleExpr_t* n, int depth) { 
-    Value val = make_value<Array<Value>>();
-    
-    Array<Value>& array = val.as<Array<Value>&>();
-    array.reserve(len(n->elts));
 
-    for(auto* elt: n->elts) {
-        Value element = Super::exec(elt, depth);
-        array.push_back(elt);
+int VMGen::classdef(ClassDef_t* n, int depth) {
+    // Only functions end up in the final program
+    if (frame->is_module) {
+        return 0;
     }
-    return val; 
+    return unsupported(n, depth);
 }
-ExprRet VMExec::slice(Slice_t* n, int depth) { 
-    //
-    // this returns an array view/range/slice
-    Value step;
-    Value upper;
-    Value lower;
-
-    if (n->step.has_value()) {
-        step = Super::exec(n->step.value(), depth);
-    }
-    if (n->lower.has_value()) {
-        lower = Super::exec(n->lower.value(), depth);
-    }
-    if (n->upper.has_value()) {
-        upper = Super::exec(n->upper.value(), depth);
-    }
-
-    return ExprRet(); 
-}
-
-ExprRet VMExec::name(Name_t* n, int depth) {
-    int idx = (n->load_id - n->store_id);
-    int size = int(variables.size());
-
-    Value val = variables[size - idx];
-
-    kwerror(outlog(), "loading {}", str(val));
-    return val;
-}
-
-int VMExec::compute_jump_call_address(Call_t* n, int depth) {
-    //
-    // def oldfun(...)
-    //     pass
-    //
-    // newfun = oldfun
-    //
-    //
-    // or returning of function ?
-    // sema will tell us the expression is callable
-    // constant folding might simplify a lot here
-
-
-    // TODO: this can be pre-computed on VMGen
-    auto find_label = [&](String name) -> int {
-        for(auto& label: program->labels) {
-            if (label.name == name) {
-                return label.index;
-            }
-        }
-        return -1;
-    };
 
-    switch (n->func->kind) {
-        case NodeKind::Name: {
-            Name* name = cast<Name>(n->func);
-            return find_label(str(name->id));
-        }
+int VMGen::whilestmt(While_t* n, int depth) {
+    int start = instruction_counter();
+    int exit  = emit_test(n->test, depth);
+
+    loop_ctx.push_back(LoopContext{{}, {}, finally_depth});
+    body(n->body, depth);
+    LoopContext loop = loop_ctx.back();
+    loop_ctx.pop_back();
+
+    for (int jump: loop.continues) {
+        program.instructions[jump].set_offset(start - (jump + 1));
     }
+    emit_jump_to(OpCode::Jump, 0, start);
 
-    kwerror(outlog(), "Unsupported expression {}", str(n->func->kind));
-    return -1;
+    patch_jump(exit);
+    body(n->orelse, depth);
+
+    // Skip orelse
+    for (int jump: loop.breaks) {
+        patch_jump(jump);
+    }
+    return 0;
 }
 
-ExprRet VMExec::call(Call_t* n, int depth) {
-    StackTrace& trace = stacktrace.emplace_back();
-
-    // Remove trace when the call finished
-    // Remove arguments from addressable variables
-    KW_DEFERRED(
-        [&](std::size_t old_size) {
-            stacktrace.pop_back();
-            variables.resize(old_size);
-        },
-        variables.size());
-
-    // fetch the label to jump to
-    int fun_idx = compute_jump_call_address(n, depth);
-
-    // is call native instruction
-    Instruction const& inst = program->instructions[fun_idx];
-    if (VMNativeFunction* native = cast<VMNativeFunction>(inst.stmt)) {
-        Array<Value> args;
-        args.reserve(n->args.size());
-        for (auto& arg: n->args) {
-            args.push_back(Super::exec(arg, depth));
-        }
+int VMGen::ifstmt(If_t* n, int depth) {
+    Array<int> ends;
 
-        Function fptr = native->fun;
-        return fptr((void*)(this), args);
-    } else {
-        // check for native call then we can just call it here
-        for (auto& arg: n->args) {
-            Value arg_val = Super::exec(arg, depth);
-            kwdebug(outlog(), "adding value: {}", str(arg_val));
-            add_value(arg_val);
-        }
+    int next = emit_test(n->test, depth);
+    body(n->body, depth);
 
-        // we could modify ic and return
-        // but then we need to have a return address
-        // here we use an implicit stack which is not good
-        // we should use our current call stack
-        //
-        // BUT in this VM expression are not flatten
-        // so we expect call to return an expression
-        // in a future version we might flatten the tree further to make it SSA
-        // that would simplify execution even further
-        int old = ic;
-        setreg(Registers::ReturnAddress, -1);
-
-        execute(fun_idx);
-
-        set_ic(old);
-        Value v = getreg(Registers::ReturnValue);
-        // std::cout << str(v) << std::endl;
-        return v;
+    for (int i = 0; i < n->tests.size(); i++) {
+        ends.push_back(emit_jump(OpCode::Jump));
+        patch_jump(next);
+
+        next = emit_test(n->tests[i], depth);
+        body(n->bodies[i], depth);
     }
-    return Value();
-}
-// Leaves
-StmtRet VMExec::invalidstmt(InvalidStatement_t* n, int depth) {
-    kwerror(outlog(), "Invalid statement");
-    return StmtRet();
-}
-StmtRet VMExec::returnstmt(Return_t* n, int depth) {
-    if (n->value.has_value()) {
-        Value ret_val = Super::exec(n->value.value(), depth);
-        setreg(Registers::ReturnValue, ret_val);
+
+    if (!n->orelse.empty()) {
+        ends.push_back(emit_jump(OpCode::Jump));
+        patch_jump(next);
+        body(n->orelse, depth);
     } else {
-        setreg(Registers::ReturnValue, Value(_None()));
+        patch_jump(next);
     }
 
-    // ic of -1 would stop the program
-    // in the case of a call that is what we want
-    set_ic(getreg(Registers::ReturnAddress).as<int>());
-    return StmtRet();
+    for (int jump: ends) {
+        patch_jump(jump);
+    }
+    return 0;
 }
-StmtRet VMExec::deletestmt(Delete_t* n, int depth) {
-    // delete addressable values
-    // they become inusable, access to them should raise
-    // an exception
-    for (auto* expr: n->targets) {
-        // should probably return an address to a value
-        Value val = Super::exec(expr, depth);
-        int   idx = val.as<int>();
-        //
-        // free_value(variables[idx]);
-        //
 
-        // Make invalid, so use will result in error
-        // this only works if addresse directly
-        // if the value was part of an object the ref might still
-        // think it is valid
-        variables[idx] = Value();
+// Only loops over range are compiled, they are counted with the native operators SEMA picked
+//
+//      counter = start
+//      stop    = stop
+//  top:
+//      if not counter < stop: jump exit
+//      target  = counter
+//      body
+//  next:
+//      counter = counter + step
+//      jump top
+//  exit:
+//      orelse
+//
+int VMGen::forstmt(For_t* n, int depth) {
+    if (!n->counted) {
+        return unsupported(n, depth);
     }
-    return StmtRet();
-}
-StmtRet VMExec::assign(Assign_t* n, int depth) {
-    Array<ExprNode*>& targets = n->targets;
-    Value             val     = Super::exec(n->value, depth);
 
-    kwassert(targets.size() == 1, "");
+    Array<ExprNode*> const& args = cast<Call>(n->iter)->args;
 
-    switch (targets[0]->kind) {
-    case NodeKind::Name: {
-        add_value(val);
+    // live for the whole loop, the statements of the body allocate above them
+    int counter = new_temp();
+    int stop    = new_temp();
+
+    if (args.size() > 1) {
+        exec_into(args[0], counter, depth);
+    } else {
+        emit(OpCode::LoadConst, counter, new_constant(n->start));
     }
-    // Unpacking
-    case NodeKind::TupleExpr: {
-        // for ech elem in val
-        //  add_value(val)
-        //
+    exec_into(args.size() > 1 ? args[1] : args[0], stop, depth);
+
+    if (n->zero_step()) {
+        emit(OpCode::Raise, program.external_class("ValueError"));
+        return 0;
     }
+
+    int start = instruction_counter();
+    barrier   = start;
+
+    emit(OpCode::Test, 0, counter, stop);
+    int exit = emit(OpCode::Ext, binary_index(n->native_compare));
+
+    store_name(cast<Name>(n->target), counter);
+
+    loop_ctx.push_back(LoopContext{{}, {}, finally_depth});
+    body(n->body, depth);
+    LoopContext loop = loop_ctx.back();
+    loop_ctx.pop_back();
+
+    int next = instruction_counter();
+    barrier  = next;
+    for (int jump: loop.continues) {
+        program.instructions[jump].set_offset(next - (jump + 1));
     }
 
-    return StmtRet();
+    emit(OpCode::BinaryConst, counter, counter, new_constant(n->step));
+    emit(OpCode::Ext, binary_index(n->native_step));
+    emit_jump_to(OpCode::Jump, 0, start);
+
+    patch_jump(exit);
+    body(n->orelse, depth);
+
+    for (int jump: loop.breaks) {
+        patch_jump(jump);
+    }
+    return 0;
 }
-StmtRet VMExec::augassign(AugAssign_t* n, int depth) {
-    n->target;
-    Value arg = Super::exec(n->value, depth);
+int VMGen::with(With_t* n, int depth) { return unsupported(n, depth); }
+// The try body is compiled inline, the handlers after it. Nothing is executed when
+// entering or leaving the try, the regions are recorded in the handler table
+// that is only searched once an exception is raised:
+//
+//      body            <- protected by the handlers
+//      orelse
+//      finalbody
+//      jump done
+//  handler_i:
+//      body_i
+//      finalbody
+//      jump done
+//  cleanup:            <- exceptions that are not handled run the finally block
+//      finalbody
+//      reraise
+//  done:
+//
+int VMGen::trystmt(Try_t* n, int depth) {
+    bool has_finally = !n->finalbody.empty();
+
+    // Class of the exception being handled
+    int exception = new_temp();
 
-    assert(n->target->kind == NodeKind::Name);
-    if (Name* name = cast<Name>(n->target)) {
-        // lookup
-        int idx = 0;
+    // Regions running the finally block when an exception goes through
+    Array<Tuple<int, int>> protected_ranges;
+    Array<int>             exits;
 
-        Array<Value> args(2);
-        args[0] = variables[idx];
-        args[1] = arg;
+    finally_depth += int(has_finally);
+    int start = instruction_counter();
+    body(n->body, depth);
+    int end = instruction_counter();
+
+    body(n->orelse, depth);
+    protected_ranges.emplace_back(start, instruction_counter());
+    finally_depth -= int(has_finally);
 
-        variables[idx] = n->native_operator(this, args);
+    body(n->finalbody, depth);
+    exits.push_back(emit_jump(OpCode::Jump));
+
+    for (ExceptHandler& handler: n->handlers) {
+        if (handler.name.has_value()) {
+            unsupported(n, depth);
+        }
+
+        VMHandler entry{start, end, instruction_counter(), -1, exception};
+        barrier = entry.target;
+
+        if (handler.type.has_value()) {
+            if (!add_handler(handler.type.value(), entry)) {
+                unsupported(n, depth);
+            }
+        } else {
+            program.handlers.push_back(entry);
+        }
+
+        finally_depth += int(has_finally);
+        handling.push_back(exception);
+        body(handler.body, depth);
+        handling.pop_back();
+        protected_ranges.emplace_back(entry.target, instruction_counter());
+        finally_depth -= int(has_finally);
+
+        body(n->finalbody, depth);
+        exits.push_back(emit_jump(OpCode::Jump));
     }
-    return StmtRet();
-}
-StmtRet VMExec::annassign(AnnAssign_t* n, int depth) {
-    ExprNode* target = n->target;
-    Value     val;
-    if (n->value.has_value()) {
-        val = Super::exec(n->value.value(), depth);
+
+    if (has_finally) {
+        int cleanup = instruction_counter();
+        barrier     = cleanup;
+
+        for (auto const& range: protected_ranges) {
+            program.handlers.push_back(
+                VMHandler{std::get<0>(range), std::get<1>(range), cleanup, -1, exception});
+        }
+
+        body(n->finalbody, depth);
+        emit(OpCode::Reraise, exception);
     }
 
-    switch (target->kind) {
-    case NodeKind::Name: {
-        add_value(val);
+    for (int jump: exits) {
+        patch_jump(jump);
     }
-    // Unpacking
-    case NodeKind::TupleExpr: {
-        // for ech elem in val
-        //  add_value(val)
-        //
+    return 0;
+}
+int VMGen::deletestmt(Delete_t* n, int depth) { return unsupported(n, depth); }
+int VMGen::match(Match_t* n, int depth) { return unsupported(n, depth); }
+
+int VMGen::matchvalue(MatchValue_t* n, int depth) { return 0; }
+int VMGen::matchsingleton(MatchSingleton_t* n, int depth) { return 0; }
+int VMGen::matchsequence(MatchSequence_t* n, int depth) { return 0; }
+int VMGen::matchmapping(MatchMapping_t* n, int depth) { return 0; }
+int VMGen::matchclass(MatchClass_t* n, int depth) { return 0; }
+int VMGen::matchstar(MatchStar_t* n, int depth) { return 0; }
+int VMGen::matchas(MatchAs_t* n, int depth) { return 0; }
+int VMGen::matchor(MatchOr_t* n, int depth) { return 0; }
+
+int VMGen::module(Module_t* n, int depth) {
+    // Register every function first so calls can be resolved
+    // regardless of the definition order
+    program.functions.push_back(VMFunction{"<module>", nullptr, 0, 0, 0});
+
+    for (StmtNode* stmt: n->body) {
+        if (FunctionDef* def = cast<FunctionDef>(stmt)) {
+            register_function(def, str(def->name));
+        }
+        if (ClassDef* cls = cast<ClassDef>(stmt)) {
+            register_class(cls);
+
+            for (StmtNode* method: cls->body) {
+                if (FunctionDef* def = cast<FunctionDef>(method)) {
+                    register_function(def, str(cls->name) + "." + str(def->name));
+                }
+            }
+        }
     }
+
+    // Entry point, names are globals
+    Frame module_frame;
+    module_frame.is_module = true;
+    frame                  = &module_frame;
+
+    program.labels.push_back({nullptr, "<module>", 0, depth});
+    body(n->body, depth);
+    emit(OpCode::ReturnNone);
+
+    program.functions[0].frame_size = module_frame.size;
+    frame                           = nullptr;
+
+    for (int i = 1; i < program.functions.size(); i++) {
+        compile_function(program.functions[i], depth + 1);
     }
-    return StmtRet();
-}
-StmtRet VMExec::exprstmt(Expr_t* n, int depth) {
-    // have to be called because of side effects
-    Super::exec(n->value, depth);
-    return StmtRet();
-}
-StmtRet VMExec::pass(Pass_t* n, int depth) {
-    kwassert(false, "should have been ignored");
-    return StmtRet();
-}
-StmtRet VMExec::breakstmt(Break_t* n, int depth) {
-    kwassert(false, "should have been converted to jump");
-    return StmtRet();
-}
-StmtRet VMExec::continuestmt(Continue_t* n, int depth) {
-    // Jump to loop start
-    kwassert(false, "should have been converted to jump");
-    return StmtRet();
-}
-StmtRet VMExec::assertstmt(Assert_t* n, int depth) {
-    kwassert(false, "should have been converted to condjump + raise");
-    return StmtRet();
-}
-StmtRet VMExec::raise(Raise_t* n, int depth) {
-    // this is an implicit jump out to an unknown location
-    //
-    return StmtRet();
+    return 0;
 }
 
+int VMGen::interactive(Interactive_t* n, int depth) { return 0; }
+int VMGen::functiontype(FunctionType_t* n, int depth) { return 0; }
+int VMGen::expression(Expression_t* n, int depth) { return 0; }
+
+//
+// Link
+// ====
 //
-// Those two change variable lookup scope
-StmtRet VMExec::global(Global_t* n, int depth) { 
-    //
-    return StmtRet(); }
-StmtRet VMExec::nonlocal(Nonlocal_t* n, int depth) { 
-    //    
-    return StmtRet(); 
-}
 
-StmtRet VMExec::nativefunction(VMNativeFunction_t* n, int depth) {
-    kwassert(false, "should be handled on the call level");
-    return StmtRet();
+uint16 link_operand(int value) {
+    kwassert(value >= 0 && value <= 0xFFFF, "Operand out of range after linking");
+    return uint16(value);
 }
 
+void VMLinker::place(Program const& unit, Placement& at, bool main) {
+    at.instruction = int(program.instructions.size());
+    at.constant    = int(program.constants.size());
+    at.unary       = int(program.unary.size());
+    at.function    = int(program.functions.size());
+    at.native      = int(program.natives.size());
+    at.global      = int(program.globals.size());
 
-StmtRet VMExec::condjump(CondJump_t* n, int depth) {
-    Value val = Super::exec(n->condition, depth);
-    ic        = n->then_jmp - 1;
-    if (val.as<bool>()) {
-        ic = n->else_jmp - 1;
+    auto qualified = [&](String const& name) -> String {
+        if (main) {
+            return name;
+        }
+        return unit.name + "." + name;
+    };
+
+    // Operators are shared between the units
+    for (BinaryFunction fun: unit.binary) {
+        auto it = std::find(program.binary.begin(), program.binary.end(), fun);
+
+        if (it == program.binary.end()) {
+            at.binary.push_back(int(program.binary.size()));
+            program.binary.push_back(fun);
+        } else {
+            at.binary.push_back(int(it - program.binary.begin()));
+        }
     }
-    return StmtRet();
-}
 
-StmtRet VMExec::jump(Jump_t* n, int depth) {
-    ic = n->destination - 1;
-    return StmtRet();
-}
+    program.constants.insert(
+        program.constants.end(), unit.constants.begin(), unit.constants.end());
+    program.unary.insert(program.unary.end(), unit.unary.begin(), unit.unary.end());
+
+    for (VMNative native: unit.natives) {
+        native.name = qualified(native.name);
+        program.natives.push_back(native);
+    }
+    for (String const& global: unit.globals) {
+        program.globals.push_back(qualified(global));
+    }
+    for (VMFunction fun: unit.functions) {
+        fun.name = qualified(fun.name);
+        fun.entry += at.instruction;
+        program.functions.push_back(fun);
+    }
+    for (Label label: unit.labels) {
+        label.name = qualified(label.name);
+        label.index += at.instruction;
+        program.labels.push_back(label);
+    }
+    for (SourceLine line: unit.lines) {
+        line.instruction += at.instruction;
+        program.lines.push_back(line);
+    }
 
-StmtRet VMExec::vmstmt(VMStmt* n, int depth) { return Super::exec(n->stmt, depth); }
+    // Classes declared by another unit are merged with their definition
+    for (VMClass cls: unit.classes) {
+        if (!cls.external) {
+            cls.name = qualified(cls.name);
+        }
+        if (cls.base >= 0) {
+            cls.base = at.classes[cls.base];
+        }
 
-ExprRet VMExec::starred(Starred_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); 
-}
-StmtRet VMExec::import(Import_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return StmtRet(); }
-StmtRet VMExec::importfrom(ImportFrom_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return StmtRet(); }
+        int index = program.external_class(cls.name);
+        if (!cls.external) {
+            program.classes[index] = cls;
+        }
+        at.classes.push_back(index);
+    }
+    for (VMHandler handler: unit.handlers) {
+        handler.start += at.instruction;
+        handler.end += at.instruction;
+        handler.target += at.instruction;
+        if (handler.klass >= 0) {
+            handler.klass = at.classes[handler.klass];
+        }
+        program.handlers.push_back(handler);
+    }
 
-ExprRet VMExec::lambda(Lambda_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); 
+    for (int i = 0; i < unit.instructions.size(); i++) {
+        Instruction inst = unit.instructions[i];
+
+        switch (inst.op) {
+        case OpCode::LoadConst: inst.b = link_operand(at.constant + inst.b); break;
+        case OpCode::LoadGlobal: inst.b = link_operand(at.global + inst.b); break;
+        case OpCode::StoreGlobal: inst.a = link_operand(at.global + inst.a); break;
+        case OpCode::BinaryConst:
+        case OpCode::TestConst: inst.c = link_operand(at.constant + inst.c); break;
+        case OpCode::Unary: inst.c = link_operand(at.unary + inst.c); break;
+        case OpCode::Call:
+        case OpCode::TailCall: inst.b = link_operand(at.function + inst.b); break;
+        case OpCode::CallNative:
+        case OpCode::CallDirect: inst.b = link_operand(at.native + inst.b); break;
+        case OpCode::Raise: inst.a = link_operand(at.classes[inst.a]); break;
+        default: break;
+        }
+        program.instructions.push_back(inst);
+
+        // The operator is stored in the Ext word
+        if (in(inst.op, OpCode::Binary, OpCode::BinaryConst, OpCode::Test, OpCode::TestConst)) {
+            Instruction ext = unit.instructions[i + 1];
+            ext.a           = link_operand(at.binary[ext.a]);
+            program.instructions.push_back(ext);
+            i += 1;
+        }
+    }
 }
-ExprRet VMExec::listcomp(ListComp_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); }
-ExprRet VMExec::generateexpr(GeneratorExp_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); }
-ExprRet VMExec::setcomp(SetComp_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); }
-ExprRet VMExec::dictcomp(DictComp_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); }
-ExprRet VMExec::await(Await_t* n, int depth) { 
-    kwerror(outlog(), "this should probably not exist anymore");
-    return ExprRet(); }
 
+void VMLinker::relocate(Array<Program> const& units, Array<Placement> const& placements) {
+    for (int u = 0; u < units.size(); u++) {
+        for (Relocation const& reloc: units[u].relocations) {
+            Instruction& inst     = program.instructions[placements[u].instruction + reloc.instruction];
+            bool         resolved = false;
 
-StmtRet VMExec::inlinestmt(Inline_t* n, int depth) {
-    kwassert(false, "should have been converted to instructions");
-    return StmtRet();
-}
-StmtRet VMExec::functiondef(FunctionDef_t* n, int depth) {
-    kwassert(false, "should have been converted to NativeCalls & instructions");
-    return StmtRet();
-}
-StmtRet VMExec::classdef(ClassDef_t* n, int depth) {
-    kwassert(false, "should have been converted to calls");
-    return StmtRet();
-}
+            for (int t = 0; t < units.size() && !resolved; t++) {
+                Program const& lib = units[t];
+                if (lib.name != reloc.module) {
+                    continue;
+                }
 
-StmtRet VMExec::forstmt(For_t* n, int depth) {
-    kwassert(false, "should have been converted to jump");
-    return StmtRet();
-}
+                // functions[0] is the module level code
+                for (int i = 1; i < lib.functions.size() && !resolved; i++) {
+                    if (lib.functions[i].name == reloc.name) {
+                        resolved = lib.functions[i].argc == reloc.argc;
+                        inst.b   = link_operand(placements[t].function + i);
+                    }
+                }
+                for (int i = 0; i < lib.natives.size() && !resolved; i++) {
+                    if (lib.natives[i].name == reloc.name) {
+                        resolved = true;
+                        inst.op  = OpCode::CallNative;
+                        inst.b   = link_operand(placements[t].native + i);
+                    }
+                }
+            }
 
-StmtRet VMExec::whilestmt(While_t* n, int depth) {
-    kwassert(false, "should have been converted to jump");
-    return StmtRet();
+            if (!resolved) {
+                kwerror(outlog(), "Undefined reference to {}.{}", reloc.module, reloc.name);
+                errors += 1;
+                inst = Instruction{OpCode::Raise, link_operand(program.external_class("NameError"))};
+            }
+        }
+    }
 }
 
-StmtRet VMExec::ifstmt(If_t* n, int depth) {
-    kwassert(false, "should have been converted to jump");
-    return StmtRet();
-}
+Program VMLinker::link(Array<Program> const& units) {
+    program = Program();
+    errors  = 0;
+
+    if (units.empty()) {
+        return program;
+    }
 
-StmtRet VMExec::with(With_t* n, int depth) {
-    kwassert(false, "should have been converted to calls & jumps");
-    return StmtRet();
+    program.name         = units[0].name;
+    program.dependencies = units[0].dependencies;
+
+    // Reserve the entry point
+    bool has_entry = units.size() > 1;
+    if (has_entry) {
+        program.functions.push_back(VMFunction{"<program>", nullptr, -1, 0, 1});
+    }
+
+    Array<Placement> placements(units.size());
+    for (int i = 0; i < units.size(); i++) {
+        place(units[i], placements[i], i == 0);
+        program.errors += units[i].errors;
+    }
+    relocate(units, placements);
+
+    if (has_entry) {
+        VMFunction& entry = program.functions[0];
+        entry.entry       = int(program.instructions.size());
+        program.labels.push_back({nullptr, entry.name, entry.entry, 0});
+
+        // Run the module level code of the imported modules first
+        for (int i = int(units.size()) - 1; i >= 0; i--) {
+            program.instructions.push_back(
+                Instruction{OpCode::Call, 0, link_operand(placements[i].function), 0});
+        }
+        program.instructions.push_back(Instruction{OpCode::ReturnNone});
+    }
+    return program;
 }
-StmtRet VMExec::trystmt(Try_t* n, int depth) {
-    kwassert(false, "should have been converted to jumps");
-    return StmtRet();
+
+Program compile_unit(Module* mod, String const& name) {
+    VMGen compiler;
+    compiler.program.name = name;
+    compiler.exec(mod, 0);
+    return compiler.program;
 }
 
-StmtRet VMExec::exported(Exported_t* n, int depth) { return StmtRet(); }
+// List the module after the modules it imports
+void collect_modules(Module*                        mod,
+                     String const&                  name,
+                     Set<String>&                   seen,
+                     Array<Tuple<String, Module*>>& modules) {
+    seen.insert(name);
+
+    auto visit = [&](String const& path) {
+        if (seen.count(path) > 0) {
+            return;
+        }
 
-StmtRet VMExec::placeholder(Placeholder_t* n, int depth) { return StmtRet(); }
+        // Modules were already imported by sema, this only fetches them
+        ImportLib::ImportedLib* lib = ImportLib::instance()->importfile(path);
+        if (lib != nullptr && lib->mod != nullptr) {
+            collect_modules(lib->mod, path, seen, modules);
+        }
+    };
 
-StmtRet VMExec::match(Match_t* n, int depth) {
-    kwassert(false, "should have been converted to jumps");
-    return StmtRet();
+    for (StmtNode* stmt: mod->body) {
+        if (Import* n = cast<Import>(stmt)) {
+            for (Alias const& alias: n->names) {
+                visit(str(alias.name));
+            }
+        }
+        if (ImportFrom* n = cast<ImportFrom>(stmt)) {
+            if (n->module.has_value() && !n->level.has_value()) {
+                visit(str(n->module.value()));
+            }
+        }
+    }
+
+    modules.emplace_back(name, mod);
 }
 
-PatRet VMExec::matchvalue(MatchValue_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchsingleton(MatchSingleton_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchsequence(MatchSequence_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchmapping(MatchMapping_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchclass(MatchClass_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchstar(MatchStar_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchas(MatchAs_t* n, int depth) { return PatRet(); }
-PatRet VMExec::matchor(MatchOr_t* n, int depth) { return PatRet(); }
+Program compile(Module* mod) {
+    Set<String>                   seen;
+    Array<Tuple<String, Module*>> modules;
+    collect_modules(mod, "__main__", seen, modules);
+
+    // The main module first, a module before the modules it imports
+    std::reverse(modules.begin(), modules.end());
 
-ModRet VMExec::module(Module_t* n, int depth) {
-    kwerror(outlog(), "No more module");
-    return ModRet();
-};
-ModRet VMExec::interactive(Interactive_t* n, int depth) { return ModRet(); }
-ModRet VMExec::functiontype(FunctionType_t* n, int depth) { return ModRet(); }
-ModRet VMExec::expression(Expression_t* n, int depth) { return ModRet(); }
+    // Units do not depend on each other but they are compiled one after the other,
+    // VMGen logs through the shared loggers and allocates through the instrumented
+    // allocator, neither is thread safe
+    Array<Program> units(modules.size());
+    for (int i = 0; i < modules.size(); i++) {
+        units[i] = compile_unit(std::get<1>(modules[i]), std::get<0>(modules[i]));
+    }
 
+    if (units.size() == 1) {
+        return units[0];
+    }
 
+    VMLinker linker;
+    return linker.link(units);
+}
 
 //
-//
+// Execute
+// =======
 //
 
-ExprRet VMExec::dicttype(DictType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
-}
-ExprRet VMExec::arraytype(ArrayType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
-}
-ExprRet VMExec::arrow(Arrow_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
+Value VMExec::execute(Program const& prog, int entry) {
+    if (prog.errors > 0) {
+        kwerror(outlog(), "{} was not fully compiled ({} errors)", prog.name, prog.errors);
+        has_error = true;
+        return Value();
     }
-ExprRet VMExec::builtintype(BuiltinType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
+    set_program(&prog);
+    return execute(entry);
 }
-ExprRet VMExec::tupletype(TupleType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
+
+Value VMExec::global(String const& name) const {
+    int idx = program->find_global(name);
+    if (idx < 0) {
+        return Value();
+    }
+    return globals[idx];
 }
-ExprRet VMExec::settype(SetType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
+
+Array<VMTrace> VMExec::stack_trace(int pc) const {
+    Array<VMTrace> trace;
+
+    for (int i = frame_count - 1; i >= 0; i--) {
+        Frame const& frame = frames[i];
+        trace.push_back(VMTrace{program->functions[frame.function].name, pc, program->line(pc)});
+
+        // The return address follows the call
+        pc = frame.return_pc - 1;
+    }
+
+    std::reverse(trace.begin(), trace.end());
+    return trace;
 }
-ExprRet VMExec::classtype(ClassType_t* n, int depth) { 
-    kwerror(outlog(), "No types during runtime");
-    return ExprRet(); 
+
+Value VMExec::execute(int function) {
+    Instruction const*    code      = program->code();
+    Value const*          constants = program->constants.data();
+    BinaryFunction const* binary    = program->binary.data();
+    UnaryFunction const*  unary     = program->unary.data();
+    VMFunction const*     functions = program->functions.data();
+    VMNative const*       natives   = program->natives.data();
+
+    if (int(frames.size()) < max_frames) {
+        frames.resize(max_frames);
+    }
+
+    // Frames below stop belong to whoever called execute
+    Frame* const stop = frames.data() + frame_count;
+    Frame* const last = frames.data() + max_frames - 1;
+    Frame*       fp   = stop;
+    int          base = 0;
+
+    if (frame_count >= max_frames) {
+        kwerror(outlog(), "Stopping max recursion reached");
+        has_error = true;
+        return Value();
+    }
+
+    if (fp != frames.data()) {
+        Frame const& top = fp[-1];
+        base             = top.base + functions[top.function].frame_size;
+    }
+
+    auto reserve = [&](int size) {
+        if (size > int(registers.size())) {
+            registers.resize(std::max(size, int(registers.size()) * 2));
+        }
+    };
+
+    reserve(base + functions[function].frame_size);
+    *fp = Frame{function, base, -1, 0};
+
+    Value* R  = registers.data() + base;
+    int    pc = functions[function].entry;
+
+    Instruction const* inst = nullptr;
+
+#if KIWI_VM_THREADED
+    // Each handler jumps straight to the next one
+    static void* const handlers[] = {
+#define OPCODE(name) &&op_##name,
+        KW_VM_OPCODES(OPCODE)
+#undef OPCODE
+    };
+
+#define VM_CASE(name) op_##name
+#define VM_NEXT()            \
+    inst = &code[pc];        \
+    pc += 1;                 \
+    goto* handlers[int(inst->op)]
+
+    VM_NEXT();
+#else
+#define VM_CASE(name) case OpCode::name
+#define VM_NEXT() goto dispatch
+
+dispatch:
+    inst = &code[pc];
+    pc += 1;
+
+    switch (inst->op) {
+    case OpCode::Size:
+#endif
+    VM_CASE(Nop) :
+    VM_CASE(Ext) : {
+        VM_NEXT();
+    }
+
+    VM_CASE(LoadConst) : {
+        R[inst->a] = constants[inst->b];
+        VM_NEXT();
+    }
+    VM_CASE(LoadNone) : {
+        R[inst->a] = Value(_None());
+        VM_NEXT();
+    }
+    VM_CASE(Move) : {
+        R[inst->a] = R[inst->b];
+        VM_NEXT();
+    }
+    VM_CASE(LoadGlobal) : {
+        R[inst->a] = globals[inst->b];
+        VM_NEXT();
+    }
+    VM_CASE(StoreGlobal) : {
+        globals[inst->a] = R[inst->b];
+        VM_NEXT();
+    }
+
+    VM_CASE(Binary) : {
+        BinaryFunction fun = binary[code[pc].a];
+        pc += 1;
+        R[inst->a] = fun(this, R[inst->b], R[inst->c]);
+        VM_NEXT();
+    }
+    VM_CASE(BinaryConst) : {
+        BinaryFunction fun = binary[code[pc].a];
+        pc += 1;
+        R[inst->a] = fun(this, R[inst->b], constants[inst->c]);
+        VM_NEXT();
+    }
+    VM_CASE(Unary) : {
+        R[inst->a] = unary[inst->c](this, R[inst->b]);
+        VM_NEXT();
+    }
+
+    VM_CASE(Jump) : {
+        pc += inst->offset();
+        VM_NEXT();
+    }
+    VM_CASE(JumpIfFalse) : {
+        if (!R[inst->a].as<bool>()) {
+            pc += inst->offset();
+        }
+        VM_NEXT();
+    }
+    VM_CASE(JumpIfTrue) : {
+        if (R[inst->a].as<bool>()) {
+            pc += inst->offset();
+        }
+        VM_NEXT();
+    }
+    VM_CASE(Test) : {
+        Instruction const& ext = code[pc];
+        pc += 1;
+        if (!binary[ext.a](this, R[inst->b], R[inst->c]).as<bool>()) {
+            pc += ext.offset();
+        }
+        VM_NEXT();
+    }
+    VM_CASE(TestConst) : {
+        Instruction const& ext = code[pc];
+        pc += 1;
+        if (!binary[ext.a](this, R[inst->b], constants[inst->c]).as<bool>()) {
+            pc += ext.offset();
+        }
+        VM_NEXT();
+    }
+
+    VM_CASE(Call) : {
+        VMFunction const& callee = functions[inst->b];
+
+        if (fp == last) {
+            kwerror(outlog(), "Stopping max recursion reached");
+            has_error   = true;
+            frame_count = int(stop - frames.data());
+            drop_memo(int(stop - frames.data()));
+            return Value();
+        }
+
+        // The result is stored when the frame returns
+        if (memo != nullptr && callee.pure) {
+            PendingMemo call{int(fp - frames.data()) + 1};
+
+            if (MemoCache::make_key(&callee, R + inst->c, callee.argc, call.key)) {
+                if (Value const* result = memo->find(call.key)) {
+                    R[inst->a] = *result;
+                    VM_NEXT();
+                }
+                pending_memo.push_back(std::move(call));
+            }
+        }
+
+        // The arguments are already in place, they become the first registers of the callee
+        int caller = fp->base;
+        fp += 1;
+        *fp = Frame{inst->b, caller + inst->c, pc, caller + inst->a};
+
+        reserve(caller + inst->c + callee.frame_size);
+        R  = registers.data() + caller + inst->c;
+        pc = callee.entry;
+        VM_NEXT();
+    }
+    VM_CASE(TailCall) : {
+        VMFunction const& callee = functions[inst->b];
+
+        // The arguments become the first registers of the frame, they are above the locals
+        for (int i = 0; i < callee.argc; i++) {
+            R[i] = R[inst->c + i];
+        }
+
+        fp->function = inst->b;
+        reserve(fp->base + callee.frame_size);
+        R  = registers.data() + fp->base;
+        pc = callee.entry;
+        VM_NEXT();
+    }
+    VM_CASE(CallNative) : {
+        VMNative const& native = natives[inst->b];
+        Array<Value>    args(R + inst->c, R + inst->c + native.argc);
+
+        // Natives can re-enter the VM, the registers might have moved once they return
+        frame_count  = int(fp - frames.data()) + 1;
+        Value result = native.fun(this, args);
+
+        R          = registers.data() + fp->base;
+        R[inst->a] = result;
+        VM_NEXT();
+    }
+    VM_CASE(CallDirect) : {
+        VMNative const& native = natives[inst->b];
+        Value           args[max_direct_args];
+
+        // The native reads its arguments in place, they cannot live in the registers
+        for (int i = 0; i < native.argc; i++) {
+            args[i] = R[inst->c + i];
+        }
+
+        frame_count  = int(fp - frames.data()) + 1;
+        Value result = native.direct(this, args);
+
+        R          = registers.data() + fp->base;
+        R[inst->a] = result;
+        VM_NEXT();
+    }
+
+    VM_CASE(Return) :
+    VM_CASE(ReturnNone) : {
+        Value result = inst->op == OpCode::Return ? R[inst->a] : Value(_None());
+
+        if (fp == stop) {
+            frame_count = int(stop - frames.data());
+            return result;
+        }
+
+        if (!pending_memo.empty() && pending_memo.back().frame == int(fp - frames.data())) {
+            memo->insert(std::move(pending_memo.back().key), result);
+            pending_memo.pop_back();
+        }
+
+        registers[fp->result] = result;
+        pc                    = fp->return_pc;
+        fp -= 1;
+        R = registers.data() + fp->base;
+        VM_NEXT();
+    }
+
+    VM_CASE(Raise) : {
+        exception = inst->a;
+        goto unwind;
+    }
+    VM_CASE(Reraise) : {
+        exception = R[inst->a].as<int32>();
+        goto unwind;
+    }
+
+#if !KIWI_VM_THREADED
+    }
+#endif
+
+unwind: {
+    // Look for a handler from the raising instruction outwards, the search does not
+    // modify the frames so the traceback can still be built if nobody handles the exception
+    VMHandler const* table = program->handlers.data();
+    int              count = int(program->handlers.size());
+    Frame*           frame = fp;
+    int              at    = pc - 1;
+
+    while (true) {
+        for (int i = 0; i < count; i++) {
+            VMHandler const& handler = table[i];
+
+            if (handler.start <= at && at < handler.end &&
+                (handler.klass < 0 || program->is_subclass(exception, handler.klass))) {
+                fp             = frame;
+                R              = registers.data() + fp->base;
+                R[handler.reg] = Value(int32(exception));
+                pc             = handler.target;
+                drop_memo(int(fp - frames.data()));
+                VM_NEXT();
+            }
+        }
+
+        // Frames below stop belong to whoever called execute, they see has_error
+        if (frame == stop) {
+            break;
+        }
+
+        // The call instruction precedes the return address
+        at = frame->return_pc - 1;
+        frame -= 1;
+    }
+
+    frame_count = int(fp - frames.data()) + 1;
+    traceback   = stack_trace(pc - 1);
+
+    kwerror(outlog(),
+            "{} raised at instruction {} (line {})",
+            exception >= 0 ? program->classes[exception].name : String("Exception"),
+            pc - 1,
+            program->line(pc - 1));
+    has_error   = true;
+    frame_count = int(stop - frames.data());
+    drop_memo(int(stop - frames.data()));
+    return Value();
 }
-ExprRet VMExec::comment(Comment_t* n, int depth) { 
-    kwerror(outlog(), "No comments during runtime");
-    return ExprRet(); 
+
+#undef VM_CASE
+#undef VM_NEXT
 }
 
 }  // namespace lython
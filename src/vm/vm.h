@@ -9,33 +9,94 @@
 #include "sema/errors.h"
 #include "utilities/guard.h"
 #include "utilities/strings.h"
+#include "vm/memo.h"
 #include "vm/tree.h"
-#include "vm/vm.h"
+
+// Dispatch with computed gotos (direct threading) when the compiler supports
+// labels as values, portable switch otherwise
+#ifndef KIWI_VM_THREADED
+#if defined(__GNUC__) || defined(__clang__)
+#define KIWI_VM_THREADED 1
+#else
+#define KIWI_VM_THREADED 0
+#endif
+#endif
 
 namespace lython {
 
+// Register based bytecode
+//
+//  * Registers are addressed relative to the frame of the current function,
+//    the arguments occupy the first registers followed by the locals and the temporaries
+//  * A call reuses the registers holding its arguments as the first registers of the callee
+//    so arguments are never copied
+//  * Jumps are relative to the instruction following the jump
+//  * Operations that need more than 3 operands are followed by an `Ext` word
+//
+// Superinstructions were picked from the sequences that dominate the bytecode
+// of the benchmark programs (bench_vm): a binary operation with a constant operand
+// (`i += 1`, `n - 1`, `i < n`) and a comparison immediately followed by a conditional jump.
+// Calls need no fused form, the arguments are already in the callee registers.
+//
+// clang-format off
+#define KW_VM_OPCODES(X)                                                    \
+    X(Nop)          /*                                                   */ \
+    X(Ext)          /* operand of the previous instruction               */ \
+    X(LoadConst)    /* R[a] = constants[b]                               */ \
+    X(LoadNone)     /* R[a] = None                                       */ \
+    X(Move)         /* R[a] = R[b]                                       */ \
+    X(LoadGlobal)   /* R[a] = globals[b]                                 */ \
+    X(StoreGlobal)  /* globals[a] = R[b]                                 */ \
+    X(Binary)       /* R[a] = binary[ext.a](R[b], R[c])                  */ \
+    X(BinaryConst)  /* R[a] = binary[ext.a](R[b], constants[c])          */ \
+    X(Unary)        /* R[a] = unary[c](R[b])                             */ \
+    X(Jump)         /* pc += offset                                      */ \
+    X(JumpIfFalse)  /* if not R[a]: pc += offset                         */ \
+    X(JumpIfTrue)   /* if R[a]: pc += offset                             */ \
+    X(Test)         /* if not binary[ext.a](R[b], R[c]): jump            */ \
+    X(TestConst)    /* if not binary[ext.a](R[b], constants[c]): jump    */ \
+    X(Call)         /* R[a] = functions[b](R[c] ... R[c + argc])         */ \
+    X(TailCall)     /* return functions[b](R[c] ... R[c + argc])         */ \
+    X(CallNative)   /* R[a] = natives[b].fun(R[c] ... R[c + argc])       */ \
+    X(CallDirect)   /* R[a] = natives[b].direct(R[c] ... R[c + argc])    */ \
+    X(Return)       /* return R[a]                                       */ \
+    X(ReturnNone)   /* return None                                       */ \
+    X(Raise)        /* raise classes[a], unwind through the handlers     */ \
+    X(Reraise)      /* raise the exception class held by R[a]            */
+// clang-format on
+
+enum class OpCode : uint16
+{
+#define OPCODE(name) name,
+    KW_VM_OPCODES(OPCODE)
+#undef OPCODE
+    Size
+};
+
+const char* to_string(OpCode op);
+
 struct Instruction {
-    // enum OpCode {
-    //     pushscope,
-    //     popscope,
-    //     addvar,
-    //     call,
-    //     setvar,
-    //     loadvar,
-    //     jump,
-    //     condjump
-    // };
-
-    // OpCode op;
-
-    VMNode* stmt = nullptr;
+    OpCode op = OpCode::Nop;
+    uint16 a  = 0;
+    uint16 b  = 0;
+    uint16 c  = 0;
+
+    // Jumps store a signed offset in b:c
+    int32 offset() const { return int32((uint32(b) << 16) | uint32(c)); }
+
+    void set_offset(int32 off) {
+        b = uint16(uint32(off) >> 16);
+        c = uint16(uint32(off) & 0xFFFF);
+    }
 };
 
+static_assert(sizeof(Instruction) == 8, "Instruction should stay compact");
+
 struct VMGenTrait {
-    using StmtRet = Value;
-    using ExprRet = Value;
-    using ModRet  = Value;
-    using PatRet  = Value;
+    using StmtRet = int;
+    using ExprRet = int;
+    using ModRet  = int;
+    using PatRet  = int;
     using Trace   = std::true_type;
 
     enum
@@ -49,202 +110,366 @@ struct Label {
     int       depth;
 };
 
+// Script function compiled to bytecode
+struct VMFunction {
+    String       name;
+    FunctionDef* def        = nullptr;
+    int          entry      = -1;  // index of the first instruction
+    int          argc       = 0;
+    int          frame_size = 0;   // number of registers used by the function
+    bool         pure       = false;  // see FunctionDef::pure, its calls can be memoized
+};
+
+struct VMNative {
+    String         name;
+    Function       fun    = nullptr;
+    DirectFunction direct = nullptr;
+    int            argc   = 0;
+};
 
-struct Program {
-    Array<Instruction> instructions;
-    Array<Label>       labels;
+// Call to a function defined in another module, patched by the linker
+struct Relocation {
+    int    instruction = -1;  // index of the Call
+    String module;
+    String name;
+    int    argc = 0;
+};
+
+// Exception class, the VM only needs its identity and its base to match handlers.
+// `external` classes are declared by another unit (or are builtin), their name is final
+struct VMClass {
+    String name;
+    int    base     = -1;
+    bool   external = false;
+};
 
-    int find_label(String const& name) {
-        for(Label& l: labels) {
+// Exceptions of `klass` raised by the instructions [start, end) resume at `target`
+// with the class of the exception in R[reg], `klass` is -1 for a bare except or a finally block.
+// The table is ordered innermost first, the first matching entry handles the exception
+struct VMHandler {
+    int32 start  = 0;
+    int32 end    = 0;
+    int32 target = 0;
+    int32 klass  = -1;
+    int32 reg    = 0;
+};
+
+// First instruction generated for a source line
+struct SourceLine {
+    int instruction = 0;
+    int line        = 0;
+};
+
+// Compiled module, the indices of a unit are local until it is linked
+struct Program {
+    String name;  // module the program was compiled from
+
+    Array<Instruction>    instructions;
+    Array<Value>          constants;
+    Array<BinaryFunction> binary;
+    Array<UnaryFunction>  unary;
+    Array<VMFunction>     functions;  // functions[0] is the module entry point
+    Array<VMNative>       natives;
+    Array<String>         globals;
+    Array<Label>          labels;
+    Array<SourceLine>     lines;  // sorted by instruction
+    Array<VMClass>        classes;
+    Array<VMHandler>      handlers;  // try regions, only read when an exception is raised
+
+    // Instructions executed in place from a mapped bytecode file (see vm/bytecode.h)
+    Instruction const* mapped      = nullptr;
+    int                mapped_size = 0;
+
+    Array<String>     dependencies;  // modules imported by the unit
+    Array<Relocation> relocations;   // calls to other units, empty once linked
+
+    // Constructs the compiler could not translate, a program with errors is not run
+    // and the caller should use the tree evaluator instead
+    int errors = 0;
+
+    int find_label(String const& name) const {
+        for(Label const& l: labels) {
             if (l.name == name) {
                 return l.index;
             }
         }
         return -1;
     }
-};
 
-struct LoopContext {
-    Jump* breakjmp = nullptr;
-    Jump* continuejmp = nullptr;
-};
+    Instruction const* code() const {
+        return mapped != nullptr ? mapped : instructions.data();
+    }
 
+    int code_size() const {
+        return mapped != nullptr ? mapped_size : int(instructions.size());
+    }
 
-struct VariableIndex {
-    int inserted_size;
-    Name* name;
-};
+    // Source line of the instruction, -1 if unknown
+    int line(int instruction) const;
+
+    int find_global(String const& name) const {
+        for (int i = 0; i < globals.size(); i++) {
+            if (globals[i] == name) {
+                return i;
+            }
+        }
+        return -1;
+    }
 
-struct LazyCallResolve {
-    Call* call = nullptr;
+    // Builtin or imported class, declared on first use
+    int external_class(String const& name) {
+        for (int i = 0; i < classes.size(); i++) {
+            if (classes[i].name == name) {
+                return i;
+            }
+        }
+        classes.push_back(VMClass{name, -1, true});
+        return int(classes.size()) - 1;
+    }
+
+    // `klass` or one of its bases is `handled`
+    bool is_subclass(int klass, int handled) const {
+        for (; klass >= 0; klass = classes[klass].base) {
+            if (klass == handled) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void dump(std::ostream& out) const;
 };
 
-struct YieldedFunction {
-    Array<Value>       variables;   //
-    Array<Value>       registers;   //
-    lython::StackTrace stacktrace;  //
-    int ic = -1;                    // instruction counter to resume from
+struct LoopContext {
+    Array<int> breaks;
+    Array<int> continues;
+    int        finally_depth = 0;  // finally blocks enclosing the loop
 };
 
 /**
- * The goal of this is to flatten the control flow into simple jumps
- * The code is flatten into a "tape" of instructions.
- * control flow change the instruction pointer
+ * Compiles the sema-annotated AST to register bytecode.
+ * Expressions return the register holding their result.
  *
- * This simplify resumption, while keeping the rest as high level as possible
+ * Each function is compiled in its own frame, names assigned inside the function
+ * are locals and live in registers, names assigned at the module level are globals.
+ * Temporaries are allocated above the locals and released at the end of each statement.
  *
- * Technically call is a jump but it is unconditional so the CPU can cache the instruction ahead
- * 
- * Exceptions handling: when a try-catch is found it push exception handling on a global stack (records the handled exception type & the resume jump)
- * when raise is called it does an unconditional jump to an exception handling function that will
- * lookup for the exception specific handler.
- * 
- * cleanup code still needs to be triggered in the right order though
- * 
+ * Constructs the bytecode does not support yet are reported and counted in `errors`,
+ * the program is then incomplete and is not run.
  */
 struct VMGen: public BaseVisitor<VMGen, false, VMGenTrait> {
     using Super = BaseVisitor<VMGen, false, VMGenTrait>;
 
-    struct GenContext {};
-
-#define FUNCTION_GEN(name, fun) Value fun(name##_t* n, int depth);
+#define FUNCTION_GEN(name, fun) int fun(name##_t* n, int depth);
 
     KW_FOREACH_AST(FUNCTION_GEN)
 
 #undef FUNCTION_GEN
 
-    Array<GenContext>       contexts;
-    Array<Instruction>      program;
-    Array<Label>            labels;
-    Array<LoopContext>      loop_ctx;
-    Array<LazyCallResolve>  calls_to_be_resolved;
+    struct Frame {
+        Dict<StringRef, int> locals;
+        Dict<StringRef, int> declared_globals;
 
-    int instruction_counter() { return int(program.size()); }
+        int  local_count = 0;
+        int  top         = 0;  // first free temporary
+        int  size        = 0;  // high water mark
+        bool is_module   = false;
+    };
 
-    void add_instruction(VMNode* stmt) { 
-        kwassert(stmt != nullptr, "Null instruction");
-        program.push_back({stmt}); 
-    }
-    void add_instruction(StmtNode* stmt) {
-        VMStmt* node = stmt->new_object<VMStmt>();
-        node->stmt   = stmt;
-        kwassert(node != nullptr, "Null instruction");
-        program.push_back({node});
-    }
+    Program            program;
+    Frame*             frame = nullptr;
+    Array<LoopContext> loop_ctx;
+    int                errors = 0;
+
+    // Instructions from this index are reachable through a jump
+    // the destination of the last instruction cannot be changed
+    int barrier = 0;
+
+    Dict<StringRef, int>    globals;
+    Dict<StringRef, int>    function_names;
+    Dict<StringRef, int>    native_names;
+    Dict<FunctionDef*, int> function_index;
+    Dict<StringRef, int>    class_names;
+
+    // try statements with a finally block being compiled,
+    // the block is only copied on the normal and exceptional exits
+    int finally_depth = 0;
+
+    // Names imported from other modules, calls to them are left to the linker
+    struct ImportedSymbol {
+        String module;
+        String name;
+    };
+    Dict<StringRef, ImportedSymbol> imports;
 
-    void add_body(String const& name, StmtNode* node, Array<StmtNode*> const& body, int depth) {
-        labels.push_back({node, name, int(program.size()), depth});
-        for (auto* stmt: body) {
-            Super::exec(stmt, depth);
-        }
-    }
+    int instruction_counter() { return int(program.instructions.size()); }
+
+    int emit(OpCode op, int a = 0, int b = 0, int c = 0);
+    int emit_jump(OpCode op, int a = 0);
+    void patch_jump(int jump);
+    void emit_jump_to(OpCode op, int a, int destination);
+
+    int new_temp();
+    int new_constant(Value value);
+    int declare_local(StringRef name);
+    int global_index(StringRef name);
+
+    // Compile the expression so its result lands in `dest`
+    void exec_into(ExprNode* expr, int dest, int depth);
+
+    // Copy `reg` into `dest`, retargets the last instruction when `reg` is a temporary
+    void move(int dest, int reg);
+
+    // Compile a call to a script function, arguments are compiled into consecutive registers
+    int emit_call(OpCode op, int function, Array<ExprNode*> const& args, int depth);
+
+    int binary_index(BinaryFunction fun);
+    int binary_operator(BinaryFunction fun, int lhs, int rhs, StmtNode* resolved, int depth);
+
+    // Compile `lhs <op> rhs`, a constant right operand is read from the constant table
+    int binary_expr(BinaryFunction fun, int lhs, ExprNode* rhs, StmtNode* resolved, int depth);
+
+    // Compile the condition and a jump taken when it is false, returns the jump to patch
+    int emit_test(ExprNode* test, int depth);
+
+    // Record the line of the statement about to be compiled
+    void mark_line(StmtNode* stmt);
+
+    // Class raised by `raise Name` or `raise Name(...)`, -1 when it is not known statically
+    int  exception_class(ExprNode* exc);
+    void register_class(ClassDef* def);
+
+    // Add the handlers of the except clause `type` (a class or a tuple of classes)
+    bool add_handler(ExprNode* type, VMHandler handler);
+
+    // Register holding the exception of the innermost handler being compiled
+    Array<int> handling;
+
+    void store_name(Name* name, int value);
+    void collect_locals(Array<StmtNode*> const& body);
+    void register_function(FunctionDef* def, String const& name);
+    void compile_function(VMFunction& fun, int depth);
+
+    void body(Array<StmtNode*> const& stmts, int depth);
+
+    int unsupported(Node* n, int depth);
 };
 
-struct VMExec: public BaseVisitor<VMExec, false, VMGenTrait> {
-    using Super = BaseVisitor<VMExec, false, VMGenTrait> ;
+// Active call, rebuilt from the frames when needed
+struct VMTrace {
+    String function;
+    int    instruction = -1;
+    int    line        = -1;
+};
 
-    // How to handle nested exception ?
-    //
-    enum class Registers: int {
-        ReturnAddress,
-        ReturnValue,
-        Size,
+/**
+ * Executes the bytecode in a single loop, calls push a frame instead of recursing
+ *
+ * The registers of every active function live in one contiguous stack, a frame is
+ * a window starting at its base. The frames themselves are allocated once,
+ * `max_frames` deep, so a call is a bump of the frame pointer and a return a decrement.
+ *
+ * A call in tail position moves its arguments to the bottom of the frame of the caller
+ * and runs the callee in it, recursion in tail position runs in constant space.
+ *
+ * Entering a try costs nothing, a raise looks up the handler table of the program
+ * for the raising instruction then for the calls of each frame until one matches.
+ */
+struct VMExec {
+    struct Frame {
+        int function  = 0;
+        int base      = 0;
+        int return_pc = -1;
+        int result    = 0;  // register of the caller receiving the return value
     };
 
-    int   ic = 0;
-
-    VMExec():
-        registers(int(Registers::Size))
-    {
-        // addressable variables which is different from reachable
-        // addressable variables are always reachable
-        // but reachable might not be addressable
-        variables.reserve(128);
-        args.reserve(8);
-    }
+    VMExec() { registers.resize(1024); }
 
     void set_program(Program const* prog) {
         program = prog;
+        globals.resize(prog->globals.size());
     }
 
-    Value execute(int entry);
+    Value execute(int function);
     Value execute(Program const& program, int entry);
-    void exec(int ic, int depth);
 
-    template<typename... Args>
-    Array<Value>& makeargs(Args... newargs) {
-        args = {newargs...};
-        return args;
-    }
+    Value global(String const& name) const;
 
-    Array<Value> args;
-    Program const* program = nullptr;
+    // Rebuild the active calls, most recent last, from the return addresses of the frames.
+    // `pc` is the instruction executing in the innermost frame.
+    // Nothing is recorded while the program runs, this is only called on errors
+    // or by whoever samples the execution
+    Array<VMTrace> stack_trace(int pc) const;
 
-    Value getreg(Registers register_) {
-        return registers[int(register_)];
-    }
-    void setreg(Registers register_, Value val) {
-        registers[int(register_)] = val;
-    }
+    Program const* program = nullptr;
 
-    int add_value(Value val) {
-        int idx = len(variables);
-        variables.push_back(val);
-        return idx;
-    }
+    Array<Value> registers;
+    Array<Value> globals;
+    Array<Frame> frames;           // resized to max_frames on the first execution
+    int          frame_count = 0;  // frames in use, non zero when a native re-enters the VM
+    bool         has_error   = false;
 
-    int compute_jump_call_address(Call_t* n, int depth); 
+    Array<VMTrace> traceback;  // calls that were active when the last exception was raised
+    int            exception = -1;  // class of the exception being raised or handled
+    int          max_frames  = 1024;
 
-    void set_ic(int entry) {
-        ic = entry;
-        kwdebug(outlog(), "IC: {}", ic);
-    }
-    void inc_ic() {
-        ic += 1;
-        kwdebug(outlog(), "IC: {}", ic);
-    }
+    // Results of pure functions, memoization is off when null
+    MemoCache* memo = nullptr;
 
-    Array<Value>              variables;
-    Array<Value>              registers;
-    Array<lython::StackTrace> stacktrace;
+    // Memoized calls waiting for their return value, innermost last
+    struct PendingMemo {
+        int            frame = 0;  // index of the frame running the call
+        MemoCache::Key key;
+    };
+    Array<PendingMemo> pending_memo;
 
-#define FUNCTION_GEN(name, fun) Value fun(name##_t* n, int depth);
+    // Forget the memoized calls of the frames above `frame`, they were unwound
+    void drop_memo(int frame) {
+        while (!pending_memo.empty() && pending_memo.back().frame > frame) {
+            pending_memo.pop_back();
+        }
+    }
+};
 
-#define X(name, _)
-#define SSECTION(name)
-#define MOD(name, fun)   FUNCTION_GEN(name, fun)
-#define EXPR(name, fun)  FUNCTION_GEN(name, fun)
-#define STMT(name, fun)  FUNCTION_GEN(name, fun)
-#define MATCH(name, fun) FUNCTION_GEN(name, fun)
-#define VM(name, fun)    FUNCTION_GEN(name, fun)
+/**
+ * Concatenates units compiled separately into a single program.
+ *
+ * The tables of each unit are appended to the tables of the program and the operands
+ * of its instructions are shifted accordingly; jumps are relative and need no fix up.
+ * Calls between units are resolved once here, the executed program never looks up a name.
+ *
+ * The first unit is the main module, its names are kept as is so they can be looked up
+ * after the execution; the names of the other units are prefixed by their module.
+ * When there is more than one unit, functions[0] is a generated entry point that
+ * initializes the imported modules before running the main module.
+ */
+struct VMLinker {
+    // Where the tables of a unit start in the linked program
+    struct Placement {
+        int        instruction = 0;
+        int        constant    = 0;
+        int        unary       = 0;
+        int        function    = 0;
+        int        native      = 0;
+        int        global      = 0;
+        Array<int> binary;
+        Array<int> classes;
+    };
 
-    NODEKIND_ENUM(X, SSECTION, EXPR, STMT, MOD, MATCH, VM)
+    // Units are initialized from the last to the first,
+    // a module should be placed before the modules it imports
+    Program link(Array<Program> const& units);
 
-#undef X
-#undef SSECTION
-#undef EXPR
-#undef STMT
-#undef MOD
-#undef MATCH
-#undef VM
+    void place(Program const& unit, Placement& placement, bool main);
+    void relocate(Array<Program> const& units, Array<Placement> const& placements);
 
-#undef FUNCTION_GEN
+    Program program;
+    int     errors = 0;
 };
 
-// Assemble programs together ?
-// so we can process imported files in parallel
-// and assemble them at the end
-//
-// Actually it is not too hard
-// import with launch the compilation in parallel
-// and make space in the main program to accomodate them
-// we could probably put them at the end so we do not have to move too many addresses
-
-inline Program compile(Module* mod) {
-    VMGen compiler;
-    compiler.exec(mod, 0);
-    return Program{compiler.program, compiler.labels};
-}
+// Compile the module and the modules it imports, each module to its own unit,
+// and link them together
+Program compile(Module* mod);
 
 inline Value eval(Program const& program) {
     VMExec eval;
@@ -253,4 +478,4 @@ inline Value eval(Program const& program) {
 
 }  // namespace lython
 
-#endif
\ No newline at end of file
+#endif
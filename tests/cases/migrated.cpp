@@ -114,7 +114,7 @@ Array<VMTestCase> const& vm_assert_ext_examples() {
             "    return 1\n",
             "fun(0)",
             "Traceback (most recent call last):\n"
-            "  File \"<input>\", line -2, in <module>\n"
+            "  File \"<input>\", line 1, in <module>\n"
             "    fun(0)\n"
             "  File \"<input>\", line 2, in fun\n"
             "    assert False, \"Very bad\"\n"
@@ -215,7 +215,7 @@ Array<VMTestCase> const& vm_exception_ext_examples() {
             "    return fun(a - 1)\n",
             "fun(2)",
             "Traceback (most recent call last):\n"
-            "  File \"<input>\", line -2, in <module>\n"
+            "  File \"<input>\", line 1, in <module>\n"
             "    fun(2)\n"
             "  File \"<input>\", line 4, in fun\n"
             "    return fun(a - 1)\n"
@@ -233,7 +233,7 @@ Array<VMTestCase> const& vm_exception_ext_examples() {
             "    return 1\n",
             "fun(2)",
             "Traceback (most recent call last):\n"
-            "  File \"<input>\", line -2, in <module>\n"
+            "  File \"<input>\", line 1, in <module>\n"
             "    fun(2)\n"
             "  File \"<input>\", line 3, in fun\n"
             "    assert False, \"Very bad\"\n"
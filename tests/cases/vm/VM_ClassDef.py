@@ -36,3 +36,31 @@ fun(Point(1.0, 2.0))# <<<
 3.0# <<<
 
 
+# >>> case: VM_ClassDef_3
+# >>> code
+class Point:
+    def __init__(self, x: f64, y: f64):
+        self.x = x
+        self.y = y
+
+    def norm2(self) -> f64:
+        return (self.x * self.x) + (self.y * self.y)
+
+def fun(p: Point) -> f64:
+    total: f64 = 0.0
+    i: i32 = 0
+    while i < 3:
+        total += p.norm2()
+        i += 1
+    return total
+# <<<
+
+
+# >>> call
+fun(Point(1.0, 2.0))# <<<
+
+
+# >>> expected
+15.0# <<<
+
+
@@ -0,0 +1,139 @@
+# >>> case: VM_For_range
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(n):
+        total += i
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+45# <<<
+
+
+# >>> case: VM_For_range_step
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(1, n, 3):
+        total += i
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+12# <<<
+
+
+# >>> case: VM_For_range_negative
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(n, 0, -2):
+        total += i
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+30# <<<
+
+
+# >>> case: VM_For_range_break
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(n):
+        if i == 2:
+            continue
+        if i > 5:
+            break
+        total += i
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+13# <<<
+
+# >>> case: VM_For_range_zero_step
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    try:
+        for i in range(n, 0, 0):
+            total += i
+    except ValueError:
+        total = -1
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+-1# <<<
+
+
+# >>> case: VM_For_range_variable_step
+# >>> code
+def fun(n: i32, s: i32) -> i32:
+    total: i32 = 0
+    for i in range(0, n, s):
+        total += i
+    return total
+# <<<
+
+
+# >>> call
+fun(10, 3)# <<<
+
+
+# >>> expected
+Traceback (most recent call last):
+  File "<input>", line 1, in <module>
+    fun(10, 3)
+  File "<input>", line 3, in fun
+    for i in range(0, n, s):
+NameError: name 'range' is not defined
+# <<<
+
+
+# >>> case: VM_For_range_rebind
+# >>> code
+def fun(n: i32) -> i32:
+    total: i32 = 0
+    for i in range(n):
+        total += i
+        i = 100
+    return total
+# <<<
+
+
+# >>> call
+fun(10)# <<<
+
+
+# >>> expected
+45# <<<
+
+
@@ -63,3 +63,20 @@ fun(10)# <<<
 10# <<<
 
 
+# >>> case: VM_FunctionDef_tail_call
+# >>> code
+def fun(a: i32, acc: i32) -> i32:
+    if a == 0:
+        return acc
+    return fun(a - 1, acc + 1)
+# <<<
+
+
+# >>> call
+fun(1000, 0)# <<<
+
+
+# >>> expected
+1000# <<<
+
+
@@ -28,7 +28,7 @@ fun(0)# <<<
 
 # >>> expected
 Traceback (most recent call last):
-  File "<input>", line -2, in <module>
+  File "<input>", line 1, in <module>
     fun(0)
   File "<input>", line 2, in fun
     assert False, "Very bad"
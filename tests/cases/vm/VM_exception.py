@@ -13,7 +13,7 @@ fun(2)# <<<
 
 # >>> expected
 Traceback (most recent call last):
-  File "<input>", line -2, in <module>
+  File "<input>", line 1, in <module>
     fun(2)
   File "<input>", line 4, in fun
     return fun(a - 1)
@@ -40,7 +40,7 @@ fun(2)# <<<
 
 # >>> expected
 Traceback (most recent call last):
-  File "<input>", line -2, in <module>
+  File "<input>", line 1, in <module>
     fun(2)
   File "<input>", line 3, in fun
     assert False, "Very bad"
@@ -48,3 +48,41 @@ AssertionError: Very bad
 # <<<
 
 
+# >>> case: VM_exception_handled
+# >>> code
+class Error:
+    pass
+
+class ValueError(Error):
+    pass
+
+class Other:
+    pass
+
+def check(n: i32) -> i32:
+    if n < 0:
+        raise ValueError()
+    return n
+
+def fun(n: i32) -> i32:
+    result: i32 = 0
+    try:
+        result = check(n)
+    except Other:
+        result = -2
+    except Error:
+        result = -1
+    finally:
+        result = result * 10
+    return result
+# <<<
+
+
+# >>> call
+fun(-1)# <<<
+
+
+# >>> expected
+-10# <<<
+
+
@@ -0,0 +1,249 @@
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Kiwi
+#include "revision_data.h"
+#include "sema/importlib.h"
+#include "sema/sema.h"
+#include "utilities/printing.h"
+#include "utilities/strings.h"
+
+using namespace lython;
+
+namespace fs = std::filesystem;
+
+String test_modules_path() { return String(_SOURCE_DIRECTORY) + "/code"; }
+
+String test_cache_path(String const& name) {
+    auto path = fs::temp_directory_path() / "lython_importlib_test" / name.c_str();
+    fs::remove_all(path);
+    return String(path.string().c_str());
+}
+
+void write_module(String const& folder, String const& name, String const& code) {
+    fs::create_directories(folder.c_str());
+    std::ofstream file((folder + "/" + name + ".py").c_str());
+    file << code;
+}
+
+String binding_type(ImportLib::ImportedLib* lib, String const& name) {
+    BindingEntry* entry = lib->sema->bindings.find(StringRef(name));
+    if (entry == nullptr) {
+        return "<missing>";
+    }
+    return str(entry->type);
+}
+
+TEST_CASE("ImportLib_ModuleCache_ColdWarm") {
+    String cache = test_cache_path("cold_warm");
+
+    ImportLib cold;
+    cold.set_cache_dir(cache);
+    cold.add_to_path(test_modules_path());
+
+    auto* cold_lib = cold.importfile(StringRef("import_test"));
+    REQUIRE(cold_lib != nullptr);
+    REQUIRE(!cold_lib->warm);
+    REQUIRE(cold_lib->key != 0);
+
+    ImportLib warm;
+    warm.set_cache_dir(cache);
+    warm.add_to_path(test_modules_path());
+
+    auto* warm_lib = warm.importfile(StringRef("import_test"));
+    REQUIRE(warm_lib != nullptr);
+    REQUIRE(warm_lib->warm);
+    REQUIRE(warm_lib->key == cold_lib->key);
+
+    for (String name: {"var", "ann", "fun", "cls"}) {
+        REQUIRE(binding_type(warm_lib, name) == binding_type(cold_lib, name));
+    }
+
+    std::cout << "Cold import\n";
+    cold.dump_import_stats(std::cout);
+    std::cout << "Warm import\n";
+    warm.dump_import_stats(std::cout);
+}
+
+TEST_CASE("ImportLib_ModuleCache_Invalidation") {
+    String cache   = test_cache_path("invalidation");
+    String modules = test_cache_path("invalidation_modules");
+
+    write_module(modules, "cache_dep", "def add(a: i32, b: i32) -> i32:\n    return a + b\n");
+    write_module(modules, "cache_mod", "from cache_dep import add\n\nx: i32 = add(1, 2)\n");
+
+    auto import = [&](bool expect_warm) {
+        ImportLib lib;
+        lib.set_cache_dir(cache);
+        lib.add_to_path(modules);
+
+        auto* mod = lib.importfile(StringRef("cache_mod"));
+        REQUIRE(mod != nullptr);
+        REQUIRE(mod->warm == expect_warm);
+        return mod->key;
+    };
+
+    uint64 first = import(false);
+    REQUIRE(import(true) == first);
+
+    // A change in a dependency invalidates the importer
+    write_module(modules, "cache_dep", "def add(a: i32, b: i32) -> i32:\n    return a - b\n");
+    uint64 second = import(false);
+    REQUIRE(second != first);
+    REQUIRE(import(true) == second);
+}
+
+TEST_CASE("ImportLib_ModuleCache_NativeOperators") {
+    String cache   = test_cache_path("operators");
+    String modules = test_cache_path("operators_modules");
+
+    write_module(modules, "cache_ops", "def add(a: i32, b: i32) -> i32:\n    return a + b\n");
+
+    auto native_operator = [&](ImportLib::ImportedLib* lib) -> BinaryFunction {
+        for (Node* node: lib->nodes) {
+            if (BinOp* op = cast<BinOp>(node)) {
+                return op->native_operator;
+            }
+        }
+        return nullptr;
+    };
+
+    ImportLib cold;
+    cold.set_cache_dir(cache);
+    cold.add_to_path(modules);
+    auto* cold_lib = cold.importfile(StringRef("cache_ops"));
+
+    ImportLib warm;
+    warm.set_cache_dir(cache);
+    warm.add_to_path(modules);
+    auto* warm_lib = warm.importfile(StringRef("cache_ops"));
+
+    REQUIRE(warm_lib->warm);
+    REQUIRE(native_operator(cold_lib) != nullptr);
+    REQUIRE(native_operator(warm_lib) == native_operator(cold_lib));
+}
+
+TEST_CASE("ImportLib_ModuleCache_CountedLoop") {
+    String cache   = test_cache_path("counted");
+    String modules = test_cache_path("counted_modules");
+
+    write_module(modules,
+                 "cache_loop",
+                 "def count(n: i32) -> i32:\n"
+                 "    total: i32 = 0\n"
+                 "    for i in range(n, 0, -2):\n"
+                 "        total += i\n"
+                 "    return total\n");
+
+    auto loop = [&](ImportLib::ImportedLib* lib) -> For* {
+        for (Node* node: lib->nodes) {
+            if (For* n = cast<For>(node)) {
+                return n;
+            }
+        }
+        return nullptr;
+    };
+
+    ImportLib cold;
+    cold.set_cache_dir(cache);
+    cold.add_to_path(modules);
+    For* cold_loop = loop(cold.importfile(StringRef("cache_loop")));
+
+    ImportLib warm;
+    warm.set_cache_dir(cache);
+    warm.add_to_path(modules);
+    auto* warm_lib  = warm.importfile(StringRef("cache_loop"));
+    For*  warm_loop = loop(warm_lib);
+
+    REQUIRE(warm_lib->warm);
+    REQUIRE(cold_loop->counted);
+    REQUIRE(warm_loop->counted);
+    REQUIRE(warm_loop->step.as<int32>() == -2);
+    REQUIRE(warm_loop->start.as<int32>() == 0);
+    REQUIRE(warm_loop->native_compare == cold_loop->native_compare);
+    REQUIRE(warm_loop->native_step == cold_loop->native_step);
+}
+
+TEST_CASE("ImportLib_ModuleCache_OptIn") {
+    // Nothing is written to disk unless a cache directory is given
+    if (std::getenv("LYTHON_CACHE") == nullptr) {
+        ModuleCache cache;
+        REQUIRE(!cache.enabled());
+    }
+}
+
+TEST_CASE("ImportLib_ModuleCache_Attributes") {
+    String cache   = test_cache_path("attributes");
+    String modules = test_cache_path("attributes_modules");
+
+    write_module(modules,
+                 "cache_attr",
+                 "class Point:\n"
+                 "    x: i32 = 0\n"
+                 "    y: i32 = 0\n"
+                 "\n"
+                 "def total(p: Point) -> i32:\n"
+                 "    return p.x + p.y\n");
+
+    auto resolved = [&](ImportLib::ImportedLib* lib) {
+        Array<String> names;
+        for (Node* node: lib->nodes) {
+            if (Attribute* attr = cast<Attribute>(node)) {
+                REQUIRE(attr->resolved != nullptr);
+                names.push_back(str(attr->resolved->name));
+            }
+        }
+        return names;
+    };
+
+    auto import = [&](bool expect_warm) {
+        ImportLib lib;
+        lib.set_cache_dir(cache);
+        lib.add_to_path(modules);
+
+        auto* mod = lib.importfile(StringRef("cache_attr"));
+        REQUIRE(mod != nullptr);
+        REQUIRE(mod->warm == expect_warm);
+        return resolved(mod);
+    };
+
+    Array<String> expected = {"x", "y"};
+    REQUIRE(import(false) == expected);
+    REQUIRE(import(true) == expected);
+
+    // An attribute index outside of its class is rejected before the module is touched
+    String entry = cache + "/cache_attr.lyc";
+    String content;
+    {
+        std::ifstream file(entry.c_str());
+        std::stringstream ss;
+        ss << file.rdbuf();
+        content = String(ss.str().c_str());
+    }
+
+    String prefix = " " + String(std::to_string(int(NodeKind::Attribute)).c_str()) + " ";
+    String corrupted;
+    std::stringstream lines(content.c_str());
+    std::string line;
+    int count = 0;
+    while (std::getline(lines, line)) {
+        String record(line.c_str());
+        auto   kind = record.find(prefix);
+        if (kind != String::npos && kind == record.find(' ')) {
+            record = record.substr(0, record.rfind(' ')) + " 99";
+            count += 1;
+        }
+        corrupted += record + "\n";
+    }
+    REQUIRE(count == 2);
+
+    {
+        std::ofstream file(entry.c_str());
+        file << corrupted;
+    }
+    REQUIRE(import(false) == expected);
+}
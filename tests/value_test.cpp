@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <iostream>
 #include <numeric>
+#include <thread>
 
 #include <catch2/catch_all.hpp>
 
@@ -37,6 +38,75 @@ struct Point2D {
     float distance2() { return sqrt(x * x + y * y); }
 };
 
+TEST_CASE("Value_Layout") {
+#if KIWI_NANBOX
+    REQUIRE(sizeof(Value) == 8);
+#endif
+
+#define ROUNDTRIP(type, name)                               \
+    {                                                       \
+        type  original = type();                            \
+        Value value(original);                              \
+        REQUIRE(value.tag() == meta::type_id<type>());      \
+        REQUIRE(value.is_type<type>());                     \
+        REQUIRE(value.holder().name == original);           \
+    }
+
+    ROUNDTRIP(bool, i1)
+    ROUNDTRIP(int32, i32)
+    ROUNDTRIP(uint8, u8)
+    ROUNDTRIP(float32, f32)
+    ROUNDTRIP(float64, f64)
+    ROUNDTRIP(int64, i64)
+    ROUNDTRIP(uint64, u64)
+#undef ROUNDTRIP
+
+    Value big(int64(1) << 40);
+    REQUIRE(big.as<int64>() == (int64(1) << 40));
+
+    Value negative(-2.5);
+    REQUIRE(negative.as<float64>() == -2.5);
+
+    // NaN keeps its type
+    Value nan(std::numeric_limits<float64>::quiet_NaN());
+    REQUIRE(nan.tag() == meta::type_id<float64>());
+    REQUIRE(std::isnan(nan.as<float64>()));
+
+    Value pointer = make_value<Point2D*>(nullptr);
+    REQUIRE(pointer.tag() == meta::type_id<Point2D*>());
+
+    REQUIRE(Value().tag() == meta::type_id<_Invalid>());
+
+    // Copies of big payloads own their box, destroying one leaves the others valid
+    Value shared = big;
+    big.destroy();
+    REQUIRE(shared.as<int64>() == (int64(1) << 40));
+
+    // Boxes come from per thread pools, a value outlives the thread that created it
+    Value remote;
+    std::thread([&]() { remote = Value(int64(3) << 40); }).join();
+    REQUIRE(remote.as<int64>() == (int64(3) << 40));
+
+#if KIWI_NANBOX
+    // Pointers are stored inline
+    Point2D point(3, 4);
+    Value   inlined = make_value<Point2D*>(&point);
+    REQUIRE(!inlined.is_boxed());
+    REQUIRE(inlined.as<Point2D*>() == &point);
+
+    // Other 8 bytes payloads are boxed, copies share the box
+    Value odd(int64(7));
+    Value odd_copy = odd;
+    REQUIRE(odd.is_boxed());
+    REQUIRE(odd_copy.box() == odd.box());
+
+    // Taking the address gives the value a box of its own
+    *odd_copy.pointer<int64>() = 9;
+    REQUIRE(odd.as<int64>() == 7);
+    REQUIRE(odd_copy.as<int64>() == 9);
+#endif
+}
+
 float freefun_distance(Point2D const* p) { return sqrt(p->x * p->x + p->y * p->y); }
 
 TEST_CASE("Value_SVO_Function Wrapping") {
@@ -210,6 +280,21 @@ TEST_CASE("Value_NOSVO_Function Wrapping") {
     //deleter(nullptr, value);
 }
 
+float freefun_add(float a, float b) { return a + b; }
+
+TEST_CASE("Value_Fixed_Function Wrapping") {
+    UnaryFunction  unary  = KIWI_WRAP_FIXED(freefun_distance);
+    BinaryFunction binary = KIWI_WRAP_FIXED(freefun_add);
+
+    auto value = make_value<Point2D>(3.0f, 4.0f);
+
+    REQUIRE(unary_invoke(nullptr, unary, value).as<float>() == 5.0f);
+    REQUIRE(Value::has_error() == false);
+
+    REQUIRE(binary_invoke(nullptr, binary, Value(1.0f), Value(2.0f)).as<float>() == 3.0f);
+    REQUIRE(Value::has_error() == false);
+}
+
 TEST_CASE("Value_Reference") {
 
     int i = 4;
@@ -736,14 +821,14 @@ Value owned_from_pointer(T* raw) {
         return;
     };
 
-    meta::ClassMetadata& metadata = meta::classmeta(val.tag);
+    meta::ClassMetadata& metadata = meta::classmeta(val.tag());
     metadata.deleter              = deleter;
     metadata.ref                  = refmaker;
     return val;
 }
 
 Value weakref(Value& val) {
-    meta::ClassMetadata& metadata = meta::classmeta(val.tag);
+    meta::ClassMetadata& metadata = meta::classmeta(val.tag());
 
     if (metadata.ref) {
         return metadata.ref(val);
@@ -3,9 +3,14 @@
 #include "revision_data.h"
 #include "sema/native_module.h"
 #include "sema/sema.h"
+#include "utilities/guard.h"
 #include "utilities/printing.h"
 #include "utilities/strings.h"
+#include "vm/bytecode.h"
+#include "vm/memo.h"
+#include "vm/partial.h"
 #include "vm/tree.h"
+#include "vm/vm.h"
 
 #include <catch2/catch_all.hpp>
 #include <sstream>
@@ -13,6 +18,8 @@
 #include "logging/logging.h"
 
 #include <catch2/catch_all.hpp>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
 // #include "cases_vm.h"
@@ -233,8 +240,1538 @@ TEST_CASE("VM_Generator") {
     run_vm_testcases("VM_Generator", get_test_cases("vm", "VM_Generator"));
 }
 
+TEST_CASE("VM_For") { run_vm_testcases("VM_For", get_test_cases("vm", "VM_For")); }
+
+Value bytecode_eval(String const& code, String const& global, Program* compiled = nullptr) {
+    StringBuffer reader(code);
+    Lexer        lex(reader);
+    Parser       parser(lex);
+    Module*      mod = parser.parse_module();
+    REQUIRE(parser.has_errors() == false);
+
+    SemanticAnalyser sema;
+    sema.exec(mod, 0);
+    REQUIRE(sema.has_errors() == false);
+
+    VMGen compiler;
+    compiler.exec(mod, 0);
+    compiler.program.dump(std::cout);
+    REQUIRE(compiler.errors == 0);
+
+    VMExec exec;
+    exec.execute(compiler.program, 0);
+    REQUIRE(exec.has_error == false);
+
+    Value result = exec.global(global);
+    if (compiled != nullptr) {
+        *compiled = compiler.program;
+    }
+    delete mod;
+    return result;
+}
+
+Program bytecode_unit(String const& code, String const& name, bool analyse = true) {
+    StringBuffer reader(code);
+    Lexer        lex(reader);
+    Parser       parser(lex);
+    Module*      mod = parser.parse_module();
+    REQUIRE(parser.has_errors() == false);
+
+    if (analyse) {
+        SemanticAnalyser sema;
+        sema.exec(mod, 0);
+        REQUIRE(sema.has_errors() == false);
+    }
+
+    VMGen compiler;
+    compiler.program.name = name;
+    compiler.exec(mod, 0);
+    REQUIRE(compiler.errors == 0);
+
+    delete mod;
+    return compiler.program;
+}
+
+TEST_CASE("VM_Bytecode") {
+    SECTION("loop") {
+        String code = "def loop(n: i32) -> f64:\n"
+                      "    total: f64 = 0.0\n"
+                      "    i: i32 = 0\n"
+                      "    while i < n:\n"
+                      "        i += 1\n"
+                      "        if i == 2:\n"
+                      "            continue\n"
+                      "        if i > 5:\n"
+                      "            break\n"
+                      "        total = total + 1.5\n"
+                      "    return total\n"
+                      "\n"
+                      "result = loop(10)\n";
+
+        REQUIRE(bytecode_eval(code, "result").as<float64>() == 6.0);
+    }
+
+    SECTION("range") {
+        String code = "def count(n: i32) -> i32:\n"
+                      "    total: i32 = 0\n"
+                      "    for i in range(n):\n"
+                      "        if i == 2:\n"
+                      "            continue\n"
+                      "        if i > 5:\n"
+                      "            break\n"
+                      "        total += i\n"
+                      "    for j in range(n, 0, -2):\n"
+                      "        total += j\n"
+                      "    return total\n"
+                      "\n"
+                      "result = count(10)\n";
+
+        REQUIRE(bytecode_eval(code, "result").as<int32>() == 43);
+    }
+
+    SECTION("range step") {
+        String code = "def zero(n: i32) -> i32:\n"
+                      "    total: i32 = 0\n"
+                      "    try:\n"
+                      "        for i in range(n, 0, 0):\n"
+                      "            total += i\n"
+                      "    except ValueError:\n"
+                      "        total = -1\n"
+                      "    return total\n"
+                      "\n"
+                      "def rebind(n: i32) -> i32:\n"
+                      "    total: i32 = 0\n"
+                      "    for i in range(n):\n"
+                      "        total += i\n"
+                      "        i = 100\n"
+                      "    return total\n"
+                      "\n"
+                      "result = rebind(10) - zero(10)\n";
+
+        REQUIRE(bytecode_eval(code, "result").as<int32>() == 46);
+    }
+
+    SECTION("recursion") {
+        String code = "def fib(n: i32) -> i32:\n"
+                      "    if n < 2:\n"
+                      "        return n\n"
+                      "    return fib(n - 1) + fib(n - 2)\n"
+                      "\n"
+                      "result = fib(10)\n";
+
+        REQUIRE(bytecode_eval(code, "result").as<int32>() == 55);
+    }
+
+    SECTION("tail calls") {
+        String code = "def count(n: i32, acc: i32) -> i32:\n"
+                      "    if n == 0:\n"
+                      "        return acc\n"
+                      "    return count(n - 1, acc + 1)\n"
+                      "\n"
+                      "def guarded(n: i32) -> i32:\n"
+                      "    try:\n"
+                      "        return count(n, 0)\n"
+                      "    except:\n"
+                      "        return -1\n"
+                      "\n"
+                      "result = count(5000, 0)\n"
+                      "protected = guarded(10)\n";
+
+        // Deeper than max_frames, each call replaces the frame of its caller
+        Program program;
+        REQUIRE(bytecode_eval(code, "result", &program).as<int32>() == 5000);
+
+        // A return inside try keeps its frame, the handlers of the frame still apply
+        int tail_calls = 0;
+        for (Instruction const& inst: program.instructions) {
+            tail_calls += inst.op == OpCode::TailCall;
+        }
+        REQUIRE(tail_calls == 1);
+
+        VMExec exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.global("protected").as<int32>() == 10);
+    }
+
+    SECTION("branches") {
+        String code = "def sign(n: i32) -> i32:\n"
+                      "    if n < 0:\n"
+                      "        return -1\n"
+                      "    elif (0 < n < 10) and (n != 5):\n"
+                      "        return 1\n"
+                      "    else:\n"
+                      "        return 0\n"
+                      "\n"
+                      "result = (sign(-3) * 100) + (sign(3) * 10) + sign(5)\n";
+
+        REQUIRE(bytecode_eval(code, "result").as<int32>() == -90);
+    }
+
+    SECTION("globals") {
+        String code = "counter: i32 = 0\n"
+                      "\n"
+                      "def incr(n: i32) -> i32:\n"
+                      "    global counter\n"
+                      "    counter += n\n"
+                      "    return counter\n"
+                      "\n"
+                      "incr(2)\n"
+                      "incr(3)\n";
+
+        REQUIRE(bytecode_eval(code, "counter").as<int32>() == 5);
+    }
+
+    SECTION("unsupported") {
+        String code = "def first(n: i32) -> i32:\n"
+                      "    items = [n, 2]\n"
+                      "    return items[0]\n"
+                      "\n"
+                      "result = first(3)\n";
+
+        StringBuffer reader(code);
+        Lexer        lex(reader);
+        Parser       parser(lex);
+        Module*      mod = parser.parse_module();
+        REQUIRE(parser.has_errors() == false);
+
+        SemanticAnalyser sema;
+        sema.exec(mod, 0);
+
+        // the list and the subscript are reported, they do not silently become None
+        Program program = compile(mod);
+        REQUIRE(program.errors == 2);
+
+        VMExec exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.has_error == true);
+
+        // the caller falls back to the tree evaluator
+        TreeEvaluator eval;
+        eval.module(mod, 0);
+        REQUIRE(eval.has_exceptions() == false);
+        delete mod;
+    }
+
+    SECTION("superinstructions") {
+        String code = "def count(n: i32) -> i32:\n"
+                      "    i: i32 = 0\n"
+                      "    while i < n:\n"
+                      "        i += 1\n"
+                      "    return i\n"
+                      "\n"
+                      "result = count(10)\n";
+
+        Program program;
+        REQUIRE(bytecode_eval(code, "result", &program).as<int32>() == 10);
+
+        auto count = [&](OpCode op) {
+            int n = 0;
+            for (Instruction const& inst: program.instructions) {
+                n += inst.op == op;
+            }
+            return n;
+        };
+
+        // i < n is fused with its jump, i += 1 reads its operand from the constant table
+        REQUIRE(count(OpCode::Test) == 1);
+        REQUIRE(count(OpCode::BinaryConst) == 1);
+        REQUIRE(count(OpCode::JumpIfFalse) == 0);
+    }
+
+    SECTION("link") {
+        // the main module is not analysed, sema would look for `lib` on disk
+        Program lib  = bytecode_unit("offset: i32 = 10\n"
+                                    "\n"
+                                    "def shifted(a: i32) -> i32:\n"
+                                    "    return a + offset\n",
+                                    "lib");
+        Program main = bytecode_unit("from lib import shifted\n"
+                                     "\n"
+                                     "result = shifted(5)\n",
+                                     "__main__",
+                                     false);
+        REQUIRE(main.relocations.size() == 1);
+
+        VMLinker linker;
+        Program  program = linker.link({main, lib});
+        program.dump(std::cout);
+        REQUIRE(linker.errors == 0);
+
+        // lib is initialized before the main module runs
+        VMExec exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.has_error == false);
+        REQUIRE(exec.global("result").as<int32>() == 15);
+        REQUIRE(exec.global("lib.offset").as<int32>() == 10);
+
+        Program missing = bytecode_unit("def other(a: i32) -> i32:\n"
+                                        "    return a\n",
+                                        "lib");
+        linker.link({main, missing});
+        REQUIRE(linker.errors == 1);
+    }
+
+    SECTION("bytecode file") {
+        String code = "def fib(n: i32) -> i32:\n"
+                      "    if n < 2:\n"
+                      "        return n\n"
+                      "    return fib(n - 1) + fib(n - 2)\n"
+                      "\n"
+                      "result = fib(10)\n";
+
+        Program program;
+        REQUIRE(bytecode_eval(code, "result", &program).as<int32>() == 55);
+
+        auto   temp = std::filesystem::temp_directory_path() / "lython_vm_test.lybc";
+        String path = temp.string().c_str();
+        REQUIRE(BytecodeFile::write(program, path));
+
+        BytecodeFile bytecode;
+        REQUIRE(bytecode.open(path));
+        REQUIRE(bytecode.program().code_size() == program.code_size());
+        REQUIRE(bytecode.program().line(program.functions[1].entry) == 2);
+
+        VMExec exec;
+        exec.execute(bytecode.program(), 0);
+        REQUIRE(exec.has_error == false);
+        REQUIRE(exec.global("result").as<int32>() == 55);
+
+        // Operands are checked before anything runs from the file
+        auto rejected = [&](OpCode op, auto patch) {
+            Program broken = program;
+            auto    it     = std::find_if(
+                broken.instructions.begin(),
+                broken.instructions.end(),
+                [&](Instruction const& inst) { return inst.op == op; });
+
+            REQUIRE(it != broken.instructions.end());
+            patch(broken, *it);
+            REQUIRE(BytecodeFile::write(broken, path));
+            return bytecode.open(path) == false;
+        };
+
+        REQUIRE(rejected(OpCode::LoadConst, [](Program& p, Instruction& inst) {
+            inst.b = uint16(p.constants.size());
+        }));
+        REQUIRE(rejected(OpCode::TestConst, [](Program& p, Instruction& inst) {
+            inst.c = uint16(p.constants.size());
+        }));
+        REQUIRE(rejected(OpCode::TestConst, [](Program& p, Instruction& inst) {
+            (&inst)[1].set_offset(1000);
+        }));
+        REQUIRE(rejected(OpCode::Call, [](Program& p, Instruction& inst) {
+            inst.b = uint16(p.functions.size());
+        }));
+        REQUIRE(rejected(OpCode::StoreGlobal, [](Program& p, Instruction& inst) {
+            inst.a = uint16(p.globals.size());
+        }));
+        REQUIRE(rejected(OpCode::Return, [](Program& p, Instruction& inst) {
+            inst.a = uint16(p.functions[1].frame_size);
+        }));
+        REQUIRE(rejected(OpCode::Call, [](Program& p, Instruction& inst) {
+            p.functions[inst.b].argc = p.functions[inst.b].frame_size + 1;
+        }));
+        REQUIRE(rejected(OpCode::ReturnNone, [](Program& p, Instruction& inst) {
+            inst.op = OpCode::Nop;
+        }));
+
+        // Files written by a build with another opcode table are rejected
+        REQUIRE(BytecodeFile::write(program, path));
+        {
+            std::fstream file(path.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(12);
+            file.put(char(0xFF));
+        }
+        REQUIRE(bytecode.open(path) == false);
+
+        // Truncated files are rejected
+        REQUIRE(BytecodeFile::write(program, path));
+        std::filesystem::resize_file(temp, 32);
+        REQUIRE(bytecode.open(path) == false);
+        std::filesystem::remove(temp);
+    }
+
+    SECTION("exceptions") {
+        String code = "class Error:\n"
+                      "    pass\n"
+                      "\n"
+                      "class ValueError(Error):\n"
+                      "    pass\n"
+                      "\n"
+                      "def check(n: i32) -> i32:\n"
+                      "    if n < 0:\n"
+                      "        raise ValueError()\n"
+                      "    return n\n"
+                      "\n"
+                      "def guarded(n: i32) -> i32:\n"
+                      "    result: i32 = 0\n"
+                      "    try:\n"
+                      "        result = check(n)\n"
+                      "    except Error:\n"
+                      "        result = -1\n"
+                      "    finally:\n"
+                      "        result = result * 10\n"
+                      "    return result\n"
+                      "\n"
+                      "def nested(n: i32) -> i32:\n"
+                      "    total: i32 = 0\n"
+                      "    try:\n"
+                      "        try:\n"
+                      "            assert n > 0\n"
+                      "        except Error:\n"
+                      "            total = 100\n"
+                      "        finally:\n"
+                      "            total += 1\n"
+                      "    except:\n"
+                      "        total += 10\n"
+                      "    return total\n"
+                      "\n"
+                      "handled = guarded(-1)\n"
+                      "reraised = nested(0)\n"
+                      "result = guarded(1)\n";
+
+        Program program;
+        REQUIRE(bytecode_eval(code, "result", &program).as<int32>() == 10);
+
+        VMExec exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.global("handled").as<int32>() == -10);
+        REQUIRE(exec.global("reraised").as<int32>() == 11);
+
+        // try regions only exist in the handler table
+        REQUIRE(program.handlers.size() == 7);
+
+        // The handler table is saved with the code
+        auto   temp = std::filesystem::temp_directory_path() / "lython_vm_exceptions.lybc";
+        String path = temp.string().c_str();
+        REQUIRE(BytecodeFile::write(program, path));
+
+        BytecodeFile bytecode;
+        REQUIRE(bytecode.open(path));
+        REQUIRE(bytecode.program().handlers.size() == program.handlers.size());
+
+        VMExec loaded;
+        loaded.execute(bytecode.program(), 0);
+        REQUIRE(loaded.global("handled").as<int32>() == -10);
+        std::filesystem::remove(temp);
+    }
+
+    SECTION("traceback") {
+        String code = "def check(n: i32) -> i32:\n"
+                      "    assert n < 0\n"
+                      "    return n\n"
+                      "\n"
+                      "def outer(n: i32) -> i32:\n"
+                      "    return check(n) + 1\n"
+                      "\n"
+                      "result = outer(1)\n";
+
+        StringBuffer reader(code);
+        Lexer        lex(reader);
+        Parser       parser(lex);
+        Module*      mod = parser.parse_module();
+
+        SemanticAnalyser sema;
+        sema.exec(mod, 0);
+        REQUIRE(sema.has_errors() == false);
+
+        Program program = compile(mod);
+        VMExec  exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.has_error == true);
+
+        // Rebuilt from the return addresses once the assert failed
+        REQUIRE(exec.traceback.size() == 3);
+        REQUIRE(exec.traceback[0].function == "<module>");
+        REQUIRE(exec.traceback[0].line == 8);
+        REQUIRE(exec.traceback[1].function == "outer");
+        REQUIRE(exec.traceback[1].line == 6);
+        REQUIRE(exec.traceback[2].function == "check");
+        REQUIRE(exec.traceback[2].line == 2);
+        delete mod;
+    }
+}
+
+Module* partial_eval(String const& code, PartialEvaluator& partial) {
+    StringBuffer reader(code);
+    Lexer        lex(reader);
+    Parser       parser(lex);
+    Module*      mod = parser.parse_module();
+    REQUIRE(parser.has_errors() == false);
+
+    SemanticAnalyser sema;
+    sema.exec(mod, 0);
+    REQUIRE(sema.has_errors() == false);
+
+    partial.module(mod, 0);
+    return mod;
+}
+
+ExprNode* assigned(Module* mod, int i) { return cast<Assign>(mod->body[i])->value; }
+
+TEST_CASE("VM_PartialEvaluator") {
+    SECTION("known inputs") {
+        String code = "SIZE = 4 * 1024\n"
+                      "DEBUG = False\n"
+                      "\n"
+                      "def fib(n: i32) -> i32:\n"
+                      "    if n < 2:\n"
+                      "        return n\n"
+                      "    return fib(n - 1) + fib(n - 2)\n"
+                      "\n"
+                      "def grade(n: i32) -> i32:\n"
+                      "    if n < 10:\n"
+                      "        return 1\n"
+                      "    elif n < 20:\n"
+                      "        return 2\n"
+                      "    return 3\n"
+                      "\n"
+                      "def scale(x: i32) -> i32:\n"
+                      "    if DEBUG:\n"
+                      "        return 0\n"
+                      "    return x * SIZE\n"
+                      "\n"
+                      "f = fib(15)\n"
+                      "g = grade(15)\n"
+                      "s = scale(2)\n";
+
+        PartialEvaluator partial;
+        Module*          mod = partial_eval(code, partial);
+
+        REQUIRE(cast<Constant>(assigned(mod, 0)) != nullptr);
+        REQUIRE(cast<Constant>(assigned(mod, 5)) != nullptr);
+        REQUIRE(cast<Constant>(assigned(mod, 6)) != nullptr);
+        REQUIRE(cast<Constant>(assigned(mod, 7)) != nullptr);
+
+        // The branch that is never taken is removed, the residual reads a literal
+        FunctionDef* scale = cast<FunctionDef>(mod->body[4]);
+        REQUIRE(scale->body.size() == 1);
+        BinOp* product = cast<BinOp>(cast<Return>(scale->body[0])->value.value());
+        REQUIRE(cast<Name>(product->left) != nullptr);
+        REQUIRE(cast<Constant>(product->right)->value.as<int32>() == 4096);
+
+        // The module does not call anything at runtime
+        Program program = compile(mod);
+        VMExec  exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.has_error == false);
+        REQUIRE(exec.global("f").as<int32>() == 610);
+        REQUIRE(exec.global("g").as<int32>() == 2);
+        REQUIRE(exec.global("s").as<int32>() == 8192);
+        delete mod;
+    }
+
+    SECTION("residual") {
+        String code = "N = 10\n"
+                      "M = 1\n"
+                      "M = 2\n"
+                      "\n"
+                      "def shadow(N: i32) -> i32:\n"
+                      "    return N + 1\n"
+                      "\n"
+                      "def pick(x: i32) -> i32:\n"
+                      "    return (x if N > 5 else 0) + M\n"
+                      "\n"
+                      "a = shadow(1)\n"
+                      "d = pick(4)\n";
+
+        PartialEvaluator partial;
+        Module*          mod = partial_eval(code, partial);
+
+        // Arguments shadow the module names
+        REQUIRE(cast<Constant>(assigned(mod, 5))->value.as<int32>() == 2);
+
+        // `M` is assigned twice, only the known part of `pick` is folded
+        REQUIRE(cast<Call>(assigned(mod, 6)) != nullptr);
+        FunctionDef* pick = cast<FunctionDef>(mod->body[4]);
+        BinOp*       sum  = cast<BinOp>(cast<Return>(pick->body[0])->value.value());
+        REQUIRE(cast<Name>(sum->left) != nullptr);
+        REQUIRE(cast<Name>(sum->right) != nullptr);
+
+        Program program = compile(mod);
+        VMExec  exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.global("d").as<int32>() == 6);
+        delete mod;
+    }
+
+    SECTION("budget") {
+        String code = "def count(n: i32) -> i32:\n"
+                      "    total: i32 = 0\n"
+                      "    for i in range(n):\n"
+                      "        total += 1\n"
+                      "    return total\n"
+                      "\n"
+                      "c = count(100)\n";
+
+        // Calls running out of budget are left to the runtime
+        PartialEvaluator partial;
+        partial.budget = 50;
+        Module* mod    = partial_eval(code, partial);
+        REQUIRE(cast<Call>(assigned(mod, 1)) != nullptr);
+
+        Program program = compile(mod);
+        VMExec  exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.global("c").as<int32>() == 100);
+        delete mod;
+
+        PartialEvaluator unbounded;
+        mod = partial_eval(code, unbounded);
+        REQUIRE(cast<Constant>(assigned(mod, 1))->value.as<int32>() == 100);
+        delete mod;
+    }
+
+    // `--no-fold` compiles the program as written, it computes the same values
+    SECTION("unfolded") {
+        String code = "LIMIT = 3 * 4\n"
+                      "\n"
+                      "def total(n: i32) -> i32:\n"
+                      "    result: i32 = 0\n"
+                      "    for i in range(n):\n"
+                      "        if i < LIMIT:\n"
+                      "            result += i\n"
+                      "    return result\n"
+                      "\n"
+                      "def clamp(x: i32) -> i32:\n"
+                      "    if x > LIMIT:\n"
+                      "        return LIMIT\n"
+                      "    return x\n"
+                      "\n"
+                      "a = total(20)\n"
+                      "b = clamp(30)\n"
+                      "c = total(5) + clamp(7)\n";
+
+        PartialEvaluator partial;
+        Module*          mod    = partial_eval(code, partial);
+        Program          folded = compile(mod);
+
+        Program unfolded;
+        bytecode_eval(code, "a", &unfolded);
+        REQUIRE(folded.code_size() < unfolded.code_size());
+
+        VMExec folded_exec;
+        VMExec unfolded_exec;
+        folded_exec.execute(folded, 0);
+        unfolded_exec.execute(unfolded, 0);
+        REQUIRE(folded_exec.has_error == false);
+        REQUIRE(unfolded_exec.has_error == false);
+
+        for (String const& name: {"LIMIT", "a", "b", "c"}) {
+            REQUIRE(folded_exec.global(name).as<int32>() ==
+                    unfolded_exec.global(name).as<int32>());
+        }
+        REQUIRE(folded_exec.global("a").as<int32>() == 66);
+        REQUIRE(folded_exec.global("c").as<int32>() == 17);
+        delete mod;
+    }
+}
+
+Module* analyse(String const& code) {
+    StringBuffer reader(code);
+    Lexer        lex(reader);
+    Parser       parser(lex);
+    Module*      mod = parser.parse_module();
+    REQUIRE(parser.has_errors() == false);
+
+    SemanticAnalyser sema;
+    sema.exec(mod, 0);
+    REQUIRE(sema.has_errors() == false);
+    return mod;
+}
+
+bool is_pure(Module* mod, String const& name) {
+    for (StmtNode* stmt: mod->body) {
+        FunctionDef* fun = cast<FunctionDef>(stmt);
+        if (fun != nullptr && str(fun->name) == name) {
+            return fun->pure;
+        }
+    }
+    return false;
+}
+
+// compile() gathers the imported modules, compiles each to a unit and links them
+TEST_CASE("VM_Modules") {
+    auto folder = std::filesystem::temp_directory_path() / "lython_vm_modules";
+    std::filesystem::create_directories(folder);
+
+    auto write = [&](char const* name, char const* code) {
+        std::ofstream file(folder / name);
+        file << code;
+    };
+    write("vm_units_a.py",
+          "def inc(a: i32) -> i32:\n"
+          "    return a + 1\n");
+    write("vm_units_b.py",
+          "from vm_units_c import scale\n"
+          "\n"
+          "def twice(a: i32) -> i32:\n"
+          "    return scale(scale(a))\n");
+    write("vm_units_c.py",
+          "offset: i32 = 10\n"
+          "\n"
+          "def scale(a: i32) -> i32:\n"
+          "    return a * 2\n");
+    ImportLib::instance()->add_to_path(String(folder.string().c_str()));
+
+    Module* mod = analyse("from vm_units_a import inc\n"
+                          "from vm_units_b import twice\n"
+                          "from vm_units_c import scale\n"
+                          "\n"
+                          "result = inc(twice(scale(1)))\n");
+
+    Program program = compile(mod);
+    REQUIRE(program.relocations.empty());
+
+    VMExec exec;
+    exec.execute(program, 0);
+    REQUIRE(exec.has_error == false);
+    REQUIRE(exec.global("result").as<int32>() == 9);
+    REQUIRE(exec.global("vm_units_c.offset").as<int32>() == 10);
+
+    // The units are compiled in a fixed order, the linked program does not change
+    Program again = compile(mod);
+    REQUIRE(again.instructions.size() == program.instructions.size());
+    for (int i = 0; i < program.instructions.size(); i++) {
+        Instruction const& a = program.instructions[i];
+        Instruction const& b = again.instructions[i];
+        REQUIRE((a.op == b.op && a.a == b.a && a.b == b.b && a.c == b.c));
+    }
+
+    delete mod;
+    std::filesystem::remove_all(folder);
+}
+
+TEST_CASE("VM_Memoization") {
+    String code = "K = 3\n"
+                  "\n"
+                  "def fib(n: i32) -> i32:\n"
+                  "    if n < 2:\n"
+                  "        return n\n"
+                  "    return fib(n - 1) + fib(n - 2)\n"
+                  "\n"
+                  "def square(x: i32) -> i32:\n"
+                  "    return x * x\n"
+                  "\n"
+                  "def sum_squares(n: i32) -> i32:\n"
+                  "    total: i32 = 0\n"
+                  "    for i in range(n):\n"
+                  "        total += square(i % 4)\n"
+                  "    return total\n"
+                  "\n"
+                  "def scaled(x: i32) -> i32:\n"
+                  "    return x * K\n"
+                  "\n"
+                  "def bump(x: i32) -> i32:\n"
+                  "    global K\n"
+                  "    K = x\n"
+                  "    return x\n"
+                  "\n"
+                  "def calls_bump(x: i32) -> i32:\n"
+                  "    return bump(x)\n"
+                  "\n"
+                  "f = fib(20)\n"
+                  "s = sum_squares(100)\n";
+
+    SECTION("effects") {
+        Module* mod = analyse(code);
+        REQUIRE(is_pure(mod, "fib"));
+        REQUIRE(is_pure(mod, "square"));
+        REQUIRE(is_pure(mod, "sum_squares"));
+
+        // Reads or writes a global, calls an impure function
+        REQUIRE(!is_pure(mod, "scaled"));
+        REQUIRE(!is_pure(mod, "bump"));
+        REQUIRE(!is_pure(mod, "calls_bump"));
+        delete mod;
+    }
+
+    // fib(n) misses once per n and hits on fib(n - 2), square misses once per i % 4
+    SECTION("tree") {
+        Module*   mod = analyse(code);
+        MemoCache memo;
+
+        TreeEvaluator eval;
+        eval.use_unboxed = false;  // fib would run natively after its first call
+        eval.memo        = &memo;
+        eval.module(mod, 0);
+
+        REQUIRE(memo.hits == 18 + 96);
+        REQUIRE(memo.misses == 21 + 1 + 4);
+        delete mod;
+    }
+
+    SECTION("bytecode") {
+        Module*   mod     = analyse(code);
+        Program   program = compile(mod);
+        MemoCache memo;
+
+        VMExec exec;
+        exec.memo = &memo;
+        exec.execute(program, 0);
+
+        REQUIRE(exec.global("f").as<int32>() == 6765);
+        REQUIRE(exec.global("s").as<int32>() == 350);
+        REQUIRE(memo.hits == 18 + 96);
+        REQUIRE(memo.misses == 21 + 1 + 4);
+        delete mod;
+    }
+
+    SECTION("exceptions") {
+        Module* mod = analyse("def check(n: i32) -> i32:\n"
+                              "    assert n > 0\n"
+                              "    return n\n"
+                              "\n"
+                              "def safe(n: i32) -> i32:\n"
+                              "    try:\n"
+                              "        return check(n)\n"
+                              "    except:\n"
+                              "        return 0\n"
+                              "\n"
+                              "a = safe(0)\n"
+                              "b = safe(0)\n"
+                              "c = check(2)\n"
+                              "d = check(2)\n");
+
+        Program   program = compile(mod);
+        MemoCache memo;
+
+        // A call that raised is not remembered
+        VMExec exec;
+        exec.memo = &memo;
+        exec.execute(program, 0);
+
+        REQUIRE(exec.has_error == false);
+        REQUIRE(exec.global("a").as<int32>() == 0);
+        REQUIRE(exec.global("d").as<int32>() == 2);
+        REQUIRE(memo.hits == 2);
+        REQUIRE(memo.size() == 2);
+        delete mod;
+    }
+
+    SECTION("least recently used") {
+        MemoCache memo(2);
+        int       fun = 0;
+        Value     args[] = {Value(int32(1)), Value(int32(2)), Value(int32(3))};
+
+        auto remember = [&](int i) {
+            MemoCache::Key key;
+            REQUIRE(MemoCache::make_key(&fun, &args[i], 1, key));
+            if (memo.find(key) == nullptr) {
+                memo.insert(key, args[i]);
+            }
+        };
+
+        remember(0);
+        remember(1);
+        remember(0);  // 1 is now the least recently used
+        remember(2);
+
+        REQUIRE(memo.evictions == 1);
+        REQUIRE(memo.hits == 1);
+        remember(0);
+        REQUIRE(memo.hits == 2);
+        remember(1);
+        REQUIRE(memo.misses == 4);
+    }
+}
+
+Value variable(TreeEvaluator& eval, String const& name) {
+    for (int i = int(eval.variables.size()) - 1; i >= 0; i--) {
+        if (eval.variables[i].name == name) {
+            return eval.variables[i].value;
+        }
+    }
+    return Value();
+}
+
+// Assignments rebind the variables of the call, loops do not grow the frame
+TEST_CASE("VM_Frame") {
+    String code = "def count(n: i32) -> i32:\n"
+                  "    total: i32 = 0\n"
+                  "    for i in range(n):\n"
+                  "        x: i32 = i\n"
+                  "        for i in range(2):\n"
+                  "            x = x + i\n"
+                  "        total += x\n"
+                  "        i = 100\n"
+                  "    return total\n"
+                  "\n"
+                  "def outer(n: i32) -> i32:\n"
+                  "    total: i32 = n\n"
+                  "    return count(n) + total\n"
+                  "\n"
+                  "t = outer(1000)\n";
+
+    Module* mod = analyse(code);
+
+    TreeEvaluator eval;
+    eval.use_unboxed = false;
+    eval.module(mod, 0);
+
+    // the callee `total` is a local, the caller one is unchanged
+    REQUIRE(!eval.has_exceptions());
+    REQUIRE(variable(eval, "t").as<int32>() == 500500 + 1000);
+    REQUIRE(eval.variables.size() < 8);
+
+    // the budget is charged once for the whole counted loop
+    TreeEvaluator bounded;
+    bounded.use_unboxed = false;
+    bounded.budget      = 500;
+    bounded.module(mod, 0);
+    REQUIRE(bounded.has_exceptions());
+    delete mod;
+}
+
+TEST_CASE("VM_GarbageCollector") {
+    // `head` keeps a cycle of the last two nodes alive, everything else is garbage
+    String code = "class Node:\n"
+                  "    value: i32 = 0\n"
+                  "    next: Node\n"
+                  "\n"
+                  "head: Node = Node()\n"
+                  "head.value = 0 - 1\n"
+                  "head.next = Node()\n"
+                  "head.next.value = 0 - 2\n"
+                  "\n"
+                  "def link(node: Node, value: i32, next: Node) -> i32:\n"
+                  "    node.value = value\n"
+                  "    node.next = next\n"
+                  "    return node.value\n"
+                  "\n"
+                  "def push(node: Node, i: i32) -> i32:\n"
+                  "    node.value = i\n"
+                  "    node.next = head.next\n"
+                  "    head.next = node\n"
+                  "    node.next.next = head\n"
+                  "    return i\n"
+                  "\n"
+                  "def check(n: i32) -> i32:\n"
+                  "    assert n < 0\n"
+                  "    return n\n"
+                  "\n"
+                  "def safe(n: i32) -> i32:\n"
+                  "    try:\n"
+                  "        return check(n)\n"
+                  "    except:\n"
+                  "        return 0 - 1\n"
+                  "\n"
+                  "def churn(n: i32) -> i32:\n"
+                  "    total: i32 = 0\n"
+                  "    for i in range(n):\n"
+                  "        total += link(Node(), i, Node())\n"
+                  "        total += push(Node(), i)\n"
+                  "        total += safe(i)\n"
+                  "    return total\n"
+                  "\n"
+                  "t = churn(1000)\n";
+
+    SECTION("reachable") {
+        Module* mod = analyse(code);
+
+        // collects every time the live memory was allocated again
+        TreeEvaluator eval;
+        eval.heap.set_nursery_size(0);
+        eval.heap.set_threshold(0);
+        eval.module(mod, 0);
+
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(variable(eval, "t").as<int32>() == 998000);
+        REQUIRE(eval.heap.get_stats().collections > 1000);
+
+        Value head = variable(eval, "head");
+        REQUIRE(eval.heap.owns(head.holder().obj));
+
+        eval.collect_garbage();
+        REQUIRE(eval.heap.get_stats().objects == 3);
+        delete mod;
+    }
+
+    SECTION("nursery") {
+        Module* mod = analyse(code);
+
+        TreeEvaluator eval;
+        eval.heap.set_nursery_size(64 * 1024);
+        eval.module(mod, 0);
+
+        HeapStats const& stats = eval.heap.get_stats();
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(variable(eval, "t").as<int32>() == 998000);
+        REQUIRE(stats.minor_collections > 5);
+        REQUIRE(stats.collections == 0);
+
+        // most objects die young, `push` keeps the last two nodes only,
+        // the messages of the exceptions are promoted with them
+        REQUIRE(stats.promoted * 3 < stats.allocated);
+
+        // `head` was promoted, the nodes it points to are found through the write barrier
+        eval.collect_nursery();
+        Value head = variable(eval, "head");
+        REQUIRE(eval.heap.owns(head.holder().obj));
+        REQUIRE(!eval.heap.is_young(head));
+        REQUIRE(stats.young == 0);
+
+        eval.collect_garbage();
+        REQUIRE(stats.objects == 3);
+        delete mod;
+    }
+
+    SECTION("constructor") {
+        // __init__ allocates enough to collect while only `self` holds the object
+        Module* mod = analyse("class Node:\n"
+                              "    value: i32 = 0\n"
+                              "    next: Node\n"
+                              "\n"
+                              "class Pair:\n"
+                              "    first: Node\n"
+                              "    second: Node\n"
+                              "    total: i32 = 0\n"
+                              "\n"
+                              "    def __init__(self, n: i32):\n"
+                              "        self.first = Node()\n"
+                              "        i: i32 = 0\n"
+                              "        while i < n:\n"
+                              "            self.total += Node().value + 1\n"
+                              "            i += 1\n"
+                              "        self.second = Node()\n"
+                              "        self.second.value = n\n"
+                              "\n"
+                              "def build(n: i32) -> i32:\n"
+                              "    total: i32 = 0\n"
+                              "    for i in range(n):\n"
+                              "        p = Pair(50)\n"
+                              "        total += p.total\n"
+                              "        total += p.second.value\n"
+                              "    return total\n"
+                              "\n"
+                              "t = build(200)\n");
+
+        TreeEvaluator eval;
+        eval.heap.set_nursery_size(64 * 1024);
+        eval.module(mod, 0);
+
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(eval.heap.get_stats().minor_collections > 10);
+        REQUIRE(variable(eval, "t").as<int32>() == 20000);
+        delete mod;
+    }
+
+    SECTION("incremental") {
+        // a long list keeps the marking busy while the churn allocates
+        Module* mod = analyse("class Node:\n"
+                              "    value: i32 = 0\n"
+                              "    next: Node\n"
+                              "\n"
+                              "head: Node = Node()\n"
+                              "\n"
+                              "def add(node: Node, fresh: Node, i: i32) -> i32:\n"
+                              "    fresh.value = i\n"
+                              "    fresh.next = node.next\n"
+                              "    node.next = fresh\n"
+                              "    return 1\n"
+                              "\n"
+                              "def link(node: Node, value: i32, next: Node) -> i32:\n"
+                              "    node.value = value\n"
+                              "    node.next = next\n"
+                              "    return node.value\n"
+                              "\n"
+                              "def grow(n: i32) -> i32:\n"
+                              "    total: i32 = 0\n"
+                              "    for i in range(n):\n"
+                              "        total += add(head, Node(), i)\n"
+                              "        total += link(Node(), i, Node())\n"
+                              "    return total\n"
+                              "\n"
+                              "t = grow(2000)\n"
+                              "a = head.next.value\n"
+                              "b = head.next.next.value\n");
+
+        // every allocation traces a few objects until the cycle is over
+        TreeEvaluator eval;
+        eval.heap.set_nursery_size(32 * 1024);
+        eval.heap.set_threshold(16 * 1024);
+        eval.heap.set_quantum(16);
+        eval.module(mod, 0);
+
+        HeapStats const& stats = eval.heap.get_stats();
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(variable(eval, "t").as<int32>() == 1999000 + 2000);
+        REQUIRE(variable(eval, "a").as<int32>() == 1999);
+        REQUIRE(variable(eval, "b").as<int32>() == 1998);
+        REQUIRE(stats.collections > 0);
+        REQUIRE(stats.increment_pauses.count > 10 * stats.collections);
+        REQUIRE(stats.final_pauses.count >= stats.collections);
+
+        // the list survived every cycle
+        eval.collect_garbage();
+        REQUIRE(eval.heap.get_phase() == RuntimeHeap::Phase::Idle);
+        REQUIRE(stats.objects == 2001);
+        delete mod;
+    }
+
+    SECTION("pauses") {
+        PauseHistogram pauses;
+        pauses.add(0.5);
+        pauses.add(3);
+        pauses.add(3.5);
+
+        REQUIRE(pauses.count == 3);
+        REQUIRE(pauses.longest == 3.5);
+        REQUIRE(pauses.buckets[0] == 1);
+        REQUIRE(pauses.buckets[2] == 2);
+    }
+
+    SECTION("generators") {
+        Module* mod = analyse("class Node:\n"
+                              "    value: i32 = 0\n"
+                              "    next: Node\n"
+                              "\n"
+                              "def link(node: Node, value: i32, next: Node) -> i32:\n"
+                              "    node.value = value\n"
+                              "    node.next = next\n"
+                              "    return node.value\n"
+                              "\n"
+                              "def produce(n: i32) -> i32:\n"
+                              "    i: i32 = 0\n"
+                              "    while i < n:\n"
+                              "        yield link(Node(), i, Node())\n"
+                              "        i += 1\n"
+                              "\n"
+                              "def consume(n: i32) -> i32:\n"
+                              "    total: i32 = 0\n"
+                              "    for v in produce(n):\n"
+                              "        total += v % 3\n"
+                              "    return total\n"
+                              "\n"
+                              "t = consume(300)\n");
+
+        TreeEvaluator eval;
+        eval.heap.set_threshold(0);
+        eval.module(mod, 0);
+
+        REQUIRE(variable(eval, "t").as<int32>() == 300);
+
+        eval.collect_garbage();
+        REQUIRE(eval.heap.get_stats().objects == 0);
+        delete mod;
+    }
+
+    SECTION("soak") {
+        Module* mod = analyse(code);
+
+        // the per node logs would dominate the run
+        outlog().disable(LogLevel::Trace);
+        outlog().disable(LogLevel::Debug);
+        KW_DEFERRED([] {
+            outlog().enable(LogLevel::Debug);
+            outlog().enable(LogLevel::Trace);
+        });
+
+        TreeEvaluator eval;
+        eval.module(mod, 0);
+
+        // `t = churn(1000)` allocates ~6000 objects every round
+        StmtNode* round = mod->body.back();
+        for (int i = 0; i < 5; i++) {
+            eval.exec(round, 0);
+        }
+
+        HeapStats const& stats = eval.heap.get_stats();
+
+        eval.collect_garbage();
+        std::size_t live      = stats.live;
+        std::size_t allocated = stats.allocated;
+        std::size_t freed     = stats.freed;
+
+        for (int i = 0; i < 20; i++) {
+            eval.exec(round, 0);
+        }
+        eval.collect_garbage();
+
+        // every byte allocated by the rounds was reclaimed
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(stats.minor_collections >= 10);
+        REQUIRE(stats.allocated - allocated >= 20 * 6000 * sizeof(HeapObject));
+        REQUIRE(stats.freed - freed == stats.allocated - allocated);
+        REQUIRE(stats.live == live);
+
+        delete mod;
+    }
+}
+
 #endif
 
+// Runs the module even when SEMA rejected it, SEMA only knows the static type
+// of the receivers while the tree evaluator dispatches on their class
+Module* tree_eval(String const& code, TreeEvaluator& eval) {
+    StringBuffer reader(code);
+    Lexer        lex(reader);
+    Parser       parser(lex);
+    Module*      mod = parser.parse_module();
+    REQUIRE(parser.has_errors() == false);
+
+    SemanticAnalyser sema;
+    sema.exec(mod, 0);
+
+    eval.use_unboxed = false;
+    eval.module(mod, 0);
+    REQUIRE(!eval.has_exceptions());
+    return mod;
+}
+
+// Class or function defined at the module level
+StmtNode* find_definition(Module* mod, String const& name) {
+    for (StmtNode* stmt: mod->body) {
+        if (ClassDef* cls = cast<ClassDef>(stmt)) {
+            if (cls->name == name) {
+                return cls;
+            }
+        }
+        if (FunctionDef* def = cast<FunctionDef>(stmt)) {
+            if (def->name == name) {
+                return def;
+            }
+        }
+    }
+    return nullptr;
+}
+
+TEST_CASE("VM_InlineCache") {
+    String classes = "class A:\n"
+                     "    def __init__(self, x: i32):\n"
+                     "        self.x = x\n"
+                     "\n"
+                     "class B(A):\n"
+                     "    def __init__(self, x: i32):\n"
+                     "        self.y = 0\n"
+                     "        self.x = x\n"
+                     "\n"
+                     "class C(A):\n"
+                     "    def __init__(self, x: i32):\n"
+                     "        self.y = 0\n"
+                     "        self.z = 0\n"
+                     "        self.x = x\n"
+                     "\n"
+                     "class D(A):\n"
+                     "    def __init__(self, x: i32):\n"
+                     "        self.w = 0\n"
+                     "        self.y = 0\n"
+                     "        self.z = 0\n"
+                     "        self.x = x\n"
+                     "\n"
+                     "class E(A):\n"
+                     "    def __init__(self, x: i32):\n"
+                     "        self.v = 0\n"
+                     "        self.w = 0\n"
+                     "        self.y = 0\n"
+                     "        self.z = 0\n"
+                     "        self.x = x\n"
+                     "\n"
+                     "def get(o: A) -> i32:\n"
+                     "    return o.x\n"
+                     "\n";
+
+    auto site = [](Module* mod) {
+        FunctionDef* get = cast<FunctionDef>(find_definition(mod, "get"));
+        return cast<Attribute>(cast<Return>(get->body[0])->value.value());
+    };
+
+    // The slot is resolved by name once, the next receivers of the class reuse it
+    SECTION("hits") {
+        TreeEvaluator eval;
+        Module* mod = tree_eval(classes + "a = A(1)\n"
+                                          "total = get(a) + get(A(2)) + get(A(3))\n",
+                                eval);
+
+        REQUIRE(variable(eval, "total").as<int32>() == 6);
+
+        ClassDef*    A     = cast<ClassDef>(find_definition(mod, "A"));
+        InlineCache& cache = site(mod)->cache;
+        REQUIRE(cache.count == 1);
+        REQUIRE(cache.entries[0].cls == A);
+        REQUIRE(cache.entries[0].slot == A->attributes[A->get_attribute(StringRef("x"))].offset);
+        delete mod;
+    }
+
+    // Classes past the size of the cache are resolved by name on every access
+    SECTION("polymorphic") {
+        TreeEvaluator eval;
+        Module* mod = tree_eval(classes + "total = get(A(1)) + get(B(2)) + get(C(3)) + get(D(4))\n"
+                                          "total = total + get(E(5)) + get(E(6)) + get(B(7))\n",
+                                eval);
+
+        REQUIRE(variable(eval, "total").as<int32>() == 28);
+
+        InlineCache& cache = site(mod)->cache;
+        REQUIRE(cache.count == InlineCache::Size);
+        REQUIRE(cache.find(cast<ClassDef>(find_definition(mod, "D"))) != nullptr);
+        REQUIRE(cache.find(cast<ClassDef>(find_definition(mod, "E"))) == nullptr);
+        delete mod;
+    }
+
+    // Attributes outside of the class layout are stored by name in the object
+    SECTION("extra") {
+        TreeEvaluator eval;
+        Module* mod = tree_eval(classes + "a = A(1)\n"
+                                          "a.extra = 7\n"
+                                          "e = a.extra\n"
+                                          "x = get(a)\n",
+                                eval);
+
+        REQUIRE(variable(eval, "e").as<int32>() == 7);
+        REQUIRE(variable(eval, "x").as<int32>() == 1);
+
+        // the site caches the miss, the slot is never used
+        Assign*    assign = cast<Assign>(mod->body[mod->body.size() - 3]);
+        Attribute* extra  = cast<Attribute>(assign->targets[0]);
+        REQUIRE(extra->cache.count == 1);
+        REQUIRE(extra->cache.entries[0].slot == -1);
+        REQUIRE(extra->cache.entries[0].method == nullptr);
+        delete mod;
+    }
+}
+
+// Reads through the inline caches match the fields printed by name through the class
+TEST_CASE("VM_ObjectLayout") {
+    String code = "class Point:\n"
+                  "    def __init__(self, x: i32, y: i32, z: i32):\n"
+                  "        self.x = x\n"
+                  "        self.y = y\n"
+                  "        self.z = z\n"
+                  "\n"
+                  "    def total(self) -> i32:\n"
+                  "        return (self.x * 100) + (self.y * 10) + self.z\n"
+                  "\n"
+                  "def read(p: Point) -> i32:\n"
+                  "    x: i32 = p.x\n"
+                  "    y: i32 = p.y\n"
+                  "    z: i32 = p.z\n"
+                  "    return (x * 100) + (y * 10) + z\n"
+                  "\n";
+
+    String points = "p = Point(1, 2, 3)\n"
+                    "first = read(p)\n"
+                    "second = read(p)\n"
+                    "method = p.total()\n";
+
+    // Methods are shared through the class, instances only hold the data attributes
+    SECTION("fields") {
+        TreeEvaluator eval;
+        Module*       mod   = tree_eval(code + points, eval);
+        ClassDef*     point = cast<ClassDef>(find_definition(mod, "Point"));
+
+        REQUIRE(point->field_count == 3);
+        REQUIRE(point->attributes[point->get_attribute(StringRef("total"))].offset == -1);
+        REQUIRE(point->attributes[point->get_attribute(StringRef("__init__"))].offset == -1);
+
+        REQUIRE(str(variable(eval, "p")) == "(x=1, y=2, z=3)");
+        REQUIRE(variable(eval, "first").as<int32>() == 123);
+        REQUIRE(variable(eval, "second").as<int32>() == 123);
+        REQUIRE(variable(eval, "method").as<int32>() == 123);
+        delete mod;
+    }
+
+    // The caches live in the AST, a second run only reads cached slots
+    SECTION("cached") {
+        TreeEvaluator cold;
+        Module*       mod = tree_eval(code + points, cold);
+
+        TreeEvaluator warm;
+        warm.use_unboxed = false;
+        warm.module(mod, 0);
+        REQUIRE(!warm.has_exceptions());
+
+        for (String const& name: {"p", "first", "second", "method"}) {
+            REQUIRE(str(variable(warm, name)) == str(variable(cold, name)));
+        }
+        delete mod;
+    }
+
+    // Classes with other layouts filled the caches of `read`,
+    // points are looked up by name on every access
+    SECTION("evicted") {
+        String layouts;
+        String reads = "evicted = 0\n";
+
+        for (String order: {"zyx", "yxz", "xzy", "zxy"}) {
+            String name = "L" + order;
+
+            layouts += "class " + name + ":\n"
+                       "    def __init__(self, x: i32, y: i32, z: i32):\n";
+            for (char attr: order) {
+                layouts += String("        self.") + attr + " = " + attr + "\n";
+            }
+            layouts += "\n";
+            reads += "evicted = evicted + read(" + name + "(4, 5, 6))\n";
+        }
+
+        TreeEvaluator eval;
+        Module*       mod = tree_eval(code + layouts + reads + points, eval);
+
+        FunctionDef* read = cast<FunctionDef>(find_definition(mod, "read"));
+        Attribute*   x    = cast<Attribute>(cast<AnnAssign>(read->body[0])->value.value());
+        REQUIRE(x->cache.count == InlineCache::Size);
+        REQUIRE(x->cache.find(cast<ClassDef>(find_definition(mod, "Point"))) == nullptr);
+
+        REQUIRE(variable(eval, "evicted").as<int32>() == 4 * 456);
+        REQUIRE(str(variable(eval, "p")) == "(x=1, y=2, z=3)");
+        REQUIRE(variable(eval, "first").as<int32>() == 123);
+        REQUIRE(variable(eval, "second").as<int32>() == 123);
+        REQUIRE(variable(eval, "method").as<int32>() == 123);
+        delete mod;
+    }
+}
+
+// Exceptions raised by the evaluators themselves are caught by the name of their class
+TEST_CASE("VM_BuiltinExceptions") {
+    String code = "def check(n: i32) -> i32:\n"
+                  "    result: i32 = n\n"
+                  "    try:\n"
+                  "        assert n > 0\n"
+                  "    except AssertionError:\n"
+                  "        result = -1\n"
+                  "    return result\n"
+                  "\n"
+                  "def step(n: i32) -> i32:\n"
+                  "    result: i32 = 0\n"
+                  "    try:\n"
+                  "        for i in range(n, 0, 0):\n"
+                  "            result += i\n"
+                  "    except ValueError:\n"
+                  "        result = -2\n"
+                  "    return result\n"
+                  "\n"
+                  "failed = check(0)\n"
+                  "passed = check(3)\n"
+                  "zero = step(3)\n";
+
+    SECTION("tree") {
+        TreeEvaluator eval;
+        Module*       mod = tree_eval(code, eval);
+
+        REQUIRE(variable(eval, "failed").as<int32>() == -1);
+        REQUIRE(variable(eval, "passed").as<int32>() == 3);
+        REQUIRE(variable(eval, "zero").as<int32>() == -2);
+        delete mod;
+    }
+
+    SECTION("vm") {
+        Program program;
+        REQUIRE(bytecode_eval(code, "failed", &program).as<int32>() == -1);
+
+        VMExec exec;
+        exec.execute(program, 0);
+        REQUIRE(exec.global("passed").as<int32>() == 3);
+        REQUIRE(exec.global("zero").as<int32>() == -2);
+    }
+}
+
+// Native calling back into the program it was called from
+VMExec* reentrant_vm       = nullptr;
+int     reentrant_function = -1;
+
+int32 reenter(int32 n) { return n + reentrant_vm->execute(reentrant_function).as<int32>(); }
+
+TEST_CASE("VM_Natives") {
+    String code = "def hypot(x: f64, y: f64) -> f64:\n"
+                  "    return sqrt(pow(x, 2.0) + pow(y, 2.0))\n"
+                  "\n"
+                  "result = hypot(3.0, 4.0)\n";
+
+    // SEMA checked the arguments of the builtins, both evaluators call their trampoline
+    SECTION("tree") {
+        Module* mod = analyse(code);
+
+        FunctionDef* hypot = cast<FunctionDef>(mod->body[0]);
+        Call*        sqrt  = cast<Call>(cast<Return>(hypot->body[0])->value.value());
+        REQUIRE(sqrt->native_typed);
+        REQUIRE(builtin_function(StringRef("sqrt"))->native_direct != nullptr);
+
+        TreeEvaluator eval;
+        eval.use_unboxed = false;
+        eval.module(mod, 0);
+        REQUIRE(!eval.has_exceptions());
+        REQUIRE(variable(eval, "result").as<float64>() == 5.0);
+        delete mod;
+    }
+
+    SECTION("bytecode") {
+        Program program;
+        REQUIRE(bytecode_eval(code, "result", &program).as<float64>() == 5.0);
+
+        int direct = 0;
+        for (Instruction const& inst: program.instructions) {
+            direct += inst.op == OpCode::CallDirect;
+            REQUIRE(inst.op != OpCode::CallNative);
+        }
+        REQUIRE(direct == 3);
+    }
+
+    // The callback recurses deep enough to grow the registers under the native call,
+    // the caller keeps using them once it returns
+    SECTION("re-entrant") {
+        String code = "def deep(n: i32) -> i32:\n"
+                      "    if n == 0:\n"
+                      "        return 0\n"
+                      "    a: i32 = n * 2\n"
+                      "    b: i32 = a + n\n"
+                      "    return deep(n - 1) + b - a\n"
+                      "\n"
+                      "def grow() -> i32:\n"
+                      "    return deep(600)\n"
+                      "\n"
+                      "def add(x: i32, y: i32) -> i32:\n"
+                      "    return x + y\n"
+                      "\n"
+                      "def caller(a: i32) -> i32:\n"
+                      "    b: i32 = a + 1\n"
+                      "    r: i32 = reenter(b)\n"
+                      "    s: i32 = add(r, b)\n"
+                      "    return s\n"
+                      "\n"
+                      "result = caller(1)\n";
+
+        for (bool direct: {true, false}) {
+            StringBuffer reader(code);
+            Lexer        lex(reader);
+            Parser       parser(lex);
+            Module*      mod = parser.parse_module();
+            REQUIRE(parser.has_errors() == false);
+
+            FunctionDef* native = native_function<&reenter>(mod, "reenter");
+            if (!direct) {
+                native->native_direct = nullptr;
+            }
+            mod->body.insert(mod->body.begin(), native);
+
+            SemanticAnalyser sema;
+            sema.exec(mod, 0);
+            REQUIRE(sema.has_errors() == false);
+
+            Program program = compile(mod);
+            OpCode  call    = direct ? OpCode::CallDirect : OpCode::CallNative;
+            REQUIRE(std::count_if(program.instructions.begin(),
+                                  program.instructions.end(),
+                                  [&](Instruction const& inst) { return inst.op == call; }) == 1);
+
+            for (int i = 0; i < program.functions.size(); i++) {
+                if (program.functions[i].name == "grow") {
+                    reentrant_function = i;
+                }
+            }
+
+            VMExec exec;
+            reentrant_vm = &exec;
+
+            exec.execute(program, 0);
+            REQUIRE(exec.has_error == false);
+            REQUIRE(exec.registers.size() > 1024);
+            REQUIRE(exec.global("result").as<int32>() == 2 + 600 * 601 / 2 + 2);
+            delete mod;
+        }
+    }
+}
+
 // TEST_CASE("VM_native_object") { run_test_case("", "get_x(name(1, 2))", "1"); }
 
 // TEST_CASE("VM_native_function") { run_test_case("", "add(1.0, 2.0)", "3.0"); }